@@ -0,0 +1,90 @@
+//
+//  AsicTableCheck.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Host check of the per-ASIC firmware table in kern_asic.hpp with
+//  synthetic PCI device IDs and revisions: revision ranges, fallback to
+//  the closest embedded candidate, and unknown devices.
+//  Prints what every table row resolves to against the embedded firmware.
+//
+//    python3 Scripts/GenerateFirmware.py fw.cpp WhateverRed/Firmware
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/AsicTableCheck.cpp
+//        fw.cpp fw_data.S -o asic
+//    ./asic
+//
+
+#include <cstdio>
+#include <cstring>
+
+#include "HostCheck.hpp"
+#include "kern_asic.hpp"
+
+static bool named(const FwDesc *desc, const char *name) {
+    return desc && !strcmp(desc->name, name);
+}
+
+// A revision split like Raven and Raven2 would need
+static constexpr AsicEntry splitTable[] = {
+    {0x1234, 0x00, 0x07, "Old", {"old.dat"}, {"old.bin"}},
+    {0x1234, 0x08, 0xFF, "New", {"new.dat", "old.dat"}, {"new.bin"}},
+    {0x5678, 0x10, 0x10, "One", {"one.dat"}, {"one.bin"}},
+};
+static_assert(asicTableValid(splitTable), "split table");
+
+static constexpr AsicEntry overlapping[] = {
+    {0x1234, 0x00, 0x08, "Old", {"old.dat"}, {"old.bin"}},
+    {0x1234, 0x08, 0xFF, "New", {"new.dat"}, {"new.bin"}},
+};
+static_assert(!asicTableValid(overlapping), "overlap not caught");
+
+static constexpr AsicEntry empty[] = {
+    {0x1234, 0x00, 0xFF, "None", {}, {"old.bin"}},
+};
+static_assert(!asicTableValid(empty), "missing candidate not caught");
+
+int main() {
+    check(!strcmp(asicLookup(splitTable, 0x1234, 0x00)->name, "Old") &&
+              !strcmp(asicLookup(splitTable, 0x1234, 0x07)->name, "Old") &&
+              !strcmp(asicLookup(splitTable, 0x1234, 0x08)->name, "New") &&
+              !strcmp(asicLookup(splitTable, 0x1234, 0xFF)->name, "New"),
+          "revision ranges");
+    check(asicLookup(splitTable, 0x5678, 0x10) &&
+              !asicLookup(splitTable, 0x5678, 0x0F) &&
+              !asicLookup(splitTable, 0x5678, 0x11) &&
+              !asicLookup(splitTable, 0x9999, 0x10),
+          "single revision and unknown device");
+
+    auto raven = asicResolve(0x15DD, 0xC6);
+    check(raven.known && !strcmp(raven.asic->name, "Raven") &&
+              named(raven.vcn, "ativvaxy_rv.dat") &&
+              named(raven.asd, "raven_asd.bin"),
+          "Raven");
+    auto picasso = asicResolve(0x15D8, 0xC1);
+    auto *picassoAsd = findFW("picasso_asd.bin");
+    check(picasso.known && !strcmp(picasso.asic->name, "Picasso") &&
+              picasso.asd == (picassoAsd ? picassoAsd : raven.asd),
+          "Picasso falls back to the Raven ASD");
+    auto unknown = asicResolve(0x9999, 0x00);
+    check(!unknown.known && unknown.asic == &asicDefault &&
+              unknown.vcn == raven.vcn && unknown.asd == raven.asd,
+          "unknown device uses the default set");
+    auto renoir = asicResolve(0x1636, 0xC1);
+    auto *renoirVcn = findFW("ativvaxy_rn.dat");
+    auto *renoirAsd = findFW("renoir_asd.bin");
+    check(renoir.known && !strcmp(renoir.asic->name, "Renoir") &&
+              renoir.vcn == (renoirVcn ? renoirVcn : raven.vcn) &&
+              renoir.asd == (renoirAsd ? renoirAsd : raven.asd),
+          "Renoir falls back to the Raven set");
+
+    printf("%-8s %-14s %-22s %s\n", "device", "asic", "vcn", "asd");
+    for (auto &entry : asicTable) {
+        auto fw = asicResolve(entry.deviceId, entry.revisionMin);
+        check(fw.asic == &entry, "table row not found");
+        printf("0x%04X   %-14s %-22s %s\n", entry.deviceId, entry.name,
+               fw.vcn ? fw.vcn->name : "(none)",
+               fw.asd ? fw.asd->name : "(none)");
+    }
+    return report();
+}
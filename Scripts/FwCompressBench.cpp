@@ -0,0 +1,104 @@
+//
+//  FwCompressBench.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Reports, for the firmware bundle in the generated kern_fw.cpp, how much
+//  chunk deduplication and LZ4 save, and per blob the chunk count, the
+//  chunks shared with other blobs, the reassembly throughput, and the cost
+//  of the first (reassembling) and later (cached) lookups through
+//  kern_fw.hpp.
+//
+//    python3 Scripts/GenerateFirmware.py fw.cpp WhateverRed/Firmware
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/FwCompressBench.cpp
+//        fw.cpp fw_data.S -o b
+//    ./b [rounds]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "kern_fw.hpp"
+
+static double elapsedUs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 50;
+    if (rounds <= 0) rounds = 1;
+
+    // Blobs referencing each chunk
+    std::vector<int> users(static_cast<size_t>(fwChunkNumber));
+    size_t rawTotal = 0, refPacked = 0, uniqueRaw = 0, stored = 0;
+    size_t tables = static_cast<size_t>(fwChunkNumber) * sizeof(FwChunk);
+    for (int i = 0; i < fwNumber; i++) {
+        rawTotal += static_cast<size_t>(fwList[i].size);
+        tables += fwList[i].chunkCount * sizeof(uint16_t);
+        for (int c = 0; c < fwList[i].chunkCount; c++) {
+            users[fwList[i].chunks[c]]++;
+            refPacked += fwChunks[fwList[i].chunks[c]].packedSize;
+        }
+    }
+    uint32_t smallest = UINT32_MAX, largest = 0;
+    for (int c = 0; c < fwChunkNumber; c++) {
+        auto &chunk = fwChunks[c];
+        uniqueRaw += chunk.size;
+        if (chunk.packedSize == chunk.size) stored++;
+        if (chunk.size < smallest) smallest = chunk.size;
+        if (chunk.size > largest) largest = chunk.size;
+    }
+
+    printf("%-20s %10s %7s %7s %10s %12s %10s\n", "firmware", "size",
+           "chunks", "shared", "MB/s", "first use us", "cached us");
+    for (int i = 0; i < fwNumber; i++) {
+        auto &desc = fwList[i];
+        size_t size = static_cast<size_t>(desc.size);
+        int shared = 0;
+        for (int c = 0; c < desc.chunkCount; c++)
+            if (users[desc.chunks[c]] > 1) shared++;
+
+        std::vector<uint8_t> out(size);
+        double best = 1e30;
+        for (int round = 0; round < rounds; round++) {
+            auto start = std::chrono::steady_clock::now();
+            bool assembled = fwAssemble(&desc, out.data());
+            double us = elapsedUs(start);
+            if (!assembled) {
+                printf("%s: reassembly failed\n", desc.name);
+                return 1;
+            }
+            if (us < best) best = us;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto view = getFWById(desc.id);
+        double firstUs = elapsedUs(start);
+        start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++)
+            if (getFWById(desc.id).data != view.data) return 1;
+        double cachedUs = elapsedUs(start) / rounds;
+
+        printf("%-20s %10zu %7d %7d %10.0f %12.1f %10.3f%s\n", desc.name,
+               size, desc.chunkCount, shared, size / best, firstUs, cachedUs,
+               desc.inPlace >= 0 ? "  in place" : "");
+    }
+
+    printf("\n%d unique chunks of %u..%u bytes, %zu stored\n", fwChunkNumber,
+           fwChunkNumber ? smallest : 0, largest, stored);
+    printf("%-28s %10zu\n", "firmware", rawTotal);
+    printf("%-28s %10zu %6.2f\n", "unique chunks", uniqueRaw,
+           static_cast<double>(rawTotal) / uniqueRaw);
+    printf("%-28s %10zu %6.2f\n", "LZ4 chunks, no dedup", refPacked,
+           static_cast<double>(rawTotal) / refPacked);
+    printf("%-28s %10u %6.2f\n", "bundle (fwChunkData)", fwChunkDataSize,
+           static_cast<double>(rawTotal) / fwChunkDataSize);
+    printf("chunk tables %zu bytes, reassembled copies use %llu bytes\n",
+           tables, static_cast<unsigned long long>(fwStats.bytesLive));
+    return 0;
+}
@@ -0,0 +1,163 @@
+//
+//  FwDiskCheck.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Host check of the on-disk firmware overrides in kern_fw.hpp, against a
+//  temporary directory: a file there replaces its embedded blob, a missing,
+//  empty, truncated, oversized or incompatible one falls back to it, reads
+//  are chunked and may come back short, and every answer is cached after
+//  the first lookup.
+//
+//    python3 Scripts/GenerateFirmware.py fw.cpp WhateverRed/Firmware
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/FwDiskCheck.cpp
+//        fw.cpp fw_data.S -o fwd
+//    ./fwd
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "HostCheck.hpp"
+#include "kern_fw.hpp"
+
+static size_t opens = 0, reads = 0, largestRead = 0;
+static size_t shortRead = 0, reportedExtra = 0;
+
+static void *countedOpen(const char *path, size_t *size) {
+    opens++;
+    auto *file = fwDefaultFileOps.open(path, size);
+    if (file) *size += reportedExtra;
+    return file;
+}
+
+static size_t countedRead(void *file, size_t offset, void *buffer,
+                          size_t size) {
+    reads++;
+    if (size > largestRead) largestRead = size;
+    if (shortRead && size > shortRead) size = shortRead;
+    return fwDefaultFileOps.read(file, offset, buffer, size);
+}
+
+static constexpr FwFileOps countedOps = {countedOpen, countedRead,
+                                         fwDefaultFileOps.close};
+
+static void reset() {
+    // Drop the cached answers, as if the kext had been reloaded.
+    for (int i = 0; i < fwNumber; i++) {
+        auto *copy = fwDiskCache[i];
+        if (copy && copy != &fwDiskNone)
+            fwFree(const_cast<FwDiskCopy *>(copy),
+                   sizeof(FwDiskCopy) + copy->size);
+        fwDiskCache[i] = nullptr;
+    }
+    opens = reads = largestRead = shortRead = reportedExtra = 0;
+}
+
+static std::string pathOf(const char *dir, int index) {
+    return std::string(dir) + "/" + fwList[index].name;
+}
+
+static void writeFile(const std::string &path,
+                      const std::vector<uint8_t> &data) {
+    auto *file = fopen(path.c_str(), "wb");
+    if (!file || (data.size() && fwrite(data.data(), 1, data.size(),
+                                        file) != data.size())) {
+        printf("cannot write %s\n", path.c_str());
+        exit(1);
+    }
+    fclose(file);
+}
+
+static bool embedded(int index) {
+    auto view = getFWByName(fwList[index].name);
+    return view && view.size == static_cast<size_t>(fwList[index].size) &&
+           view.data == fwBytes(&fwList[index]);
+}
+
+int main() {
+    if (fwNumber < 2) {
+        printf("need at least two embedded blobs\n");
+        return 1;
+    }
+    char dir[] = "/tmp/fwdiskXXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("cannot create a temporary directory\n");
+        return 1;
+    }
+    fwFileOps = &countedOps;
+
+    // No directory configured: the disk is never touched.
+    check(embedded(0) && embedded(1) && opens == 0, "unconfigured lookup");
+    check(!fwDiskConfigure(std::string(FwDiskPathSize, 'x').c_str()),
+          "overlong directory accepted");
+    check(fwDiskConfigure(dir), "directory rejected");
+
+    // Override of blob 0 spanning several chunks, read back in short pieces:
+    // the embedded blob with a different body, so its header still matches.
+    auto *embedded0 = fwBytes(&fwList[0]);
+    std::vector<uint8_t> blob(embedded0, embedded0 + fwList[0].size);
+    check(blob.size() > 3 * FwDiskChunk, "blob 0 spans too few chunks");
+    for (size_t i = sizeof(PspImageHeader); i < blob.size(); i++)
+        blob[i] ^= static_cast<uint8_t>(i * 131 + (i >> 9));
+    writeFile(pathOf(dir, 0), blob);
+    reset();
+    shortRead = 1000;
+    auto first = getFWByName(fwList[0].name);
+    check(first && first.size == blob.size() &&
+              !memcmp(first.data, blob.data(), blob.size()),
+          "override content");
+    check(largestRead <= FwDiskChunk, "read larger than a chunk");
+    check(reads >= blob.size() / shortRead, "short reads not resumed");
+    check(embedded(1), "missing file did not fall back");
+    size_t opened = opens;
+
+    // Cached: no more I/O, even once the files change.
+    unlink(pathOf(dir, 0).c_str());
+    writeFile(pathOf(dir, 1), blob);
+    for (int round = 0; round < 100; round++) {
+        check(getFWByName(fwList[0].name).data == first.data,
+              "override not cached");
+        check(embedded(1), "fallback not cached");
+    }
+    check(opens == opened && opened == 2, "files reopened");
+    check(getFW<fwId("missing.bin")>().data == nullptr, "unknown name found");
+
+    // Empty, truncated, oversized and incompatible files fall back.
+    reset();
+    auto rejected = fwStats.diskRejected;
+    check(embedded(1), "incompatible file did not fall back");
+    check(fwStats.diskRejected == rejected + 1, "rejection not counted");
+    reset();
+    std::vector<uint8_t> noise(blob.size());
+    for (size_t i = 0; i < noise.size(); i++)
+        noise[i] = static_cast<uint8_t>((i * 0x9E3779B1) >> 13);
+    writeFile(pathOf(dir, 0), noise);
+    check(embedded(0), "unparsable file did not fall back");
+    reset();
+    writeFile(pathOf(dir, 0), {});
+    check(embedded(0), "empty file did not fall back");
+    reset();
+    reportedExtra = 4096;
+    auto failures = fwStats.diskFailures;
+    check(embedded(1), "truncated file did not fall back");
+    check(fwStats.diskFailures == failures + 1, "truncation not counted");
+    reset();
+    reportedExtra = FwDiskMaxSize;
+    check(embedded(1), "oversized file did not fall back");
+    check(reads == 0, "oversized file read");
+
+    unlink(pathOf(dir, 0).c_str());
+    unlink(pathOf(dir, 1).c_str());
+    rmdir(dir);
+    printf("disk loads %llu failures %llu rejected %llu, %llu bytes live\n",
+           static_cast<unsigned long long>(fwStats.diskLoads),
+           static_cast<unsigned long long>(fwStats.diskFailures),
+           static_cast<unsigned long long>(fwStats.diskRejected),
+           static_cast<unsigned long long>(fwStats.bytesLive));
+    return report();
+}
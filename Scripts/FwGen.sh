@@ -1,9 +1,8 @@
 #!/bin/sh
 
+# Also writes kern_fw_data.S and kern_fw_blobs/, and does nothing if the
+# manifest there shows the firmware and the generator are unchanged.
 target_file="${PROJECT_DIR}/WhateverRed/kern_fw.cpp"
-if [ -f "$target_file" ]; then
-rm -f $target_file
-fi
 while [ $# -gt 0 ];
 do
     case $1 in
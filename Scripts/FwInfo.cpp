@@ -0,0 +1,123 @@
+//
+//  FwInfo.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Dumps the header metadata of AMD firmware blobs with the parser the kext
+//  uses (kern_fwheader.hpp): container, IP and ucode version, payload and
+//  PSP image layout, signature region. With -r, each file is also checked
+//  against a known good reference the way wredfwdir overrides are, and the
+//  exit status is non-zero if any is rejected.
+//
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/FwInfo.cpp -o fwinfo
+//    ./fwinfo [-r reference] <firmware>...
+//
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "kern_fwheader.hpp"
+
+static bool load(const char *path, std::vector<uint8_t> &data) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    data.assign(std::istreambuf_iterator<char>(in),
+                std::istreambuf_iterator<char>());
+    return true;
+}
+
+static void dump(const char *path, size_t size, const FwInfo &info) {
+    printf("%s: %s", path, fwFormatName(info.format));
+    if (info.format == FwFormatAmdgpu)
+        printf(" header %u.%u, IP %u.%u", info.headerVersionMajor,
+               info.headerVersionMinor, info.ipVersionMajor,
+               info.ipVersionMinor);
+    printf("\n  %-14s 0x%zX\n", "size", size);
+    printf("  %-14s 0x%08X\n", "ucode version", info.ucodeVersion);
+    printf("  %-14s 0x%X bytes\n", "header", info.headerSize);
+    printf("  %-14s 0x%X + 0x%X\n", "payload", info.payloadOffset,
+           info.payloadSize);
+    if (!info.signatureSize && !info.signedSize) {
+        printf("  no PSP image\n");
+        return;
+    }
+    char magic[5] = {};
+    memcpy(magic, &info.imageMagic, 4);
+    bool printable = true;
+    for (int i = 0; i < 4; i++)
+        if (magic[i] < 0x20 || magic[i] > 0x7E) printable = false;
+    printf("  %-14s at 0x%X, version 0x%08X, magic ", "psp image",
+           info.imageOffset, info.imageVersion);
+    if (printable)
+        printf("%s\n", magic);
+    else
+        printf("0x%08X\n", info.imageMagic);
+    printf("  %-14s 0x%X + 0x%X\n", "signed body", info.imageOffset + 0x100,
+           info.signedSize);
+    uint32_t trailer = info.imageOffset + 0x100 + info.signedSize;
+    if (info.signatureOffset > trailer)
+        printf("  %-14s 0x%X + 0x%X\n", "trailer", trailer,
+               info.signatureOffset - trailer);
+    if (info.signatureSize)
+        printf("  %-14s 0x%X + 0x%X (RSA-%u)\n", "signature",
+               info.signatureOffset, info.signatureSize,
+               info.signatureSize * 8);
+    printf("  %-14s %ssigned, %sencrypted, %scompressed\n", "flags",
+           info.isSigned ? "" : "not ", info.encrypted ? "" : "not ",
+           info.compressed ? "" : "not ");
+    printf("  %-14s ", "key");
+    for (auto b : info.keyFingerprint) printf("%02x", b);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    const char *reference = nullptr;
+    std::vector<const char *> paths;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            reference = argv[++i];
+        else
+            paths.push_back(argv[i]);
+    }
+    if (paths.empty()) {
+        fprintf(stderr, "usage: %s [-r reference] <firmware>...\n", argv[0]);
+        return 1;
+    }
+
+    FwInfo known;
+    std::vector<uint8_t> data;
+    if (reference && (!load(reference, data) ||
+                      !fwParse(data.data(), data.size(), known))) {
+        fprintf(stderr, "%s: %s\n", reference,
+                data.empty() ? "cannot read" : known.error);
+        return 1;
+    }
+
+    int status = 0;
+    for (auto *path : paths) {
+        FwInfo info;
+        if (!load(path, data)) {
+            printf("%s: cannot read\n", path);
+            status = 1;
+            continue;
+        }
+        if (!fwParse(data.data(), data.size(), info)) {
+            printf("%s: %s\n", path, info.error);
+            status = 1;
+            continue;
+        }
+        dump(path, data.size(), info);
+        if (reference) {
+            bool ok = fwCompatible(known, info);
+            printf("  %-14s %s %s\n", "reference",
+                   ok ? "compatible with" : "REJECTED, differs from",
+                   reference);
+            if (!ok) status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,106 @@
+//
+//  FwVerifyBench.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Checks CRC32C in kern_crc32c.hpp (known answer, SSE4.2 against the table
+//  fallback at every length and alignment), that every embedded blob
+//  passes its first-use verification and a corrupted copy is refused, and
+//  reports the verification throughput of both implementations.
+//
+//    python3 Scripts/GenerateFirmware.py fw.cpp WhateverRed/Firmware
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/FwVerifyBench.cpp
+//        fw.cpp fw_data.S -o fwv
+//    ./fwv [MB]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "HostCheck.hpp"
+#include "kern_fw.hpp"
+
+template <typename F>
+static double gbPerSec(const uint8_t *data, size_t size, F &&crc) {
+    double best = 1e30;
+    volatile uint32_t sink = 0;
+    for (int round = 0; round < 5; round++) {
+        auto start = std::chrono::steady_clock::now();
+        sink = sink + crc(data, size);
+        double s = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+        if (s < best) best = s;
+    }
+    return size / best / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t mb = argc > 1 ? strtoul(argv[1], nullptr, 0) : 64;
+    if (!mb) mb = 1;
+    bool hardware = CRC32C::hasHardware();
+
+    check(CRC32C::computeSoftware("123456789", 9) == 0xE3069283,
+          "software known answer");
+    check(CRC32C::compute("123456789", 9) == 0xE3069283, "known answer");
+    std::vector<uint8_t> buffer(mb << 20);
+    uint32_t seed = 1;
+    for (auto &b : buffer) b = static_cast<uint8_t>((seed *= 0x9E3779B1) >> 24);
+    for (size_t offset = 0; offset < 8; offset++)
+        for (size_t size = 0; size < 600; size++)
+            check(CRC32C::compute(buffer.data() + offset, size) ==
+                      CRC32C::computeSoftware(buffer.data() + offset, size),
+                  "implementations disagree");
+    check(CRC32C::compute(buffer.data() + 3, 1000, CRC32C::compute(
+                                                       buffer.data(), 3)) ==
+              CRC32C::compute(buffer.data(), 1003),
+          "incremental CRC");
+
+    for (int i = 0; i < fwNumber; i++) {
+        auto *desc = &fwList[i];
+        check(getFWByName(desc->name) && fwVerified[i] == FwIntact,
+              desc->name);
+        // Corrupt the reassembled copy of a blob and re-verify.
+        if (desc->inPlace < 0) {
+            auto *data = const_cast<uint8_t *>(fwCache[i]);
+            auto failures = fwStats.verifyFailures;
+            data[desc->size / 2] ^= 0x10;
+            fwVerified[i] = FwUnverified;
+            check(!getFWByName(desc->name) &&
+                      fwStats.verifyFailures == failures + 1,
+                  "corruption not detected");
+            check(!getFWByName(desc->name) &&
+                      fwStats.verifyFailures == failures + 1,
+                  "verdict not cached");
+            data[desc->size / 2] ^= 0x10;
+            fwVerified[i] = FwUnverified;
+            check(getFWByName(desc->name).data == data, "restored copy");
+        }
+    }
+
+    printf("%-20s %10s %12s %12s\n", "data", "size", "sse4.2 GB/s",
+           "table GB/s");
+    auto row = [&](const char *name, const uint8_t *data, size_t size) {
+        double hw = hardware ? gbPerSec(data, size, [](auto *p, size_t n) {
+            return ~CRC32C::hardware(p, n, ~0U);
+        })
+                             : 0;
+        double sw = gbPerSec(data, size, [](auto *p, size_t n) {
+            return CRC32C::computeSoftware(p, n);
+        });
+        printf("%-20s %10zu %12.2f %12.2f\n", name, size, hw, sw);
+    };
+    for (int i = 0; i < fwNumber; i++)
+        row(fwList[i].name, fwBytes(&fwList[i]),
+            static_cast<size_t>(fwList[i].size));
+    row("random", buffer.data(), buffer.size());
+    if (!hardware) printf("no SSE4.2, the kext would use the table\n");
+
+    printf("verifications %llu failures %llu\n",
+           static_cast<unsigned long long>(fwStats.verifications),
+           static_cast<unsigned long long>(fwStats.verifyFailures));
+    return report();
+}
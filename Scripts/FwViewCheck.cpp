@@ -0,0 +1,82 @@
+//
+//  FwViewCheck.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Host check of the firmware access API in kern_fw.hpp: repeated lookups
+//  of every embedded blob must return the same view, in-place blobs must be
+//  viewed in place and the others reassembled exactly once. Heap
+//  allocations are counted through global operator new and fwStats.
+//
+//    python3 Scripts/GenerateFirmware.py fw.cpp WhateverRed/Firmware
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/FwViewCheck.cpp
+//        fw.cpp fw_data.S -o fwc
+//    ./fwc
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "HostCheck.hpp"
+#include "kern_fw.hpp"
+
+static size_t allocations = 0, allocatedBytes = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    allocatedBytes += size;
+    if (auto *p = malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+int main() {
+    const int rounds = 1000;
+    check(fwNumber > 0, "blobs embedded");
+    std::vector<const uint8_t *> first(fwNumber);
+    size_t before = allocations, beforeBytes = allocatedBytes;
+    size_t bytes = 0, expected = 0;
+    for (int i = 0; i < fwNumber; i++)
+        if (fwList[i].inPlace < 0) expected += fwList[i].size;
+
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < fwNumber; i++) {
+            auto view = getFWByName(fwList[i].name);
+            if (!round) first[i] = view.data;
+            auto *inPlace = fwList[i].inPlace >= 0
+                                ? fwChunkData + fwList[i].inPlace
+                                : nullptr;
+            bool same = view && view.data == first[i] &&
+                        (!inPlace || view.data == inPlace) &&
+                        view.size == static_cast<size_t>(fwList[i].size);
+            if (!same)
+                printf("%s: view moved or does not match the blob\n",
+                       fwList[i].name);
+            check(same, "repeated lookups return the same view");
+            bytes += view.size;
+        }
+        check(!getFWByName("missing.bin"), "unknown name not found");
+    }
+
+    printf("%d blobs, %d rounds, %zu bytes viewed\n", fwNumber, rounds, bytes);
+    printf("lookups %llu misses %llu reassemblies %llu objects %llu\n",
+           static_cast<unsigned long long>(fwStats.lookups),
+           static_cast<unsigned long long>(fwStats.misses),
+           static_cast<unsigned long long>(fwStats.reassemblies),
+           static_cast<unsigned long long>(fwStats.objects));
+    printf("operator new %zu (%zu bytes), API reports %llu allocated, "
+           "%llu live, %zu expected\n",
+           allocations - before, allocatedBytes - beforeBytes,
+           static_cast<unsigned long long>(fwStats.bytesAllocated),
+           static_cast<unsigned long long>(fwStats.bytesLive), expected);
+    // Chunked blobs are reassembled exactly once, nothing else is copied.
+    check(allocations == before && fwStats.bytesAllocated == expected &&
+              fwStats.bytesLive == expected,
+          "only chunked blobs allocated, once");
+    return report();
+}
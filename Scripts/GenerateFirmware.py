@@ -1,7 +1,11 @@
+import hashlib
+import json
 import os
 import struct
 import sys
 
+import NetDbgDecode
+
 copyright = '''
 //  WhateverRed
 //
@@ -12,75 +16,391 @@ copyright = '''
 def format_file_name(file_name):
     return file_name.replace(".", "_").replace("-", "_")
 
-def write_single_file(target_file, path, file):
-    src_file = open(path, "rb")
-    src_data = src_file.read()
-    src_len = len(src_data)
-    
-    fw_var_name = format_file_name(file)
-    target_file.write("\nconst unsigned char ")
-    target_file.write(fw_var_name)
-    target_file.write("[] = {")
-    index = 0;
-    block = []
-    while True:
-        if index + 16 >= src_len:
-            block = src_data[index:]
-        else:
-            block = src_data[index:index + 16]
-        index += 16;
-        if len(block) < 16:
-            if len(block):
-                for b in block:
-                    if type(b) is str:
-                        b = ord(b)
-                    target_file.write("0x{:02X}, ".format(b))
-                target_file.write("\n")
-            break
-        target_file.write("0x{:02X}, 0x{:02X}, 0x{:02X}, 0x{:02X}, "
-                "0x{:02X}, 0x{:02X}, 0x{:02X}, 0x{:02X}, "
-                "0x{:02X}, 0x{:02X}, 0x{:02X}, 0x{:02X}, "
-                "0x{:02X}, 0x{:02X}, 0x{:02X}, 0x{:02X},\n"
-                .format(*struct.unpack("BBBBBBBBBBBBBBBB", block)))
-    target_file.write("};\n")
-    target_file.write("const long int ")
-    target_file.write(fw_var_name)
-    target_file.write("_size = sizeof(")
-    target_file.write(fw_var_name)
-    target_file.write(");\n")
-    src_file.close()
-    
-    
+def lz4_compress(data):
+    # LZ4 block encoder for kern_lz4.hpp. Build time only, so it searches a
+    # chain of earlier positions per 4-byte key for the longest match.
+    n = len(data)
+    out = bytearray()
+    match_limit = n - 5
+    search_limit = n - 12
+    chains = {}
+    anchor = pos = 0
+
+    def sequence(literals, offset=0, length=0):
+        lit = len(literals)
+        token = min(lit, 15) << 4
+        if offset:
+            token |= min(length - 4, 15)
+        out.append(token)
+        if lit >= 15:
+            rest = lit - 15
+            while rest >= 255:
+                out.append(255)
+                rest -= 255
+            out.append(rest)
+        out.extend(literals)
+        if offset:
+            out.extend(struct.pack("<H", offset))
+            if length - 4 >= 15:
+                rest = length - 4 - 15
+                while rest >= 255:
+                    out.append(255)
+                    rest -= 255
+                out.append(rest)
+
+    while pos < search_limit:
+        key = data[pos:pos + 4]
+        chain = chains.setdefault(key, [])
+        best_len = best_ref = 0
+        for ref in reversed(chain[-32:]):
+            if pos - ref > 0xFFFF:
+                break
+            length = 4
+            while pos + length < match_limit and \
+                    data[ref + length] == data[pos + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_ref = length, ref
+        chain.append(pos)
+        if best_len < 4:
+            pos += 1
+            continue
+        sequence(data[anchor:pos], pos - best_ref, best_len)
+        for p in range(pos + 1, min(pos + best_len, search_limit)):
+            chains.setdefault(data[p:p + 4], []).append(p)
+        pos += best_len
+        anchor = pos
+    sequence(data[anchor:])
+    return bytes(out)
+
+
+crc32c_table = []
+for i in range(256):
+    crc = i
+    for _ in range(8):
+        crc = (crc >> 1) ^ (0x82F63B78 if crc & 1 else 0)
+    crc32c_table.append(crc)
+
+
+def crc32c(data):
+    # Must match CRC32C in kern_crc32c.hpp
+    crc = 0xFFFFFFFF
+    table = crc32c_table
+    for b in data:
+        crc = (crc >> 8) ^ table[(crc ^ b) & 0xFF]
+    return crc ^ 0xFFFFFFFF
+
+
+def write_if_changed(path, data):
+    # Leaves the file and its timestamp alone if the content is the same,
+    # so the build does not recompile or reassemble it.
+    if isinstance(data, str):
+        data = data.encode()
+    if os.path.exists(path):
+        with open(path, "rb") as old:
+            if old.read() == data:
+                return
+    with open(path, "wb") as new:
+        new.write(data)
+
+
+def sha256_file(path):
+    with open(path, "rb") as file:
+        return hashlib.sha256(file.read()).hexdigest()
+
+
+def fw_id(name):
+    # FNV-1a, must match fwId() in kern_fw.hpp
+    hash = 0x811C9DC5
+    for b in name.encode():
+        hash = ((hash ^ b) * 0x01000193) & 0xFFFFFFFF
+    return hash
+
+
+def fw_mix(id, seed):
+    # Must match fwMix() in kern_fw.hpp
+    h = ((id ^ seed) * 0x9E3779B1) & 0xFFFFFFFF
+    h ^= h >> 15
+    h = (h * 0x85EBCA77) & 0xFFFFFFFF
+    h ^= h >> 13
+    return h
+
+
+def build_index(ids):
+    # Hash and displace: IDs go to buckets by fw_mix(id, 0); the largest
+    # buckets first get the smallest seed that moves all their IDs to free
+    # slots. Single-ID buckets store -(slot + 1) and need no seed.
+    size = 1 << max(1, (len(ids) - 1).bit_length())
+    mask = size - 1
+    buckets = [[] for _ in range(size)]
+    for id in ids:
+        buckets[fw_mix(id, 0) & mask].append(id)
+    displace = [0] * size
+    slots = [None] * size
+    order = sorted(range(size), key=lambda b: -len(buckets[b]))
+    for b in order:
+        bucket = buckets[b]
+        if len(bucket) > 1:
+            for seed in range(1, 1 << 20):
+                taken = [fw_mix(id, seed) & mask for id in bucket]
+                if len(set(taken)) == len(bucket) and \
+                        all(slots[t] is None for t in taken):
+                    break
+            else:
+                sys.exit("no displacement found for firmware bucket")
+            displace[b] = seed
+            for id, t in zip(bucket, taken):
+                slots[t] = id
+        elif bucket:
+            t = slots.index(None)
+            displace[b] = -t - 1
+            slots[t] = bucket[0]
+    return displace, slots
+
+
+# Content-defined chunking (FastCDC): a gear hash rolls over the last 32
+# bytes and a chunk ends where its top bits are zero, so an edit only moves
+# the boundaries next to it and identical regions of different blobs, or
+# of the same blob in different generations, come out as identical chunks.
+# The mask is harder below the average size and easier above it, which
+# keeps the sizes close to the average.
+chunk_bits = 14
+chunk_min = 1 << (chunk_bits - 2)
+chunk_max = 1 << (chunk_bits + 2)
+chunk_gear = [fw_mix(i, 0x47454152) for i in range(256)]
+chunk_mask_small = ~((1 << (32 - chunk_bits - 1)) - 1) & 0xFFFFFFFF
+chunk_mask_large = ~((1 << (32 - chunk_bits + 1)) - 1) & 0xFFFFFFFF
+
+
+def split_chunks(data):
+    n = len(data)
+    start = 0
+    while start < n:
+        end = min(n, start + chunk_max)
+        normal = min(end, start + (1 << chunk_bits))
+        cut = end
+        h = 0
+        pos = start + chunk_min
+        while pos < end:
+            h = ((h << 1) + chunk_gear[data[pos]]) & 0xFFFFFFFF
+            mask = chunk_mask_small if pos < normal else chunk_mask_large
+            pos += 1
+            if not h & mask:
+                cut = pos
+                break
+        yield data[start:cut]
+        start = cut
+
+
+class Bundle:
+    # All unique chunks, each an LZ4 block unless compression does not
+    # shrink it, concatenated into one pool. A blob whose chunks are all
+    # new and stored lies in the pool as is, and is viewed in place.
+
+    def __init__(self):
+        self.pool = bytearray()
+        self.chunks = []  # (offset, packed size, size)
+        self.index = {}
+        self.refs = 0
+        self.ref_bytes = 0
+
+    def add(self, file, data):
+        # Returns (chunk indices, offset of the blob in the pool or -1).
+        if not data:
+            sys.exit("%s: empty firmware file" % file)
+        self.pool += bytes(-len(self.pool) % 16)
+        start = len(self.pool)
+        in_place = True
+        ids = []
+        for piece in split_chunks(data):
+            key = hashlib.sha256(piece).digest()
+            self.refs += 1
+            self.ref_bytes += len(piece)
+            if key in self.index:
+                ids.append(self.index[key])
+                in_place = False
+                continue
+            packed = lz4_compress(piece)
+            if len(packed) >= len(piece):
+                packed = piece
+            elif NetDbgDecode.lz4_decompress(packed, len(piece)) != piece:
+                sys.exit("%s: LZ4 round trip failed" % file)
+            else:
+                in_place = False
+            self.index[key] = len(self.chunks)
+            self.chunks.append((len(self.pool), len(packed), len(piece)))
+            self.pool += packed
+            ids.append(self.index[key])
+        if len(self.chunks) > 0xFFFF or len(self.pool) > 0x7FFFFFFF:
+            sys.exit("firmware bundle too large")
+        return ids, start if in_place else -1
+
+
+asm_header = '''//
+//  %s
+//  WhateverRed
+//
+//  Generated by Scripts/GenerateFirmware.py, do not edit.
+//
+
+#ifdef __APPLE__
+#define FW_SYMBOL(name) _##name
+#define FW_HIDE(name) .private_extern FW_SYMBOL(name)
+    .section __TEXT,__const
+#else
+#define FW_SYMBOL(name) name
+#define FW_HIDE(name) .hidden name
+    .section .note.GNU-stack,"",@progbits
+    .section .rodata
+#endif
+'''
+
+
+def project_dir():
+    # Xcode runs the assembler from the project directory, and the host
+    # harnesses are built from the repository root, which is the same.
+    return os.environ.get("PROJECT_DIR") or \
+        os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def project_path(path):
+    # Relative and with forward slashes, so the outputs do not depend on
+    # where the checkout lives.
+    return os.path.relpath(os.path.abspath(path), project_dir()).replace(
+        os.sep, "/")
+
+
+def write_asm(path, pool_path, pool_size, digest):
+    # The bytes are pulled in by the assembler with .incbin, the hash in the
+    # comment makes the stub change, and so rebuild, whenever the pool does.
+    out = asm_header % os.path.basename(path)
+    out += "\n/* %s, %d bytes, sha256 %s */\n" % (
+        os.path.basename(pool_path), pool_size, digest)
+    out += "    .globl FW_SYMBOL(fwChunkData)\n"
+    out += "    FW_HIDE(fwChunkData)\n"
+    out += "    .p2align 4\n"
+    out += "FW_SYMBOL(fwChunkData):\n"
+    out += '    .incbin "%s"\n' % project_path(pool_path)
+    write_if_changed(path, out)
+
+
+def manifest_inputs(files, target_file):
+    # Everything the outputs depend on: the firmware contents, the
+    # generator itself, and where the stub will look for the blobs.
+    scripts = [__file__, NetDbgDecode.__file__]
+    return {
+        "generator": [sha256_file(script) for script in scripts],
+        "target": project_path(target_file),
+        "files": [[file, project_path(path), sha256_file(path)]
+                  for file, path in files],
+    }
+
+
 def process_files(target_file, dir):
-    if not os.path.exists(target_file):
-        if not os.path.exists(os.path.dirname(target_file)):
-            os.mkdirs(os.path.dirname(target_file))
-    target_file_handle = open(target_file, "w")
-    target_file_handle.write(copyright)
-    for root, dirs, files in os.walk(dir):
-        for file in files:
-            path = os.path.join(root, file)
-            write_single_file(target_file_handle, path, file)
-            
-        target_file_handle.write("\n")
-        target_file_handle.write("const struct FwDesc fwList[] = {")
-        
-        for file in files:
-            target_file_handle.write('{RAD_FW("')
-            target_file_handle.write(file)
-            target_file_handle.write('", ')
-            fw_var_name = format_file_name(file)
-            target_file_handle.write(fw_var_name)
-            target_file_handle.write(", ")
-            target_file_handle.write(fw_var_name)
-            target_file_handle.write("_size)},\n")
-            
-        target_file_handle.write("};\n")
-        target_file_handle.write("const int fwNumber = ")
-        target_file_handle.write(str(len(files)))
-        target_file_handle.write(";\n")
-            
-    target_file_handle.close()
+    target_dir = os.path.dirname(target_file)
+    if target_dir and not os.path.exists(target_dir):
+        os.makedirs(target_dir)
+    base = os.path.splitext(target_file)[0]
+    asm_file = base + "_data.S"
+    blob_dir = base + "_blobs"
+    manifest_file = os.path.join(blob_dir, "manifest.json")
+    files = []
+    for root, dirs, names in os.walk(dir):
+        files += [(name, os.path.join(root, name)) for name in names]
+    # Sorted, so the table and its seed only change when the set does.
+    files.sort()
+
+    inputs = manifest_inputs(files, target_file)
+    try:
+        with open(manifest_file) as manifest:
+            previous = json.load(manifest)
+    except (OSError, ValueError):
+        previous = None
+    if previous and previous.get("inputs") == inputs and \
+            all(os.path.exists(os.path.join(project_dir(), path))
+                for path in previous["outputs"]):
+        return
+    if previous:
+        os.remove(manifest_file)
+    elif not os.path.exists(blob_dir):
+        os.makedirs(blob_dir)
+
+    ids = {}
+    for file, path in files:
+        id = fw_id(file)
+        if id in ids:
+            sys.exit("firmware ID collision: %s and %s" % (ids[id], file))
+        ids[id] = file
+    displace, slot_ids = build_index(list(ids))
+
+    bundle = Bundle()
+    blobs = []
+    out = copyright
+    for file, path in files:
+        fw_var_name = format_file_name(file)
+        with open(path, "rb") as src_file:
+            raw_data = src_file.read()
+        chunk_ids, in_place = bundle.add(file, raw_data)
+        blobs.append((fw_var_name, in_place, len(chunk_ids)))
+        out += "\nconstexpr uint16_t %s_chunks[] = {" % fw_var_name
+        out += ", ".join(str(id) for id in chunk_ids)
+        out += "};\n"
+        out += "const long int %s_raw_size = %d;\n" % (
+            fw_var_name, len(raw_data))
+        out += "const uint32_t %s_crc = 0x%08X;\n" % (
+            fw_var_name, crc32c(raw_data))
+
+    pool_path = os.path.join(blob_dir, "chunks.bin")
+    write_if_changed(pool_path, bytes(bundle.pool))
+    write_asm(asm_file, pool_path, len(bundle.pool),
+              hashlib.sha256(bundle.pool).hexdigest())
+    out += '\nextern "C" const unsigned char fwChunkData[];  // %s\n' % (
+        os.path.basename(asm_file))
+    out += "constexpr uint32_t fwChunkDataSize = %d;\n" % len(bundle.pool)
+    out += "// %d chunks referenced, %d bytes, %d unique\n" % (
+        bundle.refs, bundle.ref_bytes, len(bundle.chunks))
+    out += "constexpr struct FwChunk fwChunks[] = {\n"
+    for offset, packed_size, size in bundle.chunks:
+        out += "    {%d, %d, %d},\n" % (offset, packed_size, size)
+    out += "};\n"
+    out += "constexpr int fwChunkNumber = %d;\n" % len(bundle.chunks)
+    out += "\n"
+    # constexpr, so the index can be checked against it at compile time.
+    out += "constexpr struct FwDesc fwList[] = {"
+    for (file, path), (fw_var_name, in_place, count) in zip(files, blobs):
+        out += '{RAD_FW("%s", %d, %s_chunks, %d, %s_raw_size, %s_crc)},\n' % (
+            file, in_place, fw_var_name, count, fw_var_name, fw_var_name)
+    out += "};\n"
+    # Decompressed copies, filled in on first use
+    out += "const uint8_t *fwCache[%d];\n" % max(1, len(files))
+    # On-disk overrides, see fwDiskCopy()
+    out += "const FwDiskCopy *fwDiskCache[%d];\n" % max(1, len(files))
+    # Results of fwVerify()
+    out += "uint8_t fwVerified[%d];\n" % max(1, len(files))
+    out += "constexpr int fwNumber = %d;\n" % len(files)
+
+    list_index = {fw_id(file): i for i, (file, _) in enumerate(files)}
+    out += "\nconstexpr uint32_t fwIndexSize = %d;\n" % len(displace)
+    out += "constexpr int32_t fwDisplace[] = {"
+    out += ", ".join(str(d) for d in displace)
+    out += "};\n"
+    out += "constexpr int16_t fwIndex[] = {"
+    out += ", ".join(
+        str(list_index[id] if id is not None else -1) for id in slot_ids)
+    out += "};\n"
+    out += ("static_assert(fwIndexValid(fwList, fwDisplace, fwIndex),\n"
+            "              \"firmware name collision or stale index\");\n")
+    out += ("static_assert(\n"
+            "    fwChunksValid(fwList, fwChunks, fwChunkDataSize),\n"
+            "    \"firmware chunk list does not add up\");\n")
+    write_if_changed(target_file, out)
+
+    # Written last, so an interrupted run is redone by the next build.
+    outputs = [project_path(path) for path in
+               [target_file, asm_file, pool_path]]
+    with open(manifest_file, "w") as manifest:
+        json.dump({"inputs": inputs, "outputs": outputs}, manifest, indent=1)
+
 
 if __name__ == '__main__':
-    process_files(sys.argv[1], sys.argv[2])
\ No newline at end of file
+    process_files(sys.argv[1], sys.argv[2])
@@ -0,0 +1,213 @@
+import json
+import os
+import re
+import sys
+
+# String macros that may appear inside NETLOG format strings.
+known_macros = {
+    "PRIKADDR": "0x%llX",
+}
+
+# NETDBG logging macros and the level each one logs at, see kern_netlevel.hpp.
+log_macros = {
+    "NETERR": 1,
+    "NETLOG": 2,
+    "NETTRACE": 3,
+}
+
+# Macros that stringize their arguments into NETDBG formats. Each entry lists
+# the argument names and the (module, format, level) records it produces.
+wrapper_macros = {}
+
+# Integer types wider than 32 bits, logged as 0x%llX by HookTrace
+hook_wide_types = {
+    "uint64_t", "int64_t", "size_t", "ssize_t", "uintptr_t", "intptr_t",
+    "mach_vm_address_t", "vm_address_t", "long", "unsigned long",
+    "long long", "unsigned long long",
+}
+
+escapes = {
+    "n": "\n", "t": "\t", "r": "\r", "0": "\0",
+    "\\": "\\", '"': '"', "'": "'",
+}
+
+
+def format_id(fmt):
+    hash = 0x811C9DC5
+    for b in fmt.encode("utf-8"):
+        hash ^= b
+        hash = (hash * 0x01000193) & 0xFFFFFFFF
+    return hash
+
+
+def read_literal(src, pos):
+    # pos points at the opening quote
+    out = []
+    pos += 1
+    while src[pos] != '"':
+        if src[pos] == "\\":
+            pos += 1
+            out.append(escapes.get(src[pos], src[pos]))
+        else:
+            out.append(src[pos])
+        pos += 1
+    return "".join(out), pos + 1
+
+
+def read_string_arg(src, pos):
+    # Concatenation of adjacent literals and known macros, up to ',' or ')'
+    parts = []
+    while True:
+        while src[pos].isspace():
+            pos += 1
+        if src[pos] == '"':
+            lit, pos = read_literal(src, pos)
+            parts.append(lit)
+            continue
+        m = re.match(r"[A-Za-z_]\w*", src[pos:])
+        if m:
+            if m.group(0) not in known_macros:
+                return None, pos
+            parts.append(known_macros[m.group(0)])
+            pos += len(m.group(0))
+            continue
+        return "".join(parts), pos
+
+
+def hook_spec(type):
+    # Must match hookValue() and HookSpec in kern_hook.hpp
+    type = " ".join(type.replace("*", " * ").split())
+    if "*" in type:
+        return "%p"
+    type = " ".join(w for w in type.split() if w not in ("const", "volatile"))
+    if type == "bool":
+        return "%d"
+    if type in hook_wide_types:
+        return "0x%llX"
+    return "0x%X"
+
+
+def split_args(text):
+    # Top-level comma separated parts
+    parts, depth, start = [], 0, 0
+    for i, c in enumerate(text):
+        if c in "(<":
+            depth += 1
+        elif c in ")>":
+            depth -= 1
+        elif c == "," and not depth:
+            parts.append(text[start:i].strip())
+            start = i + 1
+    parts.append(text[start:].strip())
+    return [part for part in parts if part]
+
+
+def hook_formats(src, pos):
+    # HOOK_DEFINE(tag, "mod", "name", policy, R(Args...)): the records of
+    # HookTrace, see hookEnterFormat() and hookLeaveFormat().
+    depth, end = 1, pos
+    while depth:
+        depth += {"(": 1, ")": -1}.get(src[end], 0)
+        end += 1
+    args = split_args(src[pos:end - 1])
+    if len(args) != 5:
+        return None
+    mod, name = args[1].strip('"'), args[2].strip('"')
+    m = re.match(r"(.*?)\((.*)\)$", args[4], re.S)
+    if not m:
+        return None
+    ret = m.group(1).strip()
+    params = [p for p in split_args(m.group(2)) if p != "void"]
+    enter = "%s(%s)" % (name, ", ".join(hook_spec(p) for p in params))
+    leave = name + " returned"
+    if ret != "void":
+        leave += " " + hook_spec(ret)
+    return mod, (enter, leave)
+
+
+def add_format(table, path, line, mod, fmt, level, sites=None):
+    full = mod + ": " + fmt + "\n"
+    if sites is not None:
+        sites.append((mod, level, full, "%s:%d" % (path, line)))
+    key = "0x%08X" % format_id(full)
+    if key in table and table[key]["format"] != full:
+        print("%s:%d: format ID collision with %s" %
+              (path, line, table[key]["source"]), file=sys.stderr)
+        sys.exit(1)
+    table[key] = {
+        "format": full,
+        "module": mod,
+        "level": level,
+        "source": "%s:%d" % (os.path.basename(path), line),
+    }
+
+
+def extract_file(path, table, sites=None):
+    src = open(path, encoding="utf-8").read()
+    macros = "|".join(log_macros)
+    for m in re.finditer(r"\b(%s)\s*\(" % macros, src):
+        line = src.count("\n", 0, m.start()) + 1
+        mod, pos = read_string_arg(src, m.end())
+        if mod is None or src[pos] != ",":
+            continue
+        fmt, pos = read_string_arg(src, pos + 1)
+        if src[pos] == "#":
+            # Stringized macro body, covered by wrapper_macros
+            continue
+        if fmt is None or src[pos] not in ",)":
+            print("%s:%d: unknown token in %s format, skipped" %
+                  (path, line, m.group(1)), file=sys.stderr)
+            continue
+        add_format(table, path, line, mod, fmt, log_macros[m.group(1)], sites)
+    for name, (params, records) in wrapper_macros.items():
+        for m in re.finditer(r"^\s*%s\s*\(" % name, src, re.M):
+            line = src.count("\n", 0, m.start()) + 1
+            args, pos = {}, m.end()
+            for param in params:
+                while src[pos].isspace():
+                    pos += 1
+                if src[pos] == '"':
+                    value, pos = read_string_arg(src, pos)
+                else:
+                    end = re.match(r"[^,)]*", src[pos:]).end()
+                    value, pos = src[pos:pos + end].strip(), pos + end
+                args[param] = value
+                pos += 1
+            for mod, fmt, level in records:
+                add_format(table, path, line, mod, fmt.format(**args), level,
+                           sites)
+    for m in re.finditer(r"^\s*HOOK_DEFINE\s*\(", src, re.M):
+        line = src.count("\n", 0, m.start()) + 1
+        hook = hook_formats(src, m.end())
+        if hook is None:
+            print("%s:%d: unreadable HOOK_DEFINE, skipped" % (path, line),
+                  file=sys.stderr)
+            continue
+        mod, formats = hook
+        for fmt in formats:
+            add_format(table, path, line, mod, fmt, 3, sites)
+
+
+def scan_dir(src_dir, sites=None):
+    table = {}
+    for root, dirs, files in os.walk(src_dir):
+        for file in sorted(files):
+            if file.endswith((".cpp", ".hpp")):
+                extract_file(os.path.join(root, file), table, sites)
+    return table
+
+
+def process_dir(src_dir, target_file):
+    # The build phase runs on every build; only a changed table is written,
+    # so its timestamp says when the formats last changed.
+    data = json.dumps(scan_dir(src_dir), indent=1, sort_keys=True)
+    if os.path.exists(target_file):
+        with open(target_file) as f:
+            if f.read() == data:
+                return
+    with open(target_file, "w") as f:
+        f.write(data)
+
+
+if __name__ == '__main__':
+    process_dir(sys.argv[1], sys.argv[2])
@@ -0,0 +1,219 @@
+//
+//  HookBench.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Host check and benchmark of the generated hook wrappers in kern_hook.hpp,
+//  routed to plain functions instead of patched kext symbols: arguments and
+//  return values pass through, the trace formats and what they log, timing
+//  and capture records, and that trace hooks of a module with trace off are
+//  empty. Then reports the per-call overhead of every policy against a
+//  direct call.
+//
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/HookBench.cpp -o hooks
+//    ./hooks [million calls]
+//
+
+// Trace on for "rad", left at the default (off) for "wred".
+#define NETLOG_LEVEL_RAD NetLogTrace
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "HostCheck.hpp"
+#include "kern_hook.hpp"
+
+/**
+ *  Binary-mode NETDBG: format ID and raw arguments
+ */
+struct RecordSink {
+    static inline uint32_t lastId;
+    static inline uint64_t lastArgs[8];
+    static inline size_t records;
+
+    template <uint32_t Id, typename... Args>
+    static void log(const char *, Args... args) {
+        uint64_t raw[] = {0, hookRawValue(args)...};
+        lastId = Id;
+        memcpy(lastArgs, raw + 1, sizeof...(Args) * sizeof(uint64_t));
+        records++;
+    }
+};
+
+/**
+ *  Text-mode NETDBG: printf into a line buffer
+ */
+struct TextSink {
+    static inline char line[256];
+    static inline size_t records;
+
+    template <uint32_t Id, typename... Args>
+    static void log(const char *fmt, Args... args) {
+        format(fmt, args...);
+        records++;
+    }
+
+    [[gnu::format(__printf__, 1, 2)]] static void format(const char *fmt,
+                                                         ...) {
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(line, sizeof(line), fmt, args);
+        va_end(args);
+    }
+};
+
+// TSC, as mach_absolute_time() is in the kernel
+struct TscClock {
+    static uint64_t now() { return __builtin_ia32_rdtsc(); }
+};
+
+using RecordTrace = HookTrace<RecordSink>;
+using TextTrace = HookTrace<TextSink>;
+using Timed = HookTime<TscClock>;
+using Captured = HookCapture<8>;
+
+// Originals, never inlined into the wrappers
+[[gnu::noinline]] static uint64_t configureDevice(void *that, uint32_t reg) {
+    asm volatile("" ::: "memory");
+    return reinterpret_cast<uintptr_t>(that) + reg;
+}
+
+[[gnu::noinline]] static bool ppEnable(void *, bool enable) {
+    asm volatile("" ::: "memory");
+    return !enable;
+}
+
+static int notified = 0;
+
+[[gnu::noinline]] static void notify(uint8_t value, const char *) {
+    notified += value;
+}
+
+HOOK_DEFINE(NoneConfigure, "rad", "configureDevice", HookNone,
+            uint64_t(void *, uint32_t));
+HOOK_DEFINE(RecordConfigure, "rad", "configureDevice", RecordTrace,
+            uint64_t(void *, uint32_t));
+HOOK_DEFINE(TextConfigure, "rad", "configureDevice", TextTrace,
+            uint64_t(void *, uint32_t));
+HOOK_DEFINE(TimedConfigure, "rad", "configureDevice", Timed,
+            uint64_t(void *, uint32_t));
+HOOK_DEFINE(CapturedConfigure, "rad", "configureDevice", Captured,
+            uint64_t(void *, uint32_t));
+HOOK_DEFINE(QuietConfigure, "wred", "configureDevice", RecordTrace,
+            uint64_t(void *, uint32_t));
+HOOK_DEFINE(TextPpEnable, "rad", "ppEnable", TextTrace, bool(void *, bool));
+HOOK_DEFINE(TextNotify, "rad", "notify", TextTrace,
+            void(uint8_t, const char *));
+
+template <typename H, typename F>
+static void route(F *original) {
+    H::org = reinterpret_cast<HookAddress>(original);
+}
+
+static void checkHooks() {
+    route<NoneConfigure>(configureDevice);
+    route<RecordConfigure>(configureDevice);
+    route<TextConfigure>(configureDevice);
+    route<TimedConfigure>(configureDevice);
+    route<CapturedConfigure>(configureDevice);
+    route<QuietConfigure>(configureDevice);
+    route<TextPpEnable>(ppEnable);
+    route<TextNotify>(notify);
+    auto *that = reinterpret_cast<void *>(0x1000);
+
+    check(NoneConfigure::wrap(that, 5) == 0x1005, "pass-through");
+    check(RecordConfigure::wrap(that, 7) == 0x1007 &&
+              RecordSink::records == 2 && RecordSink::lastArgs[0] == 0x1007,
+          "record trace");
+    check(RecordSink::lastId ==
+              hookFormatId("rad: configureDevice returned 0x%llX\n"),
+          "return format ID");
+
+    TextConfigure::wrap(that, 0x20);
+    check(!strcmp(TextSink::line, "rad: configureDevice returned 0x1020\n"),
+          "text return");
+    static constexpr auto enter =
+        hookEnterFormat<TextConfigure, void *, uint32_t>();
+    check(!strcmp(enter.data, "rad: configureDevice(%p, 0x%X)\n"),
+          "enter format");
+    check(TextPpEnable::wrap(that, true) == false &&
+              !strcmp(TextSink::line, "rad: ppEnable returned 0\n"),
+          "bool return");
+    TextSink::line[0] = 0;
+    TextNotify::wrap(3, "x");
+    check(notified == 3 && !strcmp(TextSink::line, "rad: notify returned\n"),
+          "void return");
+    static constexpr auto notifyEnter =
+        hookEnterFormat<TextNotify, uint8_t, const char *>();
+    check(!strcmp(notifyEnter.data, "rad: notify(0x%X, %p)\n"),
+          "narrow and string arguments");
+
+    auto records = RecordSink::records;
+    check(QuietConfigure::wrap(that, 1) == 0x1001 &&
+              RecordSink::records == records,
+          "trace with the module off logged");
+    static_assert(RecordTrace::enabled<RecordConfigure>() &&
+                      !RecordTrace::enabled<QuietConfigure>(),
+                  "trace levels");
+
+    for (uint32_t i = 0; i < 10; i++) TimedConfigure::wrap(that, i);
+    auto &stats = Timed::stats<TimedConfigure>;
+    check(stats.calls == 10 && stats.total >= stats.max, "timing");
+
+    for (uint32_t i = 0; i < 10; i++) CapturedConfigure::wrap(that, i);
+    auto &log = Captured::log<CapturedConfigure>;
+    auto &last = log.calls[(log.next - 1) & 7];
+    check(log.next == 10 && last.seq == 10 && last.argc == 2 &&
+              last.args[0] == 0x1000 && last.args[1] == 9 &&
+              last.ret == 0x1009,
+          "capture");
+}
+
+template <typename F>
+static double nsPerCall(size_t calls, F &&call) {
+    double best = 1e30;
+    for (int round = 0; round < 5; round++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < calls; i++) call(i);
+        double ns = std::chrono::duration<double, std::nano>(
+                        std::chrono::steady_clock::now() - start)
+                        .count() /
+                    calls;
+        if (ns < best) best = ns;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    size_t calls = (argc > 1 ? strtoul(argv[1], nullptr, 0) : 10) * 1000000;
+    if (!calls) calls = 1000000;
+    checkHooks();
+
+    auto *that = reinterpret_cast<void *>(0x1000);
+    uint64_t (*volatile direct)(void *, uint32_t) = configureDevice;
+    volatile uint64_t sink = 0;
+    auto bench = [&](uint64_t (*fn)(void *, uint32_t)) {
+        uint64_t (*volatile target)(void *, uint32_t) = fn;
+        return nsPerCall(calls, [&](size_t i) {
+            sink = sink + target(that, static_cast<uint32_t>(i));
+        });
+    };
+    double base = bench(direct);
+    printf("%-20s %10s %10s\n", "policy", "ns/call", "overhead");
+    auto row = [&](const char *policy, uint64_t (*fn)(void *, uint32_t)) {
+        double ns = bench(fn);
+        printf("%-20s %10.2f %10.2f\n", policy, ns, ns - base);
+    };
+    printf("%-20s %10.2f %10.2f\n", "direct", base, 0.0);
+    row("none", NoneConfigure::wrap);
+    row("trace, module off", QuietConfigure::wrap);
+    row("trace, binary", RecordConfigure::wrap);
+    row("trace, text", TextConfigure::wrap);
+    row("time", TimedConfigure::wrap);
+    row("capture", CapturedConfigure::wrap);
+    return report();
+}
@@ -0,0 +1,171 @@
+//
+//  HookRoutingBench.cpp
+//  WhateverRed
+//
+//  Host model of what routing a hook that only observes costs every call of
+//  a hot AMD function such as getState or QueryComputeQueueIsIdle, and so
+//  what leaving it unrouted without -wreddbg or wredtrace saves. A routed
+//  function starts with a jump to the wrapper, and the wrapper calls the
+//  original through a trampoline that jumps back into it; both jumps are
+//  modelled as indirect jumps. Trace records go to a LogRing sized like the
+//  NETDBG one, stamped and drained as the sender thread would, and RadObserve
+//  adds the hook statistics and timeline on top.
+//
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/HookRoutingBench.cpp
+//        -o hookrouting
+//    ./hookrouting [million calls]
+//
+
+// Trace on for "rad", as in a build with the observers compiled in.
+#define NETLOG_LEVEL_RAD NetLogTrace
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "HostCheck.hpp"
+#include "kern_hook.hpp"
+#include "kern_hookstats.hpp"
+#include "kern_hooktimeline.hpp"
+#include "kern_netproto.hpp"
+#include "kern_ring.hpp"
+
+// TSC, as mach_absolute_time() is in the kernel
+struct TscClock {
+    static uint64_t now() { return __builtin_ia32_rdtsc(); }
+};
+
+struct OneCpu {
+    static uint32_t current() { return 0; }
+};
+
+struct OneThread {
+    static uint64_t current() { return 1; }
+};
+
+/**
+ *  Binary NETDBG: header and raw arguments in a ring slot, released again
+ *  right away in place of the sender thread
+ */
+struct RingSink {
+    static inline LogRing<512, 512> ring;
+    static inline size_t records;
+
+    template <uint32_t Id, typename... Args>
+    static void log(const char *, Args... args) {
+        uint64_t raw[] = {0, hookRawValue(args)...};
+        auto *slot = ring.reserve();
+        if (!slot) return;
+        size_t len = sizeof...(Args) * sizeof(uint64_t);
+        NetRecordHeader header{NetRecordBinary,
+                               sizeof...(Args),
+                               static_cast<uint16_t>(len),
+                               Id,
+                               TscClock::now(),
+                               OneThread::current(),
+                               static_cast<uint16_t>(OneCpu::current()),
+                               0};
+        memcpy(slot->data, &header, sizeof(header));
+        memcpy(slot->data + sizeof(header), raw + 1, len);
+        slot->len = static_cast<uint32_t>(sizeof(header) + len);
+        ring.commit(slot);
+        ring.release(ring.front());
+        records++;
+    }
+};
+
+using RingTrace = HookTrace<RingSink>;
+using Stats = HookStats<TscClock, OneCpu, true>;
+using Timeline = HookTimeline<TscClock, OneThread, true>;
+using Observe = HookBoth<RingTrace, HookBoth<Stats, Timeline>>;
+
+// The original, never inlined into the wrappers
+[[gnu::noinline]] static uint64_t queryComputeQueueIsIdle(void *that,
+                                                          uint64_t ring) {
+    asm volatile("" ::: "memory");
+    return reinterpret_cast<uintptr_t>(that) + ring;
+}
+
+HOOK_DEFINE(NoneQuery, "rad", "QueryComputeQueueIsIdle", HookNone,
+            uint64_t(void *, uint64_t));
+HOOK_DEFINE(TraceQuery, "rad", "QueryComputeQueueIsIdle", RingTrace,
+            uint64_t(void *, uint64_t));
+HOOK_DEFINE(ObserveQuery, "rad", "QueryComputeQueueIsIdle", Observe,
+            uint64_t(void *, uint64_t));
+
+// The patched function start and the trampoline back into the original
+extern "C" {
+HookAddress routedWrapper, trampolineTarget;
+uint64_t routedEntry(void *, uint64_t);
+uint64_t trampolineEntry(void *, uint64_t);
+}
+
+asm(".text\n"
+    ".globl routedEntry\n"
+    "routedEntry:\n"
+    "    jmp *routedWrapper(%rip)\n"
+    ".globl trampolineEntry\n"
+    "trampolineEntry:\n"
+    "    jmp *trampolineTarget(%rip)\n");
+
+template <typename H>
+static uint64_t (*route())(void *, uint64_t) {
+    H::org = reinterpret_cast<HookAddress>(trampolineEntry);
+    routedWrapper = reinterpret_cast<HookAddress>(H::wrap);
+    return routedEntry;
+}
+
+template <typename F>
+static double nsPerCall(size_t calls, F &&call) {
+    double best = 1e30;
+    for (int round = 0; round < 5; round++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < calls; i++) call(i);
+        double ns = std::chrono::duration<double, std::nano>(
+                        std::chrono::steady_clock::now() - start)
+                        .count() /
+                    calls;
+        if (ns < best) best = ns;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    size_t calls = (argc > 1 ? strtoul(argv[1], nullptr, 0) : 10) * 1000000;
+    if (!calls) calls = 1000000;
+    trampolineTarget = reinterpret_cast<HookAddress>(queryComputeQueueIsIdle);
+    RingSink::ring.init();
+
+    auto *that = reinterpret_cast<void *>(0x1000);
+    volatile uint64_t sink = 0;
+    // Called through a pointer, as through the vtable of the caller
+    auto bench = [&](uint64_t (*fn)(void *, uint64_t)) {
+        uint64_t (*volatile target)(void *, uint64_t) = fn;
+        check(target(that, 7) == 0x1007, "routed call returns");
+        return nsPerCall(calls, [&](size_t i) {
+            sink = sink + target(that, i);
+        });
+    };
+
+    double direct = bench(queryComputeQueueIsIdle);
+    printf("%-28s %10s %10s\n", "QueryComputeQueueIsIdle", "ns/call",
+           "saved");
+    printf("%-28s %10.2f %10s\n", "not routed", direct, "-");
+    auto row = [&](const char *what, uint64_t (*fn)(void *, uint64_t)) {
+        double ns = bench(fn);
+        printf("%-28s %10.2f %10.2f\n", what, ns, ns - direct);
+    };
+    row("routed, no observer", route<NoneQuery>());
+    row("routed, NETDBG trace", route<TraceQuery>());
+    row("routed, trace+stats+timeline", route<ObserveQuery>());
+
+    check(RingSink::records > 2 * calls && !RingSink::ring.droppedCount() &&
+              !RingSink::ring.depth(),
+          "trace records drained");
+    HookStatsSummary summary;
+    Stats::table.summarize(0, summary);
+    check(summary.calls == 5 * calls + 1, "stats");
+    check(Timeline::buffer.size() == 16384, "timeline full");
+    return report();
+}
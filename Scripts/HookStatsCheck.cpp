@@ -0,0 +1,179 @@
+//
+//  HookStatsCheck.cpp
+//  WhateverRed
+//
+//  Host check and benchmark of the hook statistics in kern_hookstats.hpp:
+//  bucket bounds and percentiles, slot claiming and overflow, and exact
+//  per-CPU aggregation with threads standing in for CPUs, through the
+//  HookStats policy of generated and hand-written hooks. Then reports the
+//  cost per recorded call with every thread on its own CPU slot and with
+//  all of them on the same one.
+//
+//    c++ -std=c++17 -O2 -pthread -I WhateverRed Scripts/HookStatsCheck.cpp
+//        -o hookstats
+//    ./hookstats [million calls per thread]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "HostCheck.hpp"
+#include "kern_hook.hpp"
+#include "kern_hookstats.hpp"
+
+// Every call takes 100 ns, and every thread is a CPU of its own.
+struct StepClock {
+    static inline thread_local uint64_t time;
+    static uint64_t now() { return time += 100; }
+};
+
+struct ThreadCpu {
+    static inline thread_local uint32_t cpu;
+    static uint32_t current() { return cpu; }
+};
+
+using Stats = HookStats<StepClock, ThreadCpu, true, 4, 8>;
+
+[[gnu::noinline]] static int getState(void *) {
+    asm volatile("" ::: "memory");
+    return 1;
+}
+
+HOOK_DEFINE(StatsGetState, "rad", "getState", Stats, int(void *));
+HOOK_DEFINE(StatsWaitForIdle, "rad", "waitForIdle", Stats, int(void *));
+HOOK_DEFINE(StatsIsReady, "rad", "isReady", Stats, int(void *));
+HOOK_NAME(StatsPspSwInit, "rad", "_psp_sw_init");
+HOOK_NAME(StatsOverflow, "rad", "overflow");
+
+static void handWritten() { HookScope<Stats, StatsPspSwInit> scope; }
+
+static void checkBuckets() {
+    check(hookStatBucket(0) == 0 && hookStatBucket(1) == 1 &&
+              hookStatBucket(2) == 2 && hookStatBucket(3) == 2 &&
+              hookStatBucket(4) == 3 && hookStatBucket(1023) == 10 &&
+              hookStatBucket(1024) == 11,
+          "bucket bounds");
+    check(hookStatBucket(1ULL << 26) == HookStatBuckets - 1 &&
+              hookStatBucket(UINT64_MAX) == HookStatBuckets - 1,
+          "last bucket");
+    for (uint64_t ns = 1; ns < 100000; ns = ns * 3 + 1)
+        check(ns < hookStatBucketLimit(hookStatBucket(ns)),
+              "bucket limit below its values");
+
+    HookStatsSummary summary{"rad", "x", 0, 0, {}};
+    check(summary.percentile(500) == 0 && summary.mean() == 0, "no calls");
+    summary.buckets[hookStatBucket(100)] = 90;
+    summary.buckets[hookStatBucket(5000)] = 9;
+    summary.buckets[hookStatBucket(1000000)] = 1;
+    summary.calls = 100;
+    summary.total = 90 * 100 + 9 * 5000 + 1000000;
+    check(summary.percentile(500) == 128 && summary.percentile(900) == 128 &&
+              summary.percentile(950) == 8192 &&
+              summary.percentile(999) == 1 << 20 &&
+              summary.percentile(0) == 128,
+          "percentiles");
+    check(summary.mean() == 10540, "mean");
+}
+
+static void checkTable() {
+    HookStatsTable<2, 4> table;
+    int32_t a = table.NoSlot, b = table.NoSlot, c = table.NoSlot;
+    auto &slots = table.slots;
+    check(slots.claim(a, "rad", "a") == 0 && slots.claim(a, "rad", "a") == 0,
+          "claim");
+    check(slots.claim(b, "rad", "b") == 1 && table.size() == 2, "second");
+    check(slots.claim(c, "rad", "c") == table.Full && c == table.Full,
+          "full table");
+    table.record(c, 0, 10);
+    table.record(a, 5, 10);
+    table.record(a, 1, 1000);
+    HookStatsSummary summary;
+    table.summarize(0, summary);
+    check(table.droppedCount() == 1 && summary.calls == 2 &&
+              summary.total == 1010 && summary.buckets[4] == 1 &&
+              summary.buckets[10] == 1,
+          "record and summarize");
+}
+
+static void checkThreads(size_t threads, size_t calls) {
+    StatsGetState::org = reinterpret_cast<HookAddress>(getState);
+    StatsWaitForIdle::org = reinterpret_cast<HookAddress>(getState);
+    StatsIsReady::org = reinterpret_cast<HookAddress>(getState);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+        workers.emplace_back([t, calls] {
+            ThreadCpu::cpu = static_cast<uint32_t>(t);
+            auto *that = reinterpret_cast<void *>(t);
+            for (size_t i = 0; i < calls; i++) {
+                StatsGetState::wrap(that);
+                if (!(i & 3)) StatsWaitForIdle::wrap(that);
+                if (!(i & 15)) handWritten();
+            }
+        });
+    for (auto &worker : workers) worker.join();
+
+    auto &table = Stats::table;
+    check(table.size() == 3, "hooks seen");
+    uint64_t expected[] = {threads * calls, threads * ((calls + 3) / 4),
+                           threads * ((calls + 15) / 16)};
+    for (size_t i = 0; i < table.size(); i++) {
+        HookStatsSummary summary;
+        table.summarize(i, summary);
+        check(summary.calls == expected[i] &&
+                  summary.total == 100 * expected[i] &&
+                  summary.buckets[hookStatBucket(100)] == expected[i] &&
+                  summary.percentile(990) == 128,
+              "aggregated calls");
+        printf("%-16s %10llu calls, mean %llu ns\n", summary.name,
+               static_cast<unsigned long long>(summary.calls),
+               static_cast<unsigned long long>(summary.mean()));
+    }
+
+    // The table holds four hooks: the fifth one is dropped.
+    StatsIsReady::wrap(nullptr);
+    HookScope<Stats, StatsOverflow>{};
+    check(table.size() == 4 && table.droppedCount() == 1, "overflow dropped");
+}
+
+/**
+ *  ns per recorded call with threads on their own CPU slots or all on one
+ */
+template <size_t MaxCpus>
+static double nsPerRecord(size_t threads, size_t calls, bool shared) {
+    auto table = std::make_unique<HookStatsTable<1, MaxCpus>>();
+    int32_t slot = table->NoSlot;
+    table->slots.claim(slot, "bench", "record");
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+        workers.emplace_back([&, t] {
+            uint32_t cpu = shared ? 0 : static_cast<uint32_t>(t);
+            for (size_t i = 0; i < calls; i++)
+                table->record(slot, cpu, 64 + (i & 1023));
+        });
+    for (auto &worker : workers) worker.join();
+    return std::chrono::duration<double, std::nano>(
+               std::chrono::steady_clock::now() - start)
+               .count() /
+           calls;
+}
+
+int main(int argc, char **argv) {
+    size_t calls = (argc > 1 ? strtoul(argv[1], nullptr, 0) : 2) * 1000000;
+    if (!calls) calls = 1000000;
+    checkBuckets();
+    checkTable();
+    checkThreads(8, calls / 8);
+
+    size_t cpus = std::thread::hardware_concurrency();
+    printf("%-8s %14s %14s\n", "threads", "per-CPU ns", "one slot ns");
+    for (size_t threads = 1; threads <= 16 && threads <= cpus; threads *= 2)
+        printf("%-8zu %14.2f %14.2f\n", threads,
+               nsPerRecord<16>(threads, calls, false),
+               nsPerRecord<16>(threads, calls, true));
+    return report();
+}
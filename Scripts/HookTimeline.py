@@ -0,0 +1,149 @@
+"""Chrome trace events from a hook timeline dump.
+
+  sysctl -b debug.wredtimeline > timeline.bin
+  HookTimeline.py timeline.bin -o trace.json [options]
+
+The dump (kern_hooktimeline.hpp) holds the entry and exit of every timed
+hook from boot until its buffer filled, with thread and nesting depth.
+Entries and exits are paired per thread into complete events, which
+chrome://tracing or ui.perfetto.dev show as one track per thread. Each event
+carries its depth and self time, its time minus that of the hooks it
+called. Entries without an exit, calls still running or cut off by a full
+buffer, are open-ended.
+
+Options:
+  -o FILE             Write the JSON there instead of to stdout
+  --timebase N/D      Override the dump's clock to ns ratio
+  --summary N         Print the N functions with the most time to stderr
+"""
+
+import argparse
+import collections
+import json
+import struct
+import sys
+
+header = struct.Struct("<IHHIIII")
+event = struct.Struct("<QQHBBI")
+magic = 0x4C544B48
+version = 1
+no_hook = 0xFFFF
+no_depth = 0xFF
+kind_enter = 1
+kind_exit = 2
+
+
+def parse(data):
+    # Returns (header fields, [(module, name)], [(time, thread, hook, depth,
+    # kind)]).
+    if len(data) < header.size:
+        sys.exit("dump too short")
+    fields = header.unpack_from(data)
+    if fields[0] != magic or fields[1] != version:
+        sys.exit("not a version %d hook timeline dump" % version)
+    _, _, hooks, events, dropped, numer, denom = fields
+    pos = header.size
+    strings = []
+    for _ in range(2 * hooks):
+        end = data.index(b"\0", pos)
+        strings.append(data[pos:end].decode("utf-8", "replace"))
+        pos = end + 1
+    names = list(zip(strings[0::2], strings[1::2]))
+    if len(data) - pos != events * event.size:
+        sys.exit("dump truncated: %d events expected" % events)
+    records = [event.unpack_from(data, pos + i * event.size)[:5]
+               for i in range(events)]
+    return (dropped, numer, denom), names, records
+
+
+def convert(names, records, ratio):
+    # Returns (trace events, per-function totals, events skipped).
+    def name_of(hook):
+        return names[hook] if hook < len(names) else ("?", "?")
+
+    start = min((r[0] for r in records if r[4]), default=0)
+
+    def us(ts):
+        return (ts - start) * ratio / 1000
+
+    trace = []
+    totals = collections.defaultdict(lambda: [0, 0, 0, 0])
+    stacks = collections.defaultdict(list)
+    skipped = 0
+    for ts, thread, hook, depth, kind in records:
+        stack = stacks[thread]
+        if kind == kind_enter:
+            # [entry, hook, depth, time in callees]
+            stack.append([ts, hook, depth, 0])
+            continue
+        if kind != kind_exit or not stack or stack[-1][1] != hook:
+            skipped += 1
+            continue
+        entered, _, depth, callees = stack.pop()
+        duration = ts - entered
+        if stack:
+            stack[-1][3] += duration
+        module, name = name_of(hook)
+        self_time = duration - callees
+        trace.append({
+            "name": name, "cat": module, "ph": "X", "pid": 0,
+            "tid": thread, "ts": us(entered),
+            "dur": duration * ratio / 1000,
+            "args": {"depth": depth if depth != no_depth else None,
+                     "self_us": self_time * ratio / 1000},
+        })
+        total = totals[module, name]
+        total[0] += 1
+        total[1] += duration
+        total[2] += self_time
+        total[3] = max(total[3], duration)
+    for thread, stack in stacks.items():
+        for entered, hook, depth, _ in stack:
+            module, name = name_of(hook)
+            trace.append({
+                "name": name, "cat": module, "ph": "B", "pid": 0,
+                "tid": thread, "ts": us(entered),
+                "args": {"depth": depth if depth != no_depth else None},
+            })
+    for thread in stacks:
+        trace.append({"name": "thread_name", "ph": "M", "pid": 0,
+                      "tid": thread, "args": {"name": "thread %d" % thread}})
+    return trace, totals, skipped
+
+
+def summary(totals, ratio, count, out):
+    out.write("%-40s %8s %12s %12s %12s\n" % (
+        "function (ms)", "calls", "total", "self", "max"))
+    ranked = sorted(totals.items(), key=lambda t: t[1][1], reverse=True)
+    for (module, name), (calls, total, self_time, longest) in \
+            ranked[:count]:
+        out.write("%-40s %8d %12.3f %12.3f %12.3f\n" % (
+            ("%s: %s" % (module, name))[:40], calls, total * ratio / 1e6,
+            self_time * ratio / 1e6, longest * ratio / 1e6))
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="hook timeline to trace")
+    parser.add_argument("dump")
+    parser.add_argument("-o", "--output")
+    parser.add_argument("--timebase")
+    parser.add_argument("--summary", type=int, default=0)
+    args = parser.parse_args()
+
+    with open(args.dump, "rb") as f:
+        (dropped, numer, denom), names, records = parse(f.read())
+    if args.timebase:
+        numer, denom = (int(x) for x in args.timebase.split("/"))
+    trace, totals, skipped = convert(names, records, numer / (denom or 1))
+    if dropped:
+        print("buffer full: %d later events dropped" % dropped,
+              file=sys.stderr)
+    if skipped:
+        print("%d events without a matching entry skipped" % skipped,
+              file=sys.stderr)
+    out = open(args.output, "w") if args.output else sys.stdout
+    json.dump({"traceEvents": trace, "displayTimeUnit": "ms"}, out)
+    if args.output:
+        out.close()
+    if args.summary:
+        summary(totals, numer / (denom or 1), args.summary, sys.stderr)
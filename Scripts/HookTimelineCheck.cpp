@@ -0,0 +1,257 @@
+//
+//  HookTimelineCheck.cpp
+//  WhateverRed
+//
+//  Host check and benchmark of the hook timeline in kern_hooktimeline.hpp:
+//  nesting depth through generated and hand-written hooks, threads entering
+//  and leaving concurrently, a full buffer and a full thread table, and the
+//  dump read back. Then reports the cost of an entry and exit pair while
+//  recording and once the buffer is full. Given a file, writes the dump of
+//  the threaded run there, for Scripts/HookTimeline.py.
+//
+//    c++ -std=c++17 -O2 -pthread -I WhateverRed Scripts/HookTimelineCheck.cpp
+//        -o hooktimeline
+//    ./hooktimeline [timeline.bin]
+//    python3 Scripts/HookTimeline.py timeline.bin -o trace.json
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HostCheck.hpp"
+#include "kern_hook.hpp"
+#include "kern_hooktimeline.hpp"
+
+// Every reading is 100 ns after the last one of the same thread.
+struct StepClock {
+    static inline thread_local uint64_t time;
+    static uint64_t now() { return time += 100; }
+};
+
+// Thread IDs in sequence from 1, as thread_tid() gives them out
+struct SeqThread {
+    static inline uint64_t last;
+    static inline thread_local uint64_t id;
+    static uint64_t current() {
+        if (!id) id = __atomic_add_fetch(&last, 1, __ATOMIC_RELAXED);
+        return id;
+    }
+};
+
+using Timeline = HookTimeline<StepClock, SeqThread, true>;
+
+[[gnu::noinline]] static int smuSwInit(void *) {
+    asm volatile("" ::: "memory");
+    return 1;
+}
+
+HOOK_DEFINE(TimelineSmuSwInit, "rad", "_smu_sw_init", Timeline, int(void *));
+
+[[gnu::noinline]] static int initializePowerPlay(void *that) {
+    return TimelineSmuSwInit::wrap(that) + 1;
+}
+
+HOOK_DEFINE(TimelineInitializePP, "rad", "initializePowerPlay", Timeline,
+            int(void *));
+HOOK_NAME(TimelinePowerUpHw, "rad", "powerUpHW");
+
+static void powerUpHw(void *that) {
+    HookScope<Timeline, TimelinePowerUpHw> scope;
+    TimelineInitializePP::wrap(that);
+}
+
+struct Dump {
+    HookTimelineHeader header;
+    std::vector<std::string> names;
+    std::vector<HookEvent> events;
+};
+
+static bool parse(const std::vector<uint8_t> &data, Dump &out) {
+    if (data.size() < sizeof(out.header)) return false;
+    memcpy(&out.header, data.data(), sizeof(out.header));
+    size_t pos = sizeof(out.header);
+    for (size_t i = 0; i < 2U * out.header.hookCount; i++) {
+        auto *end = memchr(data.data() + pos, 0, data.size() - pos);
+        if (!end) return false;
+        auto length = static_cast<const uint8_t *>(end) - data.data() - pos;
+        out.names.emplace_back(
+            reinterpret_cast<const char *>(data.data() + pos), length);
+        pos += length + 1;
+    }
+    if (data.size() - pos != out.header.eventCount * sizeof(HookEvent))
+        return false;
+    out.events.resize(out.header.eventCount);
+    memcpy(out.events.data(), data.data() + pos, data.size() - pos);
+    return out.header.magic == HookTimelineMagic &&
+           out.header.version == HookTimelineVersion;
+}
+
+template <typename Buffer>
+static std::vector<uint8_t> dump(const Buffer &buffer) {
+    std::vector<uint8_t> data(buffer.dumpSize());
+    data.resize(buffer.dump(data.data(), data.size(), 1, 1));
+    return data;
+}
+
+/**
+ *  Replays events per thread: every exit closes the last entry of its
+ *  thread, at the depth it was entered at, and every thread ends outside
+ *  all hooks. Returns the number of calls, 0 if the events do not nest.
+ */
+static size_t replay(const std::vector<HookEvent> &events) {
+    std::map<uint64_t, std::vector<HookEvent>> stacks;
+    size_t calls = 0;
+    for (auto &event : events) {
+        auto &stack = stacks[event.thread];
+        if (event.kind == HookEventEnter && event.depth == stack.size()) {
+            stack.push_back(event);
+        } else if (event.kind == HookEventExit && !stack.empty() &&
+                   stack.back().hook == event.hook &&
+                   stack.back().depth == event.depth &&
+                   stack.back().time < event.time) {
+            stack.pop_back();
+            calls++;
+        } else {
+            return 0;
+        }
+    }
+    for (auto &stack : stacks)
+        if (!stack.second.empty()) return 0;
+    return calls;
+}
+
+static void checkNesting() {
+    TimelineSmuSwInit::org = reinterpret_cast<HookAddress>(smuSwInit);
+    TimelineInitializePP::org =
+        reinterpret_cast<HookAddress>(initializePowerPlay);
+    check(TimelineInitializePP::wrap(nullptr) == 2, "pass-through");
+
+    Dump out;
+    check(parse(dump(Timeline::buffer), out), "dump");
+    check(out.header.hookCount == 2 && out.names[0] == "rad" &&
+              out.names[1] == "initializePowerPlay" &&
+              out.names[3] == "_smu_sw_init",
+          "names in first call order");
+    uint8_t kinds[] = {HookEventEnter, HookEventEnter, HookEventExit,
+                       HookEventExit};
+    uint16_t hooks[] = {0, 1, 1, 0};
+    uint8_t depths[] = {0, 1, 1, 0};
+    bool same = out.events.size() == 4;
+    for (size_t i = 0; same && i < 4; i++)
+        same = out.events[i].kind == kinds[i] &&
+               out.events[i].hook == hooks[i] &&
+               out.events[i].depth == depths[i] &&
+               out.events[i].time == 100 * (i + 1);
+    check(same, "nested events");
+}
+
+static void checkThreads(size_t threads, size_t calls, const char *path) {
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+        workers.emplace_back([calls] {
+            for (size_t i = 0; i < calls; i++) powerUpHw(nullptr);
+        });
+    for (auto &worker : workers) worker.join();
+
+    auto data = dump(Timeline::buffer);
+    Dump out;
+    check(parse(data, out) && out.header.hookCount == 3 &&
+              out.header.dropped == 0,
+          "threaded dump");
+    check(replay(out.events) == 2 + threads * calls * 3, "threads nest");
+    if (path) {
+        auto *file = fopen(path, "wb");
+        check(file && fwrite(data.data(), 1, data.size(), file) ==
+                          data.size(),
+              "write dump");
+        if (file) fclose(file);
+    }
+}
+
+static void checkLimits() {
+    using Buffer = HookTimelineBuffer<6, 4, 2>;
+    Buffer buffer;
+    int32_t slot = Buffer::Slots::NoSlot;
+    auto hook = buffer.slots.claim(slot, "rad", "a");
+    auto a = buffer.enter(hook, 1, 10);
+    auto b = buffer.enter(hook, 2, 11);
+    auto c = buffer.enter(hook, 3, 12);
+    check(a.depth == 0 && b.depth == 0 && c.depth == HookEventNoDepth,
+          "thread table full");
+    buffer.exit(a, 20);
+    auto d = buffer.enter(hook, 4, 21);
+    check(d.depth == 0, "thread entry given back");
+    buffer.exit(b, 22);
+    buffer.exit(c, 23);
+    buffer.exit(d, 24);
+    check(buffer.size() == 6 && buffer.droppedCount() == 2,
+          "full buffer keeps the first events");
+    auto e = buffer.enter(-2, 5, 25);
+    check(e.hook == HookEventNoHook && buffer.droppedCount() == 3,
+          "unnamed hook");
+
+    uint8_t small[sizeof(HookTimelineHeader) + 4];
+    check(buffer.dump(small, sizeof(small), 1, 1) == 0, "dump too large");
+    Dump out;
+    check(parse(dump(buffer), out) && out.header.eventCount == 6 &&
+              out.header.dropped == 3 && out.events[4].time == 21 &&
+              out.events[5].time == 22,
+          "full dump");
+}
+
+// TSC, as mach_absolute_time() is in the kernel
+struct TscClock {
+    static uint64_t now() { return __builtin_ia32_rdtsc(); }
+};
+
+/**
+ *  ns per entry and exit pair, each thread nesting two deep
+ */
+static double nsPerPair(size_t threads, size_t pairs, bool full) {
+    using Buffer = HookTimelineBuffer<1 << 20>;
+    auto buffer = std::make_unique<Buffer>();
+    int32_t slot = Buffer::Slots::NoSlot;
+    buffer->slots.claim(slot, "bench", "pair");
+    if (full)
+        for (size_t i = 0; i <= (1 << 19); i++)
+            buffer->exit(buffer->enter(slot, 1, 0), 0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+        workers.emplace_back([&, t] {
+            for (size_t i = 0; i < pairs / 2; i++) {
+                auto outer = buffer->enter(slot, t + 1, TscClock::now());
+                auto inner = buffer->enter(slot, t + 1, TscClock::now());
+                buffer->exit(inner, TscClock::now());
+                buffer->exit(outer, TscClock::now());
+            }
+        });
+    for (auto &worker : workers) worker.join();
+    return std::chrono::duration<double, std::nano>(
+               std::chrono::steady_clock::now() - start)
+               .count() /
+           pairs;
+}
+
+int main(int argc, char **argv) {
+    checkNesting();
+    checkThreads(4, 200, argc > 1 ? argv[1] : nullptr);
+    checkLimits();
+
+    // Half a buffer of events per run in all threads together
+    size_t cpus = std::thread::hardware_concurrency();
+    printf("%-8s %14s %14s\n", "threads", "recording ns", "full ns");
+    for (size_t threads = 1; threads <= 16 && threads <= cpus; threads *= 2) {
+        size_t pairs = (1 << 18) / threads;
+        printf("%-8zu %14.2f %14.2f\n", threads,
+               nsPerPair(threads, pairs, false),
+               nsPerPair(threads, pairs, true));
+    }
+    return report();
+}
@@ -0,0 +1,35 @@
+//
+//  HostCheck.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Pass/fail bookkeeping shared by the host harnesses in Scripts. Each
+//  harness is a single translation unit, so the state is file static.
+//
+
+#ifndef HostCheck_hpp
+#define HostCheck_hpp
+#include <cstdio>
+
+/**
+ *  Cleared by the first failed check
+ */
+static bool ok = true;
+
+static void check(bool cond, const char *what) {
+    if (!cond) {
+        printf("FAILED: %s\n", what);
+        ok = false;
+    }
+}
+
+/**
+ *  Print the verdict, returns the exit status for main
+ */
+static int report() {
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+#endif /* HostCheck_hpp */
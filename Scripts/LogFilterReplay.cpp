@@ -0,0 +1,146 @@
+//
+//  LogFilterReplay.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Replays a captured NETDBG log through the kext's LogFilter and reports
+//  the reduction in records and bytes per source. Like the kext, the replay
+//  flushes pending summaries every LogFilter::FlushInterval ms.
+//
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/LogFilterReplay.cpp -o replay
+//    ./replay <capture> [-r rate] [-b burst] [-i interval_us]
+//
+//  The capture is either plain text (one message per line) or the output of
+//  "NetDbgReceiver.py query", whose leading receive time in nanoseconds is
+//  used as the replay clock. Plain text lines are spaced interval_us apart.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "kern_logfilter.hpp"
+
+struct Source {
+    explicit Source(const char *name) : name(name) {}
+
+    const char *name;
+    LogFilter filter;
+    uint64_t inRecords{0}, inBytes{0}, outRecords{0}, outBytes{0};
+};
+
+int main(int argc, char **argv) {
+    const char *path = nullptr;
+    uint32_t rate = 100, burst = 400;
+    uint64_t intervalUs = 100;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            rate = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            burst = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            intervalUs = strtoull(argv[++i], nullptr, 0);
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s <capture> [-r rate] [-b burst] [-i us]\n",
+                argv[0]);
+        return 1;
+    }
+
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+
+    // Only the firmware debug streams are filtered in the kext.
+    Source sources[] = {
+        Source("AMD TTL COS"),
+        Source("_MCILDebugPrint"),
+        Source("other"),
+    };
+    sources[0].filter.configure(sources[0].name, rate, burst);
+    sources[1].filter.configure(sources[1].name, rate, burst);
+
+    auto flush = [&]() {
+        for (size_t i = 0; i < 2; i++)
+            sources[i].filter.flush([&](const char *, size_t n) {
+                sources[i].outRecords++;
+                sources[i].outBytes += n;
+            });
+    };
+
+    std::string line;
+    uint64_t lineNo = 0, filterNs = 0, submitted = 0, nextFlush = 0;
+    while (std::getline(in, line)) {
+        line += '\n';
+        uint64_t now = lineNo++ * intervalUs / 1000;
+        const char *msg = line.c_str();
+        unsigned long long recv;
+        int conn, skip = 0;
+        if (sscanf(msg, "%llu %d %n", &recv, &conn, &skip) == 2 && skip) {
+            now = recv / 1000000;
+            msg += skip;
+        }
+        size_t len = line.size() - (msg - line.c_str());
+        if (now >= nextFlush) {
+            if (nextFlush) flush();
+            nextFlush = now - now % LogFilter::FlushInterval +
+                        LogFilter::FlushInterval;
+        }
+
+        auto &source = !strncmp(msg, "AMD TTL COS", 11)       ? sources[0]
+                       : !strncmp(msg, "_MCILDebugPrint", 15) ? sources[1]
+                                                              : sources[2];
+        source.inRecords++;
+        source.inBytes += len;
+        if (&source == &sources[2]) {
+            source.outRecords++;
+            source.outBytes += len;
+            continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        source.filter.submit(msg, len, now, [&](const char *, size_t n) {
+            source.outRecords++;
+            source.outBytes += n;
+        });
+        filterNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+        submitted++;
+    }
+
+    flush();
+
+    uint64_t inRecords = 0, inBytes = 0, outRecords = 0, outBytes = 0;
+    printf("%-16s %10s %10s %12s %12s %8s\n", "source", "in", "out",
+           "in bytes", "out bytes", "saved");
+    for (auto &source : sources) {
+        printf("%-16s %10llu %10llu %12llu %12llu %7.1f%%\n", source.name,
+               (unsigned long long)source.inRecords,
+               (unsigned long long)source.outRecords,
+               (unsigned long long)source.inBytes,
+               (unsigned long long)source.outBytes,
+               source.inBytes
+                   ? 100.0 * (source.inBytes - source.outBytes) / source.inBytes
+                   : 0.0);
+        inRecords += source.inRecords;
+        inBytes += source.inBytes;
+        outRecords += source.outRecords;
+        outBytes += source.outBytes;
+    }
+    printf("%-16s %10llu %10llu %12llu %12llu %7.1f%%\n", "total",
+           (unsigned long long)inRecords, (unsigned long long)outRecords,
+           (unsigned long long)inBytes, (unsigned long long)outBytes,
+           inBytes ? 100.0 * (inBytes - outBytes) / inBytes : 0.0);
+    printf("rate %u/s burst %u, %.1f ns per message\n", rate, burst,
+           submitted ? double(filterNs) / submitted : 0.0);
+    return 0;
+}
@@ -0,0 +1,184 @@
+//
+//  LogRingStress.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Host stress test and benchmark of the NETDBG ring in kern_ring.hpp.
+//  Producer threads push numbered records as fast as they can while one
+//  consumer drains them, sized like the kext's ring. Checks that every
+//  record a producer got into the ring arrives exactly once and in order,
+//  that every record it did not is counted as dropped, and that the high
+//  water mark stays within the ring. Then reports, for growing numbers of
+//  producers, the cost of a push, the messages per second through the ring
+//  when producers retry until it takes their record, and what is dropped
+//  when they do not and the consumer is slow, as a stalled socket would be.
+//
+//    c++ -std=c++17 -O2 -pthread -I WhateverRed Scripts/LogRingStress.cpp
+//        -o logring
+//    ./logring [million messages per producer]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "HostCheck.hpp"
+#include "kern_ring.hpp"
+
+// As NETDBG::Ring
+using Ring = LogRing<512, 512>;
+
+struct Message {
+    uint32_t producer;
+    uint32_t pad;
+    uint64_t seq;
+    char text[48];
+};
+
+struct Producer {
+    std::vector<uint8_t> accepted, seen;
+    uint64_t drops{0};
+    double ns{0};
+};
+
+struct Result {
+    double msgsPerSec, pushNs;
+    uint64_t received, dropped, highWater;
+};
+
+/**
+ *  Runs threads producers of messages each against one consumer that spins
+ *  for spin iterations per record. Lossless producers retry a full ring
+ *  instead of dropping. With verify, checks the delivery of every record.
+ */
+static Result run(size_t threads, size_t messages, unsigned spin,
+                  bool lossless, bool verify) {
+    auto ring = std::make_unique<Ring>();
+    ring->init();
+    std::vector<Producer> producers(threads);
+    for (auto &producer : producers) {
+        if (!verify) continue;
+        producer.accepted.resize(messages);
+        producer.seen.resize(messages);
+    }
+    std::vector<uint64_t> next(threads);
+    bool inOrder = true, intact = true;
+    uint64_t total = 0;
+    size_t done = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&] {
+        while (true) {
+            auto *slot = ring->front();
+            if (!slot) {
+                if (__atomic_load_n(&done, __ATOMIC_ACQUIRE) == threads &&
+                    !ring->front())
+                    break;
+                // Let the producers run when they share the CPU
+                std::this_thread::yield();
+                continue;
+            }
+            Message message;
+            intact &= slot->len == sizeof(message);
+            memcpy(&message, slot->data, sizeof(message));
+            ring->release(slot);
+            for (volatile unsigned i = 0; i < spin; i = i + 1) {}
+            total++;
+            if (!verify) continue;
+            auto p = message.producer;
+            if (p >= threads || message.seq >= messages) {
+                intact = false;
+                continue;
+            }
+            inOrder &= message.seq >= next[p];
+            next[p] = message.seq + 1;
+            producers[p].seen[message.seq]++;
+        }
+    });
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+        workers.emplace_back([&, t] {
+            auto &producer = producers[t];
+            Message message{static_cast<uint32_t>(t), 0, 0, "stress"};
+            auto begin = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < messages; i++) {
+                message.seq = i;
+                bool accepted;
+                while (!(accepted = ring->push(&message, sizeof(message))) &&
+                       lossless) {
+                    producer.drops++;
+                    std::this_thread::yield();
+                }
+                if (verify) producer.accepted[i] = accepted;
+                if (!accepted) producer.drops++;
+            }
+            producer.ns = std::chrono::duration<double, std::nano>(
+                              std::chrono::steady_clock::now() - begin)
+                              .count();
+            __atomic_add_fetch(&done, 1, __ATOMIC_RELEASE);
+        });
+    for (auto &worker : workers) worker.join();
+    consumer.join();
+    double sec = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+
+    uint64_t drops = 0;
+    double ns = 0;
+    for (size_t t = 0; t < threads; t++) {
+        drops += producers[t].drops;
+        ns += producers[t].ns;
+        if (!verify) continue;
+        auto &producer = producers[t];
+        uint64_t accepted = 0;
+        bool once = true;
+        for (size_t i = 0; i < messages; i++) {
+            accepted += producer.accepted[i];
+            once &= producer.seen[i] == producer.accepted[i];
+        }
+        check(once, "every accepted record arrives once, no other");
+        check(lossless ? accepted == messages
+                       : accepted + producer.drops == messages,
+              "every record accepted or dropped");
+    }
+    check(inOrder, "records of a producer in order");
+    check(intact, "records intact");
+    check(total + (lossless ? 0 : drops) == threads * messages,
+          "received and dropped add up");
+    check(ring->droppedCount() == drops, "ring counts every drop");
+    check(ring->highWaterMark() <= Ring::slotCount &&
+              (!drops || ring->highWaterMark() == Ring::slotCount),
+          "high water within the ring, full once it dropped");
+    check(!ring->depth(), "ring drained");
+    return {total / sec, ns / (threads * messages), total, drops,
+            ring->highWaterMark()};
+}
+
+int main(int argc, char **argv) {
+    size_t messages = (argc > 1 ? strtoul(argv[1], nullptr, 0) : 1) * 1000000;
+    if (!messages) messages = 1000000;
+    size_t cpus = std::thread::hardware_concurrency();
+
+    // Delivery under contention, with and without drops
+    for (size_t threads : {size_t(1), size_t(4), cpus + 1})
+        for (unsigned spin : {0U, 200U})
+            for (bool lossless : {false, true})
+                run(threads, messages / 8, spin, lossless, true);
+
+    // More producers than CPUs is contention too, as in the kext.
+    printf("%zu CPUs\n%-10s %10s %14s %14s %10s\n", cpus, "producers",
+           "push ns", "msgs/s", "slow msgs/s", "dropped");
+    for (size_t threads = 1; threads <= 16; threads *= 2) {
+        auto fast = run(threads, messages / threads, 0, true, false);
+        auto slow = run(threads, messages / threads, 200, false, false);
+        printf("%-10zu %10.1f %14.0f %14.0f %9.1f%%\n", threads, slow.pushNs,
+               fast.msgsPerSec, slow.msgsPerSec,
+               100.0 * slow.dropped / (slow.received + slow.dropped));
+    }
+    return report();
+}
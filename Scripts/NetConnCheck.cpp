@@ -0,0 +1,190 @@
+//
+//  NetConnCheck.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Checks NetConnection from kern_netconn.hpp against a scripted socket and
+//  a fake clock: state transitions, the backoff doubling from 100 ms up to
+//  30 s and its reset on success, the 5 s connect timeout, disconnects on
+//  send errors and the Stats counters.
+//
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/NetConnCheck.cpp -o conncheck
+//    ./conncheck
+//
+
+#include <cstdio>
+#include <deque>
+
+#include "HostCheck.hpp"
+#include "kern_netconn.hpp"
+
+/**
+ *  Socket that answers open(), check() and send() from scripts, and counts
+ *  the calls. An empty script answers EINPROGRESS, or 0 for send().
+ */
+struct ScriptedSocket {
+    std::deque<int> opens, checks, sends;
+    size_t openCalls{0}, checkCalls{0}, sendCalls{0}, closeCalls{0};
+    bool isOpen{false};
+
+    static int next(std::deque<int> &script, int fallback) {
+        if (script.empty()) return fallback;
+        int ret = script.front();
+        script.pop_front();
+        return ret;
+    }
+
+    int open() {
+        openCalls++;
+        ::check(!isOpen, "open() only after close()");
+        isOpen = true;
+        return next(opens, EINPROGRESS);
+    }
+
+    int check() {
+        checkCalls++;
+        ::check(isOpen, "check() only while open");
+        return next(checks, EINPROGRESS);
+    }
+
+    int send(const void *, size_t len, size_t &sent) {
+        sendCalls++;
+        ::check(isOpen, "send() only while open");
+        int err = next(sends, 0);
+        sent = err ? 0 : len;
+        return err;
+    }
+
+    void close() {
+        closeCalls++;
+        isOpen = false;
+    }
+};
+
+using Connection = NetConnection<ScriptedSocket>;
+using State = Connection::State;
+
+static bool statsAre(const Connection &connection, uint64_t attempts,
+                     uint64_t failures, uint64_t connects,
+                     uint64_t disconnects, uint64_t sendErrors) {
+    auto &stats = connection.getStats();
+    return stats.attempts == attempts && stats.failures == failures &&
+           stats.connects == connects && stats.disconnects == disconnects &&
+           stats.sendErrors == sendErrors;
+}
+
+static void transitions() {
+    ScriptedSocket socket;
+    Connection connection(socket);
+    uint64_t now = 1000;
+    check(connection.getState() == State::Disconnected, "starts disconnected");
+    check(!connection.send("x", 1, now) && !socket.sendCalls,
+          "no send before connecting");
+
+    check(!connection.poll(now), "pending connect is not ready");
+    check(connection.getState() == State::Connecting,
+          "Disconnected -> Connecting");
+    check(!connection.poll(now + 10), "still connecting");
+    check(connection.getState() == State::Connecting && socket.checkCalls == 1,
+          "pending connect is checked");
+
+    socket.checks.push_back(ECONNREFUSED);
+    check(!connection.poll(now + 20), "refused connect is not ready");
+    check(connection.getState() == State::Backoff && !socket.isOpen,
+          "Connecting -> Backoff, socket closed");
+    check(!connection.poll(now + 20 + 99) && socket.openCalls == 1,
+          "no retry before the backoff ends");
+
+    socket.opens.push_back(0);
+    check(connection.poll(now + 20 + 100), "retry after the backoff");
+    check(connection.getState() == State::Connected,
+          "Backoff -> Connected on an immediate connect");
+    check(connection.send("abc", 3, now + 200) == 3, "send while connected");
+
+    socket.sends.push_back(EWOULDBLOCK);
+    check(connection.send("abc", 3, now + 210) == 0 &&
+              connection.getState() == State::Connected,
+          "EWOULDBLOCK keeps the connection");
+
+    socket.sends.push_back(EPIPE);
+    check(connection.send("abc", 3, now + 220) == 0 &&
+              connection.getState() == State::Backoff && !socket.isOpen,
+          "send error: Connected -> Backoff, socket closed");
+    check(!connection.poll(now + 220 + 99), "send error backs off");
+
+    socket.opens.push_back(EHOSTUNREACH);
+    check(!connection.poll(now + 220 + 100) &&
+              connection.getState() == State::Backoff,
+          "failed open: Backoff -> Backoff");
+    check(statsAre(connection, 3, 2, 1, 1, 1), "Stats counters");
+    check(socket.closeCalls == 3, "every failure closes the socket");
+}
+
+static void backoff() {
+    ScriptedSocket socket;
+    Connection connection(socket);
+    uint64_t now = 0;
+    uint64_t expected = Connection::InitialBackoff;
+    check(expected == 100 && Connection::MaxBackoff == 30000,
+          "backoff bounds");
+
+    // 100 ms doubling to the 30 s cap takes nine failures.
+    for (int i = 0; i < 12; i++) {
+        socket.opens.push_back(ECONNREFUSED);
+        connection.poll(now);
+        check(connection.getState() == State::Backoff, "refused open");
+        uint64_t retryAt = now + expected;
+        connection.poll(retryAt - 1);
+        check(socket.openCalls == size_t(i) + 1, "waits out the backoff");
+        expected = expected * 2 > 30000 ? 30000 : expected * 2;
+        check(connection.getBackoff() == expected, "backoff doubles");
+        now = retryAt;
+    }
+    check(connection.getBackoff() == 30000, "backoff capped at 30 s");
+
+    socket.opens.push_back(0);
+    check(connection.poll(now), "connects after the last backoff");
+    check(connection.getBackoff() == 100, "backoff reset on success");
+
+    socket.sends.push_back(ECONNRESET);
+    connection.send("x", 1, now);
+    check(!connection.poll(now + 99) && socket.openCalls == 13,
+          "reset backs off");
+    connection.poll(now + 100);
+    check(connection.getState() == State::Connecting,
+          "reconnect after a reset uses the initial backoff");
+    check(statsAre(connection, 14, 12, 1, 1, 1), "Stats after backoff");
+}
+
+static void connectTimeout() {
+    ScriptedSocket socket;
+    Connection connection(socket);
+    uint64_t start = 5000;
+    connection.poll(start);
+    check(connection.getState() == State::Connecting, "connecting");
+    socket.checks.push_back(EALREADY);
+    check(!connection.poll(start + 4999) &&
+              connection.getState() == State::Connecting,
+          "pending for just under 5 s");
+    check(!connection.poll(start + 5000) &&
+              connection.getState() == State::Backoff && !socket.isOpen,
+          "gives up after 5 s");
+    check(statsAre(connection, 1, 1, 0, 0, 0), "timeout counted as failure");
+
+    // A connect that completes right at the deadline still counts.
+    connection.poll(start + 5100);
+    check(connection.getState() == State::Connecting, "second attempt");
+    socket.checks.push_back(0);
+    check(connection.poll(start + 5100 + 5000), "late success wins");
+    check(connection.getState() == State::Connected &&
+              statsAre(connection, 2, 1, 1, 0, 0),
+          "connected after a timeout");
+}
+
+int main() {
+    transitions();
+    backoff();
+    connectTimeout();
+    return report();
+}
@@ -0,0 +1,251 @@
+//
+//  NetDbgCompressBench.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Benchmarks the NETDBG frame compression (-wrednetlz4) on a captured log.
+//  Records are batched the way LogPump fills its batches and every batch is
+//  compressed with the kext's LZ4Block, then decompressed and compared.
+//  Reports the ratio, the compression CPU cost per MB of log, the decoder
+//  speed, and the log throughput a link of the given speeds sustains with
+//  and without compression, assuming the sender thread compresses one frame
+//  while the previous one is on the wire.
+//
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/NetDbgCompressBench.cpp -o lz4
+//    ./lz4 <capture> [-u] [-n rounds] [-l mbit,...] [-o out]
+//
+//  The capture is a binary stream (-wrednetbin or -wrednetlz4) or plain
+//  text, whose lines are wrapped in text records as the kext would send
+//  them. -u batches for UDP datagrams. -o writes the compressed stream, for
+//  "NetDbgDecode.py <formats> <out> -b" to time the receiver side.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "kern_lz4.hpp"
+#include "kern_netproto.hpp"
+
+static constexpr size_t BatchSize = 4096;
+
+static LZ4Block encoder;
+
+static bool unframe(const std::string &in, size_t pos, std::string &out) {
+    while (pos + sizeof(NetFrameHeader) <= in.size()) {
+        NetFrameHeader header;
+        memcpy(&header, in.data() + pos, sizeof(header));
+        pos += sizeof(header);
+        if (pos + header.length > in.size()) break;
+        if (header.length == header.rawLength) {
+            out.append(in, pos, header.length);
+        } else {
+            std::string raw(header.rawLength, '\0');
+            if (LZ4Block::decompress(
+                    reinterpret_cast<const uint8_t *>(in.data() + pos),
+                    header.length, reinterpret_cast<uint8_t *>(&raw[0]),
+                    raw.size()) != raw.size())
+                return false;
+            out += raw;
+        }
+        pos += header.length;
+    }
+    return true;
+}
+
+/**
+ *  Split a capture into wire records, NetRecordHeader included
+ */
+static bool loadRecords(const std::string &data,
+                        std::vector<std::string> &records) {
+    NetStreamHeader stream;
+    if (data.size() < sizeof(stream) ||
+        (memcpy(&stream, data.data(), sizeof(stream)),
+         stream.magic != NetStreamMagic)) {
+        std::istringstream lines(data);
+        std::string line;
+        while (std::getline(lines, line)) {
+            line += '\n';
+            NetRecordHeader header{
+                NetRecordText, 0, static_cast<uint16_t>(line.size()), 0, 0, 0,
+                0,             0};
+            records.push_back(
+                std::string(reinterpret_cast<const char *>(&header),
+                            sizeof(header)) +
+                line);
+        }
+        return true;
+    }
+    if (stream.version != NetStreamVersion) {
+        fprintf(stderr, "unsupported stream version %u\n", stream.version);
+        return false;
+    }
+
+    std::string raw;
+    if (stream.flags & NetStreamCompressed) {
+        if (!unframe(data, sizeof(stream), raw)) {
+            fprintf(stderr, "corrupt frame in capture\n");
+            return false;
+        }
+    } else {
+        raw = data.substr(sizeof(stream));
+    }
+    size_t pos = 0;
+    while (pos + sizeof(NetRecordHeader) <= raw.size()) {
+        NetRecordHeader header;
+        memcpy(&header, raw.data() + pos, sizeof(header));
+        size_t len = sizeof(header) + header.length;
+        if (pos + len > raw.size()) break;
+        records.push_back(raw.substr(pos, len));
+        pos += len;
+    }
+    return true;
+}
+
+struct Frame {
+    size_t begin, end;
+};
+
+static uint64_t elapsedNs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+int main(int argc, char **argv) {
+    const char *path = nullptr, *outPath = nullptr;
+    bool udp = false;
+    unsigned rounds = 5;
+    std::string links = "10,100,1000";
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-u")) {
+            udp = true;
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            rounds = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            links = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outPath = argv[++i];
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path || !rounds) {
+        fprintf(stderr,
+                "usage: %s <capture> [-u] [-n rounds] [-l mbit,...] [-o out]\n",
+                argv[0]);
+        return 1;
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+    std::vector<std::string> records;
+    if (!loadRecords(data, records)) return 1;
+    if (records.empty()) {
+        fprintf(stderr, "no records in %s\n", path);
+        return 1;
+    }
+
+    // Same limits as LogPump: a stored frame must still fit a datagram.
+    size_t limit = udp ? NetDatagramSize - sizeof(NetDatagramHeader) -
+                             sizeof(NetFrameHeader)
+                       : BatchSize;
+    std::string raw;
+    std::vector<Frame> frames;
+    size_t begin = 0;
+    for (auto &record : records) {
+        if (raw.size() > begin && raw.size() - begin + record.size() > limit) {
+            frames.push_back({begin, raw.size()});
+            begin = raw.size();
+        }
+        raw += record;
+    }
+    frames.push_back({begin, raw.size()});
+
+    std::vector<uint8_t> out(BatchSize), check(BatchSize);
+    std::string stream;
+    uint64_t frameBytes = 0, stored = 0, compressNs = ~0ULL, decompressNs = 0;
+    for (unsigned round = 0; round < rounds; round++) {
+        uint64_t roundNs = 0, bytes = 0;
+        stored = 0;
+        for (auto &frame : frames) {
+            auto *src = reinterpret_cast<const uint8_t *>(raw.data()) +
+                        frame.begin;
+            size_t len = frame.end - frame.begin;
+            auto start = std::chrono::steady_clock::now();
+            size_t n = len > 1 ? encoder.compress(src, len, out.data(), len - 1)
+                               : 0;
+            roundNs += elapsedNs(start);
+            if (!n) stored++;
+            bytes += sizeof(NetFrameHeader) + (n ? n : len);
+
+            if (!round && n) {
+                start = std::chrono::steady_clock::now();
+                size_t m = LZ4Block::decompress(out.data(), n, check.data(),
+                                                check.size());
+                decompressNs += elapsedNs(start);
+                if (m != len || memcmp(check.data(), src, len)) {
+                    fprintf(stderr, "round trip mismatch at offset %zu\n",
+                            frame.begin);
+                    return 1;
+                }
+            }
+            if (!round && outPath) {
+                NetFrameHeader header{static_cast<uint32_t>(n ? n : len),
+                                      static_cast<uint32_t>(len)};
+                stream.append(reinterpret_cast<const char *>(&header),
+                              sizeof(header));
+                stream.append(n ? reinterpret_cast<const char *>(out.data())
+                                : reinterpret_cast<const char *>(src),
+                              n ? n : len);
+            }
+        }
+        frameBytes = bytes;
+        if (roundNs < compressNs) compressNs = roundNs;
+    }
+
+    double mb = raw.size() / 1e6;
+    printf("%zu records, %zu bytes in %zu %s frames (%llu stored)\n",
+           records.size(), raw.size(), frames.size(), udp ? "udp" : "tcp",
+           static_cast<unsigned long long>(stored));
+    printf("compressed %llu bytes, ratio %.2f\n",
+           static_cast<unsigned long long>(frameBytes),
+           static_cast<double>(raw.size()) / frameBytes);
+    printf("compress   %.1f us/frame, %.1f MB/s, %.2f ms CPU per MB of log\n",
+           compressNs / 1e3 / frames.size(), mb / (compressNs / 1e9),
+           compressNs / 1e6 / mb);
+    printf("decompress %.1f MB/s\n", mb / (decompressNs / 1e9));
+
+    printf("\n%10s %14s %14s\n", "link Mbit", "plain MB/s", "lz4 MB/s");
+    std::istringstream list(links);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        double bytesPerSec = strtod(item.c_str(), nullptr) * 1e6 / 8;
+        // Per MB of log: wire time alone, or the slower of wire and CPU.
+        double plain = bytesPerSec / 1e6;
+        double wire = frameBytes / mb / bytesPerSec;
+        double cpu = compressNs / 1e9 / mb;
+        printf("%10s %14.2f %14.2f\n", item.c_str(), plain,
+               1.0 / (wire > cpu ? wire : cpu));
+    }
+
+    if (outPath) {
+        NetStreamHeader header{NetStreamMagic, NetStreamVersion,
+                               NetStreamCompressed};
+        std::ofstream file(outPath, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(stream.data(), stream.size());
+    }
+    return 0;
+}
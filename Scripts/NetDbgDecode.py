@@ -0,0 +1,197 @@
+import collections
+import json
+import re
+import struct
+import sys
+import time
+
+stream_magic = 0x4742444E
+stream_header = struct.Struct("<IHH")
+stream_compressed = 1
+# Compressed streams: u32 LZ4 block length, u32 decompressed length.
+frame_header = struct.Struct("<II")
+# Version 2 added the producer thread ID and CPU number.
+record_headers = {
+    1: struct.Struct("<BBHIQ"),
+    2: struct.Struct("<BBHIQQHH"),
+}
+latest_version = 2
+
+record_text = 0
+record_binary = 1
+
+Record = collections.namedtuple(
+    "Record", "type ts thread cpu fmt_id body")
+
+conversion = re.compile(
+    r"%([-+ 0#]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z|j|t|q)?([diouxXpcs%])")
+
+
+def load_formats(path):
+    with open(path) as f:
+        return {int(k, 16): v["format"] for k, v in json.load(f).items()}
+
+
+def render(fmt, args):
+    # Render a printf format with raw 64-bit arguments the way the kext would.
+    args = list(args)
+
+    def convert(m):
+        flags, width, prec, length, conv = m.groups()
+        if conv == "%":
+            return "%"
+        value = args.pop(0) if args else 0
+        if conv == "p":
+            return "0x%x" % value
+        if conv == "s":
+            return "<str@0x%x>" % value
+        if length not in ("ll", "l", "z", "j", "t", "q"):
+            value &= 0xFFFFFFFF
+            if conv in "di" and value & 0x80000000:
+                value -= 1 << 32
+        elif conv in "di" and value & (1 << 63):
+            value -= 1 << 64
+        if conv == "c":
+            return chr(value & 0xFF)
+        spec = "%" + flags + width + ("." + prec if prec else "")
+        return (spec + {"i": "d", "u": "d"}.get(conv, conv)) % value
+
+    return conversion.sub(convert, fmt)
+
+
+def lz4_decompress(src, raw_length):
+    # Decode one LZ4 block, see kern_lz4.hpp.
+    out = bytearray()
+    pos = 0
+    while pos < len(src):
+        token = src[pos]
+        pos += 1
+        literals = token >> 4
+        if literals == 15:
+            while True:
+                b = src[pos]
+                pos += 1
+                literals += b
+                if b != 255:
+                    break
+        out += src[pos:pos + literals]
+        pos += literals
+        if pos >= len(src):
+            break
+        offset = src[pos] | src[pos + 1] << 8
+        pos += 2
+        length = token & 15
+        if length == 15:
+            while True:
+                b = src[pos]
+                pos += 1
+                length += b
+                if b != 255:
+                    break
+        length += 4
+        if not 0 < offset <= len(out):
+            raise ValueError("bad LZ4 match offset")
+        start = len(out) - offset
+        if offset >= length:
+            out += out[start:start + length]
+        else:
+            # Overlapping match: the copied run repeats with period offset.
+            run = out[start:]
+            out += (run * (length // offset + 1))[:length]
+    if len(out) != raw_length:
+        raise ValueError("LZ4 frame decoded to %d bytes, expected %d" %
+                         (len(out), raw_length))
+    return bytes(out)
+
+
+def parse_frame(data, pos):
+    # Returns (record bytes, next position), or None if the frame is
+    # incomplete.
+    if pos + frame_header.size > len(data):
+        return None
+    length, raw_length = frame_header.unpack_from(data, pos)
+    pos += frame_header.size
+    if pos + length > len(data):
+        return None
+    payload = bytes(data[pos:pos + length])
+    if length != raw_length:
+        payload = lz4_decompress(payload, raw_length)
+    return payload, pos + length
+
+
+def parse_record(data, pos, version):
+    # Returns (Record, next position), or None if the record is incomplete.
+    header = record_headers.get(version, record_headers[latest_version])
+    if pos + header.size > len(data):
+        return None
+    fields = header.unpack_from(data, pos)
+    type, argc, length, fmt_id, ts = fields[:5]
+    thread, cpu = fields[5:7] if len(fields) > 5 else (0, 0)
+    pos += header.size
+    payload = data[pos:pos + length]
+    if len(payload) < length:
+        return None
+    if type == record_binary:
+        body = struct.unpack("<%dQ" % argc, payload)
+    else:
+        body = payload.decode("utf-8", "replace")
+    return Record(type, ts, thread, cpu, fmt_id, body), pos + length
+
+
+def record_text_of(record, formats):
+    if record.type != record_binary:
+        return record.body
+    fmt = formats.get(record.fmt_id)
+    if fmt is None:
+        return "<unknown format 0x%08X %s>\n" % (
+            record.fmt_id, " ".join("0x%x" % a for a in record.body))
+    return render(fmt, record.body)
+
+
+def records(data):
+    # Yields the Records of a binary stream capture.
+    _, version, flags = stream_header.unpack_from(data)
+    pos = stream_header.size
+    if flags & stream_compressed:
+        raw = []
+        while True:
+            parsed = parse_frame(data, pos)
+            if parsed is None:
+                break
+            payload, pos = parsed
+            raw.append(payload)
+        data, pos = b"".join(raw), 0
+    while True:
+        parsed = parse_record(data, pos, version)
+        if parsed is None:
+            break
+        record, pos = parsed
+        yield record
+
+
+def decode(data, formats, out, timestamps=False):
+    if len(data) < 4 or struct.unpack_from("<I", data)[0] != stream_magic:
+        out.write(data.decode("utf-8", "replace"))
+        return
+    for record in records(data):
+        if timestamps:
+            out.write("%d %d 0x%x " % (record.ts, record.cpu, record.thread))
+        out.write(record_text_of(record, formats))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        print("usage: %s <formats.json> <capture> [-t] [-b]" % sys.argv[0])
+        sys.exit(1)
+    with open(sys.argv[2], "rb") as f:
+        data = f.read()
+    if "-b" in sys.argv[3:]:
+        # Decode throughput only, nothing is printed.
+        start = time.perf_counter()
+        count = sum(1 for _ in records(data))
+        elapsed = time.perf_counter() - start
+        print("%d records, %d bytes in %.3f s, %.2f MB/s" %
+              (count, len(data), elapsed, len(data) / elapsed / 1e6))
+        sys.exit(0)
+    decode(data, load_formats(sys.argv[1]), sys.stdout,
+           "-t" in sys.argv[3:])
@@ -0,0 +1,143 @@
+"""Per-function latency from NETDBG entry/exit records.
+
+  NetDbgLatency.py <capture> --formats NetDbgFormats.json [options]
+  NetDbgLatency.py <store dir> [options]
+
+The input is either a binary stream capture (-wrednetbin) or a
+NetDbgReceiver store. Entry records, from HookTrace ("rad: func(...)")
+or from hand-written wrappers ("rad: func this = ...", "rad: func: ..."),
+are paired with the matching "rad: func returned ..." record of the same
+thread, nesting included, and the kext timestamps of the pair give the
+call latency. Function names may be qualified, as in "Class::method".
+Records without a kext timestamp (plain text streams) cannot be paired.
+
+Options:
+  --module rad        Module prefix of the entry and exit records
+  --timebase N/D      mach_absolute_time to ns ratio (1/1 on Intel Macs)
+  --histogram         Print a log2 latency histogram per function
+  --function NAME     Only report NAME
+"""
+
+import argparse
+import collections
+import os
+import re
+import struct
+import sys
+
+import NetDbgDecode
+import NetDbgReceiver
+
+
+def store_records(dir):
+    # Yields (connection, kext ts, thread, text) from a receiver store.
+    with open(os.path.join(dir, "time.idx"), "rb") as f:
+        idx = f.read()
+    with open(os.path.join(dir, "data.log"), "rb") as f:
+        data = f.read()
+    magic, version, size, _ = NetDbgReceiver.index_header.unpack_from(idx)
+    entry = NetDbgReceiver.index_entries.get(version)
+    if magic != NetDbgReceiver.index_magic or not entry or size != entry.size:
+        sys.exit("unsupported index format")
+    if version < 2:
+        sys.exit("store predates thread IDs, records cannot be paired")
+    for pos in range(NetDbgReceiver.index_header.size, len(idx), entry.size):
+        fields = entry.unpack_from(idx, pos)
+        _, ts, offset, length, _, conn, thread = fields[:7]
+        yield conn, ts, thread, data[offset:offset + length].decode(
+            "utf-8", "replace")
+
+
+def capture_records(path, formats):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < 4 or \
+            struct.unpack_from("<I", data)[0] != NetDbgDecode.stream_magic:
+        sys.exit("not a binary NETDBG capture, boot with -wrednetbin")
+    for record in NetDbgDecode.records(data):
+        yield 0, record.ts, record.thread, NetDbgDecode.record_text_of(
+            record, formats)
+
+
+def pair(records, module, only=None):
+    prefix = re.escape(module) + ": "
+    name = r"([\w~]+(?:::[\w~]+)*)"
+    entry = re.compile(prefix + name + r"(?:\(|:| this =)")
+    exit = re.compile(prefix + name + r" returned")
+    stacks = collections.defaultdict(list)
+    latencies = collections.defaultdict(list)
+    unstamped = 0
+    for conn, ts, thread, text in records:
+        if not ts:
+            unstamped += 1
+            continue
+        stack = stacks[conn, thread]
+        m = exit.match(text)
+        if m:
+            func = m.group(1)
+            for i in range(len(stack) - 1, -1, -1):
+                if stack[i][0] == func:
+                    if only is None or func == only:
+                        latencies[func].append(ts - stack[i][1])
+                    # Anything above it never saw its exit record.
+                    del stack[i:]
+                    break
+            continue
+        m = entry.match(text)
+        if m and (not stack or stack[-1][0] != m.group(1)):
+            stack.append((m.group(1), ts))
+    return latencies, unstamped
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def histogram(values, out):
+    buckets = collections.Counter(max(v, 1).bit_length() - 1 for v in values)
+    peak = max(buckets.values())
+    for b in range(min(buckets), max(buckets) + 1):
+        n = buckets.get(b, 0)
+        out.write("    %10s us %6d %s\n" % (
+            "%.1f" % ((1 << b) / 1000), n, "#" * (n * 40 // peak)))
+
+
+def report(latencies, ratio, show_histogram, out):
+    out.write("%-40s %6s %10s %10s %10s %10s %10s %10s\n" % (
+        "function (us)", "count", "min", "mean", "p50", "p90", "p99", "max"))
+    total = {f: sum(v) for f, v in latencies.items()}
+    for func in sorted(latencies, key=total.get, reverse=True):
+        values = sorted(int(v * ratio) for v in latencies[func])
+        us = [v / 1000 for v in values]
+        out.write("%-40s %6d %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n" % (
+            func[:40], len(us), us[0], sum(us) / len(us),
+            percentile(us, 50), percentile(us, 90), percentile(us, 99),
+            us[-1]))
+        if show_histogram:
+            histogram(values, out)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="NETDBG call latency")
+    parser.add_argument("source")
+    parser.add_argument("--formats")
+    parser.add_argument("--module", default="rad")
+    parser.add_argument("--timebase", default="1/1")
+    parser.add_argument("--histogram", action="store_true")
+    parser.add_argument("--function")
+    args = parser.parse_args()
+
+    numer, denom = (int(x) for x in args.timebase.split("/"))
+    if os.path.isdir(args.source):
+        source = store_records(args.source)
+    else:
+        formats = NetDbgDecode.load_formats(args.formats) \
+            if args.formats else {}
+        source = capture_records(args.source, formats)
+    latencies, unstamped = pair(source, args.module, args.function)
+    if unstamped:
+        print("%d records without a kext timestamp skipped" % unstamped,
+              file=sys.stderr)
+    if not latencies:
+        sys.exit("no entry/exit pairs found")
+    report(latencies, numer / denom, args.histogram, sys.stdout)
@@ -0,0 +1,104 @@
+"""Check of the entry/exit pairing in NetDbgLatency.py.
+
+  python3 Scripts/NetDbgLatencyCheck.py
+
+Feeds pair() records in the formats the kext produces: HookTrace entries
+from kern_hook.hpp ("rad: name(args)", "rad: name returned value", and
+"rad: name returned" for void), and the hand-written wrapper formats, with
+plain and qualified names, nested calls, threads and connections
+interleaved, and records without a kext timestamp.
+"""
+
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import NetDbgLatency
+
+ok = True
+
+
+def check(cond, what):
+    global ok
+    if not cond:
+        print("FAILED: %s" % what)
+        ok = False
+
+
+def pair(lines, only=None):
+    # lines are (ts, thread, text), all on connection 0.
+    return NetDbgLatency.pair(
+        ((0, ts, thread, text) for ts, thread, text in lines), "rad", only)
+
+
+def hooktrace():
+    latencies, unstamped = pair([
+        (100, 1, "rad: AMDRadeonX5000_AMDHardware::powerUpHW(0x1)\n"),
+        (150, 1, "rad: _smu_sw_init(0xFFFFFF8012345000)\n"),
+        (170, 1, "rad: _smu_sw_init returned 0x0\n"),
+        (200, 1, "rad: AMDRadeonX5000_AMDHardware::powerUpHW returned 0x1\n"),
+        (300, 1, "rad: AMDRadeonX6000_AMDHWDisplay::~AMDRadeonX6000_"
+                 "AMDHWDisplay(0xFFFFFF8012345000)\n"),
+        (340, 1, "rad: AMDRadeonX6000_AMDHWDisplay::~AMDRadeonX6000_"
+                 "AMDHWDisplay returned\n"),
+    ])
+    check(unstamped == 0, "HookTrace records are all stamped")
+    check(latencies.get("AMDRadeonX5000_AMDHardware::powerUpHW") == [100],
+          "qualified HookTrace entry paired with its exit")
+    check(latencies.get("_smu_sw_init") == [20], "nested HookTrace call")
+    check(latencies.get("AMDRadeonX6000_AMDHWDisplay::~AMDRadeonX6000_"
+                        "AMDHWDisplay") == [40], "void destructor")
+    check(len(latencies) == 3, "no names cut at a colon")
+
+
+def wrappers():
+    latencies, _ = pair([
+        (10, 1, "rad: populateDeviceMemory: this = 0x1 reg = 0x2\n"),
+        (15, 1, "rad: queryEngineRunningState this = 0x1\n"),
+        (25, 1, "rad: queryEngineRunningState returned 0x0\n"),
+        (40, 1, "rad: populateDeviceMemory returned 0x0\n"),
+        (50, 1, "rad: AMDRadeonX5000_AMDHWRegisters::read: this = 0x1\n"),
+        (57, 1, "rad: AMDRadeonX5000_AMDHWRegisters::read returned 0x3\n"),
+    ])
+    check(latencies.get("populateDeviceMemory") == [30], "wrapper \": \"")
+    check(latencies.get("queryEngineRunningState") == [10],
+          "wrapper \" this =\"")
+    check(latencies.get("AMDRadeonX5000_AMDHWRegisters::read") == [7],
+          "qualified wrapper name")
+
+
+def threads():
+    latencies, unstamped = pair([
+        (100, 1, "rad: Hw::powerUpHW(0x1)\n"),
+        (110, 2, "rad: Hw::powerUpHW(0x2)\n"),
+        (0, 1, "rad: Hw::powerUpHW returned 0x1\n"),
+        (130, 2, "rad: Hw::powerUpHW returned 0x1\n"),
+        (160, 1, "rad: Hw::powerUpHW returned 0x1\n"),
+        # An entry that never returned is dropped by the exit below it.
+        (200, 1, "rad: outer(0x0)\n"),
+        (210, 1, "rad: lost(0x0)\n"),
+        (260, 1, "rad: outer returned 0x0\n"),
+    ])
+    check(unstamped == 1, "unstamped record skipped")
+    check(sorted(latencies.get("Hw::powerUpHW", [])) == [20, 60],
+          "threads paired separately")
+    check(latencies.get("outer") == [60] and "lost" not in latencies,
+          "missing exit record")
+
+    latencies, _ = pair([
+        (5, 1, "rad: a::b(0x0)\n"),
+        (6, 1, "rad: c(0x0)\n"),
+        (8, 1, "rad: c returned 0x0\n"),
+        (9, 1, "rad: a::b returned 0x0\n"),
+    ], "c")
+    check(list(latencies) == ["c"] and latencies["c"] == [2],
+          "--function filter")
+
+
+if __name__ == '__main__':
+    hooktrace()
+    wrappers()
+    threads()
+    print("ok" if ok else "FAILED")
+    sys.exit(0 if ok else 1)
@@ -0,0 +1,506 @@
+"""NETDBG receiver and indexer.
+
+  NetDbgReceiver.py serve <dir> [--port 420] [--formats NetDbgFormats.json]
+  NetDbgReceiver.py query <dir> [--tag rad] [--from NS] [--to NS] [--count]
+                                [--stamps]
+  NetDbgReceiver.py replay <dir> [capture | --generate N] [--formats F]
+                                 [--chunk BYTES] [--datagrams]
+
+The receiver accepts any number of kext connections, splits their streams
+(plain text or 'NDBG' binary framing) into newline-terminated records and
+appends them to an on-disk store. UDP datagrams ('NDGR' header with a
+per-sender sequence number) are accepted on the same port; lost datagrams
+are recorded as "netdbg: lost N datagrams" records, ones that turn up late
+are still decoded, and duplicates are dropped. LZ4 compressed streams and
+datagrams (-wrednetlz4) are expanded on arrival.
+
+  data.log      Record text, each record terminated by a newline.
+  time.idx      16-byte header: magic 'NDIX', u32 version (2),
+                u32 entry size (48), u32 reserved. Followed by one entry per
+                record in arrival order, little-endian:
+                  u64 receive time (ns since the epoch)
+                  u64 kext timestamp (mach_absolute_time, 0 if unknown)
+                  u64 offset of the record in data.log
+                  u32 record length in bytes
+                  u16 tag ID
+                  u16 connection ID
+                  u64 kext thread ID (0 if unknown)
+                  u16 CPU number
+                  u16 reserved, u32 padding
+                Version 1 entries stop after the connection ID (32 bytes);
+                existing version 1 stores keep being appended as version 1.
+                Receive times are monotonic, so the file is sorted by time.
+  tag-NNNN.idx  Sorted u64 record numbers (entry indices into time.idx) of
+                every record with tag NNNN.
+  tags.json     Tag names, indexed by tag ID.
+
+A record's tag is its module prefix ("rad", "wred", "netdbg", "AMD TTL COS",
+"_MCILDebugPrint", ...). Queries mmap the index files and binary search them,
+so they take milliseconds regardless of the log size.
+
+replay measures ingest throughput: it pushes a captured TCP stream, or one
+of N generated records alternating text and binary ones, through the same
+decoder and store as serve, in chunks the size of a socket read, and
+reports records/s and MB/s. With --datagrams the capture is a sequence of
+UDP datagrams, each preceded by its u16 little-endian length, fed through
+the datagram path; the lost, late and duplicate datagram counts are
+reported too.
+"""
+
+import argparse
+import json
+import mmap
+import os
+import selectors
+import socket
+import struct
+import sys
+import time
+
+import NetDbgDecode
+
+datagram_magic = 0x5247444E
+datagram_header = struct.Struct("<IIHH")
+datagram_binary = 1
+datagram_compressed = 2
+
+index_magic = b"NDIX"
+index_header = struct.Struct("<4sIII")
+index_entries = {
+    1: struct.Struct("<QQQIHH"),
+    2: struct.Struct("<QQQIHHQHH4x"),
+}
+record_number = struct.Struct("<Q")
+# Datagram captures for replay
+datagram_length = struct.Struct("<H")
+
+
+def record_tag(line):
+    if line.startswith("_MCILDebugPrint"):
+        return "_MCILDebugPrint"
+    colon = line.find(": ")
+    if 0 < colon <= 32:
+        return line[:colon]
+    return "untagged"
+
+
+class Store:
+    def __init__(self, dir):
+        self.dir = dir
+        os.makedirs(dir, exist_ok=True)
+        tags_path = os.path.join(dir, "tags.json")
+        self.tags = json.load(open(tags_path)) if os.path.exists(
+            tags_path) else []
+        self.tag_ids = {t: i for i, t in enumerate(self.tags)}
+        self.data = open(os.path.join(dir, "data.log"), "ab")
+        idx_path = os.path.join(dir, "time.idx")
+        new = not os.path.exists(idx_path) or not os.path.getsize(idx_path)
+        if new:
+            self.version = 2
+        else:
+            with open(idx_path, "rb") as f:
+                self.version = index_header.unpack(
+                    f.read(index_header.size))[1]
+        self.entry = index_entries[self.version]
+        self.index = open(idx_path, "ab")
+        if new:
+            self.index.write(index_header.pack(index_magic, self.version,
+                                               self.entry.size, 0))
+        self.count = (self.index.tell() - index_header.size) // self.entry.size
+        self.offset = self.data.tell()
+        self.tag_files = {}
+        # Keep receive times monotonic across restarts, even if the clock
+        # went back in between.
+        self.last_time = 0
+        if self.count:
+            with open(idx_path, "rb") as f:
+                f.seek(index_header.size + (self.count - 1) * self.entry.size)
+                self.last_time = self.entry.unpack(
+                    f.read(self.entry.size))[0]
+        self.bytes = 0
+
+    def tag_id(self, tag):
+        id = self.tag_ids.get(tag)
+        if id is None:
+            id = len(self.tags)
+            self.tags.append(tag)
+            self.tag_ids[tag] = id
+            with open(os.path.join(self.dir, "tags.json"), "w") as f:
+                json.dump(self.tags, f)
+        return id
+
+    def append(self, conn, stamp, line):
+        raw = line.encode("utf-8", "replace")
+        now = max(time.time_ns(), self.last_time)
+        self.last_time = now
+        tag = self.tag_id(record_tag(line))
+        self.data.write(raw)
+        kext_ts, thread, cpu = stamp
+        fields = [now, kext_ts, self.offset, len(raw), tag, conn & 0xFFFF]
+        if self.version >= 2:
+            fields += [thread, cpu, 0]
+        self.index.write(self.entry.pack(*fields))
+        tag_file = self.tag_files.get(tag)
+        if tag_file is None:
+            tag_file = open(os.path.join(self.dir, "tag-%04d.idx" % tag), "ab")
+            self.tag_files[tag] = tag_file
+        tag_file.write(record_number.pack(self.count))
+        self.offset += len(raw)
+        self.count += 1
+        self.bytes += len(raw)
+
+    def flush(self):
+        self.data.flush()
+        self.index.flush()
+        for f in self.tag_files.values():
+            f.flush()
+
+
+class Connection:
+    def __init__(self, id, store, formats):
+        self.id = id
+        self.store = store
+        self.formats = formats
+        self.buffer = b""
+        self.records = b""
+        self.binary = None
+        self.compressed = False
+        self.version = NetDbgDecode.latest_version
+        self.line = ""
+        self.line_stamp = (0, 0, 0)
+
+    def emit(self, text, stamp=(0, 0, 0)):
+        while text:
+            if not self.line:
+                self.line_stamp = stamp
+            nl = text.find("\n")
+            if nl < 0:
+                self.line += text
+                return
+            self.store.append(self.id, self.line_stamp,
+                              self.line + text[:nl + 1])
+            self.line = ""
+            text = text[nl + 1:]
+
+    def feed(self, data):
+        self.buffer += data
+        if self.binary is None:
+            if len(self.buffer) < 4:
+                return
+            magic = struct.unpack_from("<I", self.buffer)[0]
+            self.binary = magic == NetDbgDecode.stream_magic
+            if self.binary:
+                if len(self.buffer) < NetDbgDecode.stream_header.size:
+                    self.binary = None
+                    return
+                _, self.version, flags = \
+                    NetDbgDecode.stream_header.unpack_from(self.buffer)
+                self.compressed = bool(flags & NetDbgDecode.stream_compressed)
+                self.buffer = self.buffer[NetDbgDecode.stream_header.size:]
+        if not self.binary:
+            text = self.buffer.decode("utf-8", "replace")
+            self.buffer = b""
+            self.emit(text)
+            return
+        if self.compressed:
+            pos = 0
+            while True:
+                try:
+                    parsed = NetDbgDecode.parse_frame(self.buffer, pos)
+                except (ValueError, IndexError) as e:
+                    self.emit("netdbg: corrupt frame dropped (%s)\n" % e)
+                    pos = len(self.buffer)
+                    break
+                if parsed is None:
+                    break
+                payload, pos = parsed
+                self.records += payload
+            self.buffer = self.buffer[pos:]
+        else:
+            self.records += self.buffer
+            self.buffer = b""
+        pos = 0
+        while True:
+            parsed = NetDbgDecode.parse_record(self.records, pos,
+                                               self.version)
+            if parsed is None:
+                break
+            record, pos = parsed
+            self.emit(NetDbgDecode.record_text_of(record, self.formats),
+                      (record.ts, record.thread, record.cpu))
+        self.records = self.records[pos:]
+
+    def close(self):
+        if self.line:
+            self.emit("\n")
+
+
+class DatagramSource:
+    # Sequence numbers still missing are remembered this far back, so a
+    # datagram arriving late is told apart from a duplicate.
+    reorder_window = 1024
+
+    def __init__(self, id, store, formats):
+        self.conn = Connection(id, store, formats)
+        self.expected = None
+        self.missing = set()
+        self.lost = 0
+        self.late = 0
+        self.duplicates = 0
+
+    def feed(self, data):
+        if len(data) < datagram_header.size:
+            return
+        magic, seq, version, flags = datagram_header.unpack_from(data)
+        if magic != datagram_magic:
+            return
+        ahead = (seq - self.expected) & 0xFFFFFFFF \
+            if self.expected is not None else 0
+        if seq == 0 or ahead < 1 << 31:
+            if seq != 0 and ahead:
+                # Whatever was buffered belongs to a record we cannot
+                # complete.
+                self.conn.line = ""
+                self.conn.buffer = b""
+                self.conn.records = b""
+                self.lost += ahead
+                self.missing.update(
+                    (self.expected + i) & 0xFFFFFFFF
+                    for i in range(max(0, ahead - self.reorder_window),
+                                   ahead))
+                self.conn.emit("netdbg: lost %d datagrams\n" % ahead)
+            if seq == 0:
+                self.missing.clear()
+            self.expected = (seq + 1) & 0xFFFFFFFF
+            self.missing = {m for m in self.missing
+                            if (seq - m) & 0xFFFFFFFF < self.reorder_window}
+        elif seq in self.missing:
+            # Counted as lost when the gap opened; datagrams hold whole
+            # records, so it can still be decoded.
+            self.missing.discard(seq)
+            self.lost -= 1
+            self.late += 1
+            self.conn.emit("netdbg: datagram %d arrived late\n" % seq)
+        else:
+            self.duplicates += 1
+            return
+        self.conn.binary = bool(flags & datagram_binary)
+        self.conn.compressed = bool(flags & datagram_compressed)
+        self.conn.version = version
+        self.conn.feed(data[datagram_header.size:])
+
+
+def serve(args):
+    store = Store(args.dir)
+    formats = NetDbgDecode.load_formats(args.formats) if args.formats else {}
+    sel = selectors.DefaultSelector()
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind((args.bind, args.port))
+    server.listen(64)
+    server.setblocking(False)
+    sel.register(server, selectors.EVENT_READ, None)
+    dgram = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    dgram.bind((args.bind, args.port))
+    dgram.setblocking(False)
+    sel.register(dgram, selectors.EVENT_READ, "udp")
+    sources = {}
+    next_id = 0
+    started = time.monotonic()
+    last_report = started
+    wire = 0
+    try:
+        while True:
+            for key, _ in sel.select(timeout=1.0):
+                if key.data == "udp":
+                    data, addr = dgram.recvfrom(1 << 16)
+                    wire += len(data)
+                    source = sources.get(addr)
+                    if source is None:
+                        print("udp source %d from %s:%d" % (next_id, *addr))
+                        source = DatagramSource(next_id, store, formats)
+                        sources[addr] = source
+                        next_id += 1
+                    source.feed(data)
+                    continue
+                if key.data is None:
+                    sock, addr = server.accept()
+                    sock.setblocking(False)
+                    print("connection %d from %s:%d" % (next_id, *addr))
+                    sel.register(sock, selectors.EVENT_READ,
+                                 Connection(next_id, store, formats))
+                    next_id += 1
+                    continue
+                data = key.fileobj.recv(1 << 16)
+                wire += len(data)
+                if data:
+                    key.data.feed(data)
+                else:
+                    key.data.close()
+                    sel.unregister(key.fileobj)
+                    key.fileobj.close()
+                    print("connection %d closed" % key.data.id)
+            store.flush()
+            now = time.monotonic()
+            if args.verbose and now - last_report >= 5:
+                elapsed = now - started
+                print("%d records, %.1f records/s, %.2f MB/s, "
+                      "%.2f MB/s on the wire" %
+                      (store.count, store.count / elapsed,
+                       store.bytes / elapsed / 1e6, wire / elapsed / 1e6))
+                last_report = now
+    except KeyboardInterrupt:
+        store.flush()
+
+
+def generate(count):
+    # Returns a binary stream of count records, text and binary ones in turn,
+    # and the formats of the binary ones.
+    formats = {
+        1: "rad: _smu_sw_init returned 0x%llX\n",
+        2: "rad: populateDeviceMemory: this = %p reg = 0x%X\n",
+        3: "rad: powerUpHW(%p, 0x%X, 0x%llX)\n",
+    }
+    header = NetDbgDecode.record_headers[NetDbgDecode.latest_version]
+    out = [NetDbgDecode.stream_header.pack(NetDbgDecode.stream_magic,
+                                           NetDbgDecode.latest_version, 0)]
+    for i in range(count):
+        ts, thread, cpu = 1000 * i, 0x100 + i % 8, i % 4
+        if i % 2:
+            id = 1 + i % len(formats)
+            args = struct.pack("<%dQ" % id, *range(i, i + id))
+            out.append(header.pack(NetDbgDecode.record_binary, id, len(args),
+                                   id, ts, thread, cpu, 0) + args)
+        else:
+            text = b"wred: generated record %d of %d\n" % (i, count)
+            out.append(header.pack(NetDbgDecode.record_text, 0, len(text), 0,
+                                   ts, thread, cpu, 0) + text)
+    return b"".join(out), formats
+
+
+def replay(args):
+    if args.capture:
+        with open(args.capture, "rb") as f:
+            data = f.read()
+        formats = NetDbgDecode.load_formats(args.formats) \
+            if args.formats else {}
+    else:
+        data, formats = generate(args.generate)
+    store = Store(args.dir)
+    first = store.count
+    start = time.perf_counter()
+    if args.datagrams:
+        source = DatagramSource(0, store, formats)
+        pos = datagrams = 0
+        while pos + datagram_length.size <= len(data):
+            length, = datagram_length.unpack_from(data, pos)
+            pos += datagram_length.size
+            source.feed(data[pos:pos + length])
+            pos += length
+            datagrams += 1
+        source.conn.close()
+    else:
+        conn = Connection(0, store, formats)
+        for pos in range(0, len(data), args.chunk):
+            conn.feed(data[pos:pos + args.chunk])
+        conn.close()
+    store.flush()
+    elapsed = time.perf_counter() - start
+    count = store.count - first
+    print("%d records, %d bytes in %.3f s: %.0f records/s, %.2f MB/s in, "
+          "%.2f MB/s stored" % (count, len(data), elapsed, count / elapsed,
+                                len(data) / elapsed / 1e6,
+                                store.bytes / elapsed / 1e6))
+    if args.datagrams:
+        print("%d datagrams: %d lost, %d late, %d duplicate" % (
+            datagrams, source.lost, source.late, source.duplicates))
+    if not count:
+        sys.exit("no records decoded")
+
+
+def bisect(view, count, entry, key, value):
+    lo, hi = 0, count
+    while lo < hi:
+        mid = (lo + hi) // 2
+        if key(entry.unpack_from(view, mid * entry.size)) < value:
+            lo = mid + 1
+        else:
+            hi = mid
+    return lo
+
+
+def query(args):
+    with open(os.path.join(args.dir, "time.idx"), "rb") as f, \
+            open(os.path.join(args.dir, "data.log"), "rb") as d:
+        idx = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, size, _ = index_header.unpack_from(idx)
+        index_entry = index_entries.get(version)
+        if magic != index_magic or not index_entry or \
+                size != index_entry.size:
+            sys.exit("unsupported index format")
+        view = memoryview(idx)[index_header.size:]
+        count = len(view) // index_entry.size
+        first = bisect(view, count, index_entry, lambda e: e[0],
+                       args.time_from)
+        last = bisect(view, count, index_entry, lambda e: e[0],
+                      args.time_to + 1) if args.time_to is not None else count
+        numbers = range(first, last)
+        if args.tag is not None:
+            tags = json.load(open(os.path.join(args.dir, "tags.json")))
+            if args.tag not in tags:
+                numbers = range(0)
+            else:
+                tf = open(os.path.join(args.dir, "tag-%04d.idx" %
+                                       tags.index(args.tag)), "rb")
+                tmap = mmap.mmap(tf.fileno(), 0, access=mmap.ACCESS_READ)
+                tview = memoryview(tmap)
+                tcount = len(tview) // record_number.size
+                lo = bisect(tview, tcount, record_number, lambda e: e[0],
+                            first)
+                hi = bisect(tview, tcount, record_number, lambda e: e[0], last)
+                numbers = [record_number.unpack_from(tview, i * 8)[0]
+                           for i in range(lo, hi)]
+        if args.count:
+            print(len(numbers))
+            return
+        data = mmap.mmap(d.fileno(), 0, access=mmap.ACCESS_READ)
+        out = sys.stdout.buffer
+        for n in numbers:
+            entry = index_entry.unpack_from(view, n * index_entry.size)
+            recv, ts, offset, length, tag, conn = entry[:6]
+            prefix = b"%d %d " % (recv, conn)
+            if args.stamps:
+                thread, cpu = entry[6:8] if version >= 2 else (0, 0)
+                prefix += b"%d %d 0x%x " % (ts, cpu, thread)
+            out.write(prefix + data[offset:offset + length])
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="NETDBG receiver")
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("serve")
+    p.add_argument("dir")
+    p.add_argument("--bind", default="0.0.0.0")
+    p.add_argument("--port", type=int, default=420)
+    p.add_argument("--formats")
+    p.add_argument("-v", "--verbose", action="store_true")
+    p.set_defaults(func=serve)
+    p = sub.add_parser("query")
+    p.add_argument("dir")
+    p.add_argument("--tag")
+    p.add_argument("--from", dest="time_from", type=int, default=0)
+    p.add_argument("--to", dest="time_to", type=int)
+    p.add_argument("--count", action="store_true")
+    p.add_argument("--stamps", action="store_true",
+                   help="print kext timestamp, CPU and thread of each record")
+    p.set_defaults(func=query)
+    p = sub.add_parser("replay")
+    p.add_argument("dir")
+    p.add_argument("capture", nargs="?")
+    p.add_argument("--generate", type=int, default=200000)
+    p.add_argument("--formats")
+    p.add_argument("--chunk", type=int, default=1 << 16)
+    p.add_argument("--datagrams", action="store_true")
+    p.set_defaults(func=replay)
+    args = parser.parse_args()
+    args.func(args)
@@ -0,0 +1,249 @@
+//
+//  NetDbgUdpCheck.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  End-to-end check of the NETDBG UDP transport. The kext's LogPump and
+//  NetConnection send numbered records through a transport that drops,
+//  delays and duplicates datagrams, driven by a fixed-seed generator; what
+//  arrives is replayed through NetDbgReceiver.py, whose lost, late and
+//  duplicate datagram counters and stored records must match what the
+//  transport did. Covers text, binary and LZ4 compressed datagrams.
+//
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/NetDbgUdpCheck.cpp -o udpcheck
+//    ./udpcheck [seed] [path/to/NetDbgReceiver.py]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "HostCheck.hpp"
+#include "kern_logpump.hpp"
+#include "kern_lz4.hpp"
+#include "kern_netconn.hpp"
+#include "kern_ring.hpp"
+
+struct SimClock {
+    static inline uint64_t us;
+
+    static uint64_t now() { return us / 1000; }
+    static uint64_t stamp() { return us; }
+    static void delay(uint32_t delayUs) { us += delayUs; }
+};
+
+/**
+ *  Datagram link that loses, holds back for one datagram, or delivers
+ *  twice a share of what is sent, in delivery order in wire.
+ */
+struct LossyTransport {
+    uint64_t state{0};
+    std::vector<std::string> wire;
+    std::string held;
+    size_t sent{0}, dropped{0}, delayed{0}, duplicated{0};
+
+    uint32_t next() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<uint32_t>(state >> 33);
+    }
+
+    int open() { return 0; }
+    int check() { return 0; }
+    void close() {}
+
+    int send(const void *data, size_t len, size_t &done) {
+        SimClock::us += 5;
+        done = len;
+        sent++;
+        std::string datagram(static_cast<const char *>(data), len);
+        auto roll = next() % 100;
+        if (roll < 6) {
+            dropped++;
+            return 0;
+        }
+        if (roll < 12 && held.empty()) {
+            held = datagram;
+            delayed++;
+            return 0;
+        }
+        wire.push_back(datagram);
+        if (roll < 16) {
+            wire.push_back(datagram);
+            duplicated++;
+        }
+        if (!held.empty()) {
+            wire.push_back(held);
+            held.clear();
+        }
+        return 0;
+    }
+
+    void finish() {
+        if (!held.empty()) wire.push_back(held);
+        held.clear();
+    }
+};
+
+using Ring = LogRing<512, 64>;
+using Connection = NetConnection<LossyTransport>;
+using Pump = LogPump<Connection, SimClock, 4096, 2048>;
+
+static std::string message(size_t i) {
+    char text[128];
+    snprintf(text, sizeof(text), "udp: record %zu %s\n", i,
+             std::string(60, 'x').c_str());
+    return text;
+}
+
+static bool pushRecord(Ring &ring, const std::string &text, bool binary) {
+    std::string record = text;
+    if (binary) {
+        NetRecordHeader header{
+            NetRecordText, 0, static_cast<uint16_t>(text.size()), 0, 0, 0, 0,
+            0};
+        record.insert(0, reinterpret_cast<const char *>(&header),
+                      sizeof(header));
+    }
+    return ring.push(record.data(), record.size());
+}
+
+/**
+ *  Records in a datagram, counted by their text
+ */
+static size_t recordsIn(const std::string &datagram) {
+    NetDatagramHeader header;
+    memcpy(&header, datagram.data(), sizeof(header));
+    std::string payload = datagram.substr(sizeof(header));
+    if (header.flags & NetDatagramCompressed) {
+        NetFrameHeader frame;
+        memcpy(&frame, payload.data(), sizeof(frame));
+        std::string raw(frame.rawLength, '\0');
+        if (frame.length == frame.rawLength)
+            raw = payload.substr(sizeof(frame));
+        else
+            LZ4Block::decompress(
+                reinterpret_cast<const uint8_t *>(payload.data()) +
+                    sizeof(frame),
+                frame.length, reinterpret_cast<uint8_t *>(&raw[0]),
+                raw.size());
+        payload = raw;
+    }
+    size_t count = 0;
+    for (auto at = payload.find("udp: record "); at != std::string::npos;
+         at = payload.find("udp: record ", at + 1))
+        count++;
+    return count;
+}
+
+static bool runCommand(const std::string &command, std::string &out) {
+    auto *pipe = popen(command.c_str(), "r");
+    if (!pipe) return false;
+    char buffer[256];
+    while (fgets(buffer, sizeof(buffer), pipe)) out += buffer;
+    return pclose(pipe) == 0;
+}
+
+static void run(const char *name, uint64_t seed, bool binary, bool compress,
+                const char *receiver) {
+    static Ring ring;
+    static Pump pump;
+    ring.init();
+    SimClock::us = 0;
+
+    LossyTransport transport;
+    transport.state = seed;
+    Connection connection(transport);
+    pump = Pump();
+    pump.configure(binary, true, true, compress);
+
+    const size_t messages = 3000;
+    size_t pushed = 0;
+    while (true) {
+        while (pushed < messages && pushRecord(ring, message(pushed), binary))
+            pushed++;
+        check(pump.prepare(connection), "datagram transport always ready");
+        pump.fill(ring);
+        if (pump.send(connection) == Pump::Result::Idle &&
+            pushed == messages && !ring.front())
+            break;
+    }
+    transport.finish();
+
+    // What the receiver should make of it: a datagram older than the newest
+    // seen is late the first time and a duplicate after that, and a missing
+    // one is lost unless it turns up late.
+    std::set<uint32_t> seen;
+    uint32_t newest = 0;
+    size_t late = 0, duplicates = 0, records = 0;
+    for (auto &datagram : transport.wire) {
+        NetDatagramHeader header;
+        memcpy(&header, datagram.data(), sizeof(header));
+        if (!seen.insert(header.seq).second) {
+            duplicates++;
+            continue;
+        }
+        if (header.seq < newest) late++;
+        if (header.seq > newest) newest = header.seq;
+        records += recordsIn(datagram);
+    }
+    size_t lost = newest + 1 - seen.size();
+
+    char dir[] = "/tmp/udpcheck.XXXXXX";
+    check(mkdtemp(dir), "temporary store");
+    std::string capture = std::string(dir) + "/capture.bin";
+    auto *file = fopen(capture.c_str(), "wb");
+    for (auto &datagram : transport.wire) {
+        uint16_t len = static_cast<uint16_t>(datagram.size());
+        fwrite(&len, sizeof(len), 1, file);
+        fwrite(datagram.data(), 1, datagram.size(), file);
+    }
+    fclose(file);
+
+    std::string store = std::string(dir) + "/store";
+    std::string replayed, counted;
+    check(runCommand(std::string("python3 ") + receiver + " replay " + store +
+                         " " + capture + " --datagrams",
+                     replayed),
+          "replay");
+    check(runCommand(std::string("python3 ") + receiver + " query " + store +
+                         " --tag udp --count",
+                     counted),
+          "query");
+    runCommand(std::string("rm -rf ") + dir, counted);
+
+    size_t gotDatagrams = 0, gotLost = 0, gotLate = 0, gotDuplicates = 0;
+    bool parsed = false;
+    for (auto *line = replayed.c_str(); line && !parsed;
+         line = strchr(line, '\n') ? strchr(line, '\n') + 1 : nullptr)
+        parsed = sscanf(line,
+                        "%zu datagrams: %zu lost, %zu late, %zu duplicate",
+                        &gotDatagrams, &gotLost, &gotLate,
+                        &gotDuplicates) == 4;
+    size_t gotRecords = strtoul(counted.c_str(), nullptr, 10);
+    check(parsed && gotDatagrams == transport.wire.size(),
+          "receiver saw every datagram");
+    check(gotLost == lost && gotLate == late && gotDuplicates == duplicates,
+          "gap counters");
+    check(gotRecords == records, "records of every datagram stored once");
+    check(newest < transport.sent && lost <= transport.dropped,
+          "sequence numbers");
+    printf("%-10s %4zu datagrams sent, %zu dropped, %zu delayed, %zu "
+           "doubled; receiver %zu lost, %zu late, %zu duplicate, %zu/%zu "
+           "records\n",
+           name, transport.sent, transport.dropped, transport.delayed,
+           transport.duplicated, gotLost, gotLate, gotDuplicates, gotRecords,
+           messages);
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = argc > 1 ? strtoull(argv[1], nullptr, 0) : 1;
+    const char *receiver = argc > 2 ? argv[2] : "Scripts/NetDbgReceiver.py";
+    run("udp text", seed, false, false, receiver);
+    run("udp binary", seed, true, false, receiver);
+    run("udp lz4", seed, true, true, receiver);
+    return report();
+}
@@ -0,0 +1,198 @@
+"""Report what each NETDBG log level configuration keeps and saves.
+
+  NetLogLevels.py <source dir> [--store DIR | --capture FILE --formats JSON]
+                  [--config name=rad:1,fw:0 ...] [--build]
+
+For every configuration it reports the logging call sites and format string
+bytes compiled in, which follow directly from the compile-time levels in
+kern_netlevel.hpp. With a receiver store or a binary capture of a fully
+enabled (debug) boot it also reports how many records and bytes that boot
+would have produced. With --build (macOS only) every configuration is
+built with xcodebuild and the __text and __cstring section sizes of the
+resulting binary are reported as well.
+"""
+
+import argparse
+import collections
+import os
+import re
+import struct
+import subprocess
+import sys
+
+import GenerateNetDbgFormats
+import NetDbgDecode
+import NetDbgReceiver
+
+modules = ("rad", "wred", "netdbg", "fw")
+
+# Built-in configurations, module -> level (0 off, 1 error, 2 info, 3 trace)
+configs = collections.OrderedDict([
+    ("debug", {"rad": 3, "wred": 3, "netdbg": 3, "fw": 2}),
+    ("release", {"rad": 2, "wred": 2, "netdbg": 2, "fw": 0}),
+    ("errors", {"rad": 1, "wred": 1, "netdbg": 1, "fw": 0}),
+    ("off", {"rad": 0, "wred": 0, "netdbg": 0, "fw": 0}),
+])
+
+# Firmware debug output is tagged by the wrappers, not by a NETLOG module.
+fw_tags = ("AMD TTL COS", "_MCILDebugPrint")
+
+
+def parse_config(spec):
+    name, _, levels = spec.partition("=")
+    config = dict(configs["release"])
+    for item in levels.split(","):
+        mod, _, level = item.partition(":")
+        if mod not in modules:
+            sys.exit("unknown module %s" % mod)
+        config[mod] = int(level)
+    return name, config
+
+
+def format_regex(fmt):
+    parts = NetDbgDecode.conversion.split(fmt)
+    # split() interleaves the literal text with the conversion groups
+    step = NetDbgDecode.conversion.groups + 1
+    pattern = "".join(re.escape(parts[i]) + (".*?" if i + 1 < len(parts)
+                                             else "")
+                      for i in range(0, len(parts), step))
+    return re.compile(pattern + r"\Z", re.S)
+
+
+class Classifier:
+    def __init__(self, table):
+        self.by_id = {int(k, 16): v for k, v in table.items()}
+        self.by_module = collections.defaultdict(list)
+        for v in table.values():
+            self.by_module[v["module"]].append(
+                (format_regex(v["format"]), v["level"]))
+
+    def text(self, text):
+        for tag in fw_tags:
+            if text.startswith(tag):
+                return "fw", 2
+        mod = text.split(": ", 1)[0]
+        for regex, level in self.by_module.get(mod, ()):
+            if regex.match(text):
+                return mod, level
+        # Unknown records (netdbg notices, other sources) are never filtered
+        return None, 0
+
+    def record(self, record, formats):
+        if record.type == NetDbgDecode.record_binary:
+            entry = self.by_id.get(record.fmt_id)
+            if entry:
+                return entry["module"], entry["level"]
+        return self.text(NetDbgDecode.record_text_of(record, formats))
+
+
+def runtime_records(args, classifier):
+    # Yields (module, level, bytes) for every record of the capture.
+    if args.store:
+        with open(os.path.join(args.store, "time.idx"), "rb") as f:
+            idx = f.read()
+        with open(os.path.join(args.store, "data.log"), "rb") as f:
+            data = f.read()
+        _, version, size, _ = NetDbgReceiver.index_header.unpack_from(idx)
+        entry = NetDbgReceiver.index_entries[version]
+        for pos in range(NetDbgReceiver.index_header.size, len(idx), size):
+            fields = entry.unpack_from(idx, pos)
+            offset, length = fields[2], fields[3]
+            text = data[offset:offset + length].decode("utf-8", "replace")
+            yield classifier.text(text) + (length,)
+    elif args.capture:
+        formats = NetDbgDecode.load_formats(args.formats)
+        with open(args.capture, "rb") as f:
+            data = f.read()
+        if struct.unpack_from("<I", data)[0] != NetDbgDecode.stream_magic:
+            sys.exit("not a binary NETDBG capture")
+        version = NetDbgDecode.stream_header.unpack_from(data)[1]
+        header = NetDbgDecode.record_headers[version].size
+        for record in NetDbgDecode.records(data):
+            size = header + (len(record.body) * 8
+                             if record.type == NetDbgDecode.record_binary
+                             else len(record.body.encode()))
+            yield classifier.record(record, formats) + (size,)
+
+
+def kept(config, mod, level):
+    return mod is None or level <= config.get(mod, 2)
+
+
+def build_sizes(root, config):
+    defines = " ".join("NETLOG_LEVEL_%s=%d" % (m.upper(), l)
+                       for m, l in config.items())
+    out = os.path.join(root, "build", "netlog-levels")
+    subprocess.run(["xcodebuild", "-project",
+                    os.path.join(root, "WhateverRed.xcodeproj"),
+                    "-configuration", "Release", "SYMROOT=" + out,
+                    "GCC_PREPROCESSOR_DEFINITIONS=$(inherited) " + defines],
+                   check=True, stdout=subprocess.DEVNULL)
+    binary = os.path.join(out, "Release", "WhateverRed.kext", "Contents",
+                          "MacOS", "WhateverRed")
+    sizes = {}
+    for line in subprocess.run(["size", "-m", binary], check=True,
+                               capture_output=True, text=True).stdout.split(
+                                   "\n"):
+        m = re.search(r"Section (__text|__cstring): (\d+)", line)
+        if m:
+            sizes[m.group(1)] = sizes.get(m.group(1), 0) + int(m.group(2))
+    return sizes
+
+
+def main():
+    parser = argparse.ArgumentParser(description="NETDBG level report")
+    parser.add_argument("src")
+    parser.add_argument("--store")
+    parser.add_argument("--capture")
+    parser.add_argument("--formats")
+    parser.add_argument("--config", action="append", default=[])
+    parser.add_argument("--build", action="store_true")
+    args = parser.parse_args()
+    if args.capture and not args.formats:
+        sys.exit("--capture needs --formats")
+
+    for spec in args.config:
+        name, config = parse_config(spec)
+        configs[name] = config
+
+    sites = []
+    table = GenerateNetDbgFormats.scan_dir(args.src, sites)
+    runtime = []
+    if args.store or args.capture:
+        runtime = list(runtime_records(args, Classifier(table)))
+
+    base = None
+    print("%-10s %6s %9s %9s %11s %9s" % ("config", "sites", "fmt bytes",
+                                           "records", "rec bytes", "saved"))
+    for name, config in configs.items():
+        site_count = sum(1 for mod, level, _, _ in sites
+                         if kept(config, mod, level))
+        fmt_bytes = sum(len(fmt.encode()) + 1 for fmt in
+                        {fmt for mod, level, fmt, _ in sites
+                         if kept(config, mod, level)})
+        records = [n for mod, level, n in runtime if kept(config, mod, level)]
+        row = (site_count, fmt_bytes, len(records), sum(records))
+        base = base or row
+        saved = 100.0 * (base[3] - row[3]) / base[3] if base[3] else \
+            100.0 * (base[1] - row[1]) / base[1] if base[1] else 0
+        print("%-10s %6d %9d %9s %11s %8.1f%%" % (
+            name, row[0], row[1], row[2] if runtime else "-",
+            row[3] if runtime else "-", saved))
+
+    by_level = collections.Counter((mod, level) for mod, level, _, _ in sites)
+    print("\ncall sites per module and level:")
+    for (mod, level), n in sorted(by_level.items()):
+        print("  %-8s %d  %4d" % (mod, level, n))
+
+    if args.build:
+        root = os.path.dirname(os.path.abspath(args.src))
+        print("\n%-10s %10s %10s" % ("config", "__text", "__cstring"))
+        for name, config in configs.items():
+            sizes = build_sizes(root, config)
+            print("%-10s %10d %10d" % (name, sizes.get("__text", 0),
+                                       sizes.get("__cstring", 0)))
+
+
+if __name__ == '__main__':
+    main()
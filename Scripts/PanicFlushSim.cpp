@@ -0,0 +1,261 @@
+//
+//  PanicFlushSim.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Host simulation of the NETDBG panic flush. Builds the kext's LogPump,
+//  LogRing and NetConnection against a scripted transport and a virtual
+//  clock, interrupts the pump mid-batch the way a panic would, and checks
+//  that LogPump::drain delivers every record exactly once, the panic record
+//  ahead of the backlog, within its deadline, and identically on every run.
+//
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/PanicFlushSim.cpp -o sim
+//    ./sim [seed]
+//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "HostCheck.hpp"
+#include "kern_logpump.hpp"
+#include "kern_lz4.hpp"
+#include "kern_netconn.hpp"
+#include "kern_ring.hpp"
+
+struct SimClock {
+    static uint64_t us;
+
+    static uint64_t now() { return us / 1000; }
+    static uint64_t stamp() { return us; }
+    static void delay(uint32_t delayUs) { us += delayUs; }
+};
+
+uint64_t SimClock::us = 0;
+
+/**
+ *  Transport that accepts random amounts of data or nothing at all,
+ *  driven by a fixed-seed generator.
+ */
+struct SimTransport {
+    uint64_t state{0};
+    bool dead{false};
+    bool udp{false};
+    std::string received;
+    size_t datagrams{0};
+
+    uint32_t next() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<uint32_t>(state >> 33);
+    }
+
+    int open() { return next() % 2 ? 0 : EINPROGRESS; }
+    int check() { return next() % 3 ? 0 : EINPROGRESS; }
+    void close() {}
+
+    int send(const void *data, size_t len, size_t &sent) {
+        SimClock::us += 5;
+        if (dead || next() % 4 == 0) return EWOULDBLOCK;
+        // Datagrams are all or nothing, streams may be cut anywhere.
+        sent = udp ? len : 1 + next() % len;
+        auto *bytes = static_cast<const char *>(data);
+        if (udp) {
+            received.append(bytes + sizeof(NetDatagramHeader),
+                            len - sizeof(NetDatagramHeader));
+            datagrams++;
+        } else {
+            received.append(bytes, sent);
+        }
+        return 0;
+    }
+};
+
+using Ring = LogRing<512, 64>;
+using PanicRing = LogRing<512, 4>;
+using Connection = NetConnection<SimTransport>;
+using Pump = LogPump<Connection, SimClock, 4096, 2048>;
+
+struct Outcome {
+    bool drained;
+    uint64_t elapsedUs;
+    std::vector<std::string> records;
+    std::string tail;
+};
+
+/**
+ *  Expand the frames of a compressed stream into plain records.
+ */
+static std::string unframe(const std::string &stream, size_t pos) {
+    std::string out;
+    while (pos + sizeof(NetFrameHeader) <= stream.size()) {
+        NetFrameHeader header;
+        memcpy(&header, stream.data() + pos, sizeof(header));
+        pos += sizeof(header);
+        if (pos + header.length > stream.size()) break;
+        std::string raw(header.rawLength, '\0');
+        auto *data = reinterpret_cast<const uint8_t *>(stream.data() + pos);
+        if (header.length == header.rawLength)
+            raw.assign(stream, pos, header.length);
+        else if (LZ4Block::decompress(data, header.length,
+                                      reinterpret_cast<uint8_t *>(&raw[0]),
+                                      raw.size()) != raw.size())
+            break;
+        out += raw;
+        pos += header.length;
+    }
+    return out;
+}
+
+static std::vector<std::string> parse(std::string stream, bool binary,
+                                      bool udp, bool compress) {
+    std::vector<std::string> out;
+    size_t pos = 0;
+    if (binary && !udp) pos = sizeof(NetStreamHeader);
+    if (compress) {
+        stream = unframe(stream, pos);
+        pos = 0;
+    }
+    while (pos < stream.size()) {
+        if (binary) {
+            NetRecordHeader header;
+            if (pos + sizeof(header) > stream.size()) break;
+            memcpy(&header, stream.data() + pos, sizeof(header));
+            pos += sizeof(header);
+            out.push_back(stream.substr(pos, header.length));
+            pos += header.length;
+        } else {
+            auto nl = stream.find('\n', pos);
+            if (nl == std::string::npos) break;
+            out.push_back(stream.substr(pos, nl + 1 - pos));
+            pos = nl + 1;
+        }
+    }
+    return out;
+}
+
+template <typename R>
+static void pushRecord(R &ring, const std::string &text, bool binary) {
+    std::string record = text;
+    if (binary) {
+        NetRecordHeader header{
+            NetRecordText, 0, static_cast<uint16_t>(text.size()), 0, 0, 0, 0,
+            0};
+        record.insert(0, reinterpret_cast<const char *>(&header),
+                      sizeof(header));
+    }
+    ring.push(record.data(), record.size());
+}
+
+static std::string message(size_t i) {
+    char text[128];
+    snprintf(text, sizeof(text), "sim: message %zu %s\n", i,
+             std::string(80, 'x').c_str());
+    return text;
+}
+
+static Outcome run(uint64_t seed, bool binary, bool udp, bool compress,
+                   bool dead, size_t messages) {
+    static Ring ring;
+    static PanicRing panicRing;
+    static Pump pump;
+    ring.init();
+    panicRing.init();
+    SimClock::us = 0;
+
+    SimTransport transport;
+    transport.state = seed;
+    transport.udp = udp;
+    Connection connection(transport);
+    pump = Pump();
+    pump.configure(binary, udp, true, compress);
+
+    for (size_t i = 0; i < messages; i++) pushRecord(ring, message(i), binary);
+
+    // Sender thread: get a batch partly out, then lose the CPU to the panic.
+    while (!pump.prepare(connection)) SimClock::delay(100);
+    pump.fill(ring);
+    pump.send(connection);
+
+    pushRecord(panicRing, "panic: simulated\n", binary);
+    transport.dead = dead;
+    auto start = SimClock::us;
+    Outcome outcome;
+    outcome.drained = pump.drain(connection, SimClock::now() + 500, 100,
+                                 panicRing, ring);
+    outcome.elapsedUs = SimClock::us - start;
+    outcome.records = parse(transport.received, binary, udp, compress);
+    char tail[2048];
+    pump.copyTail(tail, sizeof(tail));
+    outcome.tail = tail;
+    return outcome;
+}
+
+static void simulate(const char *name, uint64_t seed, bool binary, bool udp,
+                     bool compress = false) {
+    const size_t messages = 48;
+    auto a = run(seed, binary, udp, compress, false, messages);
+    auto b = run(seed, binary, udp, compress, false, messages);
+
+    bool passed = a.drained;
+    if (a.records != b.records || a.elapsedUs != b.elapsedUs ||
+        a.tail != b.tail) {
+        printf("%s: runs differ\n", name);
+        passed = false;
+    }
+
+    // The connection notice first, then whatever was already batched, the
+    // panic record, and the rest of the backlog, each record exactly once.
+    size_t panicAt = 0, next = 0;
+    for (size_t i = 1; i < a.records.size(); i++) {
+        if (a.records[i] == "panic: simulated\n") {
+            panicAt = i;
+            continue;
+        }
+        if (a.records[i] != message(next++)) {
+            printf("%s: record %zu is \"%s\"\n", name, i,
+                   a.records[i].c_str());
+            passed = false;
+            break;
+        }
+    }
+    if (!panicAt || panicAt + 1 == a.records.size() || next != messages) {
+        printf("%s: panic record %zu, %zu of %zu messages\n", name, panicAt,
+               next, messages);
+        passed = false;
+    }
+    auto &last = a.records.back();
+    if (a.tail.size() < last.size() ||
+        a.tail.compare(a.tail.size() - last.size(), last.size(), last)) {
+        printf("%s: trace tail does not end with the last record\n", name);
+        passed = false;
+    }
+
+    auto dead = run(seed, binary, udp, compress, true, messages);
+    if (dead.drained || dead.elapsedUs > 501 * 1000) {
+        printf("%s: dead transport took %llu us\n", name,
+               (unsigned long long)dead.elapsedUs);
+        passed = false;
+    }
+
+    printf("%-12s %s: %zu records in %llu us, panic at %zu; dead link gave up "
+           "after %llu us\n",
+           name, passed ? "ok" : "FAILED", a.records.size(),
+           (unsigned long long)a.elapsedUs, panicAt,
+           (unsigned long long)dead.elapsedUs);
+    check(passed, name);
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = argc > 1 ? strtoull(argv[1], nullptr, 0) : 1;
+    simulate("tcp text", seed, false, false);
+    simulate("tcp binary", seed, true, false);
+    simulate("udp text", seed, false, true);
+    simulate("udp binary", seed, true, true);
+    simulate("tcp lz4", seed, true, false, true);
+    simulate("udp lz4", seed, true, true, true);
+    return report();
+}
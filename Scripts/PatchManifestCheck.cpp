@@ -0,0 +1,194 @@
+//
+//  PatchManifestCheck.cpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+//  Offline check of the byte patch manifest in kern_patch.hpp. Without
+//  arguments, lists the manifest and checks searching, masks and applying
+//  on a synthetic image, then reports the search speed. Given kext binaries
+//  by bundle ID, reports per patch the matches in the x86_64 code against
+//  those expected, with the same search the kext does at boot, and fails if
+//  a required patch matches nothing, which panics the kext.
+//
+//    c++ -std=c++17 -O2 -I WhateverRed Scripts/PatchManifestCheck.cpp
+//        -o patches
+//    ./patches [--darwin 21] [bundle-id=path/to/kext/Contents/MacOS/binary]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "HostCheck.hpp"
+#include "kern_patch.hpp"
+
+static uint32_t readBig32(const uint8_t *p) {
+    return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/**
+ *  The x86_64 slice of a universal binary, or the whole file if thin
+ */
+static bool x86Slice(const std::vector<uint8_t> &file, size_t &offset,
+                     size_t &size) {
+    static constexpr uint32_t FatMagic = 0xCAFEBABE;
+    static constexpr uint32_t CpuX86_64 = 0x01000007;
+    offset = 0;
+    size = file.size();
+    if (file.size() < 8 || readBig32(file.data()) != FatMagic) return true;
+    uint32_t count = readBig32(file.data() + 4);
+    for (uint32_t i = 0; i < count && 8 + 20 * (i + 1) <= file.size(); i++) {
+        auto *arch = file.data() + 8 + 20 * i;
+        if (readBig32(arch) != CpuX86_64) continue;
+        offset = readBig32(arch + 8);
+        size = readBig32(arch + 12);
+        return offset + size <= file.size();
+    }
+    return false;
+}
+
+static void listManifest() {
+    printf("manifest version %u, %zu patches\n", PatchManifestVersion,
+           sizeof(radPatches) / sizeof(radPatches[0]));
+    for (auto &patch : radPatches)
+        printf("  %-28s %-38s %3zu bytes x%u (at most %u), Darwin %u-%u, "
+               "%s\n",
+               patch.name, patch.kext, patch.size, patch.expected, patch.limit,
+               patch.minDarwin, patch.maxDarwin,
+               patch.required ? "required" : "optional");
+}
+
+/**
+ *  Counts and applies a patch the way RAD::applyPatches does
+ */
+static BinaryPatchResult applyAll(const BinaryPatch &patch, uint8_t *data,
+                                  size_t size) {
+    BinaryPatchResult result{};
+    auto start = std::chrono::steady_clock::now();
+    for (size_t at = patch.search(data, size, 0); at != PatchNotFound;
+         at = patch.search(data, size, at + patch.size)) {
+        result.matches++;
+        if (result.patched == patch.limit) continue;
+        patch.apply(data + at);
+        result.patched++;
+    }
+    result.ns = static_cast<uint64_t>(
+        std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+    return result;
+}
+
+static void checkSynthetic() {
+    std::vector<uint8_t> image(16 << 20);
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (auto &byte : image) {
+        state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+        byte = static_cast<uint8_t>(state);
+    }
+    // Every patch its expected number of times, plus one more of the first
+    size_t at = 4096;
+    for (auto &patch : radPatches)
+        for (uint32_t i = 0; i < patch.expected; i++, at += 1 << 20)
+            memcpy(&image[at], patch.find, patch.size);
+    memcpy(&image[at], radPatches[0].find, radPatches[0].size);
+
+    double bytes = 0, ns = 0;
+    for (size_t i = 0; i < sizeof(radPatches) / sizeof(radPatches[0]); i++) {
+        auto &patch = radPatches[i];
+        auto result = applyAll(patch, image.data(), image.size());
+        bytes += image.size();
+        ns += result.ns;
+        uint32_t planted = patch.expected + (i == 0);
+        uint32_t patched = planted < patch.limit ? planted : patch.limit;
+        check(result.matches == planted && result.patched == patched,
+              "matches planted, patched up to the limit");
+        auto again = applyAll(patch, image.data(), image.size());
+        check(again.matches == planted - patched,
+              "patched bytes match no more");
+    }
+    printf("search %.0f MB/s\n", bytes / ns * 1000);
+
+    // Masks: any register in the second byte, only its low nibble written
+    static constexpr uint8_t find[] = {0xbe, 0x3b, 0x00};
+    static constexpr uint8_t findMask[] = {0xFF, 0x00, 0xFF};
+    static constexpr uint8_t replace[] = {0xbe, 0x0e, 0x00};
+    static constexpr uint8_t replaceMask[] = {0x00, 0x0F, 0x00};
+    static constexpr BinaryPatch masked{
+        "masked", "host", find, replace, findMask, replaceMask, 3, 1, 1,
+        PatchDarwinCatalina, PatchDarwinMonterey, false};
+    const BinaryPatch manifest[] = {masked};
+    check(!patchManifestValid(manifest), "patched bytes matching rejected");
+    uint8_t data[] = {0x01, 0xbe, 0x75, 0x00, 0xbe, 0x3b, 0x01};
+    check(masked.search(data, sizeof(data), 0) == 1 &&
+              masked.search(data, sizeof(data), 2) == PatchNotFound,
+          "masked search");
+    masked.apply(data + 1);
+    check(data[1] == 0xbe && data[2] == 0x7e && data[3] == 0x00,
+          "masked apply");
+    check(masked.appliesTo(PatchDarwinBigSur) && !masked.appliesTo(18) &&
+              !masked.appliesTo(22),
+          "Darwin range");
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &out) {
+    auto *file = fopen(path, "rb");
+    if (!file) return false;
+    fseek(file, 0, SEEK_END);
+    out.resize(static_cast<size_t>(ftell(file)));
+    fseek(file, 0, SEEK_SET);
+    bool read = fread(out.data(), 1, out.size(), file) == out.size();
+    fclose(file);
+    return read;
+}
+
+static void checkKext(const char *arg, uint32_t darwin) {
+    auto *path = strchr(arg, '=');
+    if (!path) {
+        printf("FAILED: %s is not bundle-id=path\n", arg);
+        ok = false;
+        return;
+    }
+    std::string id(arg, path++ - arg);
+    std::vector<uint8_t> file;
+    size_t offset, size;
+    if (!readFile(path, file) || !x86Slice(file, offset, size)) {
+        printf("FAILED: no x86_64 code in %s\n", path);
+        ok = false;
+        return;
+    }
+    printf("%s: %zu bytes\n", id.c_str(), size);
+    for (auto &patch : radPatches) {
+        if (id != patch.kext) continue;
+        if (darwin && !patch.appliesTo(darwin)) {
+            printf("  %-28s not for Darwin %u\n", patch.name, darwin);
+            continue;
+        }
+        auto result = applyAll(patch, file.data() + offset, size);
+        const char *status = result.failed(patch) ? "MISSING"
+                             : result.matches != patch.expected ? "differs"
+                                                             : "ok";
+        printf("  %-28s %3u matches, %u expected, %8.3f ms  %s\n", patch.name,
+               result.matches, patch.expected, result.ns / 1e6, status);
+        if (result.failed(patch)) ok = false;
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t darwin = 0;
+    std::vector<const char *> kexts;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--darwin") && i + 1 < argc)
+            darwin = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+        else
+            kexts.push_back(argv[i]);
+    }
+    listManifest();
+    if (kexts.empty()) checkSynthetic();
+    for (auto *kext : kexts) checkKext(kext, darwin);
+    return report();
+}
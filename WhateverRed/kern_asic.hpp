@@ -0,0 +1,127 @@
+//
+//  kern_asic.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_asic_hpp
+#define kern_asic_hpp
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kern_fw.hpp"
+
+static constexpr size_t AsicFwCandidates = 3;
+
+/**
+ *  Firmware set of an APU, by PCI device ID and revision range (inclusive).
+ *  Each kind lists candidate names in order of preference, the first one
+ *  embedded wins; the later ones are the closest relatives we ship.
+ *  amdgpu tells Raven2 from Raven and Picasso by the internal ASIC revision,
+ *  which is only known once CAIL is up, long after the firmware set has to
+ *  be chosen; the PCI revision does not say, so those rows cover all of
+ *  them until a revision split is known.
+ */
+struct AsicEntry {
+    uint16_t deviceId;
+    uint8_t revisionMin, revisionMax;
+    const char *name;
+    const char *vcn[AsicFwCandidates];
+    const char *asd[AsicFwCandidates];
+};
+
+static constexpr AsicEntry asicTable[] = {
+    {0x15DD, 0x00, 0xFF, "Raven", {"ativvaxy_rv.dat"}, {"raven_asd.bin"}},
+    {0x15D8,
+     0x00,
+     0xFF,
+     "Picasso",
+     {"ativvaxy_rv.dat"},
+     {"picasso_asd.bin", "raven_asd.bin"}},
+    // Renoir and its derivatives got Raven's firmware before the table;
+    // they still do unless their own is embedded.
+    {0x1636,
+     0x00,
+     0xFF,
+     "Renoir",
+     {"ativvaxy_rn.dat", "ativvaxy_rv.dat"},
+     {"renoir_asd.bin", "raven_asd.bin"}},
+    {0x164C,
+     0x00,
+     0xFF,
+     "Lucienne",
+     {"ativvaxy_rn.dat", "ativvaxy_rv.dat"},
+     {"renoir_asd.bin", "raven_asd.bin"}},
+    {0x1638,
+     0x00,
+     0xFF,
+     "Green Sardine",
+     {"ativvaxy_rn.dat", "ativvaxy_rv.dat"},
+     {"green_sardine_asd.bin", "renoir_asd.bin", "raven_asd.bin"}},
+};
+
+/**
+ *  Used for device IDs missing from the table, as before the table existed
+ */
+static constexpr const AsicEntry &asicDefault = asicTable[0];
+
+/**
+ *  Compile-time check: sane ranges, no device and revision in two entries,
+ *  and at least one candidate of each kind.
+ */
+template <size_t N>
+static constexpr bool asicTableValid(const AsicEntry (&table)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if (table[i].revisionMin > table[i].revisionMax || !table[i].vcn[0] ||
+            !table[i].asd[0])
+            return false;
+        for (size_t j = 0; j < i; j++)
+            if (table[i].deviceId == table[j].deviceId &&
+                table[i].revisionMin <= table[j].revisionMax &&
+                table[j].revisionMin <= table[i].revisionMax)
+                return false;
+    }
+    return true;
+}
+
+static_assert(asicTableValid(asicTable), "overlapping or empty ASIC entry");
+
+template <size_t N>
+static inline const AsicEntry *asicLookup(const AsicEntry (&table)[N],
+                                          uint16_t deviceId,
+                                          uint8_t revision) {
+    for (auto &entry : table)
+        if (entry.deviceId == deviceId && revision >= entry.revisionMin &&
+            revision <= entry.revisionMax)
+            return &entry;
+    return nullptr;
+}
+
+/**
+ *  Firmware resolved for the APU in use. A null blob means none of the
+ *  candidates is embedded.
+ */
+struct AsicFirmware {
+    const AsicEntry *asic;
+    bool known;
+    const FwDesc *vcn;
+    const FwDesc *asd;
+};
+
+static inline const FwDesc *asicPick(
+    const char *const (&names)[AsicFwCandidates]) {
+    for (auto *name : names)
+        if (name)
+            if (auto *desc = findFW(name)) return desc;
+    return nullptr;
+}
+
+static inline AsicFirmware asicResolve(uint16_t deviceId, uint8_t revision) {
+    auto *asic = asicLookup(asicTable, deviceId, revision);
+    bool known = asic != nullptr;
+    if (!asic) asic = &asicDefault;
+    return {asic, known, asicPick(asic->vcn), asicPick(asic->asd)};
+}
+
+#endif /* kern_asic_hpp */
@@ -0,0 +1,116 @@
+//
+//  kern_crc32c.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_crc32c_hpp
+#define kern_crc32c_hpp
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ *  Slicing-by-8 tables for the reflected Castagnoli polynomial
+ */
+struct CRC32CTables {
+    uint32_t t[8][256];
+
+    constexpr CRC32CTables() : t() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++)
+            for (int k = 1; k < 8; k++)
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+    }
+};
+
+inline constexpr CRC32CTables crc32cTables{};
+
+/**
+ *  CRC32C (Castagnoli), as recorded per firmware blob by
+ *  Scripts/GenerateFirmware.py. Uses the SSE4.2 crc32 instruction when the
+ *  CPU has it, and slicing-by-8 tables built at compile time otherwise. The
+ *  instruction works on general purpose registers, so no vector state is
+ *  touched in the kernel. No allocations and no libc beyond memcpy, so the
+ *  kext and host tools share it.
+ */
+class CRC32C {
+   public:
+    static uint32_t compute(const void *data, size_t size, uint32_t crc = 0) {
+        auto *p = static_cast<const uint8_t *>(data);
+#if defined(__x86_64__)
+        if (hasHardware()) return ~hardware(p, size, ~crc);
+#endif
+        return ~software(p, size, ~crc);
+    }
+
+    static uint32_t computeSoftware(const void *data, size_t size,
+                                    uint32_t crc = 0) {
+        return ~software(static_cast<const uint8_t *>(data), size, ~crc);
+    }
+
+    /**
+     *  SSE4.2 support, from CPUID leaf 1. Not cached: callers checksum whole
+     *  firmware blobs, next to which one CPUID is noise.
+     */
+    static bool hasHardware() {
+#if defined(__x86_64__)
+        uint32_t eax = 1, ebx, ecx = 0, edx;
+        asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+        return ecx & (1U << 20);
+#else
+        return false;
+#endif
+    }
+
+#if defined(__x86_64__)
+    [[gnu::target("sse4.2")]] static uint32_t hardware(const uint8_t *p,
+                                                       size_t size,
+                                                       uint32_t crc) {
+        while (size && (reinterpret_cast<uintptr_t>(p) & 7)) {
+            crc = __builtin_ia32_crc32qi(crc, *p++);
+            size--;
+        }
+        uint64_t crc64 = crc;
+        for (; size >= 32; p += 32, size -= 32) {
+            crc64 = __builtin_ia32_crc32di(crc64, read64(p));
+            crc64 = __builtin_ia32_crc32di(crc64, read64(p + 8));
+            crc64 = __builtin_ia32_crc32di(crc64, read64(p + 16));
+            crc64 = __builtin_ia32_crc32di(crc64, read64(p + 24));
+        }
+        for (; size >= 8; p += 8, size -= 8)
+            crc64 = __builtin_ia32_crc32di(crc64, read64(p));
+        crc = static_cast<uint32_t>(crc64);
+        while (size--) crc = __builtin_ia32_crc32qi(crc, *p++);
+        return crc;
+    }
+#endif
+
+   private:
+    static uint64_t read64(const uint8_t *p) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint32_t software(const uint8_t *p, size_t size, uint32_t crc) {
+        auto &t = crc32cTables.t;
+        for (; size >= 8; p += 8, size -= 8) {
+            uint64_t v = read64(p) ^ crc;
+            crc = t[7][v & 0xFF] ^ t[6][(v >> 8) & 0xFF] ^
+                  t[5][(v >> 16) & 0xFF] ^ t[4][(v >> 24) & 0xFF] ^
+                  t[3][(v >> 32) & 0xFF] ^ t[2][(v >> 40) & 0xFF] ^
+                  t[1][(v >> 48) & 0xFF] ^ t[0][v >> 56];
+        }
+        while (size--) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+        return crc;
+    }
+};
+
+#endif /* kern_crc32c_hpp */
@@ -8,29 +8,557 @@
 
 #ifndef kern_fw_h
 #define kern_fw_h
-#include <libkern/c++/OSData.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#ifdef KERNEL
+#include <Headers/kern_file.hpp>
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSData.h>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+
+#include "kern_crc32c.hpp"
+#include "kern_fwheader.hpp"
+#include "kern_lz4.hpp"
+
+/**
+ *  Firmware ID: FNV-1a of the file name. Hot paths take it as a template
+ *  argument, so the name never reaches the binary.
+ */
+static constexpr uint32_t fwId(const char *name) {
+    uint32_t hash = 0x811C9DC5;
+    while (*name) {
+        hash ^= static_cast<uint8_t>(*name++);
+        hash *= 0x01000193;
+    }
+    return hash;
+}
 
+/**
+ *  Unique piece of the embedded firmware, at offset in fwChunkData: an LZ4
+ *  block of packedSize bytes that decompresses to size bytes, or the bytes
+ *  themselves if both are equal. Chunks end at content-defined boundaries,
+ *  so regions shared by several blobs are stored once.
+ */
+struct FwChunk {
+    uint32_t offset;
+    uint32_t packedSize;
+    uint32_t size;
+};
+
+/**
+ *  Embedded blob: the concatenation of chunkCount chunks, listed by index
+ *  into fwChunks. inPlace is the offset of the blob in fwChunkData if it is
+ *  stored there contiguously and uncompressed, -1 if it has to be
+ *  reassembled. crc is the CRC32C of the firmware itself.
+ */
 struct FwDesc {
     const char *name;
-    const unsigned char *var;
+    const int32_t inPlace;
+    const uint16_t *chunks;
+    const int chunkCount;
     const int size;
+    const uint32_t id;
+    const uint32_t crc;
 };
 
-#define RAD_FW(fw_name, fw_var, fw_size) \
-    .name = fw_name, .var = fw_var, .size = fw_size
+#define RAD_FW(fw_name, fw_in_place, fw_chunks, fw_chunk_count, fw_size, \
+               fw_crc)                                                  \
+    .name = fw_name, .inPlace = fw_in_place, .chunks = fw_chunks,       \
+    .chunkCount = fw_chunk_count, .size = fw_size, .id = fwId(fw_name), \
+    .crc = fw_crc
 
+/**
+ *  Generated by Scripts/GenerateFirmware.py, sorted by name, with a perfect
+ *  hash of the IDs (hash and displace). An ID picks a bucket; fwDisplace of
+ *  the bucket is either a seed for rehashing the ID into its slot or, if
+ *  negative, the slot itself. fwIndex maps slots to fwList indices, or -1.
+ *  fwIndexSize is a power of two. The chunks themselves are pulled in with
+ *  .incbin by the generated kern_fw_data.S.
+ */
 extern const struct FwDesc fwList[];
 extern const int fwNumber;
+extern "C" const unsigned char fwChunkData[];
+extern const uint32_t fwChunkDataSize;
+extern const struct FwChunk fwChunks[];
+extern const int fwChunkNumber;
+extern const uint32_t fwIndexSize;
+extern const int32_t fwDisplace[];
+extern const int16_t fwIndex[];
+extern const uint8_t *fwCache[];
+extern uint8_t fwVerified[];
+extern const struct FwDiskCopy *fwDiskCache[];
+
+static constexpr uint32_t fwMix(uint32_t id, uint32_t seed) {
+    uint32_t h = (id ^ seed) * 0x9E3779B1;
+    h ^= h >> 15;
+    h *= 0x85EBCA77;
+    return h ^ (h >> 13);
+}
+
+static constexpr uint32_t fwSlot(uint32_t id, const int32_t *displace,
+                                 uint32_t size) {
+    auto d = displace[fwMix(id, 0) & (size - 1)];
+    return d < 0 ? static_cast<uint32_t>(-d - 1)
+                 : fwMix(id, static_cast<uint32_t>(d)) & (size - 1);
+}
+
+/**
+ *  Compile-time check of the generated index: unique IDs, and every entry
+ *  found in its own slot.
+ */
+template <size_t N, size_t S>
+static constexpr bool fwIndexValid(const FwDesc (&list)[N],
+                                   const int32_t (&displace)[S],
+                                   const int16_t (&index)[S]) {
+    if (S & (S - 1)) return false;
+    for (size_t i = 0; i < N; i++) {
+        if (list[i].id != fwId(list[i].name)) return false;
+        for (size_t j = 0; j < i; j++)
+            if (list[i].id == list[j].id) return false;
+        if (index[fwSlot(list[i].id, displace, S)] != static_cast<int>(i))
+            return false;
+    }
+    return true;
+}
+
+/**
+ *  Compile-time check of the chunk lists: every chunk within the pool, the
+ *  chunks of a blob adding up to its size, and in-place blobs really lying
+ *  uncompressed and contiguous in the pool.
+ */
+template <size_t N, size_t C>
+static constexpr bool fwChunksValid(const FwDesc (&list)[N],
+                                    const FwChunk (&chunks)[C],
+                                    uint32_t dataSize) {
+    for (auto &chunk : chunks)
+        if (chunk.offset > dataSize ||
+            chunk.packedSize > dataSize - chunk.offset ||
+            chunk.packedSize > chunk.size)
+            return false;
+    for (auto &desc : list) {
+        uint64_t size = 0;
+        int64_t next = desc.inPlace;
+        for (int i = 0; i < desc.chunkCount; i++) {
+            if (desc.chunks[i] >= C) return false;
+            auto &chunk = chunks[desc.chunks[i]];
+            if (desc.inPlace >= 0) {
+                if (chunk.offset != next || chunk.packedSize != chunk.size)
+                    return false;
+                next += chunk.size;
+            }
+            size += chunk.size;
+        }
+        if (size != static_cast<uint64_t>(desc.size)) return false;
+    }
+    return true;
+}
+
+/**
+ *  Read-only view of an embedded firmware blob. The bytes are either part of
+ *  the kext image or its one reassembled copy, so a view stays valid
+ *  forever and is never copied or freed.
+ */
+struct FwView {
+    const uint8_t *data;
+    size_t size;
+
+    explicit operator bool() const { return data != nullptr; }
+};
+
+/**
+ *  Firmware access accounting. In-place blobs are viewed as they are; the
+ *  others are reassembled from their chunks once, on first use, into a
+ *  buffer kept for the lifetime of the kext. The OSData wrappers of
+ *  getFWDataByName are likewise created at most once per blob.
+ */
+struct FwStats {
+    uint64_t lookups;
+    uint64_t misses;
+    uint64_t reassemblies;
+    uint64_t reassemblyFailures;
+    uint64_t verifications;
+    uint64_t verifyFailures;
+    uint64_t objects;
+    uint64_t diskLoads;
+    uint64_t diskFailures;
+    uint64_t diskRejected;
+    uint64_t bytesAllocated;
+    uint64_t bytesLive;
+};
+
+inline FwStats fwStats{};
+
+static inline void *fwAlloc(size_t size) {
+#ifdef KERNEL
+    return IOMalloc(size);
+#else
+    return malloc(size);
+#endif
+}
+
+static inline void fwFree(void *data, size_t size) {
+#ifdef KERNEL
+    IOFree(data, size);
+#else
+    static_cast<void>(size);
+    free(data);
+#endif
+}
+
+static inline void fwAccount(size_t size) {
+    __atomic_fetch_add(&fwStats.bytesAllocated, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&fwStats.bytesLive, size, __ATOMIC_RELAXED);
+}
+
+/**
+ *  Reassemble desc into dst, desc->size bytes: stored chunks are copied,
+ *  compressed ones decompressed straight into place.
+ */
+static inline bool fwAssemble(const FwDesc *desc, uint8_t *dst) {
+    size_t size = static_cast<size_t>(desc->size), done = 0;
+    for (int i = 0; i < desc->chunkCount; i++) {
+        auto &chunk = fwChunks[desc->chunks[i]];
+        auto *src = fwChunkData + chunk.offset;
+        if (chunk.size > size - done) return false;
+        if (chunk.packedSize == chunk.size)
+            memcpy(dst + done, src, chunk.size);
+        else if (LZ4Block::decompress(src, chunk.packedSize, dst + done,
+                                      chunk.size) != chunk.size)
+            return false;
+        done += chunk.size;
+    }
+    return done == size;
+}
+
+/**
+ *  The firmware bytes of desc, reassembling them on first use. Racing
+ *  callers may both reassemble; one copy wins and the other is freed.
+ */
+static inline const uint8_t *fwBytes(const FwDesc *desc) {
+    if (desc->inPlace >= 0) return fwChunkData + desc->inPlace;
+
+    auto *cache = &fwCache[desc - fwList];
+    auto *data = __atomic_load_n(cache, __ATOMIC_ACQUIRE);
+    if (data) return data;
+
+    size_t size = static_cast<size_t>(desc->size);
+    auto *buffer = static_cast<uint8_t *>(fwAlloc(size));
+    if (!buffer) return nullptr;
+    if (!fwAssemble(desc, buffer)) {
+        __atomic_fetch_add(&fwStats.reassemblyFailures, 1, __ATOMIC_RELAXED);
+        fwFree(buffer, size);
+        return nullptr;
+    }
+    const uint8_t *expected = nullptr;
+    if (!__atomic_compare_exchange_n(cache, &expected, buffer, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        fwFree(buffer, size);
+        return expected;
+    }
+    __atomic_fetch_add(&fwStats.reassemblies, 1, __ATOMIC_RELAXED);
+    fwAccount(size);
+    return buffer;
+}
+
+/**
+ *  On-disk overrides. With a directory configured (wredfwdir), a blob is
+ *  read from <dir>/<name> the first time it is looked up and that copy is
+ *  kept for the lifetime of the kext. A missing, unreadable or oversized
+ *  file falls back to the embedded blob, as does one whose header does not
+ *  match the embedded one (fwCompatible). Either way the first answer sticks,
+ *  so a blob never changes under a driver that already got it.
+ */
+struct FwDiskCopy {
+    const uint8_t *data;
+    size_t size;
+};
+
+/**
+ *  File access used by the loader. open returns the file and its size, or
+ *  nullptr if there is none. read may return fewer bytes than asked for,
+ *  and 0 on end of file or error. Replaceable, to check the loader on the
+ *  host.
+ */
+struct FwFileOps {
+    void *(*open)(const char *path, size_t *size);
+    size_t (*read)(void *file, size_t offset, void *buffer, size_t size);
+    void (*close)(void *file);
+};
+
+static constexpr size_t FwDiskPathSize = 128;
+static constexpr size_t FwDiskChunk = 64 * 1024;
+static constexpr size_t FwDiskMaxSize = 16 * 1024 * 1024;
+
+#ifdef KERNEL
+struct FwVnodeFile {
+    vnode_t vnode;
+    vfs_context_t ctxt;
+};
+
+static inline void *fwVnodeOpen(const char *path, size_t *size) {
+    auto *file = static_cast<FwVnodeFile *>(IOMalloc(sizeof(FwVnodeFile)));
+    if (!file) return nullptr;
+    file->vnode = NULLVP;
+    file->ctxt = vfs_context_create(nullptr);
+    if (!file->ctxt || vnode_lookup(path, 0, &file->vnode, file->ctxt)) {
+        if (file->ctxt) vfs_context_rele(file->ctxt);
+        IOFree(file, sizeof(FwVnodeFile));
+        return nullptr;
+    }
+    *size = FileIO::readFileSize(file->vnode, file->ctxt);
+    return file;
+}
+
+static inline size_t fwVnodeRead(void *file, size_t offset, void *buffer,
+                                 size_t size) {
+    auto *vnodeFile = static_cast<FwVnodeFile *>(file);
+    return FileIO::readFileData(buffer, static_cast<off_t>(offset), size,
+                                vnodeFile->vnode, vnodeFile->ctxt)
+               ? 0
+               : size;
+}
+
+static inline void fwVnodeClose(void *file) {
+    auto *vnodeFile = static_cast<FwVnodeFile *>(file);
+    vnode_put(vnodeFile->vnode);
+    vfs_context_rele(vnodeFile->ctxt);
+    IOFree(vnodeFile, sizeof(FwVnodeFile));
+}
+
+static constexpr FwFileOps fwDefaultFileOps = {fwVnodeOpen, fwVnodeRead,
+                                               fwVnodeClose};
+#else
+static inline void *fwStdioOpen(const char *path, size_t *size) {
+    auto *file = fopen(path, "rb");
+    if (!file) return nullptr;
+    long end = fseek(file, 0, SEEK_END) ? -1 : ftell(file);
+    if (end < 0) {
+        fclose(file);
+        return nullptr;
+    }
+    *size = static_cast<size_t>(end);
+    return file;
+}
+
+static inline size_t fwStdioRead(void *file, size_t offset, void *buffer,
+                                 size_t size) {
+    auto *stream = static_cast<FILE *>(file);
+    if (fseek(stream, static_cast<long>(offset), SEEK_SET)) return 0;
+    return fread(buffer, 1, size, stream);
+}
+
+static inline void fwStdioClose(void *file) {
+    fclose(static_cast<FILE *>(file));
+}
+
+static constexpr FwFileOps fwDefaultFileOps = {fwStdioOpen, fwStdioRead,
+                                               fwStdioClose};
+#endif
+
+inline char fwDiskDir[FwDiskPathSize];
+inline const FwFileOps *fwFileOps = &fwDefaultFileOps;
+// Cached answer for blobs that are served from the embedded copy
+inline const FwDiskCopy fwDiskNone{};
+
+/**
+ *  Set the override directory. Must happen before the first lookup; false
+ *  if the path does not fit.
+ */
+static inline bool fwDiskConfigure(const char *dir) {
+    size_t len = dir ? strlen(dir) : FwDiskPathSize;
+    if (len >= FwDiskPathSize) return false;
+    memcpy(fwDiskDir, dir, len + 1);
+    return true;
+}
+
+/**
+ *  Read a whole file into one buffer of its exact size, FwDiskChunk bytes
+ *  at a time, so no single I/O or temporary copy scales with the file.
+ */
+static inline const FwDiskCopy *fwDiskRead(const char *path) {
+    size_t size = 0;
+    auto *file = fwFileOps->open(path, &size);
+    if (!file) return nullptr;
+
+    FwDiskCopy *copy = nullptr;
+    size_t total = sizeof(FwDiskCopy) + size;
+    if (size && size <= FwDiskMaxSize)
+        copy = static_cast<FwDiskCopy *>(fwAlloc(total));
+    size_t done = 0;
+    if (copy) {
+        auto *data = reinterpret_cast<uint8_t *>(copy + 1);
+        while (done < size) {
+            size_t chunk = size - done;
+            if (chunk > FwDiskChunk) chunk = FwDiskChunk;
+            size_t n = fwFileOps->read(file, done, data + done, chunk);
+            if (!n || n > chunk) break;
+            done += n;
+        }
+        copy->data = data;
+        copy->size = size;
+    }
+    fwFileOps->close(file);
+
+    if (!copy || done != size) {
+        if (copy) fwFree(copy, total);
+        __atomic_fetch_add(&fwStats.diskFailures, 1, __ATOMIC_RELAXED);
+        return nullptr;
+    }
+    __atomic_fetch_add(&fwStats.diskLoads, 1, __ATOMIC_RELAXED);
+    return copy;
+}
 
-static inline OSData *getFWDescByName(const char *name) {
-    for (int i = 0; i < fwNumber; i++) {
-        if (strcmp(fwList[i].name, name) == 0) {
-            FwDesc desc = fwList[i];
-            return OSData::withBytes(desc.var, desc.size);
+/**
+ *  Whether copy can stand in for desc. Blobs without a header we know are
+ *  taken as they are.
+ */
+static inline bool fwDiskCompatible(const FwDesc *desc,
+                                    const FwDiskCopy *copy) {
+    FwInfo known, other;
+    auto *data = fwBytes(desc);
+    if (!data || !fwParse(data, static_cast<size_t>(desc->size), known))
+        return true;
+    return fwParse(copy->data, copy->size, other) &&
+           fwCompatible(known, other);
+}
+
+/**
+ *  The on-disk copy of desc, or nullptr to use the embedded one
+ */
+static inline const FwDiskCopy *fwDiskCopy(const FwDesc *desc) {
+    if (!fwDiskDir[0]) return nullptr;
+    auto *cache = &fwDiskCache[desc - fwList];
+    auto *copy = __atomic_load_n(cache, __ATOMIC_ACQUIRE);
+    if (!copy) {
+        char path[FwDiskPathSize + 64];
+        int len = snprintf(path, sizeof(path), "%s/%s", fwDiskDir, desc->name);
+        auto *loaded = len > 0 && static_cast<size_t>(len) < sizeof(path)
+                           ? fwDiskRead(path)
+                           : nullptr;
+        if (loaded && !fwDiskCompatible(desc, loaded)) {
+            __atomic_fetch_add(&fwStats.diskRejected, 1, __ATOMIC_RELAXED);
+            fwFree(const_cast<FwDiskCopy *>(loaded),
+                   sizeof(FwDiskCopy) + loaded->size);
+            loaded = nullptr;
+        }
+        copy = loaded ? loaded : &fwDiskNone;
+        const FwDiskCopy *expected = nullptr;
+        if (!__atomic_compare_exchange_n(cache, &expected, copy, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            if (loaded)
+                fwFree(const_cast<FwDiskCopy *>(loaded),
+                       sizeof(FwDiskCopy) + loaded->size);
+            copy = expected;
+        } else if (loaded) {
+            fwAccount(sizeof(FwDiskCopy) + loaded->size);
         }
     }
-    return NULL;
+    return copy == &fwDiskNone ? nullptr : copy;
+}
+
+enum FwVerifyState : uint8_t {
+    FwUnverified = 0,
+    FwIntact,
+    FwCorrupt,
+};
+
+/**
+ *  Check the firmware bytes of desc against the CRC32C recorded at build
+ *  time. Done once per blob, the result is kept in fwVerified; racing
+ *  callers may both check and reach the same verdict.
+ */
+static inline bool fwVerify(const FwDesc *desc, const uint8_t *data) {
+    auto *state = &fwVerified[desc - fwList];
+    auto known = __atomic_load_n(state, __ATOMIC_ACQUIRE);
+    if (known != FwUnverified) return known == FwIntact;
+
+    bool intact =
+        CRC32C::compute(data, static_cast<size_t>(desc->size)) == desc->crc;
+    __atomic_fetch_add(&fwStats.verifications, 1, __ATOMIC_RELAXED);
+    if (!intact)
+        __atomic_fetch_add(&fwStats.verifyFailures, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(state, intact ? FwIntact : FwCorrupt, __ATOMIC_RELEASE);
+    return intact;
+}
+
+static inline const FwDesc *findFWById(uint32_t id) {
+    __atomic_fetch_add(&fwStats.lookups, 1, __ATOMIC_RELAXED);
+    auto index = fwIndex[fwSlot(id, fwDisplace, fwIndexSize)];
+    if (index >= 0 && fwList[index].id == id) return &fwList[index];
+    __atomic_fetch_add(&fwStats.misses, 1, __ATOMIC_RELAXED);
+    return nullptr;
+}
+
+/**
+ *  Constant time, the name is only compared once its ID has matched.
+ */
+static inline const FwDesc *findFW(const char *name) {
+    auto *desc = findFWById(fwId(name));
+    if (desc && strcmp(desc->name, name) == 0) return desc;
+    if (desc) __atomic_fetch_add(&fwStats.misses, 1, __ATOMIC_RELAXED);
+    return nullptr;
+}
+
+static inline FwView fwView(const FwDesc *desc) {
+    if (!desc) return {nullptr, 0};
+    if (auto *copy = fwDiskCopy(desc)) return {copy->data, copy->size};
+    auto *data = fwBytes(desc);
+    if (!data || !fwVerify(desc, data)) return {nullptr, 0};
+    return {data, static_cast<size_t>(desc->size)};
+}
+
+static inline FwView getFWByName(const char *name) {
+    return fwView(findFW(name));
+}
+
+static inline FwView getFWById(uint32_t id) { return fwView(findFWById(id)); }
+
+/**
+ *  getFW<fwId("name")>(): lookup without any string at run time
+ */
+template <uint32_t Id>
+static inline FwView getFW() {
+    return getFWById(Id);
+}
+
+#ifdef KERNEL
+static constexpr int FwDataCacheSize = 64;
+inline OSData *fwDataCache[FwDataCacheSize];
+
+/**
+ *  OSData over the embedded blob, for APIs that need an OSObject. One
+ *  object per blob is created on first use and kept for the lifetime of the
+ *  kext; the caller borrows it and must not release it.
+ */
+static inline OSData *getFWDataByName(const char *name) {
+    auto *desc = findFW(name);
+    if (!desc) return nullptr;
+    auto index = desc - fwList;
+    if (index >= FwDataCacheSize) return nullptr;
+
+    auto *data = __atomic_load_n(&fwDataCache[index], __ATOMIC_ACQUIRE);
+    if (data) return data;
+    auto view = fwView(desc);
+    if (!view) return nullptr;
+    data = OSData::withBytesNoCopy(const_cast<uint8_t *>(view.data),
+                                   static_cast<unsigned int>(view.size));
+    if (!data) return nullptr;
+    OSData *expected = nullptr;
+    if (!__atomic_compare_exchange_n(&fwDataCache[index], &expected, data,
+                                     false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+        // Another thread won the race, use its object.
+        data->release();
+        return expected;
+    }
+    __atomic_fetch_add(&fwStats.objects, 1, __ATOMIC_RELAXED);
+    fwAccount(sizeof(OSData));
+    return data;
 }
+#endif
 
 #endif /* kern_fw_h */
@@ -0,0 +1,197 @@
+//
+//  kern_fwheader.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_fwheader_hpp
+#define kern_fwheader_hpp
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ *  amdgpu common firmware header, as in Linux amdgpu_ucode.h. The PSP
+ *  header (version 1.x) adds three words after it: feature version, and
+ *  the SOS offset and size, unused by ASD.
+ */
+struct AmdFwCommonHeader {
+    uint32_t sizeBytes;
+    uint32_t headerSizeBytes;
+    uint16_t headerVersionMajor;
+    uint16_t headerVersionMinor;
+    uint16_t ipVersionMajor;
+    uint16_t ipVersionMinor;
+    uint32_t ucodeVersion;
+    uint32_t ucodeSizeBytes;
+    uint32_t ucodeArrayOffsetBytes;
+    uint32_t crc32;
+} __attribute__((packed));
+
+static_assert(sizeof(AmdFwCommonHeader) == 0x20, "AmdFwCommonHeader size");
+
+/**
+ *  Header of an image signed for the PSP, 0x100 bytes. The body follows,
+ *  then trailerSize bytes outside the signed range, then the signature,
+ *  imageSize bytes in all. Bare images, as loaded by the macOS firmware
+ *  directory (ativvaxy_rv.dat), start with a "POWERED BY AMD" banner;
+ *  ones wrapped by an amdgpu header (raven_asd.bin) carry "$PS1" at 0x10.
+ */
+struct PspImageHeader {
+    uint8_t banner[16];
+    uint32_t magic;
+    uint32_t signedSize;
+    uint32_t encrypted;
+    uint8_t reserved1[20];
+    uint32_t isSigned;
+    uint32_t reserved2;
+    uint8_t keyFingerprint[16];
+    uint32_t compressed;
+    uint8_t reserved3[20];
+    uint32_t version;
+    uint8_t reserved4[8];
+    uint32_t imageSize;
+    uint32_t trailerSize;
+    uint8_t reserved5[140];
+} __attribute__((packed));
+
+static_assert(sizeof(PspImageHeader) == 0x100, "PspImageHeader size");
+static_assert(offsetof(PspImageHeader, keyFingerprint) == 0x38,
+              "PspImageHeader layout");
+static_assert(offsetof(PspImageHeader, imageSize) == 0x6C,
+              "PspImageHeader layout");
+
+static constexpr uint32_t PspMagic = 0x31535024;  // "$PS1"
+static constexpr char PspBanner[] = "POWERED BY AMD\r\n";
+
+enum FwFormat : uint8_t {
+    FwFormatUnknown = 0,
+    FwFormatAmdgpu,    // amdgpu header, with or without a PSP image inside
+    FwFormatPspImage,  // bare PSP image
+};
+
+/**
+ *  Parsed blob layout. Offsets are from the start of the blob. For amdgpu
+ *  blobs, the payload is the ucode array; for bare images, the signed body.
+ *  The signature fields are 0 if no PSP image could be found.
+ */
+struct FwInfo {
+    FwFormat format;
+    uint16_t headerVersionMajor, headerVersionMinor;
+    uint16_t ipVersionMajor, ipVersionMinor;
+    uint32_t ucodeVersion;
+    uint32_t headerSize;
+    uint32_t payloadOffset, payloadSize;
+    uint32_t imageOffset, imageMagic, imageVersion, signedSize;
+    uint32_t signatureOffset, signatureSize;
+    bool isSigned, encrypted, compressed;
+    uint8_t keyFingerprint[16];
+    const char *error;
+};
+
+static inline const char *fwFormatName(FwFormat format) {
+    switch (format) {
+        case FwFormatAmdgpu:
+            return "amdgpu";
+        case FwFormatPspImage:
+            return "psp image";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ *  Fill in the PSP image part of info from an image of size bytes at
+ *  offset. False if it is not one.
+ */
+static inline bool fwParsePspImage(const uint8_t *data, size_t offset,
+                                   size_t size, FwInfo &info) {
+    PspImageHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data + offset, sizeof(header));
+    uint64_t end = uint64_t{sizeof(header)} + header.signedSize +
+                   header.trailerSize;
+    if (header.imageSize != size || !header.signedSize || end > size)
+        return false;
+    // RSA-2048 or RSA-4096 when signed, nothing otherwise
+    uint32_t signature = header.imageSize - static_cast<uint32_t>(end);
+    if (header.isSigned ? signature != 0x100 && signature != 0x200
+                        : signature != 0)
+        return false;
+
+    info.imageOffset = static_cast<uint32_t>(offset);
+    info.imageMagic = header.magic;
+    info.imageVersion = header.version;
+    info.signedSize = header.signedSize;
+    info.signatureOffset = static_cast<uint32_t>(offset + end);
+    info.signatureSize = signature;
+    info.isSigned = header.isSigned != 0;
+    info.encrypted = header.encrypted != 0;
+    info.compressed = header.compressed != 0;
+    memcpy(info.keyFingerprint, header.keyFingerprint,
+           sizeof(info.keyFingerprint));
+    return true;
+}
+
+/**
+ *  Parse the header of an AMD firmware blob. On failure, info.error says
+ *  why.
+ */
+static inline bool fwParse(const uint8_t *data, size_t size, FwInfo &info) {
+    memset(&info, 0, sizeof(info));
+    if (!data || size < sizeof(PspImageHeader) || size > UINT32_MAX) {
+        info.error = "too small for a firmware header";
+        return false;
+    }
+
+    AmdFwCommonHeader common;
+    memcpy(&common, data, sizeof(common));
+    if (common.sizeBytes == size) {
+        uint64_t payloadEnd =
+            uint64_t{common.ucodeArrayOffsetBytes} + common.ucodeSizeBytes;
+        if (common.headerSizeBytes < sizeof(common) ||
+            common.headerSizeBytes > common.ucodeArrayOffsetBytes ||
+            !common.ucodeSizeBytes || payloadEnd > size) {
+            info.error = "amdgpu header with an inconsistent layout";
+            return false;
+        }
+        info.format = FwFormatAmdgpu;
+        info.headerVersionMajor = common.headerVersionMajor;
+        info.headerVersionMinor = common.headerVersionMinor;
+        info.ipVersionMajor = common.ipVersionMajor;
+        info.ipVersionMinor = common.ipVersionMinor;
+        info.ucodeVersion = common.ucodeVersion;
+        info.headerSize = common.headerSizeBytes;
+        info.payloadOffset = common.ucodeArrayOffsetBytes;
+        info.payloadSize = common.ucodeSizeBytes;
+        fwParsePspImage(data, info.payloadOffset, info.payloadSize, info);
+        return true;
+    }
+
+    if (memcmp(data, PspBanner, sizeof(PspBanner) - 1) ||
+        !fwParsePspImage(data, 0, size, info)) {
+        info.error = "neither an amdgpu header nor a PSP image";
+        return false;
+    }
+    info.format = FwFormatPspImage;
+    info.ucodeVersion = info.imageVersion;
+    info.headerSize = sizeof(PspImageHeader);
+    info.payloadOffset = sizeof(PspImageHeader);
+    info.payloadSize = info.signedSize;
+    return true;
+}
+
+/**
+ *  Whether a replacement can be handed to the same loader as a known good
+ *  blob: same container, same IP, and a PSP image where there was one.
+ */
+static inline bool fwCompatible(const FwInfo &known, const FwInfo &other) {
+    return known.format == other.format &&
+           known.ipVersionMajor == other.ipVersionMajor &&
+           known.ipVersionMinor == other.ipVersionMinor &&
+           (!known.signatureSize) == (!other.signatureSize) &&
+           known.isSigned == other.isSigned;
+}
+
+#endif /* kern_fwheader_hpp */
@@ -0,0 +1,129 @@
+//
+//  kern_fwobject.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_fwobject_hpp
+#define kern_fwobject_hpp
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  How firmware objects are made and reference counted: AMDFirmware and
+ *  OSObject in the kext, mocks in Scripts/FwObjectCacheCheck.cpp.
+ */
+struct FwObjectOps {
+    void *(*create)(const void *data, uint32_t size, uint32_t flags,
+                    const char *name);
+    void (*retain)(void *object);
+    void (*release)(void *object);
+};
+
+/**
+ *  Firmware objects created for a firmware directory, one per device type,
+ *  kept across controller restarts instead of being rebuilt from the blob
+ *  every time the X5000 stack reinitialises. The cache holds one reference
+ *  of its own; get() hands out another, which the caller passes on exactly
+ *  like a fresh create() result. An entry is rebuilt if the blob it was made
+ *  from changes.
+ *
+ *  Objects belong to the kext instance that created them (identified by its
+ *  load address): if it is ever loaded again, the old objects are forgotten
+ *  rather than released, as their code went away with it.
+ *
+ *  get() never waits: if another thread is inside the cache, the object is
+ *  created uncached. attach() and flush() are rare and do wait.
+ */
+class FwObjectCache {
+   public:
+    static constexpr size_t Slots = 16;
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t createFailures;
+        uint64_t bypassed;
+        uint64_t dropped;
+    };
+
+    void attach(const FwObjectOps *ops, uintptr_t owner) {
+        lock();
+        if (this->owner != owner) {
+            for (auto &entry : entries)
+                if (entry.object) {
+                    entry = {};
+                    stats.dropped++;
+                }
+            this->owner = owner;
+        }
+        this->ops = ops;
+        __atomic_clear(&busy, __ATOMIC_RELEASE);
+    }
+
+    /**
+     *  A reference to the object for deviceType made from size bytes at data,
+     *  or nullptr if it could not be created.
+     */
+    void *get(uint32_t deviceType, const void *data, uint32_t size,
+              uint32_t flags, const char *name) {
+        if (!ops) return nullptr;
+        if (deviceType >= Slots ||
+            __atomic_test_and_set(&busy, __ATOMIC_ACQUIRE)) {
+            __atomic_fetch_add(&stats.bypassed, 1, __ATOMIC_RELAXED);
+            return ops->create(data, size, flags, name);
+        }
+
+        auto &entry = entries[deviceType];
+        if (entry.object && entry.data == data && entry.size == size &&
+            entry.flags == flags) {
+            stats.hits++;
+        } else {
+            stats.misses++;
+            if (entry.object) ops->release(entry.object);
+            entry = {data, size, flags, ops->create(data, size, flags, name)};
+            if (!entry.object) stats.createFailures++;
+        }
+        auto *object = entry.object;
+        if (object) ops->retain(object);
+        __atomic_clear(&busy, __ATOMIC_RELEASE);
+        return object;
+    }
+
+    /**
+     *  Drop the cache's references, when the kext using the cache goes away.
+     *  The owner is still loaded then: a kext is not unloaded while
+     *  instances of its classes exist, and these references keep some.
+     */
+    void flush() {
+        lock();
+        for (auto &entry : entries) {
+            if (entry.object) ops->release(entry.object);
+            entry = {};
+        }
+        __atomic_clear(&busy, __ATOMIC_RELEASE);
+    }
+
+    const Stats &getStats() const { return stats; }
+
+   private:
+    void lock() {
+        while (__atomic_test_and_set(&busy, __ATOMIC_ACQUIRE)) {}
+    }
+
+    struct Entry {
+        const void *data;
+        uint32_t size;
+        uint32_t flags;
+        void *object;
+    };
+
+    Entry entries[Slots]{};
+    const FwObjectOps *ops{};
+    uintptr_t owner{};
+    bool busy{};
+    Stats stats{};
+};
+
+#endif /* kern_fwobject_hpp */
@@ -0,0 +1,475 @@
+//
+//  kern_hook.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_hook_hpp
+#define kern_hook_hpp
+#include <stddef.h>
+#include <stdint.h>
+#ifdef KERNEL
+#include <mach/mach_types.h>
+#endif
+
+#include "kern_netlevel.hpp"
+
+/**
+ *  Wrappers generated from the signature of the routed function, for hooks
+ *  that only observe: a compile-time policy decides what happens around the
+ *  call to the original, and the wrapper is nothing but that call when the
+ *  policy does nothing. Hooks that change behaviour stay hand-written.
+ *
+ *      HOOK_DEFINE(TraceGetState, "rad", "getState", RadTrace,
+ *                  uint64_t(void *));
+ *      {"__ZN27AMDRadeonX5000_AMDHWHandler8getStateEv",
+ *       TraceGetState::wrap, TraceGetState::org}
+ *
+ *  Scripts/GenerateNetDbgFormats.py reads HOOK_DEFINE for the formats of
+ *  HookTrace, so the signature has to be spelt out there, and in the same
+ *  types as in the Scripts/HookBench.cpp host build.
+ */
+#define HOOK_DEFINE(tag, mod, fname, policy, ...) \
+    HOOK_NAME(tag##Name, mod, fname);             \
+    using tag = Hook<tag##Name, __VA_ARGS__, policy>
+
+/**
+ *  Module and name of a hook, for policies used directly by hand-written
+ *  wrappers (see HookScope)
+ */
+#define HOOK_NAME(tag, mod, fname)            \
+    struct tag {                              \
+        static constexpr char module[] = mod; \
+        static constexpr char name[] = fname; \
+    }
+
+#ifdef KERNEL
+using HookAddress = mach_vm_address_t;
+#else
+using HookAddress = uint64_t;
+#endif
+
+template <typename Name, typename Sig, typename Policy>
+struct Hook;
+
+template <typename T>
+struct HookIsVoid {
+    static constexpr bool value = false;
+};
+
+template <>
+struct HookIsVoid<void> {
+    static constexpr bool value = true;
+};
+
+template <typename Name, typename Policy, typename R, typename... Args>
+struct Hook<Name, R(Args...), Policy> {
+    using Function = R (*)(Args...);
+    static constexpr const char *module = Name::module;
+    static constexpr const char *name = Name::name;
+
+    /**
+     *  Original, filled in by the patcher
+     */
+    static inline HookAddress org{};
+
+    static R wrap(Args... args) {
+        auto token = Policy::template enter<Hook>(args...);
+        auto original = reinterpret_cast<Function>(org);
+        if constexpr (HookIsVoid<R>::value) {
+            original(args...);
+            Policy::template leave<Hook>(token);
+        } else {
+            R ret = original(args...);
+            Policy::template leave<Hook>(token, ret);
+            return ret;
+        }
+    }
+};
+
+/**
+ *  Arguments and return values as logged: pointers as %p, bool as %d, other
+ *  integers in hex at their width. Must match hook_spec() in
+ *  Scripts/GenerateNetDbgFormats.py.
+ */
+template <typename T>
+static constexpr const void *hookValue(T *v) {
+    return v;
+}
+
+static constexpr int hookValue(bool v) { return v; }
+
+template <typename T>
+static constexpr auto hookValue(T v) {
+    if constexpr (sizeof(T) > 4)
+        return static_cast<unsigned long long>(v);
+    else
+        return static_cast<unsigned int>(v);
+}
+
+static inline uint64_t hookRawValue(const void *v) {
+    return reinterpret_cast<uintptr_t>(v);
+}
+
+static inline uint64_t hookRawValue(unsigned long long v) { return v; }
+
+static inline uint64_t hookRawValue(unsigned int v) { return v; }
+
+static inline uint64_t hookRawValue(int v) {
+    return static_cast<uint64_t>(v);
+}
+
+/**
+ *  A value as logged, widened to 64 bits
+ */
+template <typename T>
+static inline uint64_t hookRaw(T v) {
+    return hookRawValue(hookValue(v));
+}
+
+template <typename T>
+struct HookSpec;
+
+template <>
+struct HookSpec<const void *> {
+    static constexpr char value[] = "%p";
+};
+
+template <>
+struct HookSpec<int> {
+    static constexpr char value[] = "%d";
+};
+
+template <>
+struct HookSpec<unsigned int> {
+    static constexpr char value[] = "0x%X";
+};
+
+template <>
+struct HookSpec<unsigned long long> {
+    static constexpr char value[] = "0x%llX";
+};
+
+template <typename T>
+T hookDeclval();
+
+template <typename T>
+using HookSpecOf = HookSpec<decltype(hookValue(hookDeclval<T>()))>;
+
+/**
+ *  Format string built at compile time
+ */
+template <size_t N>
+struct HookFormat {
+    char data[N]{};
+    size_t size{};
+
+    constexpr void append(const char *s) {
+        while (*s) data[size++] = *s++;
+    }
+};
+
+static constexpr size_t hookLength(const char *s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+/**
+ *  "<module>: <name>(<spec>, ...)\n"
+ */
+template <typename H, typename... Args>
+static constexpr auto hookEnterFormat() {
+    HookFormat<hookLength(H::module) + hookLength(H::name) + 8 +
+               8 * sizeof...(Args)>
+        format;
+    format.append(H::module);
+    format.append(": ");
+    format.append(H::name);
+    format.append("(");
+    const char *specs[] = {"", HookSpecOf<Args>::value...};
+    for (size_t i = 1; i <= sizeof...(Args); i++) {
+        if (i > 1) format.append(", ");
+        format.append(specs[i]);
+    }
+    format.append(")\n");
+    return format;
+}
+
+/**
+ *  "<module>: <name> returned <spec>\n", without the spec for void
+ */
+template <typename H, typename R>
+static constexpr auto hookLeaveFormat() {
+    HookFormat<hookLength(H::module) + hookLength(H::name) + 24> format;
+    format.append(H::module);
+    format.append(": ");
+    format.append(H::name);
+    format.append(" returned");
+    if constexpr (!HookIsVoid<R>::value) {
+        format.append(" ");
+        format.append(HookSpecOf<R>::value);
+    }
+    format.append("\n");
+    return format;
+}
+
+/**
+ *  FNV-1a, the NETDBG format ID
+ */
+static constexpr uint32_t hookFormatId(const char *fmt) {
+    uint32_t hash = 0x811C9DC5;
+    while (*fmt) {
+        hash ^= static_cast<uint8_t>(*fmt++);
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+template <typename H>
+struct HookReturn;
+
+template <typename Name, typename Policy, typename R, typename... Args>
+struct HookReturn<Hook<Name, R(Args...), Policy>> {
+    using Type = R;
+};
+
+/**
+ *  Module and name of up to MaxHooks hooks, numbered in the order of their
+ *  first call, for policies that keep per-hook data in tables.
+ */
+template <size_t MaxHooks>
+class HookSlots {
+   public:
+    static constexpr int32_t NoSlot = -1;
+    static constexpr int32_t Full = -2;
+
+    struct Name {
+        const char *module;
+        const char *name;
+    };
+
+    /**
+     *  The slot of a hook, given its slot variable, taken if still NoSlot.
+     *  Returns (and keeps) Full if all slots are taken.
+     */
+    int32_t claim(int32_t &slot, const char *module, const char *name) {
+        while (__atomic_test_and_set(&busy, __ATOMIC_ACQUIRE)) {}
+        auto index = __atomic_load_n(&slot, __ATOMIC_RELAXED);
+        if (index == NoSlot && count == MaxHooks) {
+            index = Full;
+            __atomic_store_n(&slot, index, __ATOMIC_RELAXED);
+        } else if (index == NoSlot) {
+            index = static_cast<int32_t>(count);
+            names[index] = {module, name};
+            __atomic_store_n(&slot, index, __ATOMIC_RELAXED);
+            __atomic_store_n(&count, count + 1, __ATOMIC_RELEASE);
+        }
+        __atomic_clear(&busy, __ATOMIC_RELEASE);
+        return index;
+    }
+
+    /**
+     *  claim() for a hook type, with its slot kept in slot<H>
+     */
+    template <typename H>
+    int32_t of(int32_t &slot) {
+        auto index = __atomic_load_n(&slot, __ATOMIC_RELAXED);
+        if (__builtin_expect(index == NoSlot, 0))
+            index = claim(slot, H::module, H::name);
+        return index;
+    }
+
+    size_t size() const { return __atomic_load_n(&count, __ATOMIC_ACQUIRE); }
+
+    const Name &operator[](size_t slot) const { return names[slot]; }
+
+   private:
+    Name names[MaxHooks]{};
+    size_t count{};
+    bool busy{};
+};
+
+/**
+ *  Nothing around the call; the reference for the others.
+ */
+struct HookNone {
+    struct Token {};
+
+    template <typename H, typename... Args>
+    static Token enter(Args...) {
+        return {};
+    }
+
+    template <typename H, typename... R>
+    static void leave(Token, R...) {}
+};
+
+/**
+ *  Two policies around the same call, First outermost
+ */
+template <typename First, typename Second>
+struct HookBoth {
+    struct Token {
+        typename First::Token first;
+        typename Second::Token second;
+    };
+
+    template <typename H, typename... Args>
+    static Token enter(Args... args) {
+        auto first = First::template enter<H>(args...);
+        return {first, Second::template enter<H>(args...)};
+    }
+
+    template <typename H, typename... R>
+    static void leave(Token token, R... ret) {
+        Second::template leave<H>(token.second, ret...);
+        First::template leave<H>(token.first, ret...);
+    }
+};
+
+/**
+ *  A policy around the rest of a hand-written wrapper, for hooks that
+ *  cannot be generated. Arguments and return value are not seen.
+ *
+ *      HookScope<RadStats, StatsPspSwInit> scope;
+ */
+template <typename Policy, typename Name>
+class HookScope {
+   public:
+    HookScope() : token(Policy::template enter<Name>()) {}
+    ~HookScope() { Policy::template leave<Name>(token); }
+
+   private:
+    typename Policy::Token token;
+};
+
+/**
+ *  Logs entry with all arguments and the return value at trace level of
+ *  the hook's module, through Sink::log<format ID>(format, args...). With
+ *  trace off for the module, the policy is empty and enabled<H>() is false,
+ *  so such hooks need not be routed at all.
+ */
+template <typename Sink>
+struct HookTrace {
+    struct Token {};
+
+    template <typename H>
+    static constexpr bool enabled() {
+        return netLogEnabled(H::module, NetLogTrace);
+    }
+
+    template <typename H, typename... Args>
+    static Token enter(Args... args) {
+        if constexpr (enabled<H>()) {
+            static constexpr auto format = hookEnterFormat<H, Args...>();
+            Sink::template log<hookFormatId(format.data)>(format.data,
+                                                          hookValue(args)...);
+        }
+        return {};
+    }
+
+    template <typename H, typename... R>
+    static void leave(Token, R... ret) {
+        if constexpr (enabled<H>()) {
+            static constexpr auto format =
+                hookLeaveFormat<H, typename HookReturn<H>::Type>();
+            Sink::template log<hookFormatId(format.data)>(format.data,
+                                                          hookValue(ret)...);
+        }
+    }
+};
+
+/**
+ *  Call count and time spent in the original, per hook
+ */
+struct HookTimeStats {
+    uint64_t calls;
+    uint64_t total;
+    uint64_t max;
+};
+
+/**
+ *  Times the original with Clock::now(), in its units.
+ */
+template <typename Clock>
+struct HookTime {
+    using Token = uint64_t;
+
+    template <typename H>
+    static inline HookTimeStats stats{};
+
+    template <typename H, typename... Args>
+    static Token enter(Args...) {
+        return Clock::now();
+    }
+
+    template <typename H, typename... R>
+    static void leave(Token start, R...) {
+        uint64_t elapsed = Clock::now() - start;
+        auto &s = stats<H>;
+        __atomic_fetch_add(&s.calls, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&s.total, elapsed, __ATOMIC_RELAXED);
+        auto max = __atomic_load_n(&s.max, __ATOMIC_RELAXED);
+        while (elapsed > max &&
+               !__atomic_compare_exchange_n(&s.max, &max, elapsed, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {}
+    }
+};
+
+/**
+ *  One captured call: arguments and return value as logged, widened
+ */
+template <size_t MaxArgs>
+struct HookCall {
+    uint64_t seq;
+    uint32_t argc;
+    uint64_t args[MaxArgs];
+    uint64_t ret;
+};
+
+/**
+ *  Keeps the last Depth calls of each hook, for inspection from a debugger
+ *  or a later dump. Slots are claimed atomically; a reader racing a writer
+ *  may see a torn record, whose seq is then not the latest.
+ */
+template <size_t Depth, size_t MaxArgs = 6>
+struct HookCapture {
+    static_assert(Depth && !(Depth & (Depth - 1)), "Depth: power of two");
+
+    using Call = HookCall<MaxArgs>;
+    using Token = Call *;
+
+    struct Log {
+        uint64_t next;
+        Call calls[Depth];
+    };
+
+    template <typename H>
+    static inline Log log{};
+
+    template <typename H, typename... Args>
+    static Token enter(Args... args) {
+        static_assert(sizeof...(Args) <= MaxArgs, "too many arguments");
+        auto &l = log<H>;
+        auto seq = __atomic_fetch_add(&l.next, 1, __ATOMIC_RELAXED);
+        auto *call = &l.calls[seq & (Depth - 1)];
+        uint64_t values[] = {0, hookRaw(args)...};
+        call->argc = sizeof...(Args);
+        for (size_t i = 0; i < sizeof...(Args); i++)
+            call->args[i] = values[i + 1];
+        call->ret = 0;
+        __atomic_store_n(&call->seq, seq + 1, __ATOMIC_RELEASE);
+        return call;
+    }
+
+    template <typename H, typename... R>
+    static void leave(Token call, R... ret) {
+        uint64_t values[] = {0, hookRaw(ret)...};
+        call->ret = values[sizeof...(R)];
+    }
+};
+
+#endif /* kern_hook_hpp */
@@ -0,0 +1,177 @@
+//
+//  kern_hookstats.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_hookstats_hpp
+#define kern_hookstats_hpp
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kern_hook.hpp"
+
+/**
+ *  Per-hook call counters and latency histograms, set with -DHOOK_STATS=0/1.
+ *  On in DEBUG builds. With them off, HookStats is empty and hooks that only
+ *  observe need not be routed for it.
+ */
+#ifndef HOOK_STATS
+#ifdef DEBUG
+#define HOOK_STATS 1
+#else
+#define HOOK_STATS 0
+#endif
+#endif
+
+static constexpr bool hookStatsEnabled = HOOK_STATS;
+
+/**
+ *  Histogram buckets: bucket 0 counts calls under 1 ns, bucket b > 0 those
+ *  of [2^(b-1), 2^b) ns, and the last one everything from 2^26 ns (67 ms).
+ */
+static constexpr size_t HookStatBuckets = 28;
+
+static inline size_t hookStatBucket(uint64_t ns) {
+    size_t bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    return bucket < HookStatBuckets ? bucket : HookStatBuckets - 1;
+}
+
+/**
+ *  Upper bound of a bucket in ns, UINT64_MAX for the last one
+ */
+static constexpr uint64_t hookStatBucketLimit(size_t bucket) {
+    return bucket + 1 < HookStatBuckets ? 1ULL << bucket : UINT64_MAX;
+}
+
+/**
+ *  One hook on one CPU, in two cache lines of its own: a CPU updating its
+ *  counters never takes the line away from another.
+ */
+struct alignas(64) HookCpuStats {
+    uint64_t calls;
+    uint64_t total;
+    uint32_t buckets[HookStatBuckets];
+};
+
+static_assert(sizeof(HookCpuStats) == 128, "HookCpuStats: two cache lines");
+
+/**
+ *  One hook summed over all CPUs
+ */
+struct HookStatsSummary {
+    const char *module;
+    const char *name;
+    uint64_t calls;
+    uint64_t total;
+    uint64_t buckets[HookStatBuckets];
+
+    uint64_t mean() const { return calls ? total / calls : 0; }
+
+    /**
+     *  Upper bound in ns of the bucket holding the permille-th call
+     */
+    uint64_t percentile(uint32_t permille) const {
+        if (!calls) return 0;
+        uint64_t rank = (calls * permille + 999) / 1000, seen = 0;
+        if (!rank) rank = 1;
+        for (size_t i = 0; i < HookStatBuckets; i++) {
+            seen += buckets[i];
+            if (seen >= rank) return hookStatBucketLimit(i);
+        }
+        return hookStatBucketLimit(HookStatBuckets - 1);
+    }
+};
+
+/**
+ *  Stats of up to MaxHooks hooks on up to MaxCpus CPUs. Hooks take a slot
+ *  on their first call; CPUs beyond MaxCpus share slots, which only costs
+ *  contention as all updates are atomic. Calls of hooks beyond MaxHooks are
+ *  counted in dropped.
+ */
+template <size_t MaxHooks, size_t MaxCpus>
+class HookStatsTable {
+    static_assert(MaxCpus && !(MaxCpus & (MaxCpus - 1)),
+                  "MaxCpus: power of two");
+
+   public:
+    using Slots = HookSlots<MaxHooks>;
+    static constexpr int32_t NoSlot = Slots::NoSlot;
+    static constexpr int32_t Full = Slots::Full;
+
+    Slots slots;
+
+    void record(int32_t slot, uint32_t cpu, uint64_t ns) {
+        if (slot < 0) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        auto &stats = cpus[slot][cpu & (MaxCpus - 1)];
+        __atomic_fetch_add(&stats.calls, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats.total, ns, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats.buckets[hookStatBucket(ns)], 1,
+                           __ATOMIC_RELAXED);
+    }
+
+    size_t size() const { return slots.size(); }
+
+    uint64_t droppedCount() const {
+        return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    }
+
+    /**
+     *  Sum of a slot over all CPUs. Counters are read while they change, so
+     *  calls, total and buckets may be off by the calls in flight.
+     */
+    void summarize(size_t slot, HookStatsSummary &out) const {
+        out = {slots[slot].module, slots[slot].name, 0, 0, {}};
+        for (auto &stats : cpus[slot]) {
+            out.calls += __atomic_load_n(&stats.calls, __ATOMIC_RELAXED);
+            out.total += __atomic_load_n(&stats.total, __ATOMIC_RELAXED);
+            for (size_t i = 0; i < HookStatBuckets; i++)
+                out.buckets[i] +=
+                    __atomic_load_n(&stats.buckets[i], __ATOMIC_RELAXED);
+        }
+    }
+
+   private:
+    HookCpuStats cpus[MaxHooks][MaxCpus]{};
+    uint64_t dropped{};
+};
+
+/**
+ *  Times the original with Clock::now() in ns and records it on the CPU
+ *  given by Cpu::current(), in one table shared by all hooks using the
+ *  policy. Does nothing unless Enabled.
+ */
+template <typename Clock, typename Cpu, bool Enabled = hookStatsEnabled,
+          size_t MaxHooks = 64, size_t MaxCpus = 16>
+struct HookStats {
+    using Token = uint64_t;
+    using Table = HookStatsTable<MaxHooks, MaxCpus>;
+
+    static inline Table table{};
+
+    template <typename H>
+    static inline int32_t slot = Table::NoSlot;
+
+    template <typename H, typename... Args>
+    static Token enter(Args...) {
+        if constexpr (Enabled)
+            return Clock::now();
+        else
+            return 0;
+    }
+
+    template <typename H, typename... R>
+    static void leave(Token start, R...) {
+        if constexpr (Enabled) {
+            uint64_t elapsed = Clock::now() - start;
+            table.record(table.slots.template of<H>(slot<H>), Cpu::current(),
+                         elapsed);
+        }
+    }
+};
+
+#endif /* kern_hookstats_hpp */
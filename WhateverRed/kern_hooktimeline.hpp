@@ -0,0 +1,278 @@
+//
+//  kern_hooktimeline.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_hooktimeline_hpp
+#define kern_hooktimeline_hpp
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "kern_hook.hpp"
+
+/**
+ *  Timeline of hook entries and exits, set with -DHOOK_TIMELINE=0/1. On in
+ *  DEBUG builds. With it off, HookTimeline is empty and its buffer is never
+ *  instantiated.
+ */
+#ifndef HOOK_TIMELINE
+#ifdef DEBUG
+#define HOOK_TIMELINE 1
+#else
+#define HOOK_TIMELINE 0
+#endif
+#endif
+
+static constexpr bool hookTimelineEnabled = HOOK_TIMELINE;
+
+enum HookEventKind : uint8_t {
+    HookEventNone = 0,
+    HookEventEnter = 1,
+    HookEventExit = 2,
+};
+
+/**
+ *  One entry or exit. hook is the slot in the dump's name table, or
+ *  HookEventNoHook; depth is the number of hooks the thread was already in,
+ *  HookEventNoDepth if its thread could not be tracked. kind is written
+ *  last: events still being written are HookEventNone.
+ */
+struct HookEvent {
+    uint64_t time;
+    uint64_t thread;
+    uint16_t hook;
+    uint8_t depth;
+    uint8_t kind;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(HookEvent) == 24, "HookEvent: 24 bytes");
+
+static constexpr uint16_t HookEventNoHook = 0xFFFF;
+static constexpr uint8_t HookEventNoDepth = 0xFF;
+
+static constexpr uint32_t HookTimelineMagic = 0x4C544B48;  // 'HKTL'
+static constexpr uint16_t HookTimelineVersion = 1;
+
+/**
+ *  Dump layout: this header, hookCount pairs of NUL-terminated module and
+ *  name, then eventCount HookEvents. Event times are in the units of the
+ *  recording clock, timebaseNumer / timebaseDenom ns each. Scripts/
+ *  HookTimeline.py converts dumps to Chrome trace events.
+ */
+struct HookTimelineHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t hookCount;
+    uint32_t eventCount;
+    uint32_t dropped;
+    uint32_t timebaseNumer;
+    uint32_t timebaseDenom;
+} __attribute__((packed));
+
+/**
+ *  The first Capacity entries and exits, in a buffer allocated up front:
+ *  recording stops when it is full, keeping the start of the timeline, and
+ *  later events are only counted. Nesting depth is tracked for up to
+ *  MaxThreads threads inside hooks at the same time.
+ */
+template <size_t Capacity, size_t MaxHooks = 64, size_t MaxThreads = 32>
+class HookTimelineBuffer {
+    static_assert(MaxThreads && !(MaxThreads & (MaxThreads - 1)),
+                  "MaxThreads: power of two");
+
+   public:
+    using Slots = HookSlots<MaxHooks>;
+
+    Slots slots;
+
+    /**
+     *  What exit() needs of the matching enter()
+     */
+    struct Token {
+        uint64_t thread;
+        uint16_t hook;
+        uint8_t depth;
+        uint8_t threadSlot;
+    };
+
+    Token enter(int32_t hook, uint64_t thread, uint64_t time) {
+        Token token{thread, hook < 0 ? HookEventNoHook
+                                     : static_cast<uint16_t>(hook),
+                    HookEventNoDepth, NoThread};
+        push(token);
+        record(HookEventEnter, token, time);
+        return token;
+    }
+
+    void exit(const Token &token, uint64_t time) {
+        record(HookEventExit, token, time);
+        if (token.threadSlot != NoThread) {
+            auto &entry = threads[token.threadSlot];
+            if (!--entry.depth)
+                __atomic_store_n(&entry.thread, 0, __ATOMIC_RELEASE);
+        }
+    }
+
+    /**
+     *  Events recorded so far, at most Capacity
+     */
+    size_t size() const {
+        auto next = __atomic_load_n(&this->next, __ATOMIC_ACQUIRE);
+        return next < Capacity ? next : Capacity;
+    }
+
+    uint64_t droppedCount() const {
+        return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    }
+
+    /**
+     *  Bytes dump() needs for what is recorded now. Recording goes on, so
+     *  a later dump may be larger.
+     */
+    size_t dumpSize() const {
+        size_t size = sizeof(HookTimelineHeader);
+        for (size_t i = 0; i < slots.size(); i++)
+            size += strlen(slots[i].module) + strlen(slots[i].name) + 2;
+        return size + this->size() * sizeof(HookEvent);
+    }
+
+    /**
+     *  Writes the timeline as it is now to out. Returns the bytes written,
+     *  0 if they do not fit in size.
+     */
+    size_t dump(uint8_t *out, size_t size, uint32_t timebaseNumer,
+                uint32_t timebaseDenom) const {
+        // Events first: every hook they refer to is named by then.
+        auto events = this->size();
+        auto hooks = slots.size();
+        HookTimelineHeader header{HookTimelineMagic,
+                                  HookTimelineVersion,
+                                  static_cast<uint16_t>(hooks),
+                                  static_cast<uint32_t>(events),
+                                  static_cast<uint32_t>(droppedCount()),
+                                  timebaseNumer,
+                                  timebaseDenom};
+        size_t pos = 0;
+        auto put = [&](const void *data, size_t length) {
+            if (pos + length > size) return false;
+            memcpy(out + pos, data, length);
+            pos += length;
+            return true;
+        };
+        if (!put(&header, sizeof(header))) return 0;
+        for (size_t i = 0; i < hooks; i++)
+            if (!put(slots[i].module, strlen(slots[i].module) + 1) ||
+                !put(slots[i].name, strlen(slots[i].name) + 1))
+                return 0;
+        for (size_t i = 0; i < events; i++) {
+            HookEvent event = buffer[i];
+            event.kind = __atomic_load_n(&buffer[i].kind, __ATOMIC_ACQUIRE);
+            if (!put(&event, sizeof(event))) return 0;
+        }
+        return pos;
+    }
+
+   private:
+    static constexpr uint8_t NoThread = 0xFF;
+    static_assert(MaxThreads < NoThread, "MaxThreads: thread slot");
+
+    struct ThreadDepth {
+        uint64_t thread;
+        uint32_t depth;
+    };
+
+    /**
+     *  Finds or takes the entry of token.thread, which only that thread
+     *  ever changes. Entries are given back at depth 0, so a thread is
+     *  looked for everywhere before a free entry is taken.
+     */
+    void push(Token &token) {
+        // Thread IDs are handed out in sequence, which spreads them already
+        size_t start = token.thread & (MaxThreads - 1), free = NoThread;
+        for (size_t i = 0; i < MaxThreads; i++) {
+            size_t index = (start + i) & (MaxThreads - 1);
+            auto owner = __atomic_load_n(&threads[index].thread,
+                                         __ATOMIC_ACQUIRE);
+            if (owner == token.thread) {
+                token.threadSlot = static_cast<uint8_t>(index);
+                break;
+            }
+            if (!owner && free == NoThread) free = index;
+        }
+        if (token.threadSlot == NoThread) {
+            for (size_t i = 0; i < MaxThreads && free != NoThread; i++) {
+                size_t index = (free + i) & (MaxThreads - 1);
+                uint64_t expected = 0;
+                if (__atomic_compare_exchange_n(
+                        &threads[index].thread, &expected, token.thread,
+                        false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                    token.threadSlot = static_cast<uint8_t>(index);
+                    threads[index].depth = 0;
+                    break;
+                }
+            }
+            if (token.threadSlot == NoThread) return;
+        }
+        auto &entry = threads[token.threadSlot];
+        token.depth = entry.depth < HookEventNoDepth
+                          ? static_cast<uint8_t>(entry.depth)
+                          : HookEventNoDepth;
+        entry.depth++;
+    }
+
+    void record(HookEventKind kind, const Token &token, uint64_t time) {
+        auto index = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED);
+        if (index >= Capacity) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        auto &event = buffer[index];
+        event.time = time;
+        event.thread = token.thread;
+        event.hook = token.hook;
+        event.depth = token.depth;
+        __atomic_store_n(&event.kind, kind, __ATOMIC_RELEASE);
+    }
+
+    HookEvent buffer[Capacity]{};
+    ThreadDepth threads[MaxThreads]{};
+    size_t next{};
+    uint64_t dropped{};
+};
+
+/**
+ *  Records entry and exit of every hook using it with Clock::now() and
+ *  Thread::current(), in one buffer of Capacity events shared by all of
+ *  them. Does nothing unless Enabled.
+ */
+template <typename Clock, typename Thread, bool Enabled = hookTimelineEnabled,
+          size_t Capacity = 16384>
+struct HookTimeline {
+    using Buffer = HookTimelineBuffer<Capacity>;
+    using Token = typename Buffer::Token;
+
+    static inline Buffer buffer{};
+
+    template <typename H>
+    static inline int32_t slot = Buffer::Slots::NoSlot;
+
+    template <typename H, typename... Args>
+    static Token enter(Args...) {
+        if constexpr (Enabled)
+            return buffer.enter(buffer.slots.template of<H>(slot<H>),
+                                Thread::current(), Clock::now());
+        else
+            return {};
+    }
+
+    template <typename H, typename... R>
+    static void leave(const Token &token, R...) {
+        if constexpr (Enabled) buffer.exit(token, Clock::now());
+    }
+};
+
+#endif /* kern_hooktimeline_hpp */
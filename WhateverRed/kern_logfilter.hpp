@@ -0,0 +1,160 @@
+//
+//  kern_logfilter.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_logfilter_hpp
+#define kern_logfilter_hpp
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef KERNEL
+#include <libkern/libkern.h>
+#else
+#include <stdio.h>
+#endif
+
+/**
+ *  Storm suppression for one chatty log source.
+ *  Identical consecutive messages are collapsed into a single
+ *  "last message repeated N times" record, and a token bucket caps the rate
+ *  of distinct messages; whatever the bucket rejects is summarised once it
+ *  refills. Time is passed in by the caller in milliseconds and output goes
+ *  through a sink callable, so the same header runs in the kext and in the
+ *  host replay tool (Scripts/LogFilterReplay.cpp).
+ *
+ *  Callers never wait: if another thread is inside the filter the message is
+ *  passed through unfiltered. The owner calls flush() every FlushInterval ms,
+ *  so the summary of a run that has gone quiet is not held back until the
+ *  next distinct message.
+ */
+class LogFilter {
+   public:
+    struct Stats {
+        uint64_t passed;
+        uint64_t repeated;
+        uint64_t limited;
+    };
+
+    static constexpr size_t NoticeSize = 128;
+    static constexpr size_t MessageSize = 512;
+    static constexpr uint32_t FlushInterval = 1000;
+
+    /**
+     *  @param name   Prefix of the summary records
+     *  @param rate   Distinct messages per second, 0 disables rate limiting
+     *  @param burst  Bucket capacity in messages
+     */
+    void configure(const char *name, uint32_t rate, uint32_t burst) {
+        this->name = name;
+        this->rate = rate;
+        this->burst = burst ? burst : 1;
+        tokens = static_cast<uint64_t>(this->burst) * 1000;
+        last = 0;
+    }
+
+    template <typename Sink>
+    void submit(const char *msg, size_t len, uint64_t now, Sink &&sink) {
+        if (__atomic_test_and_set(&busy, __ATOMIC_ACQUIRE)) {
+            sink(msg, len);
+            return;
+        }
+
+        if (len == previousLen && !memcmp(msg, previous, len)) {
+            repeats++;
+            stats.repeated++;
+        } else if (!take(now)) {
+            suppressed++;
+            stats.limited++;
+        } else {
+            flushNotices(sink);
+            if (len <= MessageSize) {
+                memcpy(previous, msg, len);
+                previousLen = len;
+            } else {
+                previousLen = NoPrevious;
+            }
+            stats.passed++;
+            sink(msg, len);
+        }
+
+        __atomic_clear(&busy, __ATOMIC_RELEASE);
+    }
+
+    /**
+     *  Emit pending summaries, e.g. when the stream goes quiet.
+     */
+    template <typename Sink>
+    void flush(Sink &&sink) {
+        if (__atomic_test_and_set(&busy, __ATOMIC_ACQUIRE)) return;
+        flushNotices(sink);
+        __atomic_clear(&busy, __ATOMIC_RELEASE);
+    }
+
+    const Stats &getStats() const { return stats; }
+
+   private:
+    /**
+     *  previousLen while previous holds no message, as after one longer than
+     *  MessageSize, which therefore never counts as a repeat
+     */
+    static constexpr size_t NoPrevious = ~static_cast<size_t>(0);
+
+    /**
+     *  Token bucket in milli-tokens, so integer arithmetic is exact for any
+     *  rate in messages per second and elapsed time in milliseconds.
+     */
+    bool take(uint64_t now) {
+        if (!rate) return true;
+
+        uint64_t capacity = static_cast<uint64_t>(burst) * 1000;
+        if (now > last) {
+            tokens += (now - last) * rate;
+            if (tokens > capacity) tokens = capacity;
+        }
+        last = now;
+        if (tokens < 1000) return false;
+        tokens -= 1000;
+        return true;
+    }
+
+    template <typename Sink>
+    void flushNotices(Sink &sink) {
+        char notice[NoticeSize];
+        if (repeats) {
+            auto n = snprintf(notice, sizeof(notice),
+                              "%s: last message repeated %llu times\n", name,
+                              static_cast<unsigned long long>(repeats));
+            sink(notice, clamp(n));
+            repeats = 0;
+        }
+        if (suppressed) {
+            auto n = snprintf(notice, sizeof(notice),
+                              "%s: rate limited, %llu messages suppressed\n",
+                              name, static_cast<unsigned long long>(suppressed));
+            sink(notice, clamp(n));
+            suppressed = 0;
+        }
+    }
+
+    static size_t clamp(int n) {
+        if (n < 0) return 0;
+        return static_cast<size_t>(n) < NoticeSize ? n : NoticeSize - 1;
+    }
+
+    const char *name{"log"};
+    uint32_t rate{0};
+    uint32_t burst{1};
+    uint64_t tokens{1000};
+    uint64_t last{0};
+    char previous[MessageSize];
+    size_t previousLen{NoPrevious};
+    uint64_t repeats{0};
+    uint64_t suppressed{0};
+    Stats stats{};
+    bool busy{false};
+};
+
+#endif /* kern_logfilter_hpp */
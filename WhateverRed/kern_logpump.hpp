@@ -0,0 +1,351 @@
+//
+//  kern_logpump.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_logpump_hpp
+#define kern_logpump_hpp
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#ifdef KERNEL
+#include <libkern/libkern.h>
+#else
+#include <stdio.h>
+#endif
+
+#include "kern_lz4.hpp"
+#include "kern_netproto.hpp"
+
+/**
+ *  History of the most recently drained log text, oldest bytes overwritten
+ *  first. Only the pump owner writes to it.
+ */
+template <size_t Size>
+class TraceTail {
+   public:
+    void append(const char *data, size_t len) {
+        if (len > Size) {
+            data += len - Size;
+            len = Size;
+        }
+        for (size_t i = 0; i < len; i++) buffer[(pos + i) % Size] = data[i];
+        pos = (pos + len) % Size;
+        total += len;
+    }
+
+    /**
+     *  Copy the history oldest first into out, NUL terminated.
+     *  Returns the number of bytes copied.
+     */
+    size_t copy(char *out, size_t size) const {
+        if (!size) return 0;
+        size_t len = total < Size ? static_cast<size_t>(total) : Size;
+        if (len > size - 1) len = size - 1;
+        size_t begin = (pos + Size - len) % Size;
+        for (size_t i = 0; i < len; i++) out[i] = buffer[(begin + i) % Size];
+        out[len] = '\0';
+        return len;
+    }
+
+   private:
+    char buffer[Size];
+    size_t pos{0};
+    uint64_t total{0};
+};
+
+/**
+ *  Moves records from log rings into send batches and pushes them through a
+ *  NetConnection. Exactly one owner may drive the pump at a time: the sender
+ *  thread normally, the panic path once it takes over. Ownership is a try
+ *  lock, so nobody ever blocks on it.
+ *
+ *  Clock provides now() in milliseconds, stamp() for record timestamps and
+ *  delay(us) as a busy wait that is safe with interrupts disabled.
+ *
+ *  A batch is sealed when it starts going out: from then on nothing is
+ *  appended, and with compression enabled it is sent as one LZ4 frame.
+ */
+template <typename Connection, typename Clock, size_t BatchSize,
+          size_t TailSize>
+class LogPump {
+   public:
+    enum class Result {
+        Idle,
+        Blocked,
+        Sent,
+    };
+
+    /**
+     *  @param notices   Emit the in-band "connected" record on every session
+     *  @param compress  Send batches as LZ4 frames, binary mode only
+     */
+    void configure(bool binary, bool udp, bool notices, bool compress) {
+        this->binary = binary;
+        this->udp = udp;
+        this->notices = notices;
+        this->compress = compress && binary;
+        start = udp ? sizeof(NetDatagramHeader) : 0;
+        limit = udp ? NetDatagramSize : BatchSize;
+        // A frame that does not shrink must still fit in one datagram.
+        if (udp && this->compress) limit -= sizeof(NetFrameHeader);
+        reset();
+    }
+
+    bool tryAcquire() {
+        return !__atomic_test_and_set(&owner, __ATOMIC_ACQUIRE);
+    }
+
+    void release() { __atomic_clear(&owner, __ATOMIC_RELEASE); }
+
+    /**
+     *  Poll the connection and make the batch ready for filling.
+     *  Returns false while disconnected.
+     */
+    bool prepare(Connection &connection) {
+        if (!connection.poll(Clock::now())) return false;
+
+        auto &stats = connection.getStats();
+        if (stats.connects != session) {
+            // A partially sent batch cannot be resumed on a new connection.
+            session = stats.connects;
+            reset();
+            if (binary && !udp) {
+                NetStreamHeader header{
+                    NetStreamMagic, NetStreamVersion,
+                    static_cast<uint16_t>(compress ? NetStreamCompressed : 0)};
+                copy(batch, &header, sizeof(header));
+                len = head = sizeof(header);
+            }
+            if (notices)
+                notice(
+                    "netdbg: connected (attempts %llu failures %llu "
+                    "disconnects %llu send errors %llu)\n",
+                    static_cast<unsigned long long>(stats.attempts),
+                    static_cast<unsigned long long>(stats.failures),
+                    static_cast<unsigned long long>(stats.disconnects),
+                    static_cast<unsigned long long>(stats.sendErrors));
+        } else if (total && sent == total) {
+            reset();
+        }
+        return true;
+    }
+
+    /**
+     *  Move as many records from ring into the batch as fit.
+     *  Records are only appended before the batch starts going out.
+     */
+    template <typename Ring>
+    void fill(Ring &ring) {
+        if (total) return;
+
+        while (auto *slot = ring.front()) {
+            if (len + slot->len > limit) break;
+            copy(batch + len, slot->data, slot->len);
+            remember(batch + len, slot->len);
+            len += slot->len;
+            ring.release(slot);
+        }
+    }
+
+    /**
+     *  Append an in-band text record. Returns false if the batch is full.
+     */
+    [[gnu::format(__printf__, 2, 3)]] bool notice(const char *fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        auto ret = vnotice(fmt, args);
+        va_end(args);
+        return ret;
+    }
+
+    /**
+     *  Send whatever is pending without blocking.
+     */
+    Result send(Connection &connection) {
+        if (!total) {
+            if (len == start) return Result::Idle;
+            seal();
+        }
+        if (sent == total) return Result::Idle;
+
+        auto *data = compress ? frame : batch;
+        auto n = connection.send(data + sent, total - sent, Clock::now());
+        if (!n) return Result::Blocked;
+        if (udp) datagramSeq++;
+        sent += n;
+        return Result::Sent;
+    }
+
+    /**
+     *  Bounded polled flush for contexts that cannot sleep or take locks.
+     *  Drains the rings in order until all are empty and sent, or until
+     *  deadline (Clock::now() based) passes. Returns true if fully drained.
+     *  The caller must own the pump.
+     */
+    template <typename... Rings>
+    bool drain(Connection &connection, uint64_t deadline, uint32_t delayUs,
+               Rings &...rings) {
+        while (Clock::now() < deadline) {
+            if (!prepare(connection)) {
+                Clock::delay(delayUs);
+                continue;
+            }
+            (fill(rings), ...);
+            switch (send(connection)) {
+                case Result::Idle:
+                    if ((true && ... && !rings.front())) return true;
+                    break;
+                case Result::Blocked:
+                    Clock::delay(delayUs);
+                    break;
+                case Result::Sent:
+                    break;
+            }
+        }
+        return false;
+    }
+
+    /**
+     *  Copy the most recent trace text, oldest first, NUL terminated.
+     */
+    size_t copyTail(char *out, size_t size) const {
+        return tail.copy(out, size);
+    }
+
+    bool isBinary() const { return binary; }
+    bool isUdp() const { return udp; }
+    bool isCompressed() const { return compress; }
+
+    /**
+     *  Record bytes sealed into frames and frame bytes produced from them
+     */
+    uint64_t rawBytes() const { return rawTotal; }
+    uint64_t frameBytes() const { return frameTotal; }
+
+   private:
+    static void copy(void *dst, const void *src, size_t size) {
+        auto *d = static_cast<uint8_t *>(dst);
+        auto *s = static_cast<const uint8_t *>(src);
+        for (size_t i = 0; i < size; i++) d[i] = s[i];
+    }
+
+    void reset() {
+        len = head = start;
+        sent = 0;
+        total = 0;
+    }
+
+    /**
+     *  Finish the batch: fill in the datagram header and, when compressing,
+     *  encode the records after the first head bytes into frame.
+     */
+    void seal() {
+        if (udp) {
+            uint16_t flags = binary ? NetDatagramBinary : 0;
+            if (compress) flags |= NetDatagramCompressed;
+            *reinterpret_cast<NetDatagramHeader *>(batch) = {
+                NetDatagramMagic, datagramSeq, NetStreamVersion, flags};
+        }
+        total = len;
+        if (!compress) return;
+
+        copy(frame, batch, head);
+        auto *records = reinterpret_cast<uint8_t *>(batch + head);
+        auto *payload = reinterpret_cast<uint8_t *>(frame + head +
+                                                    sizeof(NetFrameHeader));
+        size_t raw = len - head;
+        // Only keep the encoding if it is strictly smaller than the input.
+        size_t n = raw > 1 ? encoder.compress(records, raw, payload, raw - 1)
+                           : 0;
+        if (!n) {
+            copy(payload, records, raw);
+            n = raw;
+        }
+        NetFrameHeader header{static_cast<uint32_t>(n),
+                              static_cast<uint32_t>(raw)};
+        copy(frame + head, &header, sizeof(header));
+        total = head + sizeof(header) + n;
+        rawTotal += raw;
+        frameTotal += sizeof(header) + n;
+    }
+
+    bool vnotice(const char *fmt, va_list args) {
+        size_t offset = binary ? sizeof(NetRecordHeader) : 0;
+        if (total || len + offset + NoticeSize > limit) return false;
+
+        auto *text = batch + len + offset;
+        auto n = vsnprintf(text, NoticeSize, fmt, args);
+        size_t msgLen = n < 0 ? 0 : static_cast<size_t>(n);
+        if (msgLen >= NoticeSize) msgLen = NoticeSize - 1;
+        if (binary)
+            *reinterpret_cast<NetRecordHeader *>(batch + len) = {
+                NetRecordText, 0, static_cast<uint16_t>(msgLen), 0,
+                Clock::stamp(), 0, 0, 0};
+        remember(batch + len, offset + msgLen);
+        len += offset + msgLen;
+        return true;
+    }
+
+    /**
+     *  Keep a text rendition of a record in the trace tail. Binary records
+     *  are kept as their format ID and raw arguments.
+     */
+    void remember(const char *data, size_t size) {
+        if (!binary) {
+            tail.append(data, size);
+            return;
+        }
+        if (size < sizeof(NetRecordHeader)) return;
+
+        NetRecordHeader header;
+        copy(&header, data, sizeof(header));
+        auto *payload = data + sizeof(header);
+        if (header.type != NetRecordBinary) {
+            tail.append(payload, size - sizeof(header));
+            return;
+        }
+
+        char line[NoticeSize];
+        size_t pos = 0;
+        auto n = snprintf(line, sizeof(line), "<0x%08X", header.fmtId);
+        pos = n > 0 ? static_cast<size_t>(n) : 0;
+        for (size_t i = 0; i < header.argc && pos < sizeof(line); i++) {
+            uint64_t arg;
+            copy(&arg, payload + i * sizeof(arg), sizeof(arg));
+            n = snprintf(line + pos, sizeof(line) - pos, " 0x%llX",
+                         static_cast<unsigned long long>(arg));
+            pos += n > 0 ? static_cast<size_t>(n) : 0;
+        }
+        if (pos > sizeof(line) - 3) pos = sizeof(line) - 3;
+        line[pos++] = '>';
+        line[pos++] = '\n';
+        tail.append(line, pos);
+    }
+
+    static constexpr size_t NoticeSize = 128;
+
+    bool owner{false};
+    bool binary{false};
+    bool udp{false};
+    bool notices{true};
+    bool compress{false};
+    size_t start{0};
+    size_t limit{BatchSize};
+    size_t len{0};
+    size_t head{0};
+    size_t sent{0};
+    size_t total{0};
+    uint64_t session{0};
+    uint32_t datagramSeq{0};
+    uint64_t rawTotal{0};
+    uint64_t frameTotal{0};
+    TraceTail<TailSize> tail;
+    LZ4Block encoder;
+    char batch[BatchSize];
+    char frame[BatchSize + sizeof(NetFrameHeader)];
+};
+
+#endif /* kern_logpump_hpp */
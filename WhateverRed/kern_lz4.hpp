@@ -0,0 +1,166 @@
+//
+//  kern_lz4.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_lz4_hpp
+#define kern_lz4_hpp
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  LZ4 block format codec for inputs below 64 KiB. Single pass greedy
+ *  matcher with a small hash table, no allocations and no libc, so it runs
+ *  in the kext sender and in host tools alike. The output is plain LZ4
+ *  block data, decodable by any LZ4 implementation.
+ */
+class LZ4Block {
+   public:
+    static constexpr size_t MaxInput = 0xFFFF;
+
+    /**
+     *  Compress src into dst. Returns the compressed size, or 0 if the
+     *  result would not fit in dstSize or the input is too large.
+     */
+    size_t compress(const uint8_t *src, size_t srcLen, uint8_t *dst,
+                    size_t dstSize) {
+        if (srcLen > MaxInput) return 0;
+        for (auto &entry : table) entry = 0;
+
+        size_t ip = 0, anchor = 0, op = 0;
+        if (srcLen >= MinInput) {
+            size_t matchLimit = srcLen - LastLiterals;
+            size_t searchLimit = srcLen - MatchFindLimit;
+            uint32_t misses = 0;
+            while (ip < searchLimit) {
+                auto h = hash(read32(src + ip));
+                size_t ref = table[h];
+                table[h] = static_cast<uint16_t>(ip);
+                if (ref >= ip || read32(src + ref) != read32(src + ip)) {
+                    // Skip faster through data that does not compress.
+                    ip += 1 + (misses++ >> SkipShift);
+                    continue;
+                }
+                misses = 0;
+
+                while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                    ip--;
+                    ref--;
+                }
+                size_t len = MinMatch;
+                while (ip + len < matchLimit && src[ip + len] == src[ref + len])
+                    len++;
+
+                if (!emit(dst, op, dstSize, src + anchor, ip - anchor,
+                          ip - ref, len))
+                    return 0;
+                ip += len;
+                anchor = ip;
+                if (ip - 2 < searchLimit)
+                    table[hash(read32(src + ip - 2))] =
+                        static_cast<uint16_t>(ip - 2);
+            }
+        }
+
+        if (!emit(dst, op, dstSize, src + anchor, srcLen - anchor, 0, 0))
+            return 0;
+        return op;
+    }
+
+    /**
+     *  Decompress a block into dst. Returns the decompressed size, or 0 if
+     *  the block is malformed or does not fit in dstSize.
+     */
+    static size_t decompress(const uint8_t *src, size_t srcLen, uint8_t *dst,
+                             size_t dstSize) {
+        size_t ip = 0, op = 0;
+        while (ip < srcLen) {
+            uint8_t token = src[ip++];
+            size_t literals = token >> 4;
+            if (literals == 15 && !readLength(src, srcLen, ip, literals))
+                return 0;
+            if (literals > srcLen - ip || literals > dstSize - op) return 0;
+            for (size_t i = 0; i < literals; i++) dst[op++] = src[ip++];
+            if (ip == srcLen) break;
+
+            if (srcLen - ip < 2) return 0;
+            size_t offset = src[ip] | (src[ip + 1] << 8);
+            ip += 2;
+            size_t len = token & 15;
+            if (len == 15 && !readLength(src, srcLen, ip, len)) return 0;
+            len += MinMatch;
+            if (!offset || offset > op || len > dstSize - op) return 0;
+            // Byte by byte, matches may overlap their own output.
+            for (size_t i = 0; i < len; i++, op++) dst[op] = dst[op - offset];
+        }
+        return op;
+    }
+
+    /**
+     *  Worst case compressed size of len bytes
+     */
+    static constexpr size_t bound(size_t len) { return len + len / 255 + 16; }
+
+   private:
+    static constexpr size_t MinMatch = 4;
+    static constexpr size_t LastLiterals = 5;
+    static constexpr size_t MatchFindLimit = 12;
+    static constexpr size_t MinInput = MatchFindLimit + 1;
+    static constexpr uint32_t SkipShift = 6;
+    static constexpr uint32_t HashLog = 12;
+
+    static uint32_t read32(const uint8_t *p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) |
+               (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    static uint32_t hash(uint32_t v) {
+        return (v * 2654435761U) >> (32 - HashLog);
+    }
+
+    static bool readLength(const uint8_t *src, size_t srcLen, size_t &ip,
+                           size_t &len) {
+        uint8_t b;
+        do {
+            if (ip == srcLen) return false;
+            b = src[ip++];
+            len += b;
+        } while (b == 255);
+        return true;
+    }
+
+    static void writeLength(uint8_t *dst, size_t &op, size_t len) {
+        for (; len >= 255; len -= 255) dst[op++] = 255;
+        dst[op++] = static_cast<uint8_t>(len);
+    }
+
+    /**
+     *  Append one sequence. A zero offset marks the final, literal-only one.
+     */
+    static bool emit(uint8_t *dst, size_t &op, size_t dstSize,
+                     const uint8_t *literals, size_t litLen, size_t offset,
+                     size_t matchLen) {
+        size_t need = 1 + litLen + litLen / 255 + 1 +
+                      (offset ? 2 + matchLen / 255 + 1 : 0);
+        if (need > dstSize - op) return false;
+
+        size_t token = op++;
+        dst[token] = static_cast<uint8_t>((litLen < 15 ? litLen : 15) << 4);
+        if (litLen >= 15) writeLength(dst, op, litLen - 15);
+        for (size_t i = 0; i < litLen; i++) dst[op++] = literals[i];
+        if (!offset) return true;
+
+        dst[op++] = static_cast<uint8_t>(offset);
+        dst[op++] = static_cast<uint8_t>(offset >> 8);
+        matchLen -= MinMatch;
+        dst[token] |= matchLen < 15 ? matchLen : 15;
+        if (matchLen >= 15) writeLength(dst, op, matchLen - 15);
+        return true;
+    }
+
+    uint16_t table[1 << HashLog];
+};
+
+#endif /* kern_lz4_hpp */
@@ -0,0 +1,141 @@
+//
+//  kern_netconn.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_netconn_hpp
+#define kern_netconn_hpp
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/errno.h>
+
+/**
+ *  Non-blocking connection state machine with exponential backoff.
+ *  The transport provides:
+ *      int open();          start a non-blocking connect, 0 when already
+ *                           connected, EINPROGRESS when pending, or an error
+ *      int check();         0 once connected, EINPROGRESS/EALREADY while
+ *                           pending, or an error
+ *      int send(const void *data, size_t len, size_t &sent);
+ *                           never blocks, EWOULDBLOCK when nothing fits
+ *      void close();
+ *  Time is passed in by the caller in milliseconds, so the machine can be
+ *  driven by a fake clock and a fake transport on the host.
+ */
+template <typename Transport>
+class NetConnection {
+   public:
+    enum class State : uint8_t {
+        Disconnected,
+        Connecting,
+        Connected,
+        Backoff,
+    };
+
+    struct Stats {
+        uint64_t attempts;
+        uint64_t failures;
+        uint64_t connects;
+        uint64_t disconnects;
+        uint64_t sendErrors;
+    };
+
+    static constexpr uint64_t InitialBackoff = 100;
+    static constexpr uint64_t MaxBackoff = 30000;
+    static constexpr uint64_t ConnectTimeout = 5000;
+
+    explicit NetConnection(Transport &transport) : transport(transport) {}
+
+    /**
+     *  Advance the state machine. Returns true when data can be sent.
+     */
+    bool poll(uint64_t now) {
+        switch (state) {
+            case State::Backoff:
+                if (now < retryAt) return false;
+                [[fallthrough]];
+            case State::Disconnected: {
+                stats.attempts++;
+                int err = transport.open();
+                if (err == 0) {
+                    connected();
+                    return true;
+                }
+                if (err == EINPROGRESS) {
+                    state = State::Connecting;
+                    connectStart = now;
+                    return false;
+                }
+                fail(now);
+                return false;
+            }
+            case State::Connecting: {
+                int err = transport.check();
+                if (err == 0) {
+                    connected();
+                    return true;
+                }
+                if ((err == EINPROGRESS || err == EALREADY) &&
+                    now - connectStart < ConnectTimeout)
+                    return false;
+                fail(now);
+                return false;
+            }
+            case State::Connected:
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     *  Send as much as the transport accepts without blocking.
+     *  A hard error drops the connection and schedules a reconnect.
+     */
+    size_t send(const void *data, size_t len, uint64_t now) {
+        if (state != State::Connected) return 0;
+
+        size_t sent = 0;
+        int err = transport.send(data, len, sent);
+        if (err == 0 || err == EWOULDBLOCK) return sent;
+
+        stats.sendErrors++;
+        stats.disconnects++;
+        transport.close();
+        retry(now);
+        return 0;
+    }
+
+    State getState() const { return state; }
+    const Stats &getStats() const { return stats; }
+    uint64_t getBackoff() const { return backoff; }
+
+   private:
+    void connected() {
+        state = State::Connected;
+        backoff = InitialBackoff;
+        stats.connects++;
+    }
+
+    void fail(uint64_t now) {
+        stats.failures++;
+        transport.close();
+        retry(now);
+    }
+
+    void retry(uint64_t now) {
+        state = State::Backoff;
+        retryAt = now + backoff;
+        backoff = backoff * 2 > MaxBackoff ? MaxBackoff : backoff * 2;
+    }
+
+    Transport &transport;
+    State state{State::Disconnected};
+    uint64_t backoff{InitialBackoff};
+    uint64_t retryAt{0};
+    uint64_t connectStart{0};
+    Stats stats{};
+};
+
+#endif /* kern_netconn_hpp */
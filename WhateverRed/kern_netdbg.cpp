@@ -8,11 +8,15 @@
 
 #include "kern_netdbg.hpp"
 
-#include <netinet/in.h>
-
 #include <Headers/kern_api.hpp>
+#include <kern/sched_prim.h>
+#include <sys/filio.h>
+
+extern "C" int cpu_number();
+extern "C" uint64_t thread_tid(thread_t thread);
 
-in_addr_t inet_addr(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+static constexpr in_addr_t inet_addr(uint32_t a, uint32_t b, uint32_t c,
+                                      uint32_t d) {
     auto ret = d;
 
     ret *= 256;
@@ -28,56 +32,271 @@ in_addr_t inet_addr(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
 }
 
 bool NETDBG::enabled = false;
-socket_t NETDBG::socket = nullptr;
+bool NETDBG::binary = false;
+NETDBG::Ring NETDBG::ring;
+bool NETDBG::started = false;
+bool NETDBG::senderAsleep = false;
+thread_t NETDBG::pumpThread = nullptr;
+uint64_t NETDBG::reportedDropped = 0;
+in_addr_t NETDBG::address = inet_addr(149, 102, 131, 82);
+uint16_t NETDBG::port = 420;
+bool NETDBG::udp = false;
+NETDBG::PanicRing NETDBG::panicRing;
+NetSocket NETDBG::transport;
+NetConnection<NetSocket> NETDBG::connection{NETDBG::transport};
+NETDBG::Pump NETDBG::pump;
 
-size_t NETDBG::nprint(char *data, size_t len) {
-    kprintf("netdbg: message: %s", data);
-
-    if (!enabled) {
-        return 0;
+static bool parseAddress(const char *str, in_addr_t &addr) {
+    uint32_t parts[4] = {};
+    size_t n = 0;
+    for (; *str; str++) {
+        if (*str == '.') {
+            if (++n == arrsize(parts)) return false;
+        } else if (*str >= '0' && *str <= '9') {
+            parts[n] = parts[n] * 10 + (*str - '0');
+            if (parts[n] > 255) return false;
+        } else {
+            return false;
+        }
     }
+    if (n != arrsize(parts) - 1) return false;
 
-    if (!socket) {
-        sock_socket(AF_INET, SOCK_STREAM, 0, NULL, 0, &socket);
+    addr = inet_addr(parts[0], parts[1], parts[2], parts[3]);
+    return true;
+}
 
-        if (!socket) return 0;
+uint64_t NETDBG::uptimeMs() {
+    uint64_t ns;
+    absolutetime_to_nanoseconds(mach_absolute_time(), &ns);
+    return ns / 1000000;
+}
 
-        int retry = 5;
-        while (retry--) {
-            struct sockaddr_in info;
-            bzero(&info, sizeof(info));
+void NETDBG::configure(const char *address, uint32_t port, bool udp) {
+    if (address && !parseAddress(address, NETDBG::address))
+        SYSLOG("netdbg", "invalid address %s, using default", address);
+    if (port > 0 && port <= 0xFFFF) NETDBG::port = port;
+    NETDBG::udp = udp;
+    DBGLOG("netdbg", "destination 0x%X port %u udp %d", NETDBG::address,
+           NETDBG::port, udp);
+}
 
-            info.sin_len = sizeof(sockaddr_in);
-            info.sin_family = PF_INET;
-            info.sin_addr.s_addr = inet_addr(149, 102, 131, 82);
-            info.sin_port = htons(420);
+void NETDBG::enable() {
+    if (__atomic_exchange_n(&started, true, __ATOMIC_ACQ_REL)) return;
 
-            int err = sock_connect(socket, (sockaddr *)&info, 0);
-            if (err == -1) {
-                SYSLOG("netdbg", "nprint err=%d", err);
-                sock_close(socket);
-                socket = nullptr;
-                continue;
-            }
-        }
+    // Compressed frames only exist in the binary protocol.
+    bool compress = checkKernelArgument("-wrednetlz4");
+    binary = compress || checkKernelArgument("-wrednetbin");
+    ring.init();
+    panicRing.init();
+    pump.configure(binary, udp, netLogEnabled("netdbg", NetLogInfo), compress);
+    thread_t thread;
+    if (kernel_thread_start(senderThread, nullptr, &thread) != KERN_SUCCESS) {
+        SYSLOG("netdbg", "failed to start sender thread");
+        return;
     }
+    thread_deallocate(thread);
+    __atomic_store_n(&enabled, true, __ATOMIC_RELEASE);
+}
+
+sockaddr_in NetSocket::destination() {
+    sockaddr_in info;
+    bzero(&info, sizeof(info));
+    info.sin_len = sizeof(sockaddr_in);
+    info.sin_family = PF_INET;
+    info.sin_addr.s_addr = NETDBG::address;
+    info.sin_port = htons(NETDBG::port);
+    return info;
+}
+
+int NetSocket::open() {
+    udp = NETDBG::udp;
+    int err = udp ? sock_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP, NULL, 0,
+                                &socket)
+                  : sock_socket(AF_INET, SOCK_STREAM, 0, NULL, 0, &socket);
+    if (err) return err;
+
+    int on = 1;
+    sock_ioctl(socket, FIONBIO, &on);
+    if (udp) return 0;
 
-    iovec vec{.iov_base = data, .iov_len = len};
+    auto info = destination();
+    err = sock_connect(socket, reinterpret_cast<sockaddr *>(&info),
+                       MSG_DONTWAIT);
+    return err == EALREADY ? EINPROGRESS : err;
+}
+
+int NetSocket::check() {
+    if (sock_isconnected(socket)) return 0;
+
+    int err = 0;
+    int len = sizeof(err);
+    sock_getsockopt(socket, SOL_SOCKET, SO_ERROR, &err, &len);
+    return err ? err : EINPROGRESS;
+}
+
+int NetSocket::send(const void *data, size_t len, size_t &sent) {
+    auto info = destination();
+    iovec vec{.iov_base = const_cast<void *>(data), .iov_len = len};
     msghdr hdr{
+        .msg_name = udp ? &info : nullptr,
+        .msg_namelen = udp ? static_cast<socklen_t>(sizeof(info)) : 0,
         .msg_iov = &vec,
         .msg_iovlen = 1,
     };
 
-    size_t sentLen = 0;
-    int err = sock_send(socket, &hdr, 0, &sentLen);
-    if (err == -1) {
-        SYSLOG("netdbg", "nprint err=%d", err);
+    return sock_send(socket, &hdr, MSG_DONTWAIT, &sent);
+}
+
+void NetSocket::close() {
+    if (socket) {
         sock_close(socket);
         socket = nullptr;
-        return 0;
     }
+}
+
+uint64_t NetClock::now() { return NETDBG::uptimeMs(); }
+
+uint64_t NetClock::stamp() { return mach_absolute_time(); }
 
-    return sentLen;
+void NetClock::delay(uint32_t us) { IODelay(us); }
+
+NetRecordHeader NETDBG::recordHeader(uint8_t type, size_t argc, size_t len,
+                                     uint32_t id) {
+    NetRecordHeader header{type,
+                           static_cast<uint8_t>(argc),
+                           static_cast<uint16_t>(len),
+                           id,
+                           mach_absolute_time(),
+                           thread_tid(current_thread()),
+                           static_cast<uint16_t>(cpu_number()),
+                           0};
+    return header;
+}
+
+template <typename R>
+size_t NETDBG::push(R &ring, const char *data, size_t len) {
+    if (!binary) return ring.push(data, len) ? len : 0;
+
+    auto *slot = ring.reserve();
+    if (!slot) return 0;
+    size_t maxLen = RingSlotSize - sizeof(NetRecordHeader);
+    if (len > maxLen) len = maxLen;
+    *reinterpret_cast<NetRecordHeader *>(slot->data) =
+        recordHeader(NetRecordText, 0, len, 0);
+    lilu_os_memcpy(slot->data + sizeof(NetRecordHeader), data, len);
+    slot->len = static_cast<uint32_t>(sizeof(NetRecordHeader) + len);
+    ring.commit(slot);
+    return len;
+}
+
+void NETDBG::wakeSender() {
+    // Orders the commit before the check, against the fence in waitForRecords
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&senderAsleep, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&senderAsleep, false, __ATOMIC_RELAXED))
+        thread_wakeup(&senderAsleep);
+}
+
+void NETDBG::waitForRecords() {
+    // A wakeup between assert_wait and thread_block makes the latter return
+    // right away, so no record committed after the check below is missed.
+    assert_wait(&senderAsleep, THREAD_UNINT);
+    __atomic_store_n(&senderAsleep, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ring.front()) wakeSender();
+    thread_block(THREAD_CONTINUE_NULL);
+}
+
+void NETDBG::senderThread(void *, wait_result_t) {
+    while (true) {
+        auto result = Pump::Result::Idle;
+        bool connected = false;
+        if (pump.tryAcquire()) {
+            __atomic_store_n(&pumpThread, current_thread(), __ATOMIC_RELAXED);
+            // While disconnected the ring keeps buffering; once it is full
+            // new messages are dropped and counted.
+            connected = pump.prepare(connection);
+            if (connected) {
+                pump.fill(ring);
+                auto dropped = ring.droppedCount();
+                if (netLogEnabled("netdbg", NetLogInfo) &&
+                    dropped != reportedDropped &&
+                    pump.notice(
+                        "netdbg: dropped %llu messages (high water %llu/%zu)\n",
+                        dropped - reportedDropped, ring.highWaterMark(),
+                        RingSlotCount))
+                    reportedDropped = dropped;
+                result = pump.send(connection);
+            }
+            __atomic_store_n(&pumpThread, nullptr, __ATOMIC_RELAXED);
+            pump.release();
+        }
+
+        // Timed retries only while there is something to send; an empty
+        // ring sleeps until the next commit.
+        if (result == Pump::Result::Sent)
+            continue;
+        else if (result == Pump::Result::Blocked)
+            IOSleep(1);
+        else if (!connected && ring.front())
+            IOSleep(10);
+        else
+            waitForRecords();
+    }
+}
+
+size_t NETDBG::panicFlush(const char *msg, size_t len, char *tail,
+                          size_t tailSize) {
+    tail[0] = '\0';
+    if (!__atomic_load_n(&enabled, __ATOMIC_ACQUIRE)) return 0;
+
+    push(panicRing, msg, len);
+
+    // sock_send takes the socket and protocol locks. If the sender thread
+    // itself panicked while it owned the pump, it may hold them and will
+    // never give the pump up, so the socket is left alone and only the tail
+    // is reported. Otherwise it may be mid-batch on another CPU; it gives up
+    // the pump within one send, so a short bounded spin is enough.
+    auto deadline = NetClock::now() + PanicFlushTimeout;
+    while (!pump.tryAcquire()) {
+        if (__atomic_load_n(&pumpThread, __ATOMIC_RELAXED) == current_thread())
+            return pump.copyTail(tail, tailSize);
+        if (NetClock::now() >= deadline) return 0;
+        NetClock::delay(PanicPollDelay);
+    }
+
+    if (!pump.drain(connection, deadline, PanicPollDelay, panicRing, ring))
+        kprintf("netdbg: panic flush timed out\n");
+
+    // Ownership is kept on purpose: the sender thread must not touch the
+    // socket again while the panic proceeds.
+    return pump.copyTail(tail, tailSize);
+}
+
+size_t NETDBG::nprint(const char *data, size_t len) {
+    // Only messages the ring does not take go to the console.
+    size_t ret =
+        __atomic_load_n(&enabled, __ATOMIC_ACQUIRE) ? push(ring, data, len) : 0;
+    if (ret)
+        wakeSender();
+    else if (len)
+        kprintf("netdbg: message: %s", data);
+    return ret;
+}
+
+size_t NETDBG::record(uint32_t id, const uint64_t *args, size_t argc) {
+    if (!__atomic_load_n(&enabled, __ATOMIC_ACQUIRE)) return 0;
+
+    auto *slot = ring.reserve();
+    if (!slot) return 0;
+    size_t len = argc * sizeof(uint64_t);
+    *reinterpret_cast<NetRecordHeader *>(slot->data) =
+        recordHeader(NetRecordBinary, argc, len, id);
+    lilu_os_memcpy(slot->data + sizeof(NetRecordHeader), args, len);
+    slot->len = static_cast<uint32_t>(sizeof(NetRecordHeader) + len);
+    ring.commit(slot);
+    wakeSender();
+    return len;
 }
 
 size_t NETDBG::printf(const char *fmt, ...) {
@@ -89,11 +308,29 @@ size_t NETDBG::printf(const char *fmt, ...) {
 }
 
 size_t NETDBG::vprintf(const char *fmt, va_list args) {
-    char *data = new char[1025];
-    size_t len = vsnprintf(data, 1024, fmt, args);
+    auto *slot = __atomic_load_n(&enabled, __ATOMIC_ACQUIRE) ? ring.reserve()
+                                                             : nullptr;
+    if (!slot) {
+        char data[RingSlotSize];
+        vsnprintf(data, sizeof(data), fmt, args);
+        kprintf("netdbg: message: %s", data);
+        return 0;
+    }
 
-    auto ret = NETDBG::nprint(data, len);
+    // Stamp before formatting, so the time reflects the call site.
+    auto header = recordHeader(NetRecordText, 0, 0, 0);
+    size_t offset = binary ? sizeof(NetRecordHeader) : 0;
+    auto *data = reinterpret_cast<char *>(slot->data + offset);
+    size_t maxLen = RingSlotSize - offset;
+    size_t len = vsnprintf(data, maxLen, fmt, args);
+    if (len >= maxLen) len = maxLen - 1;
 
-    delete[] data;
-    return ret;
+    if (binary) {
+        header.length = static_cast<uint16_t>(len);
+        *reinterpret_cast<NetRecordHeader *>(slot->data) = header;
+    }
+    slot->len = static_cast<uint32_t>(offset + len);
+    ring.commit(slot);
+    wakeSender();
+    return len;
 }
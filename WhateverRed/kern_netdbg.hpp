@@ -8,22 +8,232 @@
 
 #ifndef kern_netdbg_hpp
 #define kern_netdbg_hpp
+#include <kern/thread.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
 #include <cstdarg>
 
-#define NETLOG(mod, fmt, ...) NETDBG::printf(mod ": " fmt "\n", ##__VA_ARGS__)
+#include "kern_logpump.hpp"
+#include "kern_netconn.hpp"
+#include "kern_netlevel.hpp"
+#include "kern_netproto.hpp"
+#include "kern_ring.hpp"
+
+#define NETLOG_AT(level, mod, fmt, ...)                                    \
+    do {                                                                   \
+        if constexpr (netLogEnabled(mod, level)) {                         \
+            static_cast<void>(sizeof(                                      \
+                NETDBG::checkFormat(mod ": " fmt "\n", ##__VA_ARGS__)));   \
+            NETDBG::log<NETDBG::formatId(mod ": " fmt "\n")>(              \
+                mod ": " fmt "\n", ##__VA_ARGS__);                         \
+        }                                                                  \
+    } while (0)
+
+#define NETERR(mod, fmt, ...) NETLOG_AT(NetLogError, mod, fmt, ##__VA_ARGS__)
+#define NETLOG(mod, fmt, ...) NETLOG_AT(NetLogInfo, mod, fmt, ##__VA_ARGS__)
+#define NETTRACE(mod, fmt, ...) \
+    NETLOG_AT(NetLogTrace, mod, fmt, ##__VA_ARGS__)
+
+/**
+ *  Time source for LogPump. delay() busy-waits, so it is usable in panic
+ *  context.
+ */
+struct NetClock {
+    static uint64_t now();
+    static uint64_t stamp();
+    static void delay(uint32_t us);
+};
+
+/**
+ *  Kernel socket transport for NetConnection. Both connecting and sending
+ *  are non-blocking.
+ */
+struct NetSocket {
+    socket_t socket{nullptr};
+    bool udp{false};
+
+    int open();
+    int check();
+    int send(const void *data, size_t len, size_t &sent);
+    void close();
+
+   private:
+    static sockaddr_in destination();
+};
 
 class NETDBG {
+    friend struct NetSocket;
+
    public:
+    static constexpr size_t RingSlotSize = 512;
+    static constexpr size_t RingSlotCount = 512;
+    static constexpr size_t SendBatchSize = 4096;
+    static constexpr size_t PanicSlotCount = 4;
+    static constexpr size_t PanicTailSize = 2048;
+    static constexpr uint64_t PanicFlushTimeout = 500;
+    static constexpr uint32_t PanicPollDelay = 100;
+
     static bool enabled;
-    static socket_t socket;
-    static size_t nprint(char *data, size_t len);
+    static bool binary;
+
+    /**
+     *  Override the destination. A null address keeps the default one,
+     *  a zero port keeps the default port.
+     */
+    static void configure(const char *address, uint32_t port, bool udp);
+
+    /**
+     *  Start the sender thread and begin accepting messages.
+     */
+    static void enable();
+
+    /**
+     *  Queue a message for the sender thread. Never blocks.
+     */
+    static size_t nprint(const char *data, size_t len);
     [[gnu::format(__printf__, 1, 2)]] static size_t printf(const char *fmt,
                                                            ...);
     [[gnu::format(__printf__, 1, 0)]] static size_t vprintf(const char *fmt,
                                                             va_list args);
+
+    /**
+     *  Format string ID used by the host decoder, FNV-1a of the full string
+     */
+    static constexpr uint32_t formatId(const char *fmt) {
+        uint32_t hash = 0x811C9DC5;
+        while (*fmt) {
+            hash ^= static_cast<uint8_t>(*fmt++);
+            hash *= 0x01000193;
+        }
+        return hash;
+    }
+
+    /**
+     *  Never defined, only used for compile-time format checking in NETLOG
+     */
+    [[gnu::format(__printf__, 1, 2)]] static int checkFormat(const char *fmt,
+                                                             ...);
+
+    /**
+     *  NETLOG backend. In binary mode, messages without string arguments are
+     *  recorded as format ID and raw arguments without any formatting.
+     */
+    template <uint32_t Id, typename... Args>
+    static size_t log(const char *fmt, Args... args) {
+        if (binary && !(false || ... || IsString<Args>::value)) {
+            uint64_t raw[] = {0, toArg(args)...};
+            return record(Id, raw + 1, sizeof...(Args));
+        }
+        return printf(fmt, args...);
+    }
+
+    static size_t record(uint32_t id, const uint64_t *args, size_t argc);
+
+    /**
+     *  Messages lost because the ring was full
+     */
+    static uint64_t droppedCount() { return ring.droppedCount(); }
+
+    /**
+     *  Maximum number of messages ever waiting in the ring
+     */
+    static uint64_t highWaterMark() { return ring.highWaterMark(); }
+
+    /**
+     *  Milliseconds since boot, the clock used for rate limiting and backoff
+     */
+    static uint64_t uptimeMs();
+
+    /**
+     *  Panic path: queue msg on the reserved panic ring and flush it together
+     *  with the backlog by polling, without sleeping or blocking, for at most
+     *  PanicFlushTimeout ms. The sender thread is stopped for good.
+     *  The most recent trace text is copied to tail, NUL terminated.
+     *  When the sender thread itself panicked, nothing is sent: it may hold
+     *  the socket locks sock_send needs. A panic raised with those locks
+     *  held by any other thread still hangs in sock_send instead of
+     *  reaching the original panic handler; the socket KPI gives no way to
+     *  tell that case apart.
+     *  Returns the number of tail bytes copied.
+     */
+    static size_t panicFlush(const char *msg, size_t len, char *tail,
+                             size_t tailSize);
+
+    /**
+     *  Connection attempts, failures and disconnects since boot
+     */
+    static const NetConnection<NetSocket>::Stats &connectionStats() {
+        return connection.getStats();
+    }
+
+   private:
+    template <typename T>
+    struct IsString {
+        static constexpr bool value = false;
+    };
+
+    template <typename T>
+    static uint64_t toArg(T *v) {
+        return reinterpret_cast<uintptr_t>(v);
+    }
+
+    template <typename T>
+    static uint64_t toArg(T v) {
+        return static_cast<uint64_t>(v);
+    }
+
+    using Ring = LogRing<RingSlotSize, RingSlotCount>;
+    using PanicRing = LogRing<RingSlotSize, PanicSlotCount>;
+    using Pump = LogPump<NetConnection<NetSocket>, NetClock, SendBatchSize,
+                         PanicTailSize>;
+
+    static Ring ring;
+    static PanicRing panicRing;
+    static bool started;
+    static bool senderAsleep;
+    // The sender thread while it owns the pump, for panicFlush
+    static thread_t pumpThread;
+    static uint64_t reportedDropped;
+    static in_addr_t address;
+    static uint16_t port;
+    static bool udp;
+    static NetSocket transport;
+    static NetConnection<NetSocket> connection;
+    static Pump pump;
+
+    /**
+     *  Header stamped with the time, thread and CPU of the caller
+     */
+    static NetRecordHeader recordHeader(uint8_t type, size_t argc, size_t len,
+                                        uint32_t id);
+
+    template <typename R>
+    static size_t push(R &ring, const char *data, size_t len);
+
+    /**
+     *  Wake the sender thread if it is waiting for records. Never blocks,
+     *  and takes the wait queue lock in thread_wakeup only when the sender
+     *  is asleep, so any producer may call it after a commit.
+     */
+    static void wakeSender();
+
+    /**
+     *  Sender thread: sleep until wakeSender(), unless records are waiting
+     */
+    static void waitForRecords();
+    static void senderThread(void *param, wait_result_t wr);
+};
+
+template <>
+struct NETDBG::IsString<char *> {
+    static constexpr bool value = true;
+};
+
+template <>
+struct NETDBG::IsString<const char *> {
+    static constexpr bool value = true;
 };
 
 #endif /* kern_netdbg_hpp */
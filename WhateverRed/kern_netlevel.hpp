@@ -0,0 +1,78 @@
+//
+//  kern_netlevel.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_netlevel_hpp
+#define kern_netlevel_hpp
+
+/**
+ *  Compile-time NETDBG log levels. Every module has its own level, set with
+ *  -DNETLOG_LEVEL_<MODULE>=<level>; messages above it are discarded by
+ *  if constexpr, so neither the call nor its format string reach the binary.
+ *
+ *      0  off
+ *      1  errors (NETERR)
+ *      2  notable events (NETLOG)
+ *      3  wrapper entry/exit and argument dumps (NETTRACE)
+ *
+ *  Modules: "rad", "wred", "netdbg" (in-band connection/drop notices) and
+ *  "fw" (AMD TTL COS and MCIL firmware debug output). Modules not listed
+ *  use NETLOG_LEVEL_DEFAULT.
+ */
+enum NetLogLevel : int {
+    NetLogOff = 0,
+    NetLogError = 1,
+    NetLogInfo = 2,
+    NetLogTrace = 3,
+};
+
+#ifdef DEBUG
+#define NETLOG_DEFAULT_LEVEL NetLogTrace
+#else
+#define NETLOG_DEFAULT_LEVEL NetLogInfo
+#endif
+
+#ifndef NETLOG_LEVEL_DEFAULT
+#define NETLOG_LEVEL_DEFAULT NETLOG_DEFAULT_LEVEL
+#endif
+#ifndef NETLOG_LEVEL_RAD
+#define NETLOG_LEVEL_RAD NETLOG_DEFAULT_LEVEL
+#endif
+#ifndef NETLOG_LEVEL_WRED
+#define NETLOG_LEVEL_WRED NETLOG_DEFAULT_LEVEL
+#endif
+#ifndef NETLOG_LEVEL_NETDBG
+#define NETLOG_LEVEL_NETDBG NETLOG_DEFAULT_LEVEL
+#endif
+#ifndef NETLOG_LEVEL_FW
+#ifdef DEBUG
+#define NETLOG_LEVEL_FW NetLogInfo
+#else
+#define NETLOG_LEVEL_FW NetLogOff
+#endif
+#endif
+
+static constexpr bool netLogModuleIs(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static constexpr int netLogLevel(const char *mod) {
+    return netLogModuleIs(mod, "rad")      ? NETLOG_LEVEL_RAD
+           : netLogModuleIs(mod, "wred")   ? NETLOG_LEVEL_WRED
+           : netLogModuleIs(mod, "netdbg") ? NETLOG_LEVEL_NETDBG
+           : netLogModuleIs(mod, "fw")     ? NETLOG_LEVEL_FW
+                                           : NETLOG_LEVEL_DEFAULT;
+}
+
+static constexpr bool netLogEnabled(const char *mod, int level) {
+    return level <= netLogLevel(mod);
+}
+
+#endif /* kern_netlevel_hpp */
@@ -0,0 +1,89 @@
+//
+//  kern_netproto.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_netproto_hpp
+#define kern_netproto_hpp
+#include <stddef.h>
+#include <stdint.h>
+
+static constexpr uint32_t NetStreamMagic = 0x4742444E;  // 'NDBG'
+static constexpr uint16_t NetStreamVersion = 2;
+
+enum NetStreamFlags : uint16_t {
+    NetStreamCompressed = 1,
+};
+
+/**
+ *  Sent once per connection in binary mode, before any record.
+ *  Legacy text streams never start with this magic. With
+ *  NetStreamCompressed set, everything after it is a sequence of frames.
+ */
+struct NetStreamHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+} __attribute__((packed));
+
+static constexpr uint32_t NetDatagramMagic = 0x5247444E;  // 'NDGR'
+
+enum NetDatagramFlags : uint16_t {
+    NetDatagramBinary = 1,
+    NetDatagramCompressed = 2,
+};
+
+/**
+ *  Prefix of every UDP datagram. The sequence number increases by one per
+ *  datagram, so the receiver can detect loss.
+ */
+struct NetDatagramHeader {
+    uint32_t magic;
+    uint32_t seq;
+    uint16_t version;
+    uint16_t flags;
+} __attribute__((packed));
+
+enum NetRecordType : uint8_t {
+    NetRecordText = 0,
+    NetRecordBinary = 1,
+};
+
+/**
+ *  Binary mode record header. Text records carry the formatted message as
+ *  payload; binary records carry argc raw 64-bit arguments to be rendered on
+ *  the host with the format string matching fmtId.
+ *  Version 2 added the thread ID and CPU number of the producer, so host
+ *  tools can pair entry and exit records of the same call. Records made by
+ *  the sender itself have both set to 0.
+ */
+struct NetRecordHeader {
+    uint8_t type;
+    uint8_t argc;
+    uint16_t length;
+    uint32_t fmtId;
+    uint64_t timestamp;
+    uint64_t thread;
+    uint16_t cpu;
+    uint16_t reserved;
+} __attribute__((packed));
+
+/**
+ *  Compressed stream frame, followed by length bytes of LZ4 block data that
+ *  decompress to rawLength bytes of whole records. Frames that would not
+ *  shrink are stored as is, with length equal to rawLength. A compressed
+ *  datagram carries exactly one frame.
+ */
+struct NetFrameHeader {
+    uint32_t length;
+    uint32_t rawLength;
+} __attribute__((packed));
+
+/**
+ *  Largest UDP payload that fits an Ethernet MTU without fragmentation
+ */
+static constexpr size_t NetDatagramSize = 1472;
+
+#endif /* kern_netproto_hpp */
@@ -0,0 +1,234 @@
+//
+//  kern_patch.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_patch_hpp
+#define kern_patch_hpp
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  Version of BinaryPatch and of radPatches, bumped whenever either changes
+ *  so that offline reports say which manifest they checked.
+ */
+static constexpr uint32_t PatchManifestVersion = 2;
+
+/**
+ *  Darwin majors of the macOS releases patches apply to, the values of
+ *  Lilu's KernelVersion
+ */
+static constexpr uint8_t PatchDarwinCatalina = 19;
+static constexpr uint8_t PatchDarwinBigSur = 20;
+static constexpr uint8_t PatchDarwinMonterey = 21;
+
+static constexpr size_t PatchNotFound = ~static_cast<size_t>(0);
+
+/**
+ *  Byte patch of a kext, by bundle ID. Only the bits set in findMask must
+ *  match and only those set in replaceMask are written, null masks meaning
+ *  all bits. At most limit matches are patched. A number of matches other
+ *  than expected is reported, and a required patch that is not applied
+ *  stops the boot. The kexts ship with macOS, so the Darwin range stands for
+ *  their versions.
+ */
+struct BinaryPatch {
+    const char *name;
+    const char *kext;
+    const uint8_t *find;
+    const uint8_t *replace;
+    const uint8_t *findMask;
+    const uint8_t *replaceMask;
+    size_t size;
+    uint32_t expected;
+    uint32_t limit;
+    uint8_t minDarwin, maxDarwin;
+    bool required;
+
+    constexpr bool appliesTo(uint32_t darwin) const {
+        return darwin >= minDarwin && darwin <= maxDarwin;
+    }
+
+    constexpr bool matches(const uint8_t *at) const {
+        for (size_t i = 0; i < size; i++) {
+            uint8_t mask = findMask ? findMask[i] : 0xFF;
+            if ((at[i] ^ find[i]) & mask) return false;
+        }
+        return true;
+    }
+
+    /**
+     *  Offset of the first match in data at or after from, PatchNotFound if
+     *  there is none
+     */
+    size_t search(const uint8_t *data, size_t length, size_t from) const {
+        if (length < size) return PatchNotFound;
+        // Whole images are searched: look at the first byte alone first.
+        uint8_t first = find[0], firstMask = findMask ? findMask[0] : 0xFF;
+        for (size_t i = from; i <= length - size; i++)
+            if (!((data[i] ^ first) & firstMask) && matches(data + i))
+                return i;
+        return PatchNotFound;
+    }
+
+    constexpr uint8_t patched(uint8_t original, size_t i) const {
+        uint8_t mask = replaceMask ? replaceMask[i] : 0xFF;
+        return static_cast<uint8_t>((original & ~mask) | (replace[i] & mask));
+    }
+
+    void apply(uint8_t *at) const {
+        for (size_t i = 0; i < size; i++) at[i] = patched(at[i], i);
+    }
+};
+
+/**
+ *  What applying a patch found and cost
+ */
+struct BinaryPatchResult {
+    uint32_t matches;
+    uint32_t patched;
+    uint64_t ns;
+
+    bool failed(const BinaryPatch &patch) const {
+        return patch.required && !patched;
+    }
+};
+
+/**
+ *  Compile-time check: unique names, sane sizes, counts and ranges, a limit
+ *  that covers the expected matches, and
+ *  patched bytes that no longer match, so a second pass finds nothing.
+ */
+template <size_t N>
+static constexpr bool patchManifestValid(const BinaryPatch (&table)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        auto &patch = table[i];
+        if (!patch.name || !patch.kext || !patch.find || !patch.replace ||
+            !patch.size || !patch.expected || patch.limit < patch.expected ||
+            patch.minDarwin > patch.maxDarwin)
+            return false;
+        uint8_t result[64] = {};
+        if (patch.size > sizeof(result)) return false;
+        for (size_t b = 0; b < patch.size; b++)
+            result[b] = patch.patched(patch.find[b], b);
+        if (patch.matches(result)) return false;
+        for (size_t j = 0; j < i; j++) {
+            auto *a = patch.name, *b = table[j].name;
+            while (*a && *a == *b) a++, b++;
+            if (*a == *b) return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * _smu_9_0_1_full_asic_reset performs a full ASIC reset. The original code
+ * sends message 0x3B, which is wrong for SMU 10; the patch sends 0x1E.
+ */
+static constexpr uint8_t patchSmuResetFind[] = {
+    0x55, 0x48, 0x89, 0xe5, 0x8b, 0x56, 0x04, 0xbe, 0x3b,
+    0x00, 0x00, 0x00, 0x5d, 0xe9, 0x51, 0xfe, 0xff, 0xff};
+static constexpr uint8_t patchSmuResetReplace[] = {
+    0x55, 0x48, 0x89, 0xe5, 0x8b, 0x56, 0x04, 0xbe, 0x1e,
+    0x00, 0x00, 0x00, 0x5d, 0xe9, 0x51, 0xfe, 0xff, 0xff};
+
+/*
+ * _psp_asd_load loads a hardcoded ASD firmware binary included in the kext
+ * as _psp_asd_bin. The copied data isn't in a table, it is a single binary
+ * copied over to the PSP private memory. We can't replicate such logic in
+ * any AMDGPU kext function, as the memory accesses to GPU data is
+ * inaccessible from external kexts, therefore, we have to do a hack.
+ * The hack is very straight forward; we have replaced the assembly that
+ * loads hardcoded values from
+ *     lea rsi, [_psp_asd_bin]
+ *     mov edx, 0x2c100 (the size of _psp_asd_bin)
+ *     mov rdi, r15
+ *     call _memcpy
+ * to
+ *     mov rsi, rcx
+ *     mov rdx, r8
+ *     mov rdi, r15
+ *     call _memcpy
+ * so that it gets the pointer and size from parameter 4 and 5.
+ * Register choice was because the parameter 2 and 3 registers get
+ * overwritten before this call to memcpy.
+ * The hack we came up with looks like terrible practice, but this will
+ * have to do.
+ * Pain.
+ */
+static constexpr uint8_t patchAsdLoadCopyFind[] = {
+    0x0f, 0x85, 0x83, 0x00, 0x00, 0x00, 0x48, 0x8d, 0x35,
+    0xf7, 0x93, 0xf4, 0x00, 0xba, 0x00, 0xc1, 0x02, 0x00,
+    0x4c, 0x89, 0xff, 0xe8, 0xf2, 0xa6, 0x56, 0x02};
+static constexpr uint8_t patchAsdLoadCopyReplace[] = {
+    0x0f, 0x85, 0x83, 0x00, 0x00, 0x00, 0x48, 0x8b, 0xf1,
+    0x4c, 0x89, 0xc2, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90,
+    0x4c, 0x89, 0xff, 0xe8, 0xf2, 0xa6, 0x56, 0x02};
+static constexpr uint8_t patchAsdLoadSizeFind[] = {
+    0x44, 0x89, 0x66, 0x08, 0x48, 0xc7, 0x46, 0x0c, 0x00, 0xc1,
+    0x02, 0x00, 0x48, 0xc7, 0x46, 0x14, 0x00, 0x00, 0x00, 0x00};
+static constexpr uint8_t patchAsdLoadSizeReplace[] = {
+    0x44, 0x89, 0x66, 0x08, 0x4c, 0x89, 0x84, 0x26, 0x0c, 0x00,
+    0x00, 0x00, 0x48, 0xc7, 0x46, 0x14, 0x00, 0x00, 0x00, 0x00};
+
+/*
+ * DEVICE_COMPONENT_FACTORY::createAsicInfo only creates the ASIC info of
+ * device IDs in the 0x6000 range:
+ * if ((0x685f < deviceId) && (deviceId < 0x6880)) {
+ * 	asic_info = new ASIC_INFO__VEGA10{};
+ * }
+ * The Device ID of the iGPUs usually is not, 0x15d8 for a Picasso iGPU for
+ * example, so 0 is returned as a fallback, breaking initialisation.
+ * The patch eliminates the if statement.
+ */
+static constexpr uint8_t patchCreateAsicInfoFind[] = {
+    0x3d, 0x60, 0x68, 0x00, 0x00, 0x0f, 0x8c, 0x32, 0x00, 0x00, 0x00,
+    0x0f, 0xb7, 0x45, 0xe6, 0x3d, 0x7f, 0x68, 0x00, 0x00, 0x0f, 0x8f,
+    0x23, 0x00, 0x00, 0x00, 0xbf, 0x78, 0x00, 0x00, 0x00};
+static constexpr uint8_t patchCreateAsicInfoReplace[] = {
+    0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90,
+    0x0f, 0xb7, 0x45, 0xe6, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90,
+    0x90, 0x90, 0x90, 0x90, 0xbf, 0x78, 0x00, 0x00, 0x00};
+
+static constexpr const char *PatchKextHWLibs =
+    "com.apple.kext.AMDRadeonX5000HWLibs";
+static constexpr const char *PatchKextController =
+    "com.apple.kext.AMD10000Controller";
+
+/**
+ *  Patch without masks; find and replace must be of the same size.
+ */
+template <size_t N>
+static constexpr BinaryPatch binaryPatch(
+    const char *name, const char *kext, const uint8_t (&find)[N],
+    const uint8_t (&replace)[N], uint32_t expected, uint32_t limit,
+    bool required, uint8_t minDarwin = PatchDarwinCatalina,
+    uint8_t maxDarwin = PatchDarwinMonterey) {
+    return {name,     kext,  find,      replace,   nullptr, nullptr,
+            N,        expected, limit,  minDarwin, maxDarwin, required};
+}
+
+/**
+ *  Byte patches of the AMD kexts. Every find pattern holds rel32
+ *  displacements or stack offsets of the one function it was taken from, so
+ *  one match is expected; Scripts/PatchManifestCheck.cpp reports the real
+ *  count of a kext on disk. The limit of 2 is the replace count handed to
+ *  Lilu before the manifest.
+ */
+static constexpr BinaryPatch radPatches[] = {
+    binaryPatch("smu_9_0_1_full_asic_reset", PatchKextHWLibs,
+                patchSmuResetFind, patchSmuResetReplace, 1, 2, true),
+    binaryPatch("psp_asd_load copy", PatchKextHWLibs, patchAsdLoadCopyFind,
+                patchAsdLoadCopyReplace, 1, 2, true),
+    binaryPatch("psp_asd_load size", PatchKextHWLibs, patchAsdLoadSizeFind,
+                patchAsdLoadSizeReplace, 1, 2, true),
+    binaryPatch("createAsicInfo device ID", PatchKextController,
+                patchCreateAsicInfoFind, patchCreateAsicInfoReplace, 1, 2,
+                true),
+};
+
+static_assert(patchManifestValid(radPatches), "invalid patch manifest");
+
+#endif /* kern_patch_hpp */
@@ -11,6 +11,7 @@
 #include <Availability.h>
 #include <IOKit/IOPlatformExpert.h>
 #include <IOKit/IOService.h>
+#include <sys/sysctl.h>
 
 #include <Headers/kern_api.hpp>
 #include <Headers/kern_devinfo.hpp>
@@ -18,15 +19,147 @@
 #include <Headers/kern_iokit.hpp>
 
 #include "kern_fw.hpp"
+#include "kern_hook.hpp"
 #include "kern_netdbg.hpp"
+#include "kern_wred.hpp"
 
-#define WRAP_SIMPLE(ty, func, fmt)                                         \
-    ty RAD::wrap##func(void *that) {                                       \
-        NETLOG("rad", "" #func " this = %p", that);                        \
-        auto ret = FunctionCast(wrap##func, callbackRAD->org##func)(that); \
-        NETLOG("rad", "" #func " returned " fmt, ret);                     \
-        return ret;                                                        \
+extern "C" int cpu_number();
+extern "C" uint64_t thread_tid(thread_t thread);
+
+/**
+ *  Sink of the generated trace hooks: NETDBG at trace level of "rad".
+ */
+struct RadHookSink {
+    template <uint32_t Id, typename... Args>
+    static void log(const char *fmt, Args... args) {
+        NETDBG::log<Id>(fmt, args...);
     }
+};
+
+using RadTrace = HookTrace<RadHookSink>;
+using RadObserve = HookBoth<RadTrace, RadMeasure>;
+
+/**
+ *  Hooks that only observe are routed only for trace logging, statistics or
+ *  the timeline.
+ */
+static constexpr bool radObserved = netLogEnabled("rad", NetLogTrace) ||
+                                    hookStatsEnabled || hookTimelineEnabled;
+
+uint32_t RadHookCpu::current() { return static_cast<uint32_t>(cpu_number()); }
+
+uint64_t RadHookThread::current() { return thread_tid(current_thread()); }
+
+// Hooks that only observe AMD functions
+HOOK_DEFINE(TraceInitWithController, "rad", "initWithController", RadObserve,
+            uint64_t(void *, void *));
+HOOK_DEFINE(TraceCreateAtomBiosProxy, "rad", "createAtomBiosProxy", RadObserve,
+            void *(void *));
+HOOK_DEFINE(TraceSendRequestToAccelerator, "rad", "sendRequestToAccelerator",
+            RadObserve, IOReturn(void *, uint32_t, void *, void *, void *));
+
+HOOK_DEFINE(TraceIpiSmuSwInit, "rad", "_ipi_smu_sw_init", RadObserve,
+            uint64_t(void *));
+HOOK_DEFINE(TraceSmuInternalSwInit, "rad", "_smu_internal_sw_init", RadObserve,
+            uint32_t(uint64_t, uint64_t, void *));
+HOOK_DEFINE(TraceInternalCosReadFw, "rad", "_internal_cos_read_fw", RadObserve,
+            uint32_t(uint64_t, uint64_t *));
+HOOK_DEFINE(TracePpEnable, "rad", "ppEnable", RadObserve,
+            IOReturn(void *, bool));
+HOOK_DEFINE(TracePpDisplayConfigChange, "rad", "ppDisplayConfigChange",
+            RadObserve, IOReturn(void *, void *, void *));
+HOOK_DEFINE(TraceSMUMInitialize, "rad", "_SMUM_Initialize", RadObserve,
+            uint64_t(uint64_t, uint32_t *, uint64_t));
+HOOK_DEFINE(TracePECIRetrieveBiosDataTable, "rad",
+            "_PECI_RetrieveBiosDataTable", RadObserve,
+            uint64_t(void *, uint64_t, uint64_t **));
+
+HOOK_DEFINE(TraceInitializeProjectDependentResources, "rad",
+            "initializeProjectDependentResources", RadObserve,
+            IOReturn(void *));
+HOOK_DEFINE(TraceHwInitializeFbMemSize, "rad", "hwInitializeFbMemSize",
+            RadObserve, IOReturn(void *));
+HOOK_DEFINE(TraceHwInitializeFbBase, "rad", "hwInitializeFbBase", RadObserve,
+            IOReturn(void *));
+HOOK_DEFINE(TraceInitializeResources, "rad", "initializeResources", RadObserve,
+            IOReturn(void *));
+HOOK_DEFINE(TraceInitializePP, "rad", "initializePowerPlay", RadObserve,
+            IOReturn(void *));
+HOOK_DEFINE(TraceCreatePowerPlayInterface, "rad", "createPowerPlayInterface",
+            RadObserve, IOReturn(void *));
+HOOK_DEFINE(TracePPInitialize, "rad", "PPInitialize", RadObserve,
+            IOReturn(void *));
+HOOK_DEFINE(TraceIsReady, "rad", "isReady", RadObserve, bool(void *));
+HOOK_DEFINE(TraceUpdatePowerPlay, "rad", "updatePowerPlay", RadObserve,
+            IOReturn(void *));
+
+HOOK_DEFINE(TraceConfigureDevice, "rad", "configureDevice", RadObserve,
+            uint64_t(void *, IOPCIDevice *));
+HOOK_DEFINE(TraceInitLinkToPeer, "rad", "initLinkToPeer", RadObserve,
+            IOService *(void *, const char *));
+HOOK_DEFINE(TraceCreateHWHandler, "rad", "createHWHandler", RadObserve,
+            uint64_t(void *));
+HOOK_DEFINE(TraceCreateHWInterface, "rad", "createHWInterface", RadObserve,
+            uint64_t(void *, IOPCIDevice *));
+HOOK_DEFINE(TraceGetHWMemory, "rad", "getHWMemory", RadObserve,
+            uint64_t(void *));
+HOOK_DEFINE(TraceGetATIChipConfigBit, "rad", "getATIChipConfigBit", RadObserve,
+            uint64_t(void *));
+HOOK_DEFINE(TraceAllocateAMDHWRegisters, "rad", "allocateAMDHWRegisters",
+            RadObserve, uint64_t(void *));
+HOOK_DEFINE(TraceInitializeHWWorkarounds, "rad", "initializeHWWorkarounds",
+            RadObserve, uint64_t(void *));
+HOOK_DEFINE(TraceAllocateAMDHWAlignManager, "rad",
+            "allocateAMDHWAlignManager", RadObserve, uint64_t(void *));
+HOOK_DEFINE(TraceMapDoorbellMemory, "rad", "mapDoorbellMemory", RadObserve,
+            bool(void *));
+HOOK_DEFINE(TraceGetState, "rad", "getState", RadObserve, uint64_t(void *));
+HOOK_DEFINE(TraceInitializeTtl, "rad", "initializeTtl", RadObserve,
+            bool(void *, void *));
+HOOK_DEFINE(TraceConfRegBase, "rad", "configureRegisterBases", RadObserve,
+            uint64_t(void *));
+HOOK_DEFINE(TraceReadChipRev, "rad", "readChipRevFromRegister", RadObserve,
+            uint8_t(void *));
+HOOK_DEFINE(TraceQueryComputeQueueIsIdle, "rad", "QueryComputeQueueIsIdle",
+            RadObserve, IOReturn(void *, uint64_t));
+HOOK_DEFINE(TraceAMDHWChannelWaitForIdle, "rad",
+            "AMDRadeonX5000_AMDHWChannel::waitForIdle", RadObserve,
+            bool(void *, uint64_t));
+HOOK_DEFINE(TraceAcceleratorPowerUpHw, "rad", "powerUpHW", RadObserve,
+            uint64_t(void *));
+
+// Hand-written hooks, for RadMeasure
+HOOK_NAME(StatsTestVRAM, "rad", "TestVRAM");
+HOOK_NAME(StatsNotifyLinkChange, "rad", "notifyLinkChange");
+HOOK_NAME(StatsCreateVramInfo, "rad", "createVramInfo");
+HOOK_NAME(StatsPopulateDeviceMemory, "rad", "populateDeviceMemory");
+HOOK_NAME(StatsAmdTtlServicesConstructor, "rad", "AmdTtlServices");
+HOOK_NAME(StatsSmuSwInit, "rad", "_smu_sw_init");
+HOOK_NAME(StatsSmuGetHwVersion, "rad", "_smu_get_hw_version");
+HOOK_NAME(StatsPspSwInit, "rad", "_psp_sw_init");
+HOOK_NAME(StatsGcGetHwVersion, "rad", "_gc_get_hw_version");
+HOOK_NAME(StatsPopulateFirmwareDirectory, "rad", "populateFirmwareDirectory");
+HOOK_NAME(StatsGetGpuHwConstants, "rad", "_GetGpuHwConstants");
+HOOK_NAME(StatsQueryEngineRunningState, "rad", "queryEngineRunningState");
+HOOK_NAME(StatsCAILQueryEngineRunningState, "rad",
+          "_CAILQueryEngineRunningState");
+HOOK_NAME(StatsCailMonitorEngineInternalState, "rad",
+          "_CailMonitorEngineInternalState");
+HOOK_NAME(StatsCailMonitorPerformanceCounter, "rad",
+          "_CailMonitorPerformanceCounter");
+HOOK_NAME(StatsPECISetupInitInfo, "rad", "_PECI_SetupInitInfo");
+HOOK_NAME(StatsPECIReadRegistry, "rad", "_PECI_ReadRegistry");
+HOOK_NAME(StatsCreatePowerTuneServices, "rad", "createPowerTuneServices");
+HOOK_NAME(StatsGetHwRevision, "rad", "_get_hw_revision");
+HOOK_NAME(StatsSmuGetFwConstants, "rad", "_smu_get_fw_constants");
+HOOK_NAME(StatsTtlDevIsVega10Device, "rad", "_ttlDevIsVega10Device");
+HOOK_NAME(StatsSmu901InternalHwInit, "rad", "_smu_9_0_1_internal_hw_init");
+HOOK_NAME(StatsPspAsdLoad, "rad", "_psp_asd_load");
+HOOK_NAME(StatsCosDebugPrint, "rad", "cosDebugPrint");
+HOOK_NAME(StatsMCILDebugPrint, "rad", "_MCILDebugPrint");
+HOOK_NAME(StatsProjectByPartNumber, "rad", "findProjectByPartNumber");
+HOOK_NAME(StatsGetFamilyId, "rad", "getFamilyId");
+HOOK_NAME(StatsPopulateDeviceInfo, "rad", "populateDeviceInfo");
 
 static const char *pathAMD10000Controller[] = {
     "/System/Library/Extensions/AMD10000Controller.kext/Contents/MacOS/"
@@ -77,10 +210,43 @@ static const char *powerGatingFlags[] = {
     "CAIL_DisableAcpPowerGating",          "CAIL_DisableSAMUPowerGating",
 };
 
+/**
+ *  debug.wredtimeline: RadTimeline as a HookTimelineHeader dump, registered
+ *  only with the timeline on. Read it with
+ *  sysctl -b debug.wredtimeline > timeline.bin
+ *  and convert it with Scripts/HookTimeline.py.
+ */
+static int hookTimelineSysctl(struct sysctl_oid *, void *, int,
+                              struct sysctl_req *req) {
+    if constexpr (hookTimelineEnabled) {
+        auto &buffer = RadTimeline::buffer;
+        // Room for events and hooks recorded while the dump is taken
+        size_t size = buffer.dumpSize() + 64 * sizeof(HookEvent);
+        if (req->oldptr == USER_ADDR_NULL)
+            return SYSCTL_OUT(req, nullptr, size);
+        auto *data = static_cast<uint8_t *>(IOMalloc(size));
+        if (!data) return ENOMEM;
+        mach_timebase_info_data_t timebase;
+        clock_timebase_info(&timebase);
+        size_t length =
+            buffer.dump(data, size, timebase.numer, timebase.denom);
+        int error = length ? SYSCTL_OUT(req, data, length) : ENOMEM;
+        IOFree(data, size);
+        return error;
+    } else {
+        return ENOENT;
+    }
+}
+
+SYSCTL_PROC(_debug, OID_AUTO, wredtimeline,
+            CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_LOCKED, nullptr, 0,
+            hookTimelineSysctl, "S", "WhateverRed hook timeline");
+
 RAD *RAD::callbackRAD;
 
 void RAD::init() {
     callbackRAD = this;
+    asicFirmware = asicResolve(asicDefault.deviceId, asicDefault.revisionMin);
 
     currentPropProvider.init();
 
@@ -99,6 +265,9 @@ void RAD::init() {
 
     initHardwareKextMods();
 
+    if constexpr (hookTimelineEnabled)
+        sysctl_register_oid(&sysctl__debug_wredtimeline);
+
     // FIXME: autodetect?
     uint32_t powerGatingMask = 0;
     PE_parse_boot_argn("radpg", &powerGatingMask, sizeof(powerGatingMask));
@@ -112,28 +281,69 @@ void RAD::init() {
     }
 }
 
-void RAD::deinit() {}
+void RAD::deinit() {
+    if constexpr (hookTimelineEnabled)
+        sysctl_unregister_oid(&sysctl__debug_wredtimeline);
+    __atomic_store_n(&stopping, true, __ATOMIC_RELAXED);
+    stopPeriodicCall(logFilterCall);
+    stopPeriodicCall(hookStatsCall);
+    fwObjects.flush();
+}
+
+void RAD::stopPeriodicCall(thread_call_t &call) {
+    if (!call) return;
+    // An invocation that ran before stopping was set may have re-armed it.
+    do {
+        thread_call_cancel_wait(call);
+    } while (!thread_call_free(call));
+    call = nullptr;
+}
 
 [[noreturn]] [[gnu::cold]] void RAD::wrapPanic(const char *fmt, ...) {
-    va_list args, netdbg_args;
+    // Static so a panic on a nearly exhausted kernel stack still works
+    static char message[NETDBG::RingSlotSize];
+    static char tail[NETDBG::PanicTailSize];
+    static bool panicking = false;
+
+    auto org = FunctionCast(wrapPanic, callbackRAD->orgPanic);
+    if (__atomic_exchange_n(&panicking, true, __ATOMIC_ACQ_REL)) {
+        // Nested or concurrent panic, the buffers are taken
+        org("%s", fmt);
+    }
+
+    va_list args;
     va_start(args, fmt);
-    va_copy(netdbg_args, args);
-    NETDBG::printf("panic: ");
-    NETDBG::vprintf(fmt, netdbg_args);
-    va_end(netdbg_args);
-    IOSleep(1000);
-    FunctionCast(wrapPanic, callbackRAD->orgPanic)(fmt, args);
+    size_t prefix = snprintf(message, sizeof(message), "panic: ");
+    size_t len =
+        prefix + vsnprintf(message + prefix, sizeof(message) - prefix - 1,
+                           fmt, args);
     va_end(args);
+    if (len > sizeof(message) - 2) len = sizeof(message) - 2;
+    message[len++] = '\n';
+    message[len] = '\0';
+
+    NETDBG::panicFlush(message, len, tail, sizeof(tail));
+    org("%s--- netdbg trace ---\n%s", message + prefix, tail);
     while (true) {
         asm volatile("hlt");
     }
 }
 
 [[noreturn]] [[gnu::cold]] void RAD::wrapEnterDebugger(const char *cause) {
-    NETLOG("rad", "Debugger requested: %s", cause);
+    NETERR("rad", "Debugger requested: %s", cause);
     panic("Debugger requested");
 }
 
+void RAD::configureLogFilter(DeviceInfo *info, LogFilter &filter,
+                             const char *name, const char *rateArg,
+                             const char *burstArg) {
+    uint32_t rate = 100, burst = 400;
+    WRed::getVideoArgument(info, rateArg, &rate, sizeof(rate));
+    WRed::getVideoArgument(info, burstArg, &burst, sizeof(burst));
+    filter.configure(name, rate, burst);
+    DBGLOG("rad", "%s log filter rate %u burst %u", name, rate, burst);
+}
+
 void RAD::processKernel(KernelPatcher &patcher, DeviceInfo *info) {
     for (size_t i = 0; i < info->videoExternal.size(); i++) {
         if (info->videoExternal[i].vendor == WIOKit::VendorID::ATIAMD) {
@@ -157,6 +367,42 @@ void RAD::processKernel(KernelPatcher &patcher, DeviceInfo *info) {
     if (PE_parse_boot_argn("radgva", &gva, sizeof(gva)))
         enableGvaSupport = gva != 0;
 
+    char netAddress[16] = {};
+    uint32_t netPort = 0;
+    uint8_t netUdp = checkKernelArgument("-wrednetudp");
+    bool hasNetAddress = WRed::getVideoArgument(info, "wrednetip", netAddress,
+                                                sizeof(netAddress) - 1);
+    WRed::getVideoArgument(info, "wrednetport", &netPort, sizeof(netPort));
+    if (!netUdp)
+        WRed::getVideoArgument(info, "wrednetudp", &netUdp, sizeof(netUdp));
+    NETDBG::configure(hasNetAddress ? netAddress : nullptr, netPort,
+                      netUdp != 0);
+
+    if constexpr (radObserved) {
+        uint8_t trace = 0;
+        observeHooks = checkKernelArgument("-wreddbg") ||
+                       (WRed::getVideoArgument(info, "wredtrace", &trace,
+                                               sizeof(trace)) &&
+                        trace);
+        DBGLOG("rad", "observing hooks %s", observeHooks ? "on" : "off");
+    }
+
+    char fwDir[FwDiskPathSize] = {};
+    if (WRed::getVideoArgument(info, "wredfwdir", fwDir, sizeof(fwDir) - 1) &&
+        fwDiskConfigure(fwDir))
+        DBGLOG("rad", "firmware overrides from %s", fwDir);
+
+    if constexpr (netLogEnabled("fw", NetLogInfo)) {
+        configureLogFilter(info, cosFilter, "AMD TTL COS", "wredcosrate",
+                           "wredcosburst");
+        configureLogFilter(info, mcilFilter, "_MCILDebugPrint", "wredmcilrate",
+                           "wredmcilburst");
+        if (!logFilterCall) {
+            logFilterCall = thread_call_allocate(flushLogFilters, nullptr);
+            if (logFilterCall) thread_call_enter(logFilterCall);
+        }
+    }
+
     KernelPatcher::RouteRequest requests[] = {
         {"__ZN15IORegistryEntry11setPropertyEPKcPvj", wrapSetProperty,
          orgSetProperty},
@@ -170,28 +416,19 @@ void RAD::processKernel(KernelPatcher &patcher, DeviceInfo *info) {
     }
 }
 
-IOReturn RAD::wrapProjectByPartNumber() { return kIOReturnNotFound; }
-
-WRAP_SIMPLE(IOReturn, InitializeProjectDependentResources, "0x%X")
-WRAP_SIMPLE(IOReturn, HwInitializeFbMemSize, "0x%X")
-WRAP_SIMPLE(IOReturn, HwInitializeFbBase, "0x%X")
-
-uint64_t RAD::wrapInitWithController(void *that, void *controller) {
-    NETLOG("rad", "initWithController this = %p", that);
-    auto ret =
-        FunctionCast(wrapInitWithController,
-                     callbackRAD->orgInitWithController)(that, controller);
-    NETLOG("rad", "initWithController returned %llX", ret);
-    return ret;
+IOReturn RAD::wrapProjectByPartNumber() {
+    HookScope<RadMeasure, StatsProjectByPartNumber> stats;
+    return kIOReturnNotFound;
 }
 
 IntegratedVRAMInfoInterface *RAD::createVramInfo(
     [[maybe_unused]] void *helper, [[maybe_unused]] uint32_t offset) {
-    NETLOG("rad",
-           "------------------------------------------------------------"
-           "----------");
+    HookScope<RadMeasure, StatsCreateVramInfo> stats;
+    NETTRACE("rad",
+             "------------------------------------------------------------"
+             "----------");
     NETLOG("rad", "creating fake VRAM info, get rekt ayymd");
-    NETLOG("rad", "createVramInfo offset = 0x%X", offset);
+    NETTRACE("rad", "createVramInfo offset = 0x%X", offset);
     DataTableInitInfo initInfo{
         .helper = helper,
         .tableOffset = offset,
@@ -203,19 +440,27 @@ IntegratedVRAMInfoInterface *RAD::createVramInfo(
     };
     auto *ret = new IntegratedVRAMInfoInterface;
     ret->init(&initInfo);
-    NETLOG("rad",
-           "------------------------------------------------------------"
-           "----------");
+    NETTRACE("rad",
+             "------------------------------------------------------------"
+             "----------");
     return ret;
 }
 
 void RAD::wrapAmdTtlServicesConstructor(IOService *that,
                                         IOPCIDevice *provider) {
-    NETDBG::enabled = true;
+    HookScope<RadMeasure, StatsAmdTtlServicesConstructor> stats;
+    NETDBG::enable();
+    uint16_t deviceId = provider->extendedConfigRead16(kIOPCIConfigDeviceID);
+    uint8_t revision = provider->extendedConfigRead8(kIOPCIConfigRevisionID);
+    auto &fw = callbackRAD->asicFirmware;
+    fw = asicResolve(deviceId, revision);
+    NETLOG("rad", "device 0x%04X rev 0x%02X: %s%s, VCN %s, ASD %s", deviceId,
+           revision, fw.asic->name, fw.known ? "" : " (unknown device)",
+           fw.vcn ? fw.vcn->name : "none", fw.asd ? fw.asd->name : "none");
+
     NETLOG("rad", "patching device type table");
     MachInfo::setKernelWriting(true, KernelPatcher::kernelWriteLock);
-    *(uint32_t *)callbackRAD->orgDeviceTypeTable =
-        provider->extendedConfigRead16(kIOPCIConfigDeviceID);
+    *(uint32_t *)callbackRAD->orgDeviceTypeTable = deviceId;
     *((uint32_t *)callbackRAD->orgDeviceTypeTable + 1) = 6;
     MachInfo::setKernelWriting(false, KernelPatcher::kernelWriteLock);
 
@@ -224,42 +469,24 @@ void RAD::wrapAmdTtlServicesConstructor(IOService *that,
                  callbackRAD->orgAmdTtlServicesConstructor)(that, provider);
 }
 
-uint64_t RAD::wrapIpiSmuSwInit(void *tlsInstance) {
-    NETLOG("rad", "_ipi_smu_sw_init: tlsInstance = %p", tlsInstance);
-    auto ret = FunctionCast(wrapIpiSmuSwInit,
-                            callbackRAD->orgIpiSmuSwInit)(tlsInstance);
-    NETLOG("rad", "_ipi_smu_sw_init returned 0x%llX", ret);
-    return ret;
-}
-
 uint64_t RAD::wrapSmuSwInit(void *input, uint64_t *output) {
-    NETLOG("rad", "_smu_sw_init: input = %p output = %p", input, output);
+    HookScope<RadMeasure, StatsSmuSwInit> stats;
+    NETTRACE("rad", "_smu_sw_init: input = %p output = %p", input, output);
     auto ret =
         FunctionCast(wrapSmuSwInit, callbackRAD->orgSmuSwInit)(input, output);
-    NETLOG("rad", "_smu_sw_init: output 0:0x%llX 1:0x%llX", output[0],
-           output[1]);
-    NETLOG("rad", "_smu_sw_init returned 0x%llX", ret);
-    return ret;
-}
-
-uint32_t RAD::wrapSmuInternalSwInit(uint64_t param1, uint64_t param2,
-                                    void *param3) {
-    NETLOG("rad",
-           "_smu_internal_sw_init: param1 = 0x%llX param2 = 0x%llX param3 = %p",
-           param1, param2, param3);
-    auto ret =
-        FunctionCast(wrapSmuInternalSwInit, callbackRAD->orgSmuInternalSwInit)(
-            param1, param2, param3);
-    NETLOG("rad", "_smu_internal_sw_init returned 0x%X", ret);
+    NETTRACE("rad", "_smu_sw_init: output 0:0x%llX 1:0x%llX", output[0],
+             output[1]);
+    NETTRACE("rad", "_smu_sw_init returned 0x%llX", ret);
     return ret;
 }
 
 uint64_t RAD::wrapSmuGetHwVersion(uint64_t param1, uint32_t param2) {
-    NETLOG("rad", "_smu_get_hw_version: param1 = 0x%llX param2 = 0x%X", param1,
-           param2);
+    HookScope<RadMeasure, StatsSmuGetHwVersion> stats;
+    NETTRACE("rad", "_smu_get_hw_version: param1 = 0x%llX param2 = 0x%X",
+             param1, param2);
     auto ret = FunctionCast(wrapSmuGetHwVersion,
                             callbackRAD->orgSmuGetHwVersion)(param1, param2);
-    NETLOG("rad", "_smu_get_hw_version returned 0x%llX", ret);
+    NETTRACE("rad", "_smu_get_hw_version returned 0x%llX", ret);
     switch (ret) {
         case 0x2:
             NETLOG("rad", "Spoofing SMU v10 to v9.0.1");
@@ -275,10 +502,11 @@ uint64_t RAD::wrapSmuGetHwVersion(uint64_t param1, uint32_t param2) {
 }
 
 uint64_t RAD::wrapPspSwInit(uint32_t *param1, uint32_t *param2) {
-    NETLOG("rad", "_psp_sw_init: param1 = %p param2 = %p", param1, param2);
-    NETLOG("rad",
-           "_psp_sw_init: param1: 0:0x%X 1:0x%X 2:0x%X 3:0x%X 4:0x%X 5:0x%X",
-           param1[0], param1[1], param1[2], param1[3], param1[4], param1[5]);
+    HookScope<RadMeasure, StatsPspSwInit> stats;
+    NETTRACE("rad", "_psp_sw_init: param1 = %p param2 = %p", param1, param2);
+    NETTRACE("rad",
+             "_psp_sw_init: param1: 0:0x%X 1:0x%X 2:0x%X 3:0x%X 4:0x%X 5:0x%X",
+             param1[0], param1[1], param1[2], param1[3], param1[4], param1[5]);
     switch (param1[3]) {
         case 0xA:
             NETLOG("rad", "Spoofing PSP version v10 to v9.0.2");
@@ -299,15 +527,16 @@ uint64_t RAD::wrapPspSwInit(uint32_t *param1, uint32_t *param2) {
     }
     auto ret =
         FunctionCast(wrapPspSwInit, callbackRAD->orgPspSwInit)(param1, param2);
-    NETLOG("rad", "_psp_sw_init returned 0x%llX", ret);
+    NETTRACE("rad", "_psp_sw_init returned 0x%llX", ret);
     return ret;
 }
 
 uint32_t RAD::wrapGcGetHwVersion(uint32_t *param1) {
-    NETLOG("rad", "_gc_get_hw_version: param1 = %p", param1);
+    HookScope<RadMeasure, StatsGcGetHwVersion> stats;
+    NETTRACE("rad", "_gc_get_hw_version: param1 = %p", param1);
     auto ret = FunctionCast(wrapGcGetHwVersion,
                             callbackRAD->orgGcGetHwVersion)(param1);
-    NETLOG("rad", "_gc_get_hw_version returned 0x%X", ret);
+    NETTRACE("rad", "_gc_get_hw_version returned 0x%X", ret);
     if ((ret & 0xFF0000) == 0x90000) {
         NETLOG("rad", "Spoofing GC version 9.x.x to 9.2.1");
         return 0x90201;
@@ -315,302 +544,216 @@ uint32_t RAD::wrapGcGetHwVersion(uint32_t *param1) {
     return ret;
 }
 
-uint32_t RAD::wrapInternalCosReadFw(uint64_t param1, uint64_t *param2) {
-    NETLOG("rad", "_internal_cos_read_fw: param1 = 0x%llX param2 = %p", param1,
-           param2);
-    auto ret = FunctionCast(wrapInternalCosReadFw,
-                            callbackRAD->orgInternalCosReadFw)(param1, param2);
-    NETLOG("rad", "_internal_cos_read_fw returned 0x%X", ret);
-    return ret;
+/**
+ *  Refuse firmware the AMD loaders would choke on, before they see it: it
+ *  must parse, be of the expected container and carry a signed PSP image.
+ */
+static void checkFirmware(const char *name, const FwView &view,
+                          FwFormat format) {
+    FwInfo info;
+    if (!view) panic("%s is missing or corrupt", name);
+    if (!fwParse(view.data, view.size, info))
+        panic("%s: %s", name, info.error);
+    if (info.format != format || !info.signatureSize ||
+        (format == FwFormatAmdgpu && info.imageMagic != PspMagic))
+        panic("%s: %s firmware, expected a signed %s one", name,
+              fwFormatName(info.format), fwFormatName(format));
+    NETLOG("rad", "%s: %s, ucode 0x%08X, payload 0x%X bytes at 0x%X", name,
+           fwFormatName(info.format), info.ucodeVersion, info.payloadSize,
+           info.payloadOffset);
+}
+
+static void retainAmdFirmware(void *object) {
+    static_cast<OSObject *>(object)->retain();
+}
+
+static void releaseAmdFirmware(void *object) {
+    static_cast<OSObject *>(object)->release();
 }
 
 void RAD::wrapPopulateFirmwareDirectory(void *that) {
-    NETLOG(
+    HookScope<RadMeasure, StatsPopulateFirmwareDirectory> stats;
+    NETTRACE(
         "rad",
         "AMDRadeonX5000_AMDRadeonHWLibsX5000::populateFirmwareDirectory this "
         "= %p",
         that);
     FunctionCast(wrapPopulateFirmwareDirectory,
                  callbackRAD->orgPopulateFirmwareDirectory)(that);
-    NETLOG("rad", "injecting ativvaxy_rv.dat!");
-    auto *fwDesc = getFWDescByName("ativvaxy_rv.dat");
-
-    auto *fw = callbackRAD->orgCreateFirmware(fwDesc->getBytesNoCopy(),
-                                              fwDesc->getLength(), 0x200,
-                                              "ativvaxy_rv.dat");
+    auto *desc = callbackRAD->asicFirmware.vcn;
+    auto *name = desc ? desc->name : callbackRAD->asicFirmware.asic->vcn[0];
+    NETLOG("rad", "injecting %s!", name);
+    auto vcn = fwView(desc);
+    checkFirmware(name, vcn, FwFormatPspImage);
+
+    auto *fw = callbackRAD->fwObjects.get(
+        6, vcn.data, static_cast<uint32_t>(vcn.size), 0x200, name);
+    if (!fw) panic("Failed to create %s firmware", name);
     auto *fwDir = *(void **)((uint8_t *)that + 0xB8);
-    NETLOG("rad", "fwDir = %p", fwDir);
+    NETTRACE("rad", "fwDir = %p", fwDir);
     if (!callbackRAD->orgPutFirmware(fwDir, 6, fw)) {
-        panic("Failed to inject ativvaxy_rv.dat firmware");
+        panic("Failed to inject %s firmware", name);
     }
+    auto &objects = callbackRAD->fwObjects.getStats();
+    NETTRACE("rad",
+             "firmware: %llu lookups, %llu from disk, %llu bytes allocated, "
+             "%llu live, objects %llu reused %llu created",
+             fwStats.lookups, fwStats.diskLoads, fwStats.bytesAllocated,
+             fwStats.bytesLive, objects.hits, objects.misses);
 }
 
-void *RAD::wrapCreateAtomBiosProxy(void *param1) {
-    NETLOG("rad",
-           "------------------------------------------------------------"
-           "----------");
-    NETLOG("rad", "createAtomBiosProxy: param1 = %p", param1);
-    auto ret = FunctionCast(wrapCreateAtomBiosProxy,
-                            callbackRAD->orgCreateAtomBiosProxy)(param1);
-    NETLOG("rad", "createAtomBiosProxy returned %p", ret);
-    return ret;
+void *RAD::createAmdFirmware(const void *data, uint32_t size, uint32_t flags,
+                             const char *name) {
+    return callbackRAD->orgCreateFirmware(data, size, flags, name);
 }
 
-IOReturn RAD::wrapInitializeResources(void *that) {
-    NETLOG("rad", "initializeResources this = %p", that);
-    auto ret = FunctionCast(wrapInitializeResources,
-                            callbackRAD->orgInitializeResources)(that);
-    NETLOG("rad", "initializeResources returned 0x%X", ret);
-    return ret;
-}
+const FwObjectOps RAD::amdFirmwareOps = {createAmdFirmware, retainAmdFirmware,
+                                         releaseAmdFirmware};
 
 IOReturn RAD::wrapPopulateDeviceMemory(void *that, uint32_t reg) {
-    DBGLOG("rad", "populateDeviceMemory: this = %p reg = 0x%X", that, reg);
+    HookScope<RadMeasure, StatsPopulateDeviceMemory> stats;
+    NETTRACE("rad", "populateDeviceMemory: this = %p reg = 0x%X", that, reg);
     auto ret = FunctionCast(wrapPopulateDeviceMemory,
                             callbackRAD->orgPopulateDeviceMemory)(that, reg);
-    DBGLOG("rad", "populateDeviceMemory returned 0x%X", ret);
+    NETTRACE("rad", "populateDeviceMemory returned 0x%X", ret);
     return kIOReturnSuccess;
 }
 
 void *RAD::wrapGetGpuHwConstants(uint8_t *param1) {
-    DBGLOG("rad",
-           "------------------------------------------------------------"
-           "----------");
-    DBGLOG("rad", "_GetGpuHwConstants: param1 = %p", param1);
+    HookScope<RadMeasure, StatsGetGpuHwConstants> stats;
+    NETTRACE("rad",
+             "------------------------------------------------------------"
+             "----------");
+    NETTRACE("rad", "_GetGpuHwConstants: param1 = %p", param1);
     auto *asicCaps = *(uint8_t **)(param1 + 0x350);
-    DBGLOG("rad", "_GetGpuHwConstants: asicCaps = %p", asicCaps);
+    NETTRACE("rad", "_GetGpuHwConstants: asicCaps = %p", asicCaps);
     uint16_t deviceId = *(uint16_t *)(asicCaps + 8);
-    DBGLOG("rad", "_GetGpuHwConstants: deviceId = 0x%X", deviceId);
+    NETTRACE("rad", "_GetGpuHwConstants: deviceId = 0x%X", deviceId);
     auto *goldenSettings = *(uint8_t **)(asicCaps + 48);
-    DBGLOG("rad", "_GetGpuHwConstants: goldenSettings = %p", goldenSettings);
+    NETTRACE("rad", "_GetGpuHwConstants: goldenSettings = %p", goldenSettings);
     for (size_t i = 0; i < 24; i++) {
-        DBGLOG("rad", "_GetGpuHwConstants: goldenSettings: %zu:0x%X", i,
-               goldenSettings[i]);
+        NETTRACE("rad", "_GetGpuHwConstants: goldenSettings: %zu:0x%X", i,
+                 goldenSettings[i]);
     }
     auto ret = FunctionCast(wrapGetGpuHwConstants,
                             callbackRAD->orgGetGpuHwConstants)(param1);
-    DBGLOG("rad", "_GetGpuHwConstants returned %p", ret);
-    DBGLOG("rad",
-           "------------------------------------------------------------"
-           "----------");
+    NETTRACE("rad", "_GetGpuHwConstants returned %p", ret);
+    NETTRACE("rad",
+             "------------------------------------------------------------"
+             "----------");
     if (!ret) {
-        NETLOG("rad", "_GetGpuHwConstants failed!");
+        NETERR("rad", "_GetGpuHwConstants failed!");
         panic("_GetGpuHwConstants returned ZERO value!");
     }
     return ret;
 }
 
-uint64_t RAD::wrapMCILUpdateGfxCGPG(void *param1) {
-    NETLOG("rad",
-           "------------------------------------------------------------"
-           "----------");
-    NETLOG("rad", "_Cail_MCILUpdateGfxCGPG: param1 = %p", param1);
-    auto ret = FunctionCast(wrapMCILUpdateGfxCGPG,
-                            callbackRAD->orgMCILUpdateGfxCGPG)(param1);
-    NETLOG("rad", "_Cail_MCILUpdateGfxCGPG returned 0x%llX", ret);
-    return ret;
-}
-
 IOReturn RAD::wrapQueryEngineRunningState(void *that, void *param1,
                                           void *param2) {
-    NETLOG("rad", "queryEngineRunningState: this = %p param1 = %p param2 = %p",
-           that, param1, param2);
-    NETLOG("rad", "queryEngineRunningState: *param2 = 0x%X",
-           *static_cast<uint32_t *>(param2));
+    HookScope<RadMeasure, StatsQueryEngineRunningState> stats;
+    NETTRACE("rad",
+             "queryEngineRunningState: this = %p param1 = %p param2 = %p", that,
+             param1, param2);
+    NETTRACE("rad", "queryEngineRunningState: *param2 = 0x%X",
+             *static_cast<uint32_t *>(param2));
     auto ret = FunctionCast(wrapQueryEngineRunningState,
                             callbackRAD->orgQueryEngineRunningState)(
         that, param1, param2);
-    NETLOG("rad", "queryEngineRunningState: after *param2 = 0x%X",
-           *static_cast<uint32_t *>(param2));
-    NETLOG("rad", "queryEngineRunningState returned 0x%X", ret);
-    return ret;
-}
-
-IOReturn RAD::wrapQueryComputeQueueIsIdle(void *that, uint64_t param1) {
-    NETLOG("rad", "QueryComputeQueueIsIdle: this = %p param1 = 0x%llX", that,
-           param1);
-    auto ret =
-        FunctionCast(wrapQueryComputeQueueIsIdle,
-                     callbackRAD->orgQueryComputeQueueIsIdle)(that, param1);
-    NETLOG("rad", "QueryComputeQueueIsIdle returned 0x%X", ret);
+    NETTRACE("rad", "queryEngineRunningState: after *param2 = 0x%X",
+             *static_cast<uint32_t *>(param2));
+    NETTRACE("rad", "queryEngineRunningState returned 0x%X", ret);
     return ret;
 }
 
 uint64_t RAD::wrapCAILQueryEngineRunningState(void *param1, uint32_t *param2,
                                               uint64_t param3) {
-    NETLOG(
+    HookScope<RadMeasure, StatsCAILQueryEngineRunningState> stats;
+    NETTRACE(
         "rad",
         "_CAILQueryEngineRunningState: param1 = %p param2 = %p param3 = %llX",
         param1, param2, param3);
-    NETLOG("rad", "_CAILQueryEngineRunningState: *param2 = 0x%X", *param2);
+    NETTRACE("rad", "_CAILQueryEngineRunningState: *param2 = 0x%X", *param2);
     auto ret = FunctionCast(wrapCAILQueryEngineRunningState,
                             callbackRAD->orgCAILQueryEngineRunningState)(
         param1, param2, param3);
-    NETLOG("rad", "_CAILQueryEngineRunningState: after *param2 = 0x%X",
-           *param2);
-    NETLOG("rad", "_CAILQueryEngineRunningState returned 0x%llX", ret);
+    NETTRACE("rad", "_CAILQueryEngineRunningState: after *param2 = 0x%X",
+             *param2);
+    NETTRACE("rad", "_CAILQueryEngineRunningState returned 0x%llX", ret);
     return ret;
 }
 
 uint64_t RAD::wrapCailMonitorEngineInternalState(void *that, uint32_t param1,
                                                  uint32_t *param2) {
-    NETLOG(
+    HookScope<RadMeasure, StatsCailMonitorEngineInternalState> stats;
+    NETTRACE(
         "rad",
         "_CailMonitorEngineInternalState: this = %p param1 = 0x%X param2 = %p",
         that, param1, param2);
-    NETLOG("rad", "_CailMonitorEngineInternalState: *param2 = 0x%X", *param2);
+    NETTRACE("rad", "_CailMonitorEngineInternalState: *param2 = 0x%X", *param2);
     auto ret = FunctionCast(wrapCailMonitorEngineInternalState,
                             callbackRAD->orgCailMonitorEngineInternalState)(
         that, param1, param2);
-    NETLOG("rad", "_CailMonitorEngineInternalState: after *param2 = 0x%X",
-           *param2);
-    NETLOG("rad", "_CailMonitorEngineInternalState returned 0x%llX", ret);
+    NETTRACE("rad", "_CailMonitorEngineInternalState: after *param2 = 0x%X",
+             *param2);
+    NETTRACE("rad", "_CailMonitorEngineInternalState returned 0x%llX", ret);
     return ret;
 }
 
 uint64_t RAD::wrapCailMonitorPerformanceCounter(void *that, uint32_t *param1) {
-    NETLOG("rad", "_CailMonitorPerformanceCounter: this = %p param1 = %p", that,
-           param1);
-    NETLOG("rad", "_CailMonitorPerformanceCounter: *param1 = 0x%X", *param1);
+    HookScope<RadMeasure, StatsCailMonitorPerformanceCounter> stats;
+    NETTRACE("rad", "_CailMonitorPerformanceCounter: this = %p param1 = %p",
+             that, param1);
+    NETTRACE("rad", "_CailMonitorPerformanceCounter: *param1 = 0x%X", *param1);
     auto ret = FunctionCast(wrapCailMonitorPerformanceCounter,
                             callbackRAD->orgCailMonitorPerformanceCounter)(
         that, param1);
-    NETLOG("rad", "_CailMonitorPerformanceCounter: after *param1 = 0x%X",
-           *param1);
-    NETLOG("rad", "_CailMonitorPerformanceCounter returned 0x%llX", ret);
-    return ret;
-}
-
-bool RAD::wrapAMDHWChannelWaitForIdle(void *that, uint64_t param1) {
-    NETLOG(
-        "rad",
-        "AMDRadeonX5000_AMDHWChannel::waitForIdle: this = %p param1 = 0x%llx",
-        that, param1);
-    auto ret =
-        FunctionCast(wrapAMDHWChannelWaitForIdle,
-                     callbackRAD->orgAMDHWChannelWaitForIdle)(that, param1);
-    NETLOG("rad", "AMDRadeonX5000_AMDHWChannel::waitForIdle returned %d", ret);
-    return ret;
-}
-
-WRAP_SIMPLE(uint64_t, AcceleratorPowerUpHw, "0x%llX")
-
-IOReturn RAD::wrapInitializePP(void *that) {
-    NETLOG("rad", "initializePowerPlay this = %p", that);
-    auto ret =
-        FunctionCast(wrapInitializePP, callbackRAD->orgInitializePP)(that);
-    NETLOG("rad", "initializePowerPlay returned 0x%X", ret);
-    return ret;
-}
-
-IOReturn RAD::wrapCreatePowerPlayInterface(void *that) {
-    NETLOG("rad", "createPowerPlayInterface this = %p", that);
-    auto ret = FunctionCast(wrapCreatePowerPlayInterface,
-                            callbackRAD->orgCreatePowerPlayInterface)(that);
-    NETLOG("rad", "createPowerPlayInterface returned 0x%X", ret);
-    return ret;
-}
-
-IOReturn RAD::wrapSendRequestToAccelerator(void *that, uint32_t param1,
-                                           void *param2, void *param3,
-                                           void *param4) {
-    NETLOG(
-        "rad",
-        "sendRequestToAccelerator: that = %p param1 = 0x%X param2 = %p param3 "
-        "= %p param4 = %p",
-        that, param1, param2, param3, param4);
-    auto ret = FunctionCast(wrapSendRequestToAccelerator,
-                            callbackRAD->orgSendRequestToAccelerator)(
-        that, param1, param2, param3, param4);
-    NETLOG("rad", "sendRequestToAccelerator returned 0x%X", ret);
-    return ret;
-}
-
-WRAP_SIMPLE(IOReturn, PPInitialize, "0x%X")
-
-IOReturn RAD::wrapPpEnable(void *that, bool param1) {
-    NETLOG("rad", "ppEnable: this = %p param1 = %d", that, param1);
-    auto ret =
-        FunctionCast(wrapPpEnable, callbackRAD->orgPpEnable)(that, param1);
-    NETLOG("rad", "ppEnable returned 0x%X", ret);
-    return ret;
-}
-
-WRAP_SIMPLE(IOReturn, UpdatePowerPlay, "0x%X")
-WRAP_SIMPLE(bool, IsReady, "%d")
-
-IOReturn RAD::wrapPpDisplayConfigChange(void *that, void *param1,
-                                        void *param2) {
-    NETLOG("rad", "ppDisplayConfigChange: this = %p param1 = %p param2 = %p",
-           that, param1, param2);
-    auto ret = FunctionCast(wrapPpDisplayConfigChange,
-                            callbackRAD->orgPpDisplayConfigChange)(that, param1,
-                                                                   param2);
-    NETLOG("rad", "ppDisplayConfigChange returned 0x%X", ret);
+    NETTRACE("rad", "_CailMonitorPerformanceCounter: after *param1 = 0x%X",
+             *param1);
+    NETTRACE("rad", "_CailMonitorPerformanceCounter returned 0x%llX", ret);
     return ret;
 }
 
 uint64_t RAD::wrapPECISetupInitInfo(uint32_t *param1, uint32_t *param2) {
-    NETLOG("rad", "_PECI_SetupInitInfo: param1 = %p param2 = %p", param1,
-           param2);
-    NETLOG("rad", "_PECI_SetupInitInfo: *param1 = 0x%X", *param1);
-    NETLOG("rad",
-           "_PECI_SetupInitInfo: param2 before: 0:0x%X 1:0x%X 2:0x%X 3:0x%X",
-           param2[0], param2[1], param2[2], param2[3]);
+    HookScope<RadMeasure, StatsPECISetupInitInfo> stats;
+    NETTRACE("rad", "_PECI_SetupInitInfo: param1 = %p param2 = %p", param1,
+             param2);
+    NETTRACE("rad", "_PECI_SetupInitInfo: *param1 = 0x%X", *param1);
+    NETTRACE("rad",
+             "_PECI_SetupInitInfo: param2 before: 0:0x%X 1:0x%X 2:0x%X 3:0x%X",
+             param2[0], param2[1], param2[2], param2[3]);
     auto ret = FunctionCast(wrapPECISetupInitInfo,
                             callbackRAD->orgPECISetupInitInfo)(param1, param2);
-    NETLOG("rad",
-           "_PECI_SetupInitInfo: param2 after: 0:0x%X 1:0x%X 2:0x%X 3:0x%X",
-           param2[0], param2[1], param2[2], param2[3]);
-    NETLOG("rad", "_PECI_SetupInitInfo returned 0x%llX", ret);
+    NETTRACE("rad",
+             "_PECI_SetupInitInfo: param2 after: 0:0x%X 1:0x%X 2:0x%X 3:0x%X",
+             param2[0], param2[1], param2[2], param2[3]);
+    NETTRACE("rad", "_PECI_SetupInitInfo returned 0x%llX", ret);
     return ret;
 }
 
 uint64_t RAD::wrapPECIReadRegistry(void *param1, char *key, uint64_t param3,
                                    uint64_t param4) {
-    NETLOG("rad",
-           "_PECI_ReadRegistry param1 = %p key = %p param3 = 0x%llX param4 = "
-           "0x%llX",
-           param1, key, param3, param4);
-    NETLOG("rad", "_PECI_ReadRegistry key is %s", key);
+    HookScope<RadMeasure, StatsPECIReadRegistry> stats;
+    NETTRACE("rad",
+             "_PECI_ReadRegistry param1 = %p key = %p param3 = 0x%llX param4 = "
+             "0x%llX",
+             param1, key, param3, param4);
+    NETTRACE("rad", "_PECI_ReadRegistry key is %s", key);
     auto ret =
         FunctionCast(wrapPECIReadRegistry, callbackRAD->orgPECIReadRegistry)(
             param1, key, param3, param4);
-    NETLOG("rad", "_PECI_ReadRegistry returned 0x%llX", ret);
-    return ret;
-}
-
-uint64_t RAD::wrapSMUMInitialize(uint64_t param1, uint32_t *param2,
-                                 uint64_t param3) {
-    NETLOG("rad",
-           "_SMUM_Initialize: param1 = 0x%llX param2 = %p param3 = 0x%llX",
-           param1, param2, param3);
-    auto ret = FunctionCast(wrapSMUMInitialize, callbackRAD->orgSMUMInitialize)(
-        param1, param2, param3);
-    NETLOG("rad", "_SMUM_Initialize returned 0x%llX", ret);
-    return ret;
-}
-
-uint64_t RAD::wrapPECIRetrieveBiosDataTable(void *param1, uint64_t param2,
-                                            uint64_t **param3) {
-    NETLOG(
-        "rad",
-        "_PECI_RetrieveBiosDataTable: param1 = %p param2 = 0x%llX param3 = %p",
-        param1, param2, param3);
-    auto ret = FunctionCast(wrapPECIRetrieveBiosDataTable,
-                            callbackRAD->orgPECIRetrieveBiosDataTable)(
-        param1, param2, param3);
-    NETLOG("rad", "_PECI_RetrieveBiosDataTable returned 0x%llX", ret);
+    NETTRACE("rad", "_PECI_ReadRegistry returned 0x%llX", ret);
     return ret;
 }
 
 void *RAD::wrapCreatePowerTuneServices(void *param1, void *param2) {
+    HookScope<RadMeasure, StatsCreatePowerTuneServices> stats;
     auto *ret = IOMallocZero(0x18);
     callbackRAD->orgVega10PowerTuneServicesConstructor(ret, param1, param2);
     return ret;
 }
 
 uint16_t RAD::wrapGetFamilyId() {
+    HookScope<RadMeasure, StatsGetFamilyId> stats;
     // Usually, the value is hardcoded to 0x8d which is Vega 10
     // So we now hard code it to Raven
     return 0x8e;
@@ -618,13 +761,15 @@ uint16_t RAD::wrapGetFamilyId() {
 
 uint32_t RAD::wrapGetHwRevision(uint32_t major, uint32_t minor,
                                 uint32_t patch) {
-    NETLOG("rad", "_get_hw_revision: minor = 0x%X major = 0x%X patch = 0x%X",
-           minor, major, patch);
+    HookScope<RadMeasure, StatsGetHwRevision> stats;
+    NETTRACE("rad", "_get_hw_revision: minor = 0x%X major = 0x%X patch = 0x%X",
+             minor, major, patch);
     return (minor << 0x8) | (major << 0x10) | patch;
 }
 
 IOReturn RAD::wrapPopulateDeviceInfo(void *that) {
-    NETLOG("rad", "ASIC_INFO__VEGA10::populateDeviceInfo: this = %p", that);
+    HookScope<RadMeasure, StatsPopulateDeviceInfo> stats;
+    NETTRACE("rad", "ASIC_INFO__VEGA10::populateDeviceInfo: this = %p", that);
     auto ret = FunctionCast(wrapPopulateDeviceInfo,
                             callbackRAD->orgPopulateDeviceInfo)(that);
     auto *familyId =
@@ -635,8 +780,8 @@ IOReturn RAD::wrapPopulateDeviceInfo(void *that) {
         reinterpret_cast<uint32_t *>(static_cast<uint8_t *>(that) + 0x48);
     auto *emulatedRevision =
         reinterpret_cast<uint32_t *>(static_cast<uint8_t *>(that) + 0x4c);
-    NETLOG("rad", "before: familyId = 0x%X emulatedRevision = 0x%X", *familyId,
-           *emulatedRevision);
+    NETTRACE("rad", "before: familyId = 0x%X emulatedRevision = 0x%X",
+             *familyId, *emulatedRevision);
     *familyId = 0x8e;
     switch (*deviceId) {
         case 0x15d8:
@@ -653,14 +798,15 @@ IOReturn RAD::wrapPopulateDeviceInfo(void *that) {
             }
             break;
     }
-    NETLOG("rad", "after: familyId = 0x%X emulatedRevision = 0x%X", *familyId,
-           *emulatedRevision);
+    NETTRACE("rad", "after: familyId = 0x%X emulatedRevision = 0x%X", *familyId,
+             *emulatedRevision);
 
-    NETLOG("rad", "ASIC_INFO__VEGA10::populateDeviceInfo returned 0x%X", ret);
+    NETTRACE("rad", "ASIC_INFO__VEGA10::populateDeviceInfo returned 0x%X", ret);
     return ret;
 }
 
 uint64_t RAD::wrapSmuGetFwConstants() {
+    HookScope<RadMeasure, StatsSmuGetFwConstants> stats;
     /*
      * According to Linux AMDGPU source code,
      * on APUs, the System BIOS is the one that loads the SMC Firmware, and
@@ -671,6 +817,7 @@ uint64_t RAD::wrapSmuGetFwConstants() {
 }
 
 bool RAD::wrapTtlDevIsVega10Device() {
+    HookScope<RadMeasure, StatsTtlDevIsVega10Device> stats;
     /*
      * AMD iGPUs are Vega 10 based.
      */
@@ -678,6 +825,7 @@ bool RAD::wrapTtlDevIsVega10Device() {
 }
 
 uint64_t RAD::wrapSmu901InternalHwInit() {
+    HookScope<RadMeasure, StatsSmu901InternalHwInit> stats;
     /*
      * This is _smu_9_0_1_internal_hw_init.
      * The original function waits for the firmware to be loaded,
@@ -687,26 +835,51 @@ uint64_t RAD::wrapSmu901InternalHwInit() {
     return 0;
 }
 
+void RAD::flushLogFilters(thread_call_param_t, thread_call_param_t) {
+    callbackRAD->cosFilter.flush(NETDBG::nprint);
+    callbackRAD->mcilFilter.flush(NETDBG::nprint);
+    if (__atomic_load_n(&callbackRAD->stopping, __ATOMIC_RELAXED)) return;
+
+    uint64_t deadline;
+    clock_interval_to_deadline(LogFilter::FlushInterval, kMillisecondScale,
+                               &deadline);
+    thread_call_enter_delayed(callbackRAD->logFilterCall, deadline);
+}
+
 void RAD::wrapCosDebugPrint(char *fmt, ...) {
-    NETDBG::printf("AMD TTL COS: ");
+    HookScope<RadMeasure, StatsCosDebugPrint> stats;
     va_list args, netdbg_args;
     va_start(args, fmt);
     va_copy(netdbg_args, args);
-    NETDBG::vprintf(fmt, netdbg_args);
+    char msg[NETDBG::RingSlotSize];
+    auto prefix = snprintf(msg, sizeof(msg), "AMD TTL COS: ");
+    size_t len = prefix + vsnprintf(msg + prefix, sizeof(msg) - prefix, fmt,
+                                    netdbg_args);
     va_end(netdbg_args);
+    if (len >= sizeof(msg)) len = sizeof(msg) - 1;
+    callbackRAD->cosFilter.submit(msg, len, NETDBG::uptimeMs(),
+                                  NETDBG::nprint);
     FunctionCast(wrapCosDebugPrint, callbackRAD->orgCosDebugPrint)(fmt, args);
     va_end(args);
 }
 
 void RAD::wrapMCILDebugPrint(uint32_t level_max, char *fmt, uint64_t param3,
                              uint64_t param4, uint64_t param5, uint level) {
-    NETDBG::printf("_MCILDebugPrint PARAM1 = 0x%X: ", level_max);
-    NETDBG::printf(fmt, param3, param4, param5, level);
+    HookScope<RadMeasure, StatsMCILDebugPrint> stats;
+    char msg[NETDBG::RingSlotSize];
+    auto prefix = snprintf(msg, sizeof(msg), "_MCILDebugPrint PARAM1 = 0x%X: ",
+                           level_max);
+    size_t len = prefix + snprintf(msg + prefix, sizeof(msg) - prefix, fmt,
+                                   param3, param4, param5, level);
+    if (len >= sizeof(msg)) len = sizeof(msg) - 1;
+    callbackRAD->mcilFilter.submit(msg, len, NETDBG::uptimeMs(),
+                                   NETDBG::nprint);
     FunctionCast(wrapMCILDebugPrint, callbackRAD->orgMCILDebugPrint)(
         level_max, fmt, param3, param4, param5, level);
 }
 
 uint64_t RAD::wrapPspAsdLoad(void *pspData) {
+    HookScope<RadMeasure, StatsPspAsdLoad> stats;
     /*
      * Hack: Add custom param 4 and 5 (pointer to firmware and size)
      * aka RCX and R8 registers
@@ -715,9 +888,12 @@ uint64_t RAD::wrapPspAsdLoad(void *pspData) {
     auto org =
         reinterpret_cast<uint64_t (*)(void *, uint64_t, uint64_t, const void *,
                                       size_t)>(callbackRAD->orgPspAsdLoad);
-    auto fw = getFWDescByName("raven_asd.bin");
-    auto ret = org(pspData, 0, 0, fw->getBytesNoCopy(), fw->getLength());
-    NETLOG("rad", "_psp_asd_load returned 0x%llX", ret);
+    auto *desc = callbackRAD->asicFirmware.asd;
+    auto fw = fwView(desc);
+    checkFirmware(desc ? desc->name : callbackRAD->asicFirmware.asic->asd[0],
+                  fw, FwFormatAmdgpu);
+    auto ret = org(pspData, 0, 0, fw.data, fw.size);
+    NETTRACE("rad", "_psp_asd_load returned 0x%llX", ret);
     return ret;
 }
 
@@ -738,22 +914,35 @@ bool RAD::processKext(KernelPatcher &patcher, size_t index,
              "Even"
              "t_tmj",
              wrapNotifyLinkChange, orgNotifyLinkChange},
-            {"__ZN11AtiAsicInfo18initWithControllerEP13ATIController",
-             wrapInitWithController, orgInitWithController},
             {"__ZN23AtiVramInfoInterface_V214createVramInfoEP14AtiVBiosHelperj",
              createVramInfo},
-            {"__ZN13AtomBiosProxy19createAtomBiosProxyER16AtomBiosInitData",
-             wrapCreateAtomBiosProxy, orgCreateAtomBiosProxy},
             {"__ZN13ATIController20populateDeviceMemoryE13PCI_REG_INDEX",
              wrapPopulateDeviceMemory, orgPopulateDeviceMemory},
-            {"__ZN13ATIController24sendRequestToAcceleratorE25_"
-             "eAMDAccelIOFBRequestTypePvS1_S1_",
-             wrapSendRequestToAccelerator, orgSendRequestToAccelerator},
         };
         if (!patcher.routeMultipleLong(index, requests, arrsize(requests),
                                        address, size))
             panic("Failed to route AMDSupport symbols");
 
+        if constexpr (radObserved) {
+            KernelPatcher::RouteRequest observeRequests[] = {
+                {"__ZN11AtiAsicInfo18initWithControllerEP13ATIController",
+                 TraceInitWithController::wrap, TraceInitWithController::org},
+                {"__ZN13AtomBiosProxy19createAtomBiosProxyER16AtomBiosInitD"
+                 "ata",
+                 TraceCreateAtomBiosProxy::wrap,
+                 TraceCreateAtomBiosProxy::org},
+                {"__ZN13ATIController24sendRequestToAcceleratorE25_"
+                 "eAMDAccelIOFBRequestTypePvS1_S1_",
+                 TraceSendRequestToAccelerator::wrap,
+                 TraceSendRequestToAccelerator::org},
+            };
+            if (observeHooks &&
+                !patcher.routeMultipleLong(index, observeRequests,
+                                           arrsize(observeRequests), address,
+                                           size))
+                panic("Failed to route AMDSupport observers");
+        }
+
         return true;
     } else if (kextRadeonX5000HWLibs.loadIndex == index) {
         DBGLOG("rad", "resolving device type table");
@@ -775,6 +964,7 @@ bool RAD::processKext(KernelPatcher &patcher, size_t index,
         if (!orgPutFirmware) {
             panic("RAD: Failed to resolve AMDFirmwareDirectory::putFirmware");
         }
+        fwObjects.attach(&amdFirmwareOps, static_cast<uintptr_t>(address));
 
         orgVega10PowerTuneServicesConstructor =
             reinterpret_cast<t_Vega10PowerTuneServicesConstructor>(
@@ -791,15 +981,10 @@ bool RAD::processKext(KernelPatcher &patcher, size_t index,
         KernelPatcher::RouteRequest requests[] = {
             {"__ZN14AmdTtlServicesC2EP11IOPCIDevice",
              wrapAmdTtlServicesConstructor, orgAmdTtlServicesConstructor},
-            {"_ipi_smu_sw_init", wrapIpiSmuSwInit, orgIpiSmuSwInit},
             {"_smu_sw_init", wrapSmuSwInit, orgSmuSwInit},
-            {"_smu_internal_sw_init", wrapSmuInternalSwInit,
-             orgSmuInternalSwInit},
             {"_smu_get_hw_version", wrapSmuGetHwVersion, orgSmuGetHwVersion},
             {"_psp_sw_init", wrapPspSwInit, orgPspSwInit},
             {"_gc_get_hw_version", wrapGcGetHwVersion, orgGcGetHwVersion},
-            {"_internal_cos_read_fw", wrapInternalCosReadFw,
-             orgInternalCosReadFw},
             {"__ZN35AMDRadeonX5000_"
              "AMDRadeonHWLibsX500025populateFirmwareDirectoryEv",
              wrapPopulateFirmwareDirectory, orgPopulateFirmwareDirectory},
@@ -817,19 +1002,9 @@ bool RAD::processKext(KernelPatcher &patcher, size_t index,
             {"_CailMonitorPerformanceCounter",
              wrapCailMonitorPerformanceCounter,
              orgCailMonitorPerformanceCounter},
-            {"__ZN20AtiPowerPlayServices8ppEnableEb", wrapPpEnable,
-             orgPpEnable},
-            {"__"
-             "ZN20AtiPowerPlayServices21ppDisplayConfigChangeEP22PPDisplayConfi"
-             "gura"
-             "tionb",
-             wrapPpDisplayConfigChange, orgPpDisplayConfigChange},
             {"_PECI_SetupInitInfo", wrapPECISetupInitInfo,
              orgPECISetupInitInfo},
             {"_PECI_ReadRegistry", wrapPECIReadRegistry, orgPECIReadRegistry},
-            {"_SMUM_Initialize", wrapSMUMInitialize, orgSMUMInitialize},
-            {"_PECI_RetrieveBiosDataTable", wrapPECIRetrieveBiosDataTable,
-             orgPECIRetrieveBiosDataTable},
             {"__ZN25AtiApplePowerTuneServices23createPowerTuneServicesEP11PP_"
              "InstanceP18PowerPlayCallbacks",
              wrapCreatePowerTuneServices},
@@ -837,79 +1012,52 @@ bool RAD::processKext(KernelPatcher &patcher, size_t index,
             {"_smu_get_fw_constants", wrapSmuGetFwConstants},
             {"_ttlDevIsVega10Device", wrapTtlDevIsVega10Device},
             {"_smu_9_0_1_internal_hw_init", wrapSmu901InternalHwInit},
-            {"__ZN14AmdTtlServices13cosDebugPrintEPKcz", wrapCosDebugPrint,
-             orgCosDebugPrint},
-            {"_MCILDebugPrint", wrapMCILDebugPrint, orgMCILDebugPrint},
             {"_psp_asd_load", wrapPspAsdLoad, orgPspAsdLoad},
         };
         if (!patcher.routeMultipleLong(index, requests, arrsize(requests),
                                        address, size))
             panic("RAD: Failed to route AMDRadeonX5000HWLibs symbols");
 
-        uint8_t find[] = {0x55, 0x48, 0x89, 0xe5, 0x8b, 0x56, 0x04, 0xbe, 0x3b,
-                          0x00, 0x00, 0x00, 0x5d, 0xe9, 0x51, 0xfe, 0xff, 0xff};
-        uint8_t repl[] = {0x55, 0x48, 0x89, 0xe5, 0x8b, 0x56, 0x04, 0xbe, 0x1e,
-                          0x00, 0x00, 0x00, 0x5d, 0xe9, 0x51, 0xfe, 0xff, 0xff};
-
-        uint8_t find_load_asd_pt1[] = {0x0f, 0x85, 0x83, 0x00, 0x00, 0x00, 0x48,
-                                       0x8d, 0x35, 0xf7, 0x93, 0xf4, 0x00, 0xba,
-                                       0x00, 0xc1, 0x02, 0x00, 0x4c, 0x89, 0xff,
-                                       0xe8, 0xf2, 0xa6, 0x56, 0x02};
-        uint8_t repl_load_asd_pt1[] = {0x0f, 0x85, 0x83, 0x00, 0x00, 0x00, 0x48,
-                                       0x8b, 0xf1, 0x4c, 0x89, 0xc2, 0x90, 0x90,
-                                       0x90, 0x90, 0x90, 0x90, 0x4c, 0x89, 0xff,
-                                       0xe8, 0xf2, 0xa6, 0x56, 0x02};
-        uint8_t find_load_asd_pt2[] = {0x44, 0x89, 0x66, 0x08, 0x48, 0xc7, 0x46,
-                                       0x0c, 0x00, 0xc1, 0x02, 0x00, 0x48, 0xc7,
-                                       0x46, 0x14, 0x00, 0x00, 0x00, 0x00};
-        uint8_t repl_load_asd_pt2[] = {0x44, 0x89, 0x66, 0x08, 0x4c, 0x89, 0x84,
-                                       0x26, 0x0c, 0x00, 0x00, 0x00, 0x48, 0xc7,
-                                       0x46, 0x14, 0x00, 0x00, 0x00, 0x00};
-        KernelPatcher::LookupPatch patches[] = {
-            /*
-             * Patch for _smu_9_0_1_full_asic_reset
-             * This function performs a full ASIC reset.
-             * The patch corrects the sent message to 0x1E;
-             * the original code sends 0x3B, which is wrong for SMU 10.
-             */
-            {&kextRadeonX5000HWLibs, find, repl, arrsize(find), 2},
-            /*
-             * Patches for _psp_asd_load.
-             * _psp_asd_load loads a hardcoded ASD firmware binary
-             * included in the kext as _psp_asd_bin.
-             * The copied data isn't in a table, it is a single
-             * binary copied over to the PSP private memory.
-             * We can't replicate such logic in any AMDGPU kext function,
-             * as the memory accesses to GPU data is inaccessible
-             * from external kexts, therefore, we have to do a hack.
-             * The hack is very straight forward; we have replaced the
-             * assembly that loads hardcoded values from
-             *     lea rsi, [_psp_asd_bin]
-             *     mov edx, 0x2c100
-             *     mov rdi, r15
-             *     call _memcpy
-             * to
-             *     mov rsi, rcx
-             *     mov rdx, r8
-             *     mov rdi, r15
-             *     call _memcpy
-             * so that it gets the pointer and size from parameter 4 and 5.
-             * Register choice was because the parameter 2 and 3 registers
-             * get overwritten before this call to memcpy
-             * The hack we came up with looks like terrible practice,
-             * but this will have to do.
-             * Pain.
-             */
-            {&kextRadeonX5000HWLibs, find_load_asd_pt1, repl_load_asd_pt1,
-             arrsize(find_load_asd_pt1), 2},
-            {&kextRadeonX5000HWLibs, find_load_asd_pt2, repl_load_asd_pt2,
-             arrsize(find_load_asd_pt2), 2},
-        };
-        for (auto &patch : patches) {
-            patcher.applyLookupPatch(&patch);
-            patcher.clearError();
+        if constexpr (radObserved) {
+            KernelPatcher::RouteRequest observeRequests[] = {
+                {"_ipi_smu_sw_init", TraceIpiSmuSwInit::wrap,
+                 TraceIpiSmuSwInit::org},
+                {"_smu_internal_sw_init", TraceSmuInternalSwInit::wrap,
+                 TraceSmuInternalSwInit::org},
+                {"_internal_cos_read_fw", TraceInternalCosReadFw::wrap,
+                 TraceInternalCosReadFw::org},
+                {"__ZN20AtiPowerPlayServices8ppEnableEb", TracePpEnable::wrap,
+                 TracePpEnable::org},
+                {"__ZN20AtiPowerPlayServices21ppDisplayConfigChangeEP22PPDi"
+                 "splayConfigurationb",
+                 TracePpDisplayConfigChange::wrap,
+                 TracePpDisplayConfigChange::org},
+                {"_SMUM_Initialize", TraceSMUMInitialize::wrap,
+                 TraceSMUMInitialize::org},
+                {"_PECI_RetrieveBiosDataTable",
+                 TracePECIRetrieveBiosDataTable::wrap,
+                 TracePECIRetrieveBiosDataTable::org},
+            };
+            if (observeHooks &&
+                !patcher.routeMultipleLong(index, observeRequests,
+                                           arrsize(observeRequests), address,
+                                           size))
+                panic("RAD: Failed to route AMDRadeonX5000HWLibs observers");
         }
 
+        if constexpr (netLogEnabled("fw", NetLogInfo)) {
+            KernelPatcher::RouteRequest fwRequests[] = {
+                {"__ZN14AmdTtlServices13cosDebugPrintEPKcz", wrapCosDebugPrint,
+                 orgCosDebugPrint},
+                {"_MCILDebugPrint", wrapMCILDebugPrint, orgMCILDebugPrint},
+            };
+            if (!patcher.routeMultipleLong(index, fwRequests,
+                                           arrsize(fwRequests), address, size))
+                panic("RAD: Failed to route firmware debug print symbols");
+        }
+
+        applyPatches(kextRadeonX5000HWLibs, address, size);
+
         return true;
     } else if (kextAMD10000Controller.loadIndex == index) {
         DBGLOG("rad", "Hooking AMD10000Controller");
@@ -920,24 +1068,6 @@ bool RAD::processKext(KernelPatcher &patcher, size_t index,
              "erti"
              "es",
              wrapProjectByPartNumber},
-            {"__ZN18AMD10000Controller35initializeProjectDependentResourcesEv",
-             wrapInitializeProjectDependentResources,
-             orgInitializeProjectDependentResources},
-            {"__ZN18AMD10000Controller21hwInitializeFbMemSizeEv",
-             wrapHwInitializeFbMemSize, orgHwInitializeFbMemSize},
-            {"__ZN18AMD10000Controller18hwInitializeFbBaseEv",
-             wrapHwInitializeFbBase, orgHwInitializeFbBase},
-            {"__ZN18AMD10000Controller19initializeResourcesEv",
-             wrapInitializeResources, orgInitializeResources},
-            {"__ZN18AMD10000Controller19initializePowerPlayEv",
-             wrapInitializePP, orgInitializePP},
-            {"__ZN22Vega10PowerPlayManager24createPowerPlayInterfaceEv",
-             wrapCreatePowerPlayInterface, orgCreatePowerPlayInterface},
-            {"__ZN22Vega10PowerPlayManager10initializeEv", wrapPPInitialize,
-             orgPPInitialize},
-            {"__ZN22Vega10PowerPlayManager7isReadyEv", wrapIsReady, orgIsReady},
-            {"__ZN22Vega10PowerPlayManager15updatePowerPlayEv",
-             wrapUpdatePowerPlay, orgUpdatePowerPlay},
             {"__ZNK22Vega10SharedController11getFamilyIdEv", wrapGetFamilyId},
             {"__ZN17ASIC_INFO__VEGA1018populateDeviceInfoEv",
              wrapPopulateDeviceInfo, orgPopulateDeviceInfo},
@@ -946,29 +1076,40 @@ bool RAD::processKext(KernelPatcher &patcher, size_t index,
                                        address, size))
             panic("Failed to route AMD10000Controller symbols");
 
-        /*
-         * Patch for DEVICE_COMPONENT_FACTORY::createAsicInfo
-         * Eliminates if statement to allow creation of ASIC Info.
-         * The Device ID for the iGPUs is usually not within the 0x6000 range.
-         * For example, 0x15d8 is the Device ID for a Picasso iGPU.
-         * if ((0x685f < deviceId) && (deviceId < 0x6880)) {
-         * 	asic_info = new ASIC_INFO__VEGA10{};
-         * }
-         * The condition above fails, and 0 is returned as a fallback,
-         * breaking initialisation.
-         */
-        uint8_t find[] = {0x3d, 0x60, 0x68, 0x00, 0x00, 0x0f, 0x8c, 0x32,
-                          0x00, 0x00, 0x00, 0x0f, 0xb7, 0x45, 0xe6, 0x3d,
-                          0x7f, 0x68, 0x00, 0x00, 0x0f, 0x8f, 0x23, 0x00,
-                          0x00, 0x00, 0xbf, 0x78, 0x00, 0x00, 0x00};
-        uint8_t repl[] = {0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90,
-                          0x90, 0x90, 0x90, 0x0f, 0xb7, 0x45, 0xe6, 0x90,
-                          0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90,
-                          0x90, 0x90, 0xbf, 0x78, 0x00, 0x00, 0x00};
-        KernelPatcher::LookupPatch patch{&kextAMD10000Controller, find, repl,
-                                         arrsize(find), 2};
-        patcher.applyLookupPatch(&patch);
-        patcher.clearError();
+        if constexpr (radObserved) {
+            KernelPatcher::RouteRequest observeRequests[] = {
+                {"__ZN18AMD10000Controller35initializeProjectDependentResou"
+                 "rcesEv",
+                 TraceInitializeProjectDependentResources::wrap,
+                 TraceInitializeProjectDependentResources::org},
+                {"__ZN18AMD10000Controller21hwInitializeFbMemSizeEv",
+                 TraceHwInitializeFbMemSize::wrap,
+                 TraceHwInitializeFbMemSize::org},
+                {"__ZN18AMD10000Controller18hwInitializeFbBaseEv",
+                 TraceHwInitializeFbBase::wrap, TraceHwInitializeFbBase::org},
+                {"__ZN18AMD10000Controller19initializeResourcesEv",
+                 TraceInitializeResources::wrap,
+                 TraceInitializeResources::org},
+                {"__ZN18AMD10000Controller19initializePowerPlayEv",
+                 TraceInitializePP::wrap, TraceInitializePP::org},
+                {"__ZN22Vega10PowerPlayManager24createPowerPlayInterfaceEv",
+                 TraceCreatePowerPlayInterface::wrap,
+                 TraceCreatePowerPlayInterface::org},
+                {"__ZN22Vega10PowerPlayManager10initializeEv",
+                 TracePPInitialize::wrap, TracePPInitialize::org},
+                {"__ZN22Vega10PowerPlayManager7isReadyEv", TraceIsReady::wrap,
+                 TraceIsReady::org},
+                {"__ZN22Vega10PowerPlayManager15updatePowerPlayEv",
+                 TraceUpdatePowerPlay::wrap, TraceUpdatePowerPlay::org},
+            };
+            if (observeHooks &&
+                !patcher.routeMultipleLong(index, observeRequests,
+                                           arrsize(observeRequests), address,
+                                           size))
+                panic("Failed to route AMD10000Controller observers");
+        }
+
+        applyPatches(kextAMD10000Controller, address, size);
 
         return true;
     }
@@ -1003,7 +1144,7 @@ void RAD::process24BitOutput(KernelPatcher &patcher,
                     MachInfo::setKernelWriting(false,
                                                KernelPatcher::kernelWriteLock);
                 } else {
-                    NETLOG("rad",
+                    NETERR("rad",
                            "failed to disable write protection for "
                            "BITS_PER_COMPONENT");
                 }
@@ -1011,7 +1152,7 @@ void RAD::process24BitOutput(KernelPatcher &patcher,
             bitsPerComponent++;
         }
     } else {
-        NETLOG("rad", "failed to find BITS_PER_COMPONENT");
+        NETERR("rad", "failed to find BITS_PER_COMPONENT");
         patcher.clearError();
     }
 
@@ -1025,11 +1166,50 @@ void RAD::process24BitOutput(KernelPatcher &patcher,
 
     patcher.applyLookupPatch(&pixelPatch);
     if (patcher.getError() != KernelPatcher::Error::NoError) {
-        NETLOG("rad", "failed to patch RGB mask for 24-bit output");
+        NETERR("rad", "failed to patch RGB mask for 24-bit output");
         patcher.clearError();
     }
 }
 
+/**
+ *  Applies the radPatches of a kext, searching its whole image, and reports
+ *  per patch the matches found, those patched and the time taken.
+ */
+void RAD::applyPatches(const KernelPatcher::KextInfo &info,
+                       mach_vm_address_t address, size_t size) {
+    auto darwin = static_cast<uint32_t>(getKernelVersion());
+    auto *data = reinterpret_cast<uint8_t *>(address);
+    for (auto &patch : radPatches) {
+        if (strcmp(patch.kext, info.id) || !patch.appliesTo(darwin)) continue;
+        BinaryPatchResult result{};
+        auto start = mach_absolute_time();
+        for (size_t at = patch.search(data, size, 0); at != PatchNotFound;
+             at = patch.search(data, size, at + patch.size)) {
+            result.matches++;
+            if (result.patched == patch.limit) continue;
+            if (MachInfo::setKernelWriting(true,
+                                           KernelPatcher::kernelWriteLock) !=
+                KERN_SUCCESS) {
+                NETERR("rad", "failed to disable write protection for %s",
+                       patch.name);
+                break;
+            }
+            patch.apply(data + at);
+            MachInfo::setKernelWriting(false, KernelPatcher::kernelWriteLock);
+            result.patched++;
+        }
+        absolutetime_to_nanoseconds(mach_absolute_time() - start, &result.ns);
+
+        if (result.matches != patch.expected)
+            NETERR("rad", "patch %s: %u matches, %u expected", patch.name,
+                   result.matches, patch.expected);
+        NETLOG("rad", "patch %s: %u of %u matches patched in %llu ns",
+               patch.name, result.patched, result.matches, result.ns);
+        if (result.failed(patch))
+            panic("RAD: Failed to apply patch %s", patch.name);
+    }
+}
+
 void RAD::processConnectorOverrides(KernelPatcher &patcher,
                                     mach_vm_address_t address, size_t size) {
     KernelPatcher::RouteRequest requests[] = {
@@ -1061,106 +1241,71 @@ void RAD::processConnectorOverrides(KernelPatcher &patcher,
                               size);
 }
 
-uint64_t RAD::wrapConfigureDevice(void *that, IOPCIDevice *dev) {
-    NETLOG("rad", "configureDevice this = %p", that);
-    auto ret = FunctionCast(wrapConfigureDevice,
-                            callbackRAD->orgConfigureDevice)(that, dev);
-    NETLOG("rad", "configureDevice returned 0x%llX", ret);
-    return ret;
-}
-
-IOService *RAD::wrapInitLinkToPeer(void *that, const char *matchCategoryName) {
-    NETLOG("rad", "initLinkToPeer this = %p", that);
-    auto ret = FunctionCast(wrapInitLinkToPeer, callbackRAD->orgInitLinkToPeer)(
-        that, matchCategoryName);
-    NETLOG("rad", "initLinkToPeer returned %p", ret);
-    return ret;
-}
-
-WRAP_SIMPLE(uint64_t, CreateHWHandler, "0x%llX")
-
-uint64_t RAD::wrapCreateHWInterface(void *that, IOPCIDevice *dev) {
-    NETLOG("rad", "createHWInterface this = %p", that);
-    auto ret = FunctionCast(wrapCreateHWInterface,
-                            callbackRAD->orgCreateHWInterface)(that, dev);
-    NETLOG("rad", "createHWInterface returned 0x%llX", ret);
-    return ret;
-}
-
-WRAP_SIMPLE(uint64_t, GetHWMemory, "0x%llX")
-WRAP_SIMPLE(uint64_t, GetATIChipConfigBit, "0x%llX")
-WRAP_SIMPLE(uint64_t, AllocateAMDHWRegisters, "0x%llX")
-WRAP_SIMPLE(bool, SetupCAIL, "%d")
-WRAP_SIMPLE(uint64_t, InitializeHWWorkarounds, "0x%llX")
-WRAP_SIMPLE(uint64_t, AllocateAMDHWAlignManager, "0x%llX")
-WRAP_SIMPLE(bool, MapDoorbellMemory, "%d")
-
-uint64_t RAD::wrapGetState(void *that) {
-    DBGLOG("rad", "getState this = %p", that);
-    auto ret = FunctionCast(wrapGetState, callbackRAD->orgGetState)(that);
-    DBGLOG("rad", "getState returned 0x%llX", ret);
-    return ret;
-}
-
-bool RAD::wrapInitializeTtl(void *that, void *param1) {
-    NETLOG("rad", "initializeTtl this = %p", that);
-    auto ret = FunctionCast(wrapInitializeTtl, callbackRAD->orgInitializeTtl)(
-        that, param1);
-    NETLOG("rad", "initializeTtl returned %d", ret);
-    return ret;
-}
-
-WRAP_SIMPLE(uint64_t, ConfRegBase, "0x%llX")
-WRAP_SIMPLE(uint8_t, ReadChipRev, "%d")
-
 void RAD::processHardwareKext(KernelPatcher &patcher, size_t hwIndex,
                               mach_vm_address_t address, size_t size) {
     auto &hardware = kextRadeonHardware[hwIndex];
 
-    KernelPatcher::RouteRequest requests[] = {
-        {"__ZN37AMDRadeonX5000_"
-         "AMDGraphicsAccelerator15configureDeviceEP11IOPCIDevice",
-         wrapConfigureDevice, orgConfigureDevice},
-        {"__ZN37AMDRadeonX5000_AMDGraphicsAccelerator14initLinkToPeerEPKc",
-         wrapInitLinkToPeer, orgInitLinkToPeer},
-        {"__ZN37AMDRadeonX5000_AMDGraphicsAccelerator15createHWHandlerEv",
-         wrapCreateHWHandler, orgCreateHWHandler},
-        {"__ZN37AMDRadeonX5000_"
-         "AMDGraphicsAccelerator17createHWInterfaceEP11IOPCIDevice",
-         wrapCreateHWInterface, orgCreateHWInterface},
-        {"__ZN26AMDRadeonX5000_AMDHardware11getHWMemoryEv", wrapGetHWMemory,
-         orgGetHWMemory},
-        {"__ZN32AMDRadeonX5000_AMDVega10Hardware19getATIChipConfigBitEv",
-         wrapGetATIChipConfigBit, orgGetATIChipConfigBit},
-        {"__ZN26AMDRadeonX5000_AMDHardware22allocateAMDHWRegistersEv",
-         wrapAllocateAMDHWRegisters, orgAllocateAMDHWRegisters},
-        {"__ZN30AMDRadeonX5000_AMDGFX9Hardware23initializeHWWorkaroundsEv",
-         wrapInitializeHWWorkarounds, orgInitializeHWWorkarounds},
-        {"__ZN30AMDRadeonX5000_AMDGFX9Hardware25allocateAMDHWAlignManagerEv",
-         wrapAllocateAMDHWAlignManager, orgAllocateAMDHWAlignManager},
-        {"__ZN26AMDRadeonX5000_AMDHardware17mapDoorbellMemoryEv",
-         wrapMapDoorbellMemory, orgMapDoorbellMemory},
-        {"__ZN27AMDRadeonX5000_AMDHWHandler8getStateEv", wrapGetState,
-         orgGetState},
-        {"__ZN28AMDRadeonX5000_AMDRTHardware13initializeTtlEP16_GART_"
-         "PARAMETERS",
-         wrapInitializeTtl, orgInitializeTtl},
-        {"__ZN28AMDRadeonX5000_AMDRTHardware22configureRegisterBasesEv",
-         wrapConfRegBase, orgConfRegBase},
-        {"__ZN32AMDRadeonX5000_AMDVega10Hardware23readChipRevFromRegisterEv",
-         wrapReadChipRev, orgReadChipRev},
-        {"__ZN31AMDRadeonX5000_AMDGFX9PM4Engine23QueryComputeQueueIsIdleE18_"
-         "eAMD_"
-         "HW_RING_TYPE",
-         wrapQueryComputeQueueIsIdle, orgQueryComputeQueueIsIdle},
-        {"__ZN27AMDRadeonX5000_AMDHWChannel11waitForIdleEj",
-         wrapAMDHWChannelWaitForIdle, orgAMDHWChannelWaitForIdle},
-        {"__ZN37AMDRadeonX5000_AMDGraphicsAccelerator9powerUpHWEv",
-         wrapAcceleratorPowerUpHw, orgAcceleratorPowerUpHw},
-    };
-    if (!patcher.routeMultipleLong(hardware.loadIndex, requests,
-                                   arrsize(requests), address, size)) {
-        panic("Failed to route X5000 symbols");
+    if constexpr (radObserved) {
+        KernelPatcher::RouteRequest observeRequests[] = {
+            {"__ZN37AMDRadeonX5000_"
+             "AMDGraphicsAccelerator15configureDeviceEP11IOPCIDevice",
+             TraceConfigureDevice::wrap, TraceConfigureDevice::org},
+            {"__ZN37AMDRadeonX5000_AMDGraphicsAccelerator14initLinkToPeerEPKc",
+             TraceInitLinkToPeer::wrap, TraceInitLinkToPeer::org},
+            {"__ZN37AMDRadeonX5000_AMDGraphicsAccelerator15createHWHandlerEv",
+             TraceCreateHWHandler::wrap, TraceCreateHWHandler::org},
+            {"__ZN37AMDRadeonX5000_"
+             "AMDGraphicsAccelerator17createHWInterfaceEP11IOPCIDevice",
+             TraceCreateHWInterface::wrap, TraceCreateHWInterface::org},
+            {"__ZN26AMDRadeonX5000_AMDHardware11getHWMemoryEv",
+             TraceGetHWMemory::wrap, TraceGetHWMemory::org},
+            {"__ZN32AMDRadeonX5000_AMDVega10Hardware19getATIChipConfigBitEv",
+             TraceGetATIChipConfigBit::wrap, TraceGetATIChipConfigBit::org},
+            {"__ZN26AMDRadeonX5000_AMDHardware22allocateAMDHWRegistersEv",
+             TraceAllocateAMDHWRegisters::wrap,
+             TraceAllocateAMDHWRegisters::org},
+            {"__ZN30AMDRadeonX5000_AMDGFX9Hardware23initializeHWWorkaroundsEv",
+             TraceInitializeHWWorkarounds::wrap,
+             TraceInitializeHWWorkarounds::org},
+            {"__ZN30AMDRadeonX5000_AMDGFX9Hardware25allocateAMDHWAlignManagerE"
+             "v",
+             TraceAllocateAMDHWAlignManager::wrap,
+             TraceAllocateAMDHWAlignManager::org},
+            {"__ZN26AMDRadeonX5000_AMDHardware17mapDoorbellMemoryEv",
+             TraceMapDoorbellMemory::wrap, TraceMapDoorbellMemory::org},
+            {"__ZN27AMDRadeonX5000_AMDHWHandler8getStateEv",
+             TraceGetState::wrap, TraceGetState::org},
+            {"__ZN28AMDRadeonX5000_AMDRTHardware13initializeTtlEP16_GART_"
+             "PARAMETERS",
+             TraceInitializeTtl::wrap, TraceInitializeTtl::org},
+            {"__ZN28AMDRadeonX5000_AMDRTHardware22configureRegisterBasesEv",
+             TraceConfRegBase::wrap, TraceConfRegBase::org},
+            {"__ZN32AMDRadeonX5000_AMDVega10Hardware23readChipRevFromRegisterE"
+             "v",
+             TraceReadChipRev::wrap, TraceReadChipRev::org},
+            {"__ZN31AMDRadeonX5000_AMDGFX9PM4Engine23QueryComputeQueueIsIdleE"
+             "18_eAMD_HW_RING_TYPE",
+             TraceQueryComputeQueueIsIdle::wrap,
+             TraceQueryComputeQueueIsIdle::org},
+            {"__ZN27AMDRadeonX5000_AMDHWChannel11waitForIdleEj",
+             TraceAMDHWChannelWaitForIdle::wrap,
+             TraceAMDHWChannelWaitForIdle::org},
+            {"__ZN37AMDRadeonX5000_AMDGraphicsAccelerator9powerUpHWEv",
+             TraceAcceleratorPowerUpHw::wrap, TraceAcceleratorPowerUpHw::org},
+        };
+        if (observeHooks &&
+            !patcher.routeMultipleLong(hardware.loadIndex, observeRequests,
+                                       arrsize(observeRequests), address,
+                                       size)) {
+            panic("Failed to route X5000 observers");
+        }
+    }
+
+    if constexpr (hookStatsEnabled) {
+        if (!hookStatsCall) {
+            hookStatsCall = thread_call_allocate(publishHookStats, nullptr);
+            if (hookStatsCall) thread_call_enter(hookStatsCall);
+        }
     }
 
     // Patch AppleGVA support for non-supported models
@@ -1175,6 +1320,83 @@ void RAD::processHardwareKext(KernelPatcher &patcher, size_t hwIndex,
     }
 }
 
+static void setHookStatsNumber(OSDictionary *dict, const char *key,
+                               uint64_t value) {
+    auto *number = OSNumber::withNumber(value, 64);
+    if (number) {
+        dict->setObject(key, number);
+        number->release();
+    }
+}
+
+/**
+ *  RadStats as a dictionary of hook names, or nullptr without them. Its
+ *  table is only instantiated, and so only takes up space, with them.
+ */
+OSDictionary *RAD::hookStatsDictionary() {
+    if constexpr (hookStatsEnabled) {
+        auto &table = RadStats::table;
+        auto count = table.size();
+        auto *dict =
+            OSDictionary::withCapacity(static_cast<uint32_t>(count + 1));
+        if (!dict) return nullptr;
+        for (size_t i = 0; i < count; i++) {
+            HookStatsSummary summary;
+            table.summarize(i, summary);
+            auto *entry = OSDictionary::withCapacity(6);
+            if (!entry) continue;
+            setHookStatsNumber(entry, "calls", summary.calls);
+            setHookStatsNumber(entry, "total-ns", summary.total);
+            setHookStatsNumber(entry, "mean-ns", summary.mean());
+            setHookStatsNumber(entry, "p50-ns", summary.percentile(500));
+            setHookStatsNumber(entry, "p99-ns", summary.percentile(990));
+            // Calls per power of two ns, up to the slowest bucket seen
+            size_t used = HookStatBuckets;
+            while (used && !summary.buckets[used - 1]) used--;
+            auto *histogram =
+                OSArray::withCapacity(static_cast<uint32_t>(used));
+            if (histogram) {
+                for (size_t b = 0; b < used; b++) {
+                    auto *number =
+                        OSNumber::withNumber(summary.buckets[b], 64);
+                    if (!number) continue;
+                    histogram->setObject(number);
+                    number->release();
+                }
+                entry->setObject("histogram", histogram);
+                histogram->release();
+            }
+            dict->setObject(summary.name, entry);
+            entry->release();
+        }
+        setHookStatsNumber(dict, "dropped", table.droppedCount());
+        return dict;
+    } else {
+        return nullptr;
+    }
+}
+
+void RAD::publishHookStats(thread_call_param_t, thread_call_param_t) {
+    auto *stats = hookStatsDictionary();
+    auto *matching =
+        IOService::serviceMatching("AMDRadeonX5000_AMDGraphicsAccelerator");
+    auto *accelerators =
+        matching ? IOService::getMatchingServices(matching) : nullptr;
+    if (stats && accelerators) {
+        while (auto *accel =
+                   OSDynamicCast(IOService, accelerators->getNextObject()))
+            accel->setProperty(HookStatsProperty, stats);
+    }
+    OSSafeReleaseNULL(accelerators);
+    OSSafeReleaseNULL(matching);
+    OSSafeReleaseNULL(stats);
+    if (__atomic_load_n(&callbackRAD->stopping, __ATOMIC_RELAXED)) return;
+
+    uint64_t deadline;
+    clock_interval_to_deadline(HookStatsPeriod, kSecondScale, &deadline);
+    thread_call_enter_delayed(callbackRAD->hookStatsCall, deadline);
+}
+
 void RAD::mergeProperty(OSDictionary *props, const char *name,
                         OSObject *value) {
     // The only type we could make from device properties is data.
@@ -1261,10 +1483,10 @@ void RAD::mergeProperties(OSDictionary *props, const char *prefix,
 
             iterator->release();
         } else {
-            NETLOG("rad", "prop merge failed to iterate over properties");
+            NETERR("rad", "prop merge failed to iterate over properties");
         }
     } else {
-        NETLOG("rad", "prop merge failed to get properties");
+        NETERR("rad", "prop merge failed to get properties");
     }
 
     if (!strcmp(prefix, "CAIL,")) {
@@ -1301,7 +1523,7 @@ uint32_t RAD::wrapGetConnectorsInfoV1(void *that,
         callbackRAD->updateConnectorsInfo(nullptr, nullptr, *props, connectors,
                                           sz);
     } else
-        NETLOG("rad", "getConnectorsInfoV1 failed %X or undefined %d", code,
+        NETERR("rad", "getConnectorsInfoV1 failed %X or undefined %d", code,
                props == nullptr);
 
     return code;
@@ -1339,13 +1561,13 @@ void RAD::updateConnectorsInfo(void *atomutils,
                 NETLOG("rad", "getConnectorsInfo installed %u connectors", *sz);
                 applyPropertyFixes(ctrl, *sz);
             } else {
-                NETLOG("rad",
+                NETERR("rad",
                        "getConnectorsInfo conoverrides have invalid size %u "
                        "for %u num",
                        consSize, *sz);
             }
         } else {
-            NETLOG("rad", "getConnectorsInfo conoverrides have invalid type");
+            NETERR("rad", "getConnectorsInfo conoverrides have invalid type");
         }
     } else {
         if (atomutils) {
@@ -1439,7 +1661,7 @@ uint32_t RAD::wrapTranslateAtomConnectorInfoV1(
                 }
             }
         } else {
-            NETLOG("rad",
+            NETERR("rad",
                    "translateAtomConnectorInfoV1 failed to detect sense for "
                    "translated connector");
         }
@@ -1470,7 +1692,7 @@ void RAD::autocorrectConnectors(uint8_t *baseAddr,
         uint8_t sense =
             getSenseID(baseAddr + connectorObjects[i].usRecordOffset);
         if (!sense) {
-            NETLOG(
+            NETERR(
                 "rad",
                 "autocorrectConnectors failed to detect sense for %u connector",
                 i);
@@ -1694,7 +1916,7 @@ uint32_t RAD::wrapGetConnectorsInfoV2(void *that,
         callbackRAD->updateConnectorsInfo(nullptr, nullptr, *props, connectors,
                                           sz);
     else
-        NETLOG("rad", "getConnectorsInfoV2 failed %X or undefined %d", code,
+        NETERR("rad", "getConnectorsInfoV2 failed %X or undefined %d", code,
                props == nullptr);
 
     return code;
@@ -1720,7 +1942,7 @@ uint32_t RAD::wrapTranslateAtomConnectorInfoV2(
                     getConnectorID(info->usConnObjectId),
                     getSenseID(info->i2cRecord), txmit, enc, connector, 1);
         } else {
-            NETLOG("rad",
+            NETERR("rad",
                    "translateAtomConnectorInfoV2 failed to detect sense for "
                    "translated connector");
         }
@@ -1749,6 +1971,7 @@ bool RAD::wrapATIControllerStart(IOService *ctrl, IOService *provider) {
 bool RAD::doNotTestVram([[maybe_unused]] IOService *ctrl,
                         [[maybe_unused]] uint32_t reg,
                         [[maybe_unused]] bool retryOnFail) {
+    HookScope<RadMeasure, StatsTestVRAM> stats;
     NETLOG("rad", "TestVRAM called! Returning true");
     return true;
 }
@@ -1756,6 +1979,7 @@ bool RAD::doNotTestVram([[maybe_unused]] IOService *ctrl,
 bool RAD::wrapNotifyLinkChange(void *atiDeviceControl,
                                kAGDCRegisterLinkControlEvent_t event,
                                void *eventData, uint32_t eventFlags) {
+    HookScope<RadMeasure, StatsNotifyLinkChange> stats;
     auto ret =
         FunctionCast(wrapNotifyLinkChange, callbackRAD->orgNotifyLinkChange)(
             atiDeviceControl, event, eventData, eventFlags);
@@ -1778,12 +2002,12 @@ void RAD::updateGetHWInfo(IOService *accelVideoCtx, void *hwInfo) {
     accel = OSDynamicCast(IOService,
                           accelVideoCtx->getParentEntry(gIOServicePlane));
     if (accel == NULL) {
-        NETLOG("rad", "getHWInfo: no parent found for accelVideoCtx!");
+        NETERR("rad", "getHWInfo: no parent found for accelVideoCtx!");
         return;
     }
     pciDev = OSDynamicCast(IOService, accel->getParentEntry(gIOServicePlane));
     if (pciDev == NULL) {
-        NETLOG("rad", "getHWInfo: no parent found for accel!");
+        NETERR("rad", "getHWInfo: no parent found for accel!");
         return;
     }
     uint16_t &org = getMember<uint16_t>(hwInfo, 0x4);
@@ -12,14 +12,44 @@
 #include <IOKit/IOService.h>
 #include <IOKit/graphics/IOFramebuffer.h>
 #include <IOKit/pci/IOPCIDevice.h>
+#include <kern/thread_call.h>
 
 #include <Headers/kern_devinfo.hpp>
 #include <Headers/kern_patcher.hpp>
 
 #include "kern_agdc.hpp"
+#include "kern_asic.hpp"
 #include "kern_atom.hpp"
+#include "kern_fwobject.hpp"
+#include "kern_hook.hpp"
+#include "kern_hookstats.hpp"
+#include "kern_hooktimeline.hpp"
+#include "kern_logfilter.hpp"
+#include "kern_patch.hpp"
 #include "kern_con.hpp"
 
+/**
+ *  Time, CPU and thread of the hook statistics and timeline.
+ *  mach_absolute_time() counts ns on x86.
+ */
+struct RadHookClock {
+    static uint64_t now() { return mach_absolute_time(); }
+};
+
+struct RadHookCpu {
+    static uint32_t current();
+};
+
+struct RadHookThread {
+    static uint64_t current();
+};
+
+using RadStats = HookStats<RadHookClock, RadHookCpu>;
+using RadTimeline = HookTimeline<RadHookClock, RadHookThread>;
+using RadMeasure = HookBoth<RadStats, RadTimeline>;
+
+HOOK_NAME(StatsGetHWInfo, "rad", "getHWInfo");
+
 class RAD {
    public:
     void init();
@@ -55,43 +85,20 @@ class RAD {
         orgATIControllerStart{};
     mach_vm_address_t orgNotifyLinkChange{}, orgPopulateAccelConfig[1]{},
         orgGetHWInfo[1]{};
-    mach_vm_address_t orgConfigureDevice{}, orgInitLinkToPeer{},
-        orgCreateHWHandler{};
-    mach_vm_address_t orgCreateHWInterface{}, orgGetHWMemory{},
-        orgGetATIChipConfigBit{};
-    mach_vm_address_t orgAllocateAMDHWRegisters{}, orgSetupCAIL{},
-        orgInitializeHWWorkarounds{};
-    mach_vm_address_t orgAllocateAMDHWAlignManager{}, orgMapDoorbellMemory{};
-    mach_vm_address_t orgHwInitializeFbMemSize{}, orgHwInitializeFbBase{},
-        orgInitWithController{};
     mach_vm_address_t orgDeviceTypeTable{}, orgAmdTtlServicesConstructor{};
-    mach_vm_address_t orgGetState{}, orgConfRegBase{}, orgReadChipRev{};
-    mach_vm_address_t orgInitializeTtl{},
-        orgInitializeProjectDependentResources{};
-    mach_vm_address_t orgCreateAtomBiosProxy{}, orgInitializeResources{};
-    mach_vm_address_t orgPopulateDeviceMemory{}, orgQueryComputeQueueIsIdle{};
-    mach_vm_address_t orgAMDHWChannelWaitForIdle{}, orgAcceleratorPowerUpHw{};
-    mach_vm_address_t orgInitializePP{}, orgCreatePowerPlayInterface{};
-    mach_vm_address_t orgSendRequestToAccelerator{}, orgPPInitialize{};
-    mach_vm_address_t orgUpdatePowerPlay{}, orgIsReady{};
-    mach_vm_address_t orgPopulateDeviceInfo{};
+    mach_vm_address_t orgPopulateDeviceMemory{}, orgPopulateDeviceInfo{};
 
     /* X5000HWLibs */
-    mach_vm_address_t orgIpiSmuSwInit{}, orgSmuSwInit{};
-    mach_vm_address_t orgSmuInternalSwInit{}, orgSmuGetHwVersion{},
-        orgPspSwInit{};
-    mach_vm_address_t orgGcGetHwVersion{}, orgInternalCosReadFw{},
-        orgPopulateFirmwareDirectory{};
+    mach_vm_address_t orgSmuSwInit{}, orgSmuGetHwVersion{}, orgPspSwInit{};
+    mach_vm_address_t orgGcGetHwVersion{}, orgPopulateFirmwareDirectory{};
     t_createFirmware orgCreateFirmware = nullptr;
     t_putFirmware orgPutFirmware = nullptr;
-    mach_vm_address_t orgGetGpuHwConstants{}, orgMCILUpdateGfxCGPG{},
-        orgQueryEngineRunningState{};
+    mach_vm_address_t orgGetGpuHwConstants{}, orgQueryEngineRunningState{};
     mach_vm_address_t orgCAILQueryEngineRunningState{},
         orgCailMonitorEngineInternalState{};
-    mach_vm_address_t orgCailMonitorPerformanceCounter{}, orgPpEnable{};
-    mach_vm_address_t orgPpDisplayConfigChange{}, orgPECISetupInitInfo{};
-    mach_vm_address_t orgPECIReadRegistry{}, orgSMUMInitialize{},
-        orgPECIRetrieveBiosDataTable{};
+    mach_vm_address_t orgCailMonitorPerformanceCounter{},
+        orgPECISetupInitInfo{};
+    mach_vm_address_t orgPECIReadRegistry{};
     t_Vega10PowerTuneServicesConstructor orgVega10PowerTuneServicesConstructor =
         nullptr;
     mach_vm_address_t orgCosDebugPrint{}, orgMCILDebugPrint{};
@@ -100,6 +107,7 @@ class RAD {
 
     template <size_t Index>
     static IOReturn populateGetHWInfo(IOService *accelVideoCtx, void *hwInfo) {
+        HookScope<RadMeasure, StatsGetHWInfo> stats;
         if (callbackRAD->orgGetHWInfo[Index]) {
             int ret = FunctionCast(populateGetHWInfo<Index>,
                                    callbackRAD->orgGetHWInfo[Index])(
@@ -127,6 +135,62 @@ class RAD {
     bool forceCodecInfo = false;
     size_t maxHardwareKexts = 1;
 
+    /**
+     *  Route the hooks that only observe (trace, statistics, timeline), set
+     *  with -wreddbg or wredtrace=1 as boot argument or GPU property. The
+     *  hooks that change behaviour are always routed.
+     */
+    bool observeHooks = false;
+
+    LogFilter cosFilter, mcilFilter;
+
+    /**
+     *  Flushes the summaries of both log filters every
+     *  LogFilter::FlushInterval ms.
+     */
+    thread_call_t logFilterCall{};
+
+    static void flushLogFilters(thread_call_param_t, thread_call_param_t);
+
+    /**
+     *  Set by deinit, keeps the periodic thread calls from re-arming
+     */
+    bool stopping = false;
+
+    /**
+     *  Cancel and free a periodic thread call that re-arms itself unless
+     *  stopping is set, waiting for a running invocation to finish.
+     */
+    static void stopPeriodicCall(thread_call_t &call);
+
+    /**
+     *  Firmware set of the APU, resolved once by the AmdTtlServices
+     *  constructor. Raven's until then.
+     */
+    AsicFirmware asicFirmware{};
+
+    /**
+     *  AMDFirmware objects injected by populateFirmwareDirectory, reused
+     *  when the X5000 stack reinitialises. Attached to HWLibs once loaded,
+     *  released by deinit.
+     */
+    FwObjectCache fwObjects;
+
+    /**
+     *  Publishes RadStats on the accelerators every HookStatsPeriod seconds
+     *  as the HookStatsProperty dictionary, once the X5000 kext is patched.
+     */
+    static constexpr uint32_t HookStatsPeriod = 5;
+    static constexpr const char *HookStatsProperty = "WhateverRed,HookStats";
+    thread_call_t hookStatsCall{};
+
+    static OSDictionary *hookStatsDictionary();
+    static void publishHookStats(thread_call_param_t, thread_call_param_t);
+
+    void configureLogFilter(DeviceInfo *info, LogFilter &filter,
+                            const char *name, const char *rateArg,
+                            const char *burstArg);
+
     void initHardwareKextMods();
     void mergeProperty(OSDictionary *props, const char *name, OSObject *value);
     void mergeProperties(OSDictionary *props, const char *prefix,
@@ -173,58 +237,31 @@ class RAD {
                             mach_vm_address_t address, size_t size);
     void processConnectorOverrides(KernelPatcher &patcher,
                                    mach_vm_address_t address, size_t size);
+    void applyPatches(const KernelPatcher::KextInfo &info,
+                      mach_vm_address_t address, size_t size);
     static IOReturn wrapProjectByPartNumber();
-    static IOReturn wrapInitializeProjectDependentResources(void *that);
-    static IOReturn wrapHwInitializeFbMemSize(void *that);
-    static IOReturn wrapHwInitializeFbBase(void *that);
-    static uint64_t wrapInitWithController(void *that, void *controller);
-    static uint64_t wrapConfigureDevice(void *that, IOPCIDevice *dev);
-    static uint64_t wrapCreateHWHandler(void *that);
-    static uint64_t wrapCreateHWInterface(void *that, IOPCIDevice *dev);
-    static uint64_t wrapGetHWMemory(void *that);
-    static uint64_t wrapGetATIChipConfigBit(void *that);
-    static uint64_t wrapAllocateAMDHWRegisters(void *that);
-    static bool wrapSetupCAIL(void *that);
-    static uint64_t wrapInitializeHWWorkarounds(void *that);
-    static uint64_t wrapAllocateAMDHWAlignManager(void *that);
-    static bool wrapMapDoorbellMemory(void *that);
-    static IOService *wrapInitLinkToPeer(void *that,
-                                         const char *matchCategoryName);
-    static uint64_t wrapGetState(void *that);
-    static bool wrapInitializeTtl(void *that, void *param1);
-    static uint64_t wrapConfRegBase(void *that);
-    static uint8_t wrapReadChipRev(void *that);
-    static void *wrapCreateAtomBiosProxy(void *param1);
-    static IOReturn wrapInitializeResources(void *that);
     static IOReturn wrapPopulateDeviceMemory(void *that, uint32_t reg);
     static IntegratedVRAMInfoInterface *createVramInfo(void *helper,
                                                        uint32_t offset);
-    static IOReturn wrapQueryComputeQueueIsIdle(void *that, uint64_t param1);
-    static bool wrapAMDHWChannelWaitForIdle(void *that, uint64_t param1);
-    static uint64_t wrapAcceleratorPowerUpHw(void *that);
-    static IOReturn wrapInitializePP(void *that);
-    static IOReturn wrapCreatePowerPlayInterface(void *that);
-    static IOReturn wrapSendRequestToAccelerator(void *that, uint32_t param1,
-                                                 void *param2, void *param3,
-                                                 void *param4);
-    static IOReturn wrapPPInitialize(void *that);
     static uint16_t wrapGetFamilyId();
     static IOReturn wrapPopulateDeviceInfo(void *that);
 
     /* X5000HWLibs */
     static void wrapAmdTtlServicesConstructor(IOService *that,
                                               IOPCIDevice *provider);
-    static uint64_t wrapIpiSmuSwInit(void *tlsInstance);
     static uint64_t wrapSmuSwInit(void *input, uint64_t *output);
-    static uint32_t wrapSmuInternalSwInit(uint64_t param1, uint64_t param2,
-                                          void *param3);
     static uint64_t wrapSmuGetHwVersion(uint64_t param1, uint32_t param2);
     static uint64_t wrapPspSwInit(uint32_t *param1, uint32_t *param2);
     static uint32_t wrapGcGetHwVersion(uint32_t *param1);
-    static uint32_t wrapInternalCosReadFw(uint64_t param1, uint64_t *param2);
     static void wrapPopulateFirmwareDirectory(void *that);
+    /**
+     *  AMDFirmware is an OSObject; createFirmware returns it with one
+     *  reference.
+     */
+    static void *createAmdFirmware(const void *data, uint32_t size,
+                                   uint32_t flags, const char *name);
+    static const FwObjectOps amdFirmwareOps;
     static void *wrapGetGpuHwConstants(uint8_t *param1);
-    static uint64_t wrapMCILUpdateGfxCGPG(void *param1);
     static IOReturn wrapQueryEngineRunningState(void *that, void *param1,
                                                 void *param2);
     static uint64_t wrapCAILQueryEngineRunningState(void *param1,
@@ -235,18 +272,9 @@ class RAD {
                                                        uint32_t *param2);
     static uint64_t wrapCailMonitorPerformanceCounter(void *that,
                                                       uint32_t *param1);
-    static IOReturn wrapPpEnable(void *that, bool param1);
-    static IOReturn wrapUpdatePowerPlay(void *that);
-    static bool wrapIsReady(void *that);
-    static IOReturn wrapPpDisplayConfigChange(void *that, void *param1,
-                                              void *param2);
     static uint64_t wrapPECISetupInitInfo(uint32_t *param1, uint32_t *param2);
     static uint64_t wrapPECIReadRegistry(void *param1, char *key,
                                          uint64_t param3, uint64_t param4);
-    static uint64_t wrapSMUMInitialize(uint64_t param1, uint32_t *param2,
-                                       uint64_t param3);
-    static uint64_t wrapPECIRetrieveBiosDataTable(void *param1, uint64_t param2,
-                                                  uint64_t **param3);
     static void *wrapCreatePowerTuneServices(void *param1, void *param2);
     static uint32_t wrapGetHwRevision(uint32_t major, uint32_t minor,
                                       uint32_t patch);
@@ -0,0 +1,145 @@
+//
+//  kern_ring.hpp
+//  WhateverRed
+//
+//  Copyright © 2022 VisualDevelopment. All rights reserved.
+//
+
+#ifndef kern_ring_hpp
+#define kern_ring_hpp
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  Bounded multi-producer single-consumer ring of fixed-size slots.
+ *  Producers never block: when the ring is full the record is dropped and
+ *  accounted for. Only compiler atomics are used, so the same header builds
+ *  in the kext and as a plain C++ unit on the host.
+ */
+template <size_t SlotSize, size_t SlotCount>
+class LogRing {
+    static_assert(SlotCount && !(SlotCount & (SlotCount - 1)),
+                  "SlotCount must be a power of two");
+
+   public:
+    struct Slot {
+        uint64_t seq;
+        uint32_t len;
+        uint32_t flags;
+        uint8_t data[SlotSize];
+    };
+
+    static constexpr size_t slotSize = SlotSize;
+    static constexpr size_t slotCount = SlotCount;
+
+    void init() {
+        for (size_t i = 0; i < SlotCount; i++)
+            __atomic_store_n(&slots[i].seq, i, __ATOMIC_RELAXED);
+        __atomic_store_n(&enqueuePos, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&dequeuePos, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&dropped, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&highWater, 0, __ATOMIC_RELEASE);
+    }
+
+    /**
+     *  Claim a slot for writing. Returns nullptr (and counts a drop) when
+     *  the ring is full. The slot must be published with commit().
+     */
+    Slot *reserve() {
+        auto pos = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
+        while (true) {
+            auto *slot = &slots[pos & (SlotCount - 1)];
+            auto seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            auto diff = static_cast<int64_t>(seq - pos);
+            if (diff == 0) {
+                if (__atomic_compare_exchange_n(&enqueuePos, &pos, pos + 1,
+                                                true, __ATOMIC_RELAXED,
+                                                __ATOMIC_RELAXED)) {
+                    raiseHighWater(
+                        pos + 1 -
+                        __atomic_load_n(&dequeuePos, __ATOMIC_RELAXED));
+                    return slot;
+                }
+            } else if (diff < 0) {
+                // Full, even if the consumer has moved on since
+                raiseHighWater(SlotCount);
+                __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+                return nullptr;
+            } else {
+                pos = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    /**
+     *  Publish a slot obtained from reserve() to the consumer.
+     */
+    void commit(Slot *slot) {
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+    }
+
+    /**
+     *  Copy a record into the ring. Oversized records are truncated.
+     */
+    bool push(const void *data, size_t len, uint32_t flags = 0) {
+        auto *slot = reserve();
+        if (!slot) return false;
+        if (len > SlotSize) len = SlotSize;
+        auto *src = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < len; i++) slot->data[i] = src[i];
+        slot->len = static_cast<uint32_t>(len);
+        slot->flags = flags;
+        commit(slot);
+        return true;
+    }
+
+    /**
+     *  Consumer side: peek at the oldest committed slot, or nullptr if none.
+     *  Must be followed by release() once the slot contents are consumed.
+     */
+    Slot *front() {
+        auto pos = __atomic_load_n(&dequeuePos, __ATOMIC_RELAXED);
+        auto *slot = &slots[pos & (SlotCount - 1)];
+        auto seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        return seq == pos + 1 ? slot : nullptr;
+    }
+
+    void release(Slot *slot) {
+        auto pos = __atomic_load_n(&dequeuePos, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->seq, pos + SlotCount, __ATOMIC_RELEASE);
+        __atomic_store_n(&dequeuePos, pos + 1, __ATOMIC_RELEASE);
+    }
+
+    size_t depth() const {
+        auto head = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
+        auto tail = __atomic_load_n(&dequeuePos, __ATOMIC_RELAXED);
+        return head > tail ? static_cast<size_t>(head - tail) : 0;
+    }
+
+    uint64_t droppedCount() const {
+        return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    }
+
+    uint64_t highWaterMark() const {
+        return __atomic_load_n(&highWater, __ATOMIC_RELAXED);
+    }
+
+   private:
+    void raiseHighWater(uint64_t used) {
+        // release() frees the slot before it moves dequeuePos on.
+        if (used > SlotCount) used = SlotCount;
+        auto cur = __atomic_load_n(&highWater, __ATOMIC_RELAXED);
+        while (used > cur &&
+               !__atomic_compare_exchange_n(&highWater, &cur, used, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+
+    alignas(64) uint64_t enqueuePos{0};
+    alignas(64) uint64_t dequeuePos{0};
+    alignas(64) uint64_t dropped{0};
+    uint64_t highWater{0};
+    alignas(64) Slot slots[SlotCount];
+};
+
+#endif /* kern_ring_hpp */